@@ -0,0 +1,8 @@
+
+int main(int argc, char** argv) {
+    // array dereference to test for the existence of
+    // sanitizer libs when using -fsanitize (libubsan)
+    // compare it to another string in the array so that
+    // -Wzero-as-null-pointer-constant works
+    return argv[argc - 1] == argv[0];
+}
@@ -1,192 +1,119 @@
-#include "sax-example.h"
+/*
+ * This example prints the elements of a MessagePack file using the SAX API.
+ * The file is read in small chunks, so it can be of any size; the parser
+ * keeps its place between chunks and never copies str or bin data.
+ */
 
-static void parse_element(mpack_reader_t* reader, int depth,
-        const sax_callbacks_t* callbacks, void* context);
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
 
-bool parse_messagepack(const char* data, size_t length,
-        const sax_callbacks_t* callbacks, void* context)
-{
-    mpack_reader_t reader;
-    mpack_reader_init_data(&reader, data, length);
-    parse_element(&reader, 0, callbacks, context);
-    return mpack_ok == mpack_reader_destroy(&reader);
-}
+#include "mpack/mpack.h"
 
-static void parse_element(mpack_reader_t* reader, int depth,
-        const sax_callbacks_t* callbacks, void* context)
-{
-    if (depth >= 32) { // critical check!
-        mpack_reader_flag_error(reader, mpack_error_too_big);
-        return;
-    }
+static void indent(size_t depth) {
+    const char ruler[] = "                                                   ";
+    int width = (int)(depth * 4 < sizeof(ruler) - 1 ? depth * 4 : sizeof(ruler) - 1);
+    printf("%*.*s", width, width, ruler);
+}
 
-    mpack_tag_t tag = mpack_read_tag(reader);
-    if (mpack_reader_error(reader) != mpack_ok)
-        return;
+// The type of the last element is kept in the context so that the data
+// callback knows whether it's printing a str.
+static void element(mpack_sax_t* sax, size_t depth, mpack_tag_t tag) {
+    *(mpack_type_t*)mpack_sax_context(sax) = mpack_tag_type(&tag);
+    indent(depth);
 
     switch (mpack_tag_type(&tag)) {
         case mpack_type_nil:
-            callbacks->nil_element(context, depth);
+            printf("nil\n");
             break;
         case mpack_type_bool:
-            callbacks->bool_element(context, depth, mpack_tag_bool_value(&tag));
+            printf("bool: %s\n", mpack_tag_bool_value(&tag) ? "true" : "false");
             break;
         case mpack_type_int:
-            callbacks->int_element(context, depth, mpack_tag_int_value(&tag));
+            printf("int: %" PRIi64 "\n", mpack_tag_int_value(&tag));
             break;
         case mpack_type_uint:
-            callbacks->uint_element(context, depth, mpack_tag_uint_value(&tag));
+            printf("uint: %" PRIu64 "\n", mpack_tag_uint_value(&tag));
             break;
-
-        case mpack_type_str: {
-            uint32_t length = mpack_tag_str_length(&tag);
-            const char* data = mpack_read_bytes_inplace(reader, length);
-            callbacks->string_element(context, depth, data, length);
-            mpack_done_str(reader);
+        case mpack_type_float:
+            printf("float: %f\n", (double)mpack_tag_float_value(&tag));
             break;
-        }
-
-        case mpack_type_bin: {
-            uint32_t length = mpack_tag_bin_length(&tag);
-            const char* data = mpack_read_bytes_inplace(reader, length);
-            callbacks->bin_element(context, depth, data, length);
-            mpack_done_bin(reader);
+        case mpack_type_double:
+            printf("double: %f\n", mpack_tag_double_value(&tag));
             break;
-        }
-
-        case mpack_type_array: {
-            uint32_t count = mpack_tag_array_count(&tag);
-            callbacks->start_array(context, depth, count);
-            while (count-- > 0) {
-                parse_element(reader, depth + 1, callbacks, context);
-                if (mpack_reader_error(reader) != mpack_ok) // critical check!
-                    break;
-            }
-            callbacks->finish_array(context, depth);
-            mpack_done_array(reader);
+        case mpack_type_str:
+            printf("string of %u bytes: \"", mpack_tag_str_length(&tag));
             break;
-        }
-
-        case mpack_type_map: {
-            uint32_t count = mpack_tag_map_count(&tag);
-            callbacks->start_map(context, depth, count);
-            while (count-- > 0) {
-                parse_element(reader, depth + 1, callbacks, context);
-                parse_element(reader, depth + 1, callbacks, context);
-                if (mpack_reader_error(reader) != mpack_ok) // critical check!
-                    break;
-            }
-            callbacks->finish_map(context, depth);
-            mpack_done_map(reader);
+        case mpack_type_bin:
+            printf("bin of %u bytes: ", mpack_tag_bin_length(&tag));
+            break;
+        case mpack_type_ext:
+            printf("ext of type %i, %u bytes: ", mpack_tag_ext_exttype(&tag), mpack_tag_ext_length(&tag));
+            break;
+        case mpack_type_array:
+            printf("starting array of %u elements\n", mpack_tag_array_count(&tag));
+            break;
+        case mpack_type_map:
+            printf("starting map of %u key-value pairs\n", mpack_tag_map_count(&tag));
             break;
-        }
-
         default:
-            fprintf(stderr, "Error: type %s not implemented by this example SAX parser.\n",
-                    mpack_type_to_string(mpack_tag_type(&tag)));
-            exit(1);
+            printf("%s\n", mpack_type_to_string(mpack_tag_type(&tag)));
+            break;
     }
 }
 
-#define SAX_EXAMPLE_TEST 1
-#if SAX_EXAMPLE_TEST
-#include <stdio.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/mman.h>
-
-static void indent(int depth) {
-    const char ruler[] = "                                                   ";
-    printf("%*.*s", depth * 4, depth * 4, ruler);
-}
-
-static void nil_element(void* context, int depth) {
-    indent(depth);
-    printf("nil\n");
-}
-
-static void bool_element(void* context, int depth, int64_t value) {
-    indent(depth);
-    printf("bool: %s\n", value ? "true" : "false");
-}
-
-static void int_element(void* context, int depth, int64_t value) {
-    indent(depth);
-    printf("int: %" PRIi64 "\n", value);
-}
+static void data(mpack_sax_t* sax, size_t depth, const char* bytes, size_t size) {
+    (void)depth;
+    size_t i;
 
-static void uint_element(void* context, int depth, uint64_t value) {
-    indent(depth);
-    printf("uint: %" PRIu64 "\n", value);
-}
-
-static void string_element(void* context, int depth,
-			   const char* data, uint32_t length) {
-    indent(depth);
-    printf("string: \"");
-    fwrite(data, 1, length, stdout);
-    printf("\"\n");
-}
-
-static void bin_element(void* context, int depth,
-			const char* data, uint32_t length) {
-    uint32_t i;
-    indent(depth);
-    printf("bin: \"");
-    for (i = 0; i < length; ++i) {
-	    printf("%2.2x", data[i] & 0xff);
+    // str data is printed as is; everything else is printed in hex
+    if (*(mpack_type_t*)mpack_sax_context(sax) == mpack_type_str) {
+        fwrite(bytes, 1, size, stdout);
+    } else {
+        for (i = 0; i < size; ++i)
+            printf("%2.2x", bytes[i] & 0xff);
     }
-    printf("\"\n");
-}
-
-static void start_map(void* context, int depth, uint32_t pair_count) {
-    indent(depth);
-    printf("starting map of %u key-value pairs\n", pair_count);
-}
-
-static void start_array(void* context, int depth, uint32_t element_count) {
-    indent(depth);
-    printf("starting array of %u key-value pairs\n", element_count);
 }
 
-static void finish_map(void* context, int depth) {
-    indent(depth);
-    printf("finishing map\n");
-}
-
-static void finish_array(void* context, int depth) {
-    indent(depth);
-    printf("finishing array\n");
+static void finish(mpack_sax_t* sax, size_t depth, mpack_type_t type) {
+    (void)sax;
+    if (type == mpack_type_str) {
+        printf("\"\n");
+    } else if (type == mpack_type_array || type == mpack_type_map) {
+        indent(depth);
+        printf("finishing %s\n", type == mpack_type_array ? "array" : "map");
+    } else {
+        printf("\n");
+    }
 }
 
-static sax_callbacks_t callbacks = {
-    nil_element,
-    bool_element,
-    int_element,
-    uint_element,
-    string_element,
-    bin_element,
-    start_map,
-    start_array,
-    finish_map,
-    finish_array,
-};
-
-
 int main(int argc, char** argv) {
     if (argc != 2) {
-        fprintf(stderr, "First argument must be path to MessagePack file.");
-        exit(1);
+        fprintf(stderr, "First argument must be path to MessagePack file.\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE* file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    mpack_sax_callbacks_t callbacks = {element, data, finish};
+    mpack_type_t type = mpack_type_nil;
+    mpack_sax_t sax;
+    mpack_sax_init(&sax, &callbacks, &type);
+
+    char buffer[256];
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        mpack_sax_parse(&sax, buffer, size);
+    fclose(file);
+
+    mpack_error_t error = mpack_sax_destroy(&sax);
+    if (error != mpack_ok) {
+        fprintf(stderr, "Parse failed: %s\n", mpack_error_to_string(error));
+        return EXIT_FAILURE;
     }
-    struct stat stat;
-    int fd = open(argv[1], O_RDONLY);
-    fstat(fd, &stat);
-    const char* p = (const char*) mmap(0, stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
-    bool ok = parse_messagepack(p, stat.st_size, &callbacks, NULL);
-    if (!ok)
-        fprintf(stderr, "Parse failed!\n");
-    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    return EXIT_SUCCESS;
 }
-#endif
@@ -39,6 +39,7 @@ const char* mpack_error_to_string(mpack_error_t error) {
         MPACK_ERROR_STRING_CASE(mpack_error_bug);
         MPACK_ERROR_STRING_CASE(mpack_error_data);
         MPACK_ERROR_STRING_CASE(mpack_error_eof);
+        MPACK_ERROR_STRING_CASE(mpack_error_would_block);
         #undef MPACK_ERROR_STRING_CASE
     }
     mpack_assert(0, "unrecognized error %i", (int)error);
@@ -358,40 +359,132 @@ void mpack_tag_debug_describe(mpack_tag_t tag, char* buffer, size_t buffer_size)
 
 #if MPACK_READ_TRACKING || MPACK_WRITE_TRACKING
 
-#ifndef MPACK_TRACKING_INITIAL_CAPACITY
-// seems like a reasonable number. we grow by doubling, and it only
-// needs to be as long as the maximum depth of the message.
-#define MPACK_TRACKING_INITIAL_CAPACITY 8
-#endif
+#if MPACK_TRACKING_DEPTH_ONLY
+
+/*
+ * In depth-only mode we only count the open compound types. Everything but
+ * closing more than was opened and leaving elements open is allowed.
+ */
+
+mpack_error_t mpack_track_init(mpack_track_t* track) {
+    track->count = 0;
+    return mpack_ok;
+}
+
+mpack_error_t mpack_track_push(mpack_track_t* track, mpack_type_t type, uint32_t count) {
+    MPACK_UNUSED(type);
+    MPACK_UNUSED(count);
+    ++track->count;
+    return mpack_ok;
+}
+
+mpack_error_t mpack_track_push_builder(mpack_track_t* track, mpack_type_t type) {
+    MPACK_UNUSED(type);
+    ++track->count;
+    return mpack_ok;
+}
+
+mpack_error_t mpack_track_pop(mpack_track_t* track, mpack_type_t type) {
+    if (track->count == 0) {
+        mpack_break("attempting to close a %s but nothing was opened!", mpack_type_to_string(type));
+        return mpack_error_bug;
+    }
+    --track->count;
+    return mpack_ok;
+}
+
+mpack_error_t mpack_track_pop_builder(mpack_track_t* track, mpack_type_t type) {
+    return mpack_track_pop(track, type);
+}
+
+mpack_error_t mpack_track_peek_element(mpack_track_t* track, bool read) {
+    MPACK_UNUSED(track);
+    MPACK_UNUSED(read);
+    return mpack_ok;
+}
+
+mpack_error_t mpack_track_element(mpack_track_t* track, bool read) {
+    MPACK_UNUSED(track);
+    MPACK_UNUSED(read);
+    return mpack_ok;
+}
+
+mpack_error_t mpack_track_bytes(mpack_track_t* track, bool read, size_t count) {
+    MPACK_UNUSED(track);
+    MPACK_UNUSED(read);
+    MPACK_UNUSED(count);
+    return mpack_ok;
+}
+
+mpack_error_t mpack_track_str_bytes_all(mpack_track_t* track, bool read, size_t count) {
+    MPACK_UNUSED(track);
+    MPACK_UNUSED(read);
+    MPACK_UNUSED(count);
+    return mpack_ok;
+}
+
+mpack_error_t mpack_track_check_empty(mpack_track_t* track) {
+    if (track->count != 0) {
+        mpack_break("%i compound elements left unclosed", (int)track->count);
+        return mpack_error_bug;
+    }
+    return mpack_ok;
+}
+
+mpack_error_t mpack_track_destroy(mpack_track_t* track, bool cancel) {
+    return cancel ? mpack_ok : mpack_track_check_empty(track);
+}
+
+mpack_error_t mpack_track_copy(mpack_track_t* dest, const mpack_track_t* src) {
+    dest->count = src->count;
+    return mpack_ok;
+}
+
+#else
 
 mpack_error_t mpack_track_init(mpack_track_t* track) {
     track->count = 0;
     track->capacity = MPACK_TRACKING_INITIAL_CAPACITY;
-    track->elements = (mpack_track_element_t*)MPACK_MALLOC(sizeof(mpack_track_element_t) * track->capacity);
-    if (track->elements == NULL)
-        return mpack_error_memory;
+    track->elements = NULL;
     return mpack_ok;
 }
 
-mpack_error_t mpack_track_grow(mpack_track_t* track) {
-    mpack_assert(track->elements, "null track elements!");
+MPACK_STATIC_INLINE mpack_track_element_t* mpack_track_elements(mpack_track_t* track) {
+    return (track->elements != NULL) ? track->elements : track->inline_elements;
+}
+
+// Moves the elements to the heap or grows them there. The inline elements
+// are always enough for the initial capacity so this doesn't need to be fast.
+MPACK_NOINLINE static mpack_error_t mpack_track_grow(mpack_track_t* track) {
     mpack_assert(track->count == track->capacity, "incorrect growing?");
 
+    #ifdef MPACK_MALLOC
     size_t new_capacity = track->capacity * 2;
-
-    mpack_track_element_t* new_elements = (mpack_track_element_t*)mpack_realloc(track->elements,
-            sizeof(mpack_track_element_t) * track->count, sizeof(mpack_track_element_t) * new_capacity);
-    if (new_elements == NULL)
-        return mpack_error_memory;
+    size_t new_size = sizeof(mpack_track_element_t) * new_capacity;
+    size_t used = sizeof(mpack_track_element_t) * track->count;
+
+    mpack_track_element_t* new_elements;
+    if (track->elements == NULL) {
+        new_elements = (mpack_track_element_t*)MPACK_MALLOC(new_size);
+        if (new_elements == NULL)
+            return mpack_error_memory;
+        mpack_memcpy(new_elements, track->inline_elements, used);
+    } else {
+        new_elements = (mpack_track_element_t*)mpack_realloc(track->elements, used, new_size);
+        if (new_elements == NULL)
+            return mpack_error_memory;
+    }
 
     track->elements = new_elements;
     track->capacity = new_capacity;
     return mpack_ok;
+    #else
+    return mpack_error_too_big;
+    #endif
 }
 
-mpack_error_t mpack_track_push(mpack_track_t* track, mpack_type_t type, uint32_t count) {
-    mpack_assert(track->elements, "null track elements!");
-    mpack_log("track pushing %s count %i\n", mpack_type_to_string(type), (int)count);
+static mpack_error_t mpack_track_push_impl(mpack_track_t* track, mpack_type_t type, uint32_t count, bool builder) {
+    mpack_assert(track->capacity != 0, "track is not initialized!");
 
     // grow if needed
     if (track->count == track->capacity) {
@@ -401,37 +494,27 @@ mpack_error_t mpack_track_push(mpack_track_t* track, mpack_type_t type, uint32_t
     }
 
     // insert new track
-    track->elements[track->count].type = type;
-    track->elements[track->count].left = count;
-    track->elements[track->count].builder = false;
-    track->elements[track->count].key_needs_value = false;
+    mpack_track_element_t* element = mpack_track_elements(track) + track->count;
+    element->type = type;
+    element->left = count;
+    element->builder = builder;
+    element->key_needs_value = false;
     ++track->count;
     return mpack_ok;
 }
 
-// TODO dedupe this
+mpack_error_t mpack_track_push(mpack_track_t* track, mpack_type_t type, uint32_t count) {
+    mpack_log("track pushing %s count %i\n", mpack_type_to_string(type), (int)count);
+    return mpack_track_push_impl(track, type, count, false);
+}
+
 mpack_error_t mpack_track_push_builder(mpack_track_t* track, mpack_type_t type) {
-    mpack_assert(track->elements, "null track elements!");
     mpack_log("track pushing %s builder\n", mpack_type_to_string(type));
-
-    // grow if needed
-    if (track->count == track->capacity) {
-        mpack_error_t error = mpack_track_grow(track);
-        if (error != mpack_ok)
-            return error;
-    }
-
-    // insert new track
-    track->elements[track->count].type = type;
-    track->elements[track->count].left = 0;
-    track->elements[track->count].builder = true;
-    track->elements[track->count].key_needs_value = false;
-    ++track->count;
-    return mpack_ok;
+    return mpack_track_push_impl(track, type, 0, true);
 }
 
 static mpack_error_t mpack_track_pop_impl(mpack_track_t* track, mpack_type_t type, bool builder) {
-    mpack_assert(track->elements, "null track elements!");
+    mpack_assert(track->capacity != 0, "track is not initialized!");
     mpack_log("track popping %s\n", mpack_type_to_string(type));
 
     if (track->count == 0) {
@@ -439,7 +522,7 @@ static mpack_error_t mpack_track_pop_impl(mpack_track_t* track, mpack_type_t typ
         return mpack_error_bug;
     }
 
-    mpack_track_element_t* element = &track->elements[track->count - 1];
+    mpack_track_element_t* element = mpack_track_elements(track) + track->count - 1;
 
     if (element->type != type) {
         mpack_break("attempting to close a %s but the open element is a %s!",
@@ -482,13 +565,13 @@ mpack_error_t mpack_track_pop_builder(mpack_track_t* track, mpack_type_t type) {
 
 mpack_error_t mpack_track_peek_element(mpack_track_t* track, bool read) {
     MPACK_UNUSED(read);
-    mpack_assert(track->elements, "null track elements!");
+    mpack_assert(track->capacity != 0, "track is not initialized!");
 
     // if there are no open elements, that's fine, we can read/write elements at will
     if (track->count == 0)
         return mpack_ok;
 
-    mpack_track_element_t* element = &track->elements[track->count - 1];
+    mpack_track_element_t* element = mpack_track_elements(track) + track->count - 1;
 
     if (element->type != mpack_type_map && element->type != mpack_type_array) {
         mpack_break("elements cannot be %s within an %s", read ? "read" : "written",
@@ -510,7 +593,7 @@ mpack_error_t mpack_track_element(mpack_track_t* track, bool read) {
     if (track->count == 0 || error != mpack_ok)
         return error;
 
-    mpack_track_element_t* element = &track->elements[track->count - 1];
+    mpack_track_element_t* element = mpack_track_elements(track) + track->count - 1;
 
     if (element->type == mpack_type_map) {
         if (!element->key_needs_value) {
@@ -527,7 +610,7 @@ mpack_error_t mpack_track_element(mpack_track_t* track, bool read) {
 
 mpack_error_t mpack_track_bytes(mpack_track_t* track, bool read, size_t count) {
     MPACK_UNUSED(read);
-    mpack_assert(track->elements, "null track elements!");
+    mpack_assert(track->capacity != 0, "track is not initialized!");
 
     if (count > MPACK_UINT32_MAX) {
         mpack_break("%s more bytes than could possibly fit in a str/bin/ext!",
@@ -540,7 +623,7 @@ mpack_error_t mpack_track_bytes(mpack_track_t* track, bool read, size_t count) {
         return mpack_error_bug;
     }
 
-    mpack_track_element_t* element = &track->elements[track->count - 1];
+    mpack_track_element_t* element = mpack_track_elements(track) + track->count - 1;
 
     if (element->type == mpack_type_map || element->type == mpack_type_array) {
         mpack_break("bytes cannot be %s within an %s", read ? "read" : "written",
@@ -563,7 +646,7 @@ mpack_error_t mpack_track_str_bytes_all(mpack_track_t* track, bool read, size_t
     if (error != mpack_ok)
         return error;
 
-    mpack_track_element_t* element = &track->elements[track->count - 1];
+    mpack_track_element_t* element = mpack_track_elements(track) + track->count - 1;
 
     if (element->type != mpack_type_str) {
         mpack_break("the open type must be a string, not a %s", mpack_type_to_string(element->type));
@@ -580,7 +663,7 @@ mpack_error_t mpack_track_str_bytes_all(mpack_track_t* track, bool read, size_t
 
 mpack_error_t mpack_track_check_empty(mpack_track_t* track) {
     if (track->count != 0) {
-        mpack_break("unclosed %s", mpack_type_to_string(track->elements[0].type));
+        mpack_break("unclosed %s", mpack_type_to_string(mpack_track_elements(track)[0].type));
         return mpack_error_bug;
     }
     return mpack_ok;
@@ -588,18 +671,101 @@ mpack_error_t mpack_track_check_empty(mpack_track_t* track) {
 
 mpack_error_t mpack_track_destroy(mpack_track_t* track, bool cancel) {
     mpack_error_t error = cancel ? mpack_ok : mpack_track_check_empty(track);
+    #ifdef MPACK_MALLOC
     if (track->elements) {
         MPACK_FREE(track->elements);
         track->elements = NULL;
     }
+    #endif
     return error;
 }
+
+mpack_error_t mpack_track_copy(mpack_track_t* dest, const mpack_track_t* src) {
+    mpack_assert(src->capacity != 0, "track is not initialized!");
+
+    // the destination may be uninitialized (zeroed) or smaller
+    if (dest->capacity == 0)
+        mpack_track_init(dest);
+    if (dest->capacity < src->count) {
+        #ifdef MPACK_MALLOC
+        size_t size = sizeof(mpack_track_element_t) * src->capacity;
+        mpack_track_element_t* elements = (dest->elements == NULL) ?
+                (mpack_track_element_t*)MPACK_MALLOC(size) :
+                (mpack_track_element_t*)mpack_realloc(dest->elements, 0, size);
+        if (elements == NULL)
+            return mpack_error_memory;
+        dest->elements = elements;
+        dest->capacity = src->capacity;
+        #else
+        return mpack_error_too_big;
+        #endif
+    }
+
+    dest->count = src->count;
+    mpack_memcpy(mpack_track_elements(dest),
+            (src->elements != NULL) ? src->elements : src->inline_elements,
+            sizeof(mpack_track_element_t) * src->count);
+    return mpack_ok;
+}
+
+#endif
+#endif
+
+
+
+/*
+ * String checks skip runs of ASCII characters a 64-bit word at a time. Words
+ * are loaded with memcpy() so that they need not be aligned; this is only
+ * worthwhile if memcpy() is the libc function or a compiler builtin, since
+ * these compile to a single unaligned load.
+ */
+#if !MPACK_OPTIMIZE_FOR_SIZE && defined(MPACK_MEMCPY)
+    #define MPACK_STR_CHECK_WORDS 1
+#else
+    #define MPACK_STR_CHECK_WORDS 0
 #endif
 
+#if MPACK_STR_CHECK_WORDS
+#define MPACK_WORD_ONES  MPACK_UINT64_C(0x0101010101010101)
+#define MPACK_WORD_HIGHS MPACK_UINT64_C(0x8080808080808080)
+
+MPACK_STATIC_INLINE uint64_t mpack_str_load_word(const uint8_t* p) {
+    uint64_t word;
+    mpack_memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+// Returns true if any byte in the word is zero. (Byte order does not matter.)
+MPACK_STATIC_INLINE bool mpack_str_word_has_null(uint64_t word) {
+    return ((word - MPACK_WORD_ONES) & ~word & MPACK_WORD_HIGHS) != 0;
+}
 
+// Returns the number of leading bytes of whole words that are ASCII and, if
+// NUL is not allowed, non-zero.
+MPACK_STATIC_INLINE size_t mpack_str_skip_ascii(const uint8_t* str, size_t count, bool allow_null) {
+    size_t i = 0;
+    while (count - i >= sizeof(uint64_t)) {
+        uint64_t word = mpack_str_load_word(str + i);
+        if ((word & MPACK_WORD_HIGHS) != 0)
+            break;
+        if (!allow_null && mpack_str_word_has_null(word))
+            break;
+        i += sizeof(uint64_t);
+    }
+    return i;
+}
+#endif
 
 static bool mpack_utf8_check_impl(const uint8_t* str, size_t count, bool allow_null) {
     while (count > 0) {
+        #if MPACK_STR_CHECK_WORDS
+        size_t ascii = mpack_str_skip_ascii(str, count, allow_null);
+        str += ascii;
+        count -= ascii;
+        if (count == 0)
+            break;
+        #endif
+
         uint8_t lead = str[0];
 
         // NUL
@@ -697,13 +863,676 @@ bool mpack_utf8_check_no_null(const char* str, size_t bytes) {
 }
 
 bool mpack_str_check_no_null(const char* str, size_t bytes) {
-    size_t i;
-    for (i = 0; i < bytes; ++i)
+    size_t i = 0;
+
+    #if MPACK_STR_CHECK_WORDS
+    for (; bytes - i >= sizeof(uint64_t); i += sizeof(uint64_t))
+        if (mpack_str_word_has_null(mpack_str_load_word((const uint8_t*)str + i)))
+            return false;
+    #endif
+
+    for (; i < bytes; ++i)
         if (str[i] == '\0')
             return false;
     return true;
 }
 
+
+
+#ifdef MPACK_MALLOC
+void* mpack_allocator_alloc(const mpack_allocator_t* allocator, size_t size) {
+    if (allocator->allocate == NULL)
+        return MPACK_MALLOC(size);
+    return allocator->allocate(allocator->context, size);
+}
+
+void* mpack_allocator_realloc(const mpack_allocator_t* allocator, void* ptr,
+        size_t used_size, size_t new_size)
+{
+    if (allocator->allocate == NULL)
+        return mpack_realloc(ptr, used_size, new_size);
+    if (ptr == NULL)
+        return allocator->allocate(allocator->context, new_size);
+    if (allocator->reallocate != NULL)
+        return allocator->reallocate(allocator->context, ptr, used_size, new_size);
+
+    void* new_ptr = allocator->allocate(allocator->context, new_size);
+    if (new_ptr == NULL)
+        return NULL;
+    mpack_memcpy(new_ptr, ptr, (used_size < new_size) ? used_size : new_size);
+    mpack_allocator_free(allocator, ptr);
+    return new_ptr;
+}
+
+void mpack_allocator_free(const mpack_allocator_t* allocator, void* ptr) {
+    if (allocator->allocate == NULL)
+        MPACK_FREE(ptr);
+    else if (allocator->release != NULL)
+        allocator->release(allocator->context, ptr);
+}
+
+// arena allocations are aligned to the greater of size_t, void* and uint64_t,
+// which covers everything MPack allocates (node data, builds, strings.)
+#define MPACK_ARENA_ALIGNMENT_MAX(x, y) ((x) > (y) ? (x) : (y))
+#define MPACK_ARENA_ALIGNMENT (MPACK_ARENA_ALIGNMENT_MAX(sizeof(void*), \
+            MPACK_ARENA_ALIGNMENT_MAX(sizeof(size_t), sizeof(uint64_t))))
+
+#define MPACK_ARENA_ALIGN(size) \
+    (((size) + MPACK_ARENA_ALIGNMENT - 1) / MPACK_ARENA_ALIGNMENT * MPACK_ARENA_ALIGNMENT)
+
+#define MPACK_ARENA_HEADER_SIZE MPACK_ARENA_ALIGN(sizeof(mpack_arena_chunk_t))
+
+MPACK_STATIC_INLINE char* mpack_arena_chunk_data(mpack_arena_chunk_t* chunk) {
+    return (char*)chunk + MPACK_ARENA_HEADER_SIZE;
+}
+
+void mpack_arena_init(mpack_arena_t* arena) {
+    mpack_memset(arena, 0, sizeof(*arena));
+}
+
+void mpack_arena_destroy(mpack_arena_t* arena) {
+    mpack_arena_reset(arena);
+    while (arena->spare != NULL) {
+        mpack_arena_chunk_t* chunk = arena->spare;
+        arena->spare = chunk->prev;
+        MPACK_FREE(chunk);
+    }
+}
+
+static void mpack_arena_release_chunk(mpack_arena_t* arena, mpack_arena_chunk_t* chunk) {
+    // only full-sized chunks are kept for reuse; oversized chunks were made
+    // for one large allocation and are unlikely to be needed again.
+    if (chunk->size == MPACK_ARENA_CHUNK_SIZE) {
+        chunk->prev = arena->spare;
+        arena->spare = chunk;
+    } else {
+        MPACK_FREE(chunk);
+    }
+}
+
+static bool mpack_arena_grow(mpack_arena_t* arena, size_t size) {
+    mpack_arena_chunk_t* chunk;
+
+    if (size <= MPACK_ARENA_CHUNK_SIZE && arena->spare != NULL) {
+        chunk = arena->spare;
+        arena->spare = chunk->prev;
+    } else {
+        size_t chunk_size = (size > MPACK_ARENA_CHUNK_SIZE) ? size : MPACK_ARENA_CHUNK_SIZE;
+        chunk = (mpack_arena_chunk_t*)MPACK_MALLOC(MPACK_ARENA_HEADER_SIZE + chunk_size);
+        if (chunk == NULL)
+            return false;
+        chunk->size = chunk_size;
+    }
+
+    mpack_log("arena allocated new chunk of size %i\n", (int)chunk->size);
+    chunk->prev = arena->chunk;
+    arena->chunk = chunk;
+    arena->used = 0;
+    return true;
+}
+
+void* mpack_arena_alloc(mpack_arena_t* arena, size_t size) {
+    if (size > SIZE_MAX - MPACK_ARENA_HEADER_SIZE - MPACK_ARENA_ALIGNMENT)
+        return NULL;
+    size = (size == 0) ? MPACK_ARENA_ALIGNMENT : MPACK_ARENA_ALIGN(size);
+
+    if (arena->chunk == NULL || arena->chunk->size - arena->used < size)
+        if (!mpack_arena_grow(arena, size))
+            return NULL;
+
+    char* ptr = mpack_arena_chunk_data(arena->chunk) + arena->used;
+    arena->used += size;
+    arena->last = ptr;
+    return ptr;
+}
+
+void mpack_arena_reset(mpack_arena_t* arena) {
+    mpack_arena_mark_t mark;
+    mark.chunk = NULL;
+    mark.used = 0;
+    mpack_arena_rewind(arena, mark);
+}
+
+mpack_arena_mark_t mpack_arena_mark(const mpack_arena_t* arena) {
+    mpack_arena_mark_t mark;
+    mark.chunk = arena->chunk;
+    mark.used = arena->used;
+    return mark;
+}
+
+void mpack_arena_rewind(mpack_arena_t* arena, mpack_arena_mark_t mark) {
+    while (arena->chunk != mark.chunk) {
+        if (arena->chunk == NULL) {
+            mpack_break("mark is not in this arena!");
+            return;
+        }
+        mpack_arena_chunk_t* chunk = arena->chunk;
+        arena->chunk = chunk->prev;
+        mpack_arena_release_chunk(arena, chunk);
+    }
+
+    arena->used = mark.used;
+    arena->last = NULL;
+}
+
+static void* mpack_arena_allocator_allocate(void* context, size_t size) {
+    return mpack_arena_alloc((mpack_arena_t*)context, size);
+}
+
+static void* mpack_arena_allocator_reallocate(void* context, void* ptr,
+        size_t used_size, size_t new_size)
+{
+    mpack_arena_t* arena = (mpack_arena_t*)context;
+
+    // the most recent allocation is resized in place if it fits
+    if (ptr != NULL && ptr == arena->last && new_size <= SIZE_MAX - MPACK_ARENA_ALIGNMENT) {
+        size_t offset = (size_t)((char*)ptr - mpack_arena_chunk_data(arena->chunk));
+        size_t size = (new_size == 0) ? MPACK_ARENA_ALIGNMENT : MPACK_ARENA_ALIGN(new_size);
+        if (arena->chunk->size - offset >= size) {
+            arena->used = offset + size;
+            return ptr;
+        }
+    }
+
+    void* new_ptr = mpack_arena_alloc(arena, new_size);
+    if (new_ptr != NULL && ptr != NULL)
+        mpack_memcpy(new_ptr, ptr, (used_size < new_size) ? used_size : new_size);
+    return new_ptr;
+}
+
+static void mpack_arena_allocator_release(void* context, void* ptr) {
+    mpack_arena_t* arena = (mpack_arena_t*)context;
+
+    // only the most recent allocation can be given back
+    if (ptr != NULL && ptr == arena->last) {
+        arena->used = (size_t)((char*)ptr - mpack_arena_chunk_data(arena->chunk));
+        arena->last = NULL;
+    }
+}
+
+mpack_allocator_t mpack_arena_allocator(mpack_arena_t* arena) {
+    mpack_allocator_t allocator;
+    allocator.allocate = mpack_arena_allocator_allocate;
+    allocator.reallocate = mpack_arena_allocator_reallocate;
+    allocator.release = mpack_arena_allocator_release;
+    allocator.context = arena;
+    return allocator;
+}
+
+// The maximum number of slots to try before giving up on a perfect hash.
+// This would only ever be reached with a pathological hash function.
+#define MPACK_PERFECT_HASH_MAX_SLOTS ((uint32_t)1 << 20)
+
+static bool mpack_perfect_hash_place_bucket(mpack_perfect_hash_t* table, const uint64_t* hashes,
+        const uint16_t* keys, size_t size)
+{
+    uint32_t displacement;
+    size_t i;
+    uint32_t bucket = (uint32_t)hashes[keys[0]] & table->bucket_mask;
+
+    for (displacement = 0; displacement <= MPACK_UINT8_MAX; ++displacement) {
+        table->displacements[bucket] = (uint8_t)displacement;
+
+        for (i = 0; i < size; ++i) {
+            uint32_t slot = mpack_perfect_hash_slot(table, hashes[keys[i]]);
+            if (table->slots[slot] != 0)
+                break;
+            table->slots[slot] = (uint16_t)(keys[i] + 1u);
+        }
+        if (i == size)
+            return true;
+
+        // remove the keys of this bucket that were placed and try again
+        while (i > 0) {
+            --i;
+            table->slots[mpack_perfect_hash_slot(table, hashes[keys[i]])] = 0;
+        }
+    }
+
+    return false;
+}
+
+// Tries to place all keys in a table of the current size. The keys are
+// sorted by bucket into order, and buckets with the most keys are placed
+// first while the table is still empty.
+static bool mpack_perfect_hash_build(mpack_perfect_hash_t* table, const uint64_t* hashes, size_t count,
+        mpack_perfect_hash_key_t key, const void* context, uint16_t* order, uint32_t* starts)
+{
+    uint32_t buckets = table->bucket_mask + 1;
+    uint32_t bucket;
+    size_t i, j;
+
+    mpack_memset(table->slots, 0, sizeof(*table->slots) * (table->slot_mask + 1));
+    mpack_memset(table->displacements, 0, buckets);
+    mpack_memset(starts, 0, sizeof(*starts) * (buckets + 1));
+
+    for (i = 0; i < count; ++i)
+        ++starts[((uint32_t)hashes[i] & table->bucket_mask) + 1];
+    for (bucket = 0; bucket < buckets; ++bucket)
+        starts[bucket + 1] += starts[bucket];
+    for (i = 0; i < count; ++i)
+        order[starts[(uint32_t)hashes[i] & table->bucket_mask]++] = (uint16_t)i;
+    for (bucket = buckets; bucket > 0; --bucket)
+        starts[bucket] = starts[bucket - 1];
+    starts[0] = 0;
+
+    // drop duplicates of an earlier key so that only the first is placed,
+    // compacting the order as we go
+    uint32_t out = 0;
+    uint32_t begin = 0;
+    size_t max_size = 0;
+    for (bucket = 0; bucket < buckets; ++bucket) {
+        uint32_t end = starts[bucket + 1];
+        starts[bucket] = out;
+        for (i = begin; i < end; ++i) {
+            uint16_t index = order[i];
+            for (j = starts[bucket]; j < out; ++j) {
+                if (hashes[order[j]] != hashes[index])
+                    continue;
+                size_t length, other_length;
+                const char* str = key(context, index, &length);
+                const char* other = key(context, order[j], &other_length);
+                if (other_length == length && mpack_memcmp(other, str, length) == 0)
+                    break;
+            }
+            if (j == out)
+                order[out++] = index;
+        }
+        begin = end;
+        if (max_size < out - starts[bucket])
+            max_size = out - starts[bucket];
+    }
+    starts[buckets] = out;
+
+    for (; max_size > 0; --max_size)
+        for (bucket = 0; bucket < buckets; ++bucket)
+            if (starts[bucket + 1] - starts[bucket] == max_size &&
+                    !mpack_perfect_hash_place_bucket(table, hashes, order + starts[bucket], max_size))
+                return false;
+
+    return true;
+}
+
+mpack_error_t mpack_perfect_hash_init(mpack_perfect_hash_t* table, size_t count,
+        mpack_perfect_hash_key_t key, const void* context, const mpack_allocator_t* allocator)
+{
+    mpack_memset(table, 0, sizeof(*table));
+    if (count == 0)
+        return mpack_ok;
+    if (count > MPACK_UINT16_MAX) {
+        mpack_break("perfect hash has too many keys: %i", (int)count);
+        return mpack_error_bug;
+    }
+
+    // we start with at least twice as many slots as keys, and grow if we
+    // can't find a perfect hash
+    uint32_t slots = 1;
+    while (slots < count * 2)
+        slots *= 2;
+
+    // the hashes and the bucket order are scratch space kept across attempts
+    size_t hashes_size = sizeof(uint64_t) * count;
+    char* scratch = (char*)mpack_allocator_alloc(allocator, hashes_size + sizeof(uint16_t) * count);
+    if (scratch == NULL)
+        return mpack_error_memory;
+    uint64_t* hashes = (uint64_t*)(void*)scratch;
+    uint16_t* order = (uint16_t*)(void*)(scratch + hashes_size);
+
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        size_t length;
+        const char* str = key(context, i, &length);
+        hashes[i] = mpack_perfect_hash_key(str, length);
+    }
+
+    mpack_error_t error = mpack_error_bug;
+    for (; slots <= MPACK_PERFECT_HASH_MAX_SLOTS; slots *= 2) {
+        uint32_t buckets = (slots >= 4) ? slots / 4 : 1;
+
+        // the slots and displacements are stored in a single allocation
+        size_t slots_size = sizeof(uint16_t) * slots;
+        char* data = (char*)mpack_allocator_alloc(allocator, slots_size + buckets);
+        uint32_t* starts = (uint32_t*)mpack_allocator_alloc(allocator, sizeof(uint32_t) * (buckets + 1));
+        if (data == NULL || starts == NULL) {
+            if (data != NULL)
+                mpack_allocator_free(allocator, data);
+            if (starts != NULL)
+                mpack_allocator_free(allocator, starts);
+            error = mpack_error_memory;
+            break;
+        }
+        table->slots = (uint16_t*)(void*)data;
+        table->displacements = (uint8_t*)(data + slots_size);
+        table->slot_mask = slots - 1;
+        table->bucket_mask = buckets - 1;
+
+        bool built = mpack_perfect_hash_build(table, hashes, count, key, context, order, starts);
+        mpack_allocator_free(allocator, starts);
+        if (built) {
+            mpack_log("built perfect hash of %i keys into %i slots\n", (int)count, (int)slots);
+            error = mpack_ok;
+            break;
+        }
+
+        mpack_allocator_free(allocator, data);
+        mpack_memset(table, 0, sizeof(*table));
+    }
+
+    mpack_allocator_free(allocator, scratch);
+    if (error == mpack_error_bug)
+        mpack_break("failed to find a perfect hash for %i keys!", (int)count);
+    return error;
+}
+
+void mpack_perfect_hash_destroy(mpack_perfect_hash_t* table, const mpack_allocator_t* allocator) {
+    if (table->slots != NULL)
+        mpack_allocator_free(allocator, table->slots);
+    mpack_memset(table, 0, sizeof(*table));
+}
+
+static const char* mpack_enum_matcher_key(const void* context, size_t index, size_t* length) {
+    const mpack_enum_matcher_t* matcher = (const mpack_enum_matcher_t*)context;
+    *length = matcher->lengths[index];
+    return matcher->strings[index];
+}
+
+mpack_error_t mpack_enum_matcher_init(mpack_enum_matcher_t* matcher, const char* strings[], size_t count) {
+    return mpack_enum_matcher_init_allocator(matcher, strings, count, NULL);
+}
+
+mpack_error_t mpack_enum_matcher_init_allocator(mpack_enum_matcher_t* matcher, const char* strings[], size_t count,
+        const mpack_allocator_t* allocator)
+{
+    mpack_memset(matcher, 0, sizeof(*matcher));
+    if (allocator != NULL)
+        matcher->allocator = *allocator;
+
+    if (count > MPACK_UINT16_MAX) {
+        mpack_break("enum matcher has too many strings: %i", (int)count);
+        return mpack_error_bug;
+    }
+
+    if (count > 0) {
+        matcher->lengths = (size_t*)mpack_allocator_alloc(&matcher->allocator, sizeof(size_t) * count);
+        if (matcher->lengths == NULL)
+            return mpack_error_memory;
+    }
+
+    matcher->strings = strings;
+    matcher->count = count;
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        size_t length = mpack_strlen(strings[i]);
+        matcher->lengths[i] = length;
+        if (matcher->max_length < length)
+            matcher->max_length = length;
+    }
+
+    mpack_error_t error = mpack_perfect_hash_init(&matcher->hash, count,
+            &mpack_enum_matcher_key, matcher, &matcher->allocator);
+    if (error != mpack_ok)
+        mpack_enum_matcher_destroy(matcher);
+    return error;
+}
+
+void mpack_enum_matcher_destroy(mpack_enum_matcher_t* matcher) {
+    mpack_perfect_hash_destroy(&matcher->hash, &matcher->allocator);
+    if (matcher->lengths != NULL)
+        mpack_allocator_free(&matcher->allocator, matcher->lengths);
+    mpack_memset(matcher, 0, sizeof(*matcher));
+}
+
+size_t mpack_enum_matcher_find(const mpack_enum_matcher_t* matcher, const char* str, size_t length) {
+    if (length > matcher->max_length || matcher->count == 0)
+        return matcher->count;
+
+    size_t index = mpack_perfect_hash_find(&matcher->hash, str, length);
+    if (index == 0)
+        return matcher->count;
+    --index;
+
+    if (matcher->lengths[index] != length || mpack_memcmp(matcher->strings[index], str, length) != 0)
+        return matcher->count;
+    return index;
+}
+
+// Reads exactly count bytes, returning the number of bytes read before the
+// stream ended.
+static size_t mpack_frame_read_all(mpack_frame_read_t read_fn, void* context, char* buffer, size_t count) {
+    size_t total = 0;
+    while (total < count) {
+        size_t step = read_fn(context, buffer + total, count - total);
+        if (step == 0)
+            break;
+        mpack_assert(step <= count - total, "read function read %i bytes, more than the %i requested!",
+                (int)step, (int)(count - total));
+        total += step;
+    }
+    return total;
+}
+
+mpack_error_t mpack_read_frame(mpack_frame_read_t read_fn, void* context, size_t max_size,
+        const mpack_allocator_t* allocator, char** data, size_t* size)
+{
+    *data = NULL;
+    *size = 0;
+
+    char header[MPACK_FRAME_HEADER_SIZE];
+    size_t count = mpack_frame_read_all(read_fn, context, header, sizeof(header));
+    if (count == 0)
+        return mpack_error_eof;
+    if (count != sizeof(header))
+        return mpack_error_io;
+
+    uint32_t length = mpack_load_u32(header);
+    mpack_log("reading frame of %" PRIu32 " bytes\n", length);
+    if (length == 0)
+        return mpack_error_invalid;
+    if (length > max_size)
+        return mpack_error_too_big;
+
+    mpack_allocator_t default_allocator;
+    if (allocator == NULL) {
+        mpack_memset(&default_allocator, 0, sizeof(default_allocator));
+        allocator = &default_allocator;
+    }
+
+    char* buffer = (char*)mpack_allocator_alloc(allocator, length);
+    if (buffer == NULL)
+        return mpack_error_memory;
+    if (mpack_frame_read_all(read_fn, context, buffer, length) != length) {
+        mpack_allocator_free(allocator, buffer);
+        return mpack_error_io;
+    }
+
+    *data = buffer;
+    *size = length;
+    return mpack_ok;
+}
+#endif
+
+
+
+#if MPACK_EXTENSIONS
+    #define MPACK_TAG_SIZE_IF_EXT(size) size
+#else
+    #define MPACK_TAG_SIZE_IF_EXT(size) 0
+#endif
+
+const uint8_t mpack_tag_sizes[256] = {
+    // 0x00 - 0x7f: positive fixint
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+
+    // 0x80 - 0x8f: fixmap; 0x90 - 0x9f: fixarray
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+
+    // 0xa0 - 0xbf: fixstr
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+
+    // 0xc0 - 0xc3: nil, reserved, false, true
+    1, 0, 1, 1,
+
+    // 0xc4 - 0xc6: bin8, bin16, bin32
+    MPACK_TAG_SIZE_BIN8, MPACK_TAG_SIZE_BIN16, MPACK_TAG_SIZE_BIN32,
+
+    // 0xc7 - 0xc9: ext8, ext16, ext32
+    MPACK_TAG_SIZE_IF_EXT(MPACK_TAG_SIZE_EXT8),
+    MPACK_TAG_SIZE_IF_EXT(MPACK_TAG_SIZE_EXT16),
+    MPACK_TAG_SIZE_IF_EXT(MPACK_TAG_SIZE_EXT32),
+
+    // 0xca - 0xcb: float, double
+    MPACK_TAG_SIZE_FLOAT, MPACK_TAG_SIZE_DOUBLE,
+
+    // 0xcc - 0xcf: uint8, uint16, uint32, uint64
+    MPACK_TAG_SIZE_U8, MPACK_TAG_SIZE_U16, MPACK_TAG_SIZE_U32, MPACK_TAG_SIZE_U64,
+
+    // 0xd0 - 0xd3: int8, int16, int32, int64
+    MPACK_TAG_SIZE_I8, MPACK_TAG_SIZE_I16, MPACK_TAG_SIZE_I32, MPACK_TAG_SIZE_I64,
+
+    // 0xd4 - 0xd8: fixext1, fixext2, fixext4, fixext8, fixext16
+    MPACK_TAG_SIZE_IF_EXT(MPACK_TAG_SIZE_FIXEXT1),
+    MPACK_TAG_SIZE_IF_EXT(MPACK_TAG_SIZE_FIXEXT2),
+    MPACK_TAG_SIZE_IF_EXT(MPACK_TAG_SIZE_FIXEXT4),
+    MPACK_TAG_SIZE_IF_EXT(MPACK_TAG_SIZE_FIXEXT8),
+    MPACK_TAG_SIZE_IF_EXT(MPACK_TAG_SIZE_FIXEXT16),
+
+    // 0xd9 - 0xdb: str8, str16, str32
+    MPACK_TAG_SIZE_STR8, MPACK_TAG_SIZE_STR16, MPACK_TAG_SIZE_STR32,
+
+    // 0xdc - 0xdf: array16, array32, map16, map32
+    MPACK_TAG_SIZE_ARRAY16, MPACK_TAG_SIZE_ARRAY32, MPACK_TAG_SIZE_MAP16, MPACK_TAG_SIZE_MAP32,
+
+    // 0xe0 - 0xff: negative fixint
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+};
+
+#undef MPACK_TAG_SIZE_IF_EXT
+
+size_t mpack_scan_tag(const char* data, size_t length,
+        uint64_t* children, uint64_t* bytes, mpack_error_t* error)
+{
+    *children = 0;
+    *bytes = 0;
+    if (length == 0) {
+        *error = mpack_error_invalid;
+        return 0;
+    }
+
+    uint8_t type = (uint8_t)data[0];
+    size_t size = 1;
+    switch (type) {
+        case 0xc0: case 0xc2: case 0xc3:
+            break;
+        case 0xcc: case 0xd0: size = MPACK_TAG_SIZE_U8; break;
+        case 0xcd: case 0xd1: size = MPACK_TAG_SIZE_U16; break;
+        case 0xce: case 0xd2: size = MPACK_TAG_SIZE_U32; break;
+        case 0xcf: case 0xd3: size = MPACK_TAG_SIZE_U64; break;
+        case 0xca: size = MPACK_TAG_SIZE_FLOAT; break;
+        case 0xcb: size = MPACK_TAG_SIZE_DOUBLE; break;
+
+        #if MPACK_EXTENSIONS
+        // the data of fixext types is counted in the tag since it has no length field
+        case 0xd4: size = MPACK_TAG_SIZE_FIXEXT1 + 1; break;
+        case 0xd5: size = MPACK_TAG_SIZE_FIXEXT2 + 2; break;
+        case 0xd6: size = MPACK_TAG_SIZE_FIXEXT4 + 4; break;
+        case 0xd7: size = MPACK_TAG_SIZE_FIXEXT8 + 8; break;
+        case 0xd8: size = MPACK_TAG_SIZE_FIXEXT16 + 16; break;
+        case 0xc7: size = MPACK_TAG_SIZE_EXT8; break;
+        case 0xc8: size = MPACK_TAG_SIZE_EXT16; break;
+        case 0xc9: size = MPACK_TAG_SIZE_EXT32; break;
+        #else
+        case 0xc7: case 0xc8: case 0xc9:
+        case 0xd4: case 0xd5: case 0xd6: case 0xd7: case 0xd8:
+            *error = mpack_error_unsupported;
+            return 0;
+        #endif
+
+        case 0xc4: case 0xd9: size = MPACK_TAG_SIZE_STR8; break;
+        case 0xc5: case 0xda: size = MPACK_TAG_SIZE_STR16; break;
+        case 0xc6: case 0xdb: size = MPACK_TAG_SIZE_STR32; break;
+        case 0xdc: case 0xde: size = MPACK_TAG_SIZE_ARRAY16; break;
+        case 0xdd: case 0xdf: size = MPACK_TAG_SIZE_ARRAY32; break;
+
+        case 0xc1:
+            *error = mpack_error_invalid;
+            return 0;
+
+        default:
+            // fixint, fixmap, fixarray and fixstr
+            if (type >= 0x80 && type <= 0x8f)
+                *children = (uint64_t)(type & 0x0f) * 2;
+            else if (type >= 0x90 && type <= 0x9f)
+                *children = type & 0x0f;
+            else if (type >= 0xa0 && type <= 0xbf)
+                *bytes = type & 0x1f;
+            return 1;
+    }
+
+    if (length < size) {
+        *error = mpack_error_invalid;
+        return 0;
+    }
+
+    uint32_t len = 0;
+    switch (type) {
+        case 0xc4: case 0xc7: case 0xd9: len = mpack_load_u8(data + 1); break;
+        case 0xc5: case 0xc8: case 0xda: case 0xdc: case 0xde: len = mpack_load_u16(data + 1); break;
+        case 0xc6: case 0xc9: case 0xdb: case 0xdd: case 0xdf: len = mpack_load_u32(data + 1); break;
+        default: break;
+    }
+
+    if (type == 0xdc || type == 0xdd)
+        *children = len;
+    else if (type == 0xde || type == 0xdf)
+        *children = (uint64_t)len * 2;
+    else
+        *bytes = len;
+
+    return size;
+}
+
+size_t mpack_scan_elements(const char* data, size_t length, size_t count, mpack_error_t* error) {
+    // Skipping doesn't need a stack; we only track the total number of
+    // elements left to skip at all levels.
+    uint64_t left = count;
+    size_t pos = 0;
+
+    while (left > 0) {
+        // each element is at least one byte
+        if (left > (uint64_t)(length - pos)) {
+            *error = mpack_error_invalid;
+            return 0;
+        }
+
+        uint64_t children;
+        uint64_t bytes;
+        size_t size = mpack_scan_tag(data + pos, length - pos, &children, &bytes, error);
+        if (size == 0)
+            return 0;
+        pos += size;
+
+        if (bytes > (uint64_t)(length - pos)) {
+            *error = mpack_error_invalid;
+            return 0;
+        }
+        pos += (size_t)bytes;
+
+        left += children - 1;
+    }
+
+    return pos;
+}
+
 #if MPACK_DEBUG && MPACK_STDIO
 void mpack_print_append(mpack_print_t* print, const char* data, size_t count) {
 
@@ -108,6 +108,17 @@ MPACK_EXTERN_C_BEGIN
 #define MPACK_MAXIMUM_TAG_SIZE 9
 /** @endcond */
 
+/**
+ * @def MPACK_FRAME_HEADER_SIZE
+ *
+ * The size in bytes of the header of a frame. The header is the length of
+ * the frame's contents as a big-endian 32-bit unsigned integer.
+ *
+ * @see mpack_writer_begin_frame()
+ * @see mpack_read_frame()
+ */
+#define MPACK_FRAME_HEADER_SIZE 4
+
 #if MPACK_EXTENSIONS
 /**
  * @def MPACK_TIMESTAMP_NANOSECONDS_MAX
@@ -169,6 +180,7 @@ typedef enum mpack_error_t {
     mpack_error_bug,     /**< The MPack API was used incorrectly. (This will always assert in debug mode.) */
     mpack_error_data,    /**< The contained data is not valid. */
     mpack_error_eof,     /**< The reader failed to read because of file or socket EOF */
+    mpack_error_would_block, /**< The reader ran out of data without blocking. Reading can be resumed from the last checkpoint. (See mpack_reader_resume().) */
 } mpack_error_t;
 
 /**
@@ -225,6 +237,302 @@ typedef struct mpack_timestamp_t {
 } mpack_timestamp_t;
 #endif
 
+#ifdef MPACK_MALLOC
+/**
+ * A custom allocator for the dynamic memory of a tree, reader or writer.
+ *
+ * By default, MPack allocates with @ref MPACK_MALLOC(), @ref MPACK_REALLOC()
+ * and @ref MPACK_FREE(). An allocator can be set on an individual tree,
+ * reader or writer to allocate from elsewhere instead, for example from an
+ * arena that is released all at once when a request is finished.
+ *
+ * All functions are passed the allocator's context. An allocator with a
+ * NULL allocate function uses the default allocation functions.
+ *
+ * @see mpack_tree_set_allocator()
+ * @see mpack_reader_set_allocator()
+ * @see mpack_writer_set_allocator()
+ *
+ * @note This requires @ref MPACK_MALLOC.
+ */
+typedef struct mpack_allocator_t {
+    /** Allocates the given number of bytes, returning NULL on failure. */
+    void* (*allocate)(void* context, size_t size);
+
+    /**
+     * Resizes an allocation, of which @p used_size bytes are in use,
+     * returning NULL on failure (in which case the old allocation is left
+     * unchanged.)
+     *
+     * This can be NULL, in which case a new allocation is made and the used
+     * bytes are copied to it.
+     */
+    void* (*reallocate)(void* context, void* ptr, size_t used_size, size_t new_size);
+
+    /**
+     * Frees an allocation.
+     *
+     * This can be NULL if allocations don't need to be freed individually,
+     * for example if they are released together with the context.
+     */
+    void (*release)(void* context, void* ptr);
+
+    /** The context passed to the allocation functions. */
+    void* context;
+} mpack_allocator_t;
+
+/**
+ * @private
+ *
+ * A chunk of memory owned by an arena.
+ */
+typedef struct mpack_arena_chunk_t {
+    struct mpack_arena_chunk_t* prev;
+    size_t size;
+} mpack_arena_chunk_t;
+
+/**
+ * A chunked bump allocator.
+ *
+ * An arena allocates memory in chunks of @ref MPACK_ARENA_CHUNK_SIZE and
+ * hands out allocations by bumping a pointer through the current chunk.
+ * Individual allocations are not freed (except that freeing or resizing the
+ * most recent allocation is done in place.) Instead the whole arena is reset
+ * with mpack_arena_reset() or rewound to a mark with mpack_arena_rewind().
+ *
+ * Chunks released by resetting or rewinding are kept for reuse, so an arena
+ * that is reset between messages stops calling @ref MPACK_MALLOC() once it
+ * has grown to fit the largest message.
+ *
+ * Use mpack_arena_allocator() to allocate the pages, stack and strings of a
+ * tree, reader or writer out of an arena. For example:
+ *
+ * @code{.c}
+ * mpack_arena_t arena;
+ * mpack_arena_init(&arena);
+ * mpack_allocator_t allocator = mpack_arena_allocator(&arena);
+ *
+ * while (next_request(&data, &length)) {
+ *     mpack_tree_t tree;
+ *     mpack_tree_init_data(&tree, data, length);
+ *     mpack_tree_set_allocator(&tree, &allocator);
+ *     mpack_tree_parse(&tree);
+ *     handle_request(&tree);
+ *     mpack_tree_destroy(&tree);
+ *     mpack_arena_reset(&arena);
+ * }
+ *
+ * mpack_arena_destroy(&arena);
+ * @endcode
+ *
+ * An arena is not thread-safe. Use one arena per thread.
+ *
+ * @note This requires @ref MPACK_MALLOC.
+ */
+typedef struct mpack_arena_t {
+    mpack_arena_chunk_t* chunk; /* The current chunk, linked to older chunks. */
+    mpack_arena_chunk_t* spare; /* Released chunks kept for reuse. */
+    char* last;                 /* The most recent allocation. */
+    size_t used;                /* The number of bytes used in the current chunk. */
+} mpack_arena_t;
+
+/**
+ * A position in an arena to which it can be rewound.
+ *
+ * @see mpack_arena_mark()
+ * @see mpack_arena_rewind()
+ */
+typedef struct mpack_arena_mark_t {
+    mpack_arena_chunk_t* chunk;
+    size_t used;
+} mpack_arena_mark_t;
+
+/**
+ * Initializes an empty arena. No memory is allocated until the first
+ * allocation.
+ */
+void mpack_arena_init(mpack_arena_t* arena);
+
+/**
+ * Frees all memory owned by the arena, including spare chunks.
+ */
+void mpack_arena_destroy(mpack_arena_t* arena);
+
+/**
+ * Allocates the given number of bytes out of the arena, returning NULL if
+ * a new chunk was needed and could not be allocated.
+ *
+ * The memory is aligned suitably for any MessagePack value or MPack
+ * structure.
+ */
+void* mpack_arena_alloc(mpack_arena_t* arena, size_t size);
+
+/**
+ * Releases all allocations made out of the arena. Its chunks are kept for
+ * reuse by future allocations.
+ */
+void mpack_arena_reset(mpack_arena_t* arena);
+
+/**
+ * Returns the current position in the arena.
+ */
+mpack_arena_mark_t mpack_arena_mark(const mpack_arena_t* arena);
+
+/**
+ * Releases all allocations made since the given mark was taken. The mark
+ * must have been taken from this arena since it was last reset, and must
+ * not be before a mark the arena has already been rewound past.
+ */
+void mpack_arena_rewind(mpack_arena_t* arena, mpack_arena_mark_t mark);
+
+/**
+ * Returns an allocator that allocates out of the given arena.
+ *
+ * Freeing through the allocator does nothing (unless it is the most recent
+ * allocation.) The arena must outlive everything that uses the allocator.
+ *
+ * @see mpack_tree_set_allocator()
+ * @see mpack_reader_set_allocator()
+ * @see mpack_writer_set_allocator()
+ */
+mpack_allocator_t mpack_arena_allocator(mpack_arena_t* arena);
+
+/**
+ * @private
+ *
+ * A hash-and-displace perfect hash of up to 65535 string keys. The low bits
+ * of a key's hash choose a bucket, and the hash mixed with the displacement
+ * of that bucket chooses a slot. Displacements are chosen when the table is
+ * built so that no two keys share a slot, so a lookup is two table reads and
+ * a single key comparison.
+ *
+ * This is shared by enum matchers and schemas.
+ */
+typedef struct mpack_perfect_hash_t {
+    uint16_t* slots;        /* The index plus one of the key in each slot, or 0 */
+    uint8_t* displacements; /* The displacement of each bucket */
+    uint32_t slot_mask;     /* The number of slots minus one */
+    uint32_t bucket_mask;   /* The number of buckets minus one */
+} mpack_perfect_hash_t;
+
+/**
+ * A prebuilt matcher for a table of strings.
+ *
+ * An enum matcher indexes the strings of an enum table in a perfect hash
+ * (the same as a compiled schema) so that a string is matched against the
+ * table with a single comparison. Use it in place of the string table with
+ * mpack_expect_enum_matcher(), mpack_expect_key_matcher() and
+ * mpack_node_enum_matcher() when tables are large or matched often.
+ *
+ * @code{.c}
+ * static const char* events[] = {"connect", "disconnect", "message", ...};
+ * mpack_enum_matcher_t matcher;
+ * mpack_enum_matcher_init(&matcher, events, sizeof(events) / sizeof(*events));
+ *
+ * event_t event = (event_t)mpack_expect_enum_matcher(reader, &matcher);
+ * @endcode
+ *
+ * A matcher matches exactly as the linear search of mpack_expect_enum()
+ * does: if a string appears in the table more than once, the first index is
+ * matched. A matcher is immutable once built so it can be shared between
+ * threads.
+ *
+ * @note This requires @ref MPACK_MALLOC.
+ */
+typedef struct mpack_enum_matcher_t {
+    const char** strings;        /* The table of strings. */
+    size_t count;                /* The number of strings. */
+    size_t* lengths;             /* The length of each string. */
+    mpack_perfect_hash_t hash;   /* The perfect hash of the strings. */
+    size_t max_length;           /* The length of the longest string. */
+    mpack_allocator_t allocator; /* The allocator of the lengths and hash. */
+} mpack_enum_matcher_t;
+
+/**
+ * Builds a matcher for the given table of strings.
+ *
+ * The table is referenced, not copied, so it must outlive the matcher. At
+ * most 65535 strings are supported.
+ *
+ * @return @ref mpack_ok, @ref mpack_error_memory if the matcher could not be
+ *     allocated, or @ref mpack_error_bug if there are too many strings. The
+ *     matcher does not need to be destroyed if an error is returned.
+ */
+mpack_error_t mpack_enum_matcher_init(mpack_enum_matcher_t* matcher, const char* strings[], size_t count);
+
+/**
+ * Builds a matcher for the given table of strings, allocating it with the
+ * given allocator (or with MPACK_MALLOC() if it is NULL.)
+ *
+ * The allocator is copied into the matcher and used again to free it in
+ * mpack_enum_matcher_destroy().
+ *
+ * @see mpack_enum_matcher_init()
+ */
+mpack_error_t mpack_enum_matcher_init_allocator(mpack_enum_matcher_t* matcher, const char* strings[], size_t count,
+        const mpack_allocator_t* allocator);
+
+/**
+ * Destroys a matcher built with mpack_enum_matcher_init().
+ */
+void mpack_enum_matcher_destroy(mpack_enum_matcher_t* matcher);
+
+/**
+ * Returns the index of the given string in the matcher's table, or the
+ * number of strings in the table if it does not match.
+ */
+size_t mpack_enum_matcher_find(const mpack_enum_matcher_t* matcher, const char* str, size_t length);
+
+/**
+ * A function that reads the bytes of frames from a stream.
+ *
+ * It should read at least one and at most @p count bytes into @p buffer and
+ * return the number of bytes read. It should return 0 at the end of the
+ * stream or on error.
+ *
+ * @see mpack_read_frame()
+ */
+typedef size_t (*mpack_frame_read_t)(void* context, char* buffer, size_t count);
+
+/**
+ * Reads one frame from a stream into a new buffer of exactly its size.
+ *
+ * A frame is a length header of @ref MPACK_FRAME_HEADER_SIZE bytes followed
+ * by that many bytes of MessagePack, as written by mpack_writer_begin_frame()
+ * and mpack_writer_end_frame(). Since the size is known up front, nothing is
+ * read past the end of the frame and the buffer never needs to grow. The
+ * contents can be handed to mpack_tree_init_data() or
+ * mpack_reader_init_data(), for example on another thread while the next
+ * frame is being read:
+ *
+ * @code{.c}
+ * char* data;
+ * size_t size;
+ * while (mpack_read_frame(&read_socket, &socket, MAX_SIZE, NULL, &data, &size) == mpack_ok)
+ *     dispatch_frame(data, size); // parses and frees the frame
+ * @endcode
+ *
+ * The buffer must be freed with @p allocator, or with MPACK_FREE() if it is
+ * NULL. On error, nothing needs to be freed and @p data is set to NULL.
+ *
+ * @param read_fn The function that reads from the stream
+ * @param context The context passed to @p read_fn
+ * @param max_size The maximum allowed size of a frame's contents
+ * @param allocator The allocator for the buffer, or NULL to use
+ *     MPACK_MALLOC()
+ * @param data Where to place the allocated frame contents
+ * @param size Where to place the size of the frame contents
+ *
+ * @return @ref mpack_ok; @ref mpack_error_eof if the stream ended before the
+ *     frame; @ref mpack_error_io if it ended within the frame; @ref
+ *     mpack_error_invalid if the frame is empty; @ref mpack_error_too_big if
+ *     it is larger than @p max_size; or @ref mpack_error_memory if the buffer
+ *     could not be allocated.
+ */
+mpack_error_t mpack_read_frame(mpack_frame_read_t read_fn, void* context, size_t max_size,
+        const mpack_allocator_t* allocator, char** data, size_t* size);
+#endif
+
 /**
  * An MPack tag is a MessagePack object header. It is a variant type
  * representing any kind of object, and includes the length of compound types
@@ -994,6 +1302,34 @@ MPACK_INLINE void mpack_store_double(char* p, double value) {
 }
 #endif
 
+#if MPACK_FLOAT && MPACK_DOUBLE
+/**
+ * @private
+ *
+ * Converts a double to a float if it is exact, that is if the float converts
+ * back to a double with exactly the same bits. This keeps the sign of zero
+ * and the payload of NaNs.
+ */
+MPACK_INLINE bool mpack_narrow_double_to_float(double value, float* f) {
+    union {
+        double d;
+        uint64_t u;
+    } v, w;
+    v.d = value;
+
+    // finite doubles beyond the largest float (0x47efffffe0000000 as a
+    // double) are rejected before converting since the conversion would be
+    // undefined. infinities and NaNs are converted.
+    uint64_t magnitude = v.u & MPACK_UINT64_C(0x7fffffffffffffff);
+    if (magnitude > MPACK_UINT64_C(0x47efffffe0000000) && magnitude < MPACK_UINT64_C(0x7ff0000000000000))
+        return false;
+
+    *f = (float)value;
+    w.d = (double)*f;
+    return w.u == v.u;
+}
+#endif
+
 #if MPACK_FLOAT && !MPACK_DOUBLE
 /**
  * Performs a manual shortening conversion on the raw 64-bit representation of
@@ -1059,6 +1395,53 @@ MPACK_INLINE float mpack_shorten_raw_double_to_float(uint64_t d) {
 }
 #endif
 
+/**
+ * @private
+ *
+ * The initial hash for mpack_hash_bytes().
+ */
+#define MPACK_HASH_SEED MPACK_UINT64_C(0xcbf29ce484222325)
+
+/**
+ * @private
+ *
+ * Continues a 64-bit FNV-1a hash over the given bytes. Start from
+ * MPACK_HASH_SEED.
+ */
+MPACK_INLINE uint64_t mpack_hash_bytes(uint64_t hash, const char* data, size_t length) {
+    size_t i;
+    for (i = 0; i < length; ++i) {
+        hash ^= (uint8_t)data[i];
+        hash *= MPACK_UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+/**
+ * @private
+ *
+ * Combines a value into a hash and mixes the result with the murmur3
+ * finalizer so that all of its bits depend on all of the input bits.
+ */
+MPACK_INLINE uint64_t mpack_hash_mix(uint64_t hash, uint64_t value) {
+    hash *= MPACK_UINT64_C(0x100000001b3);
+    hash ^= value;
+    hash ^= hash >> 33;
+    hash *= MPACK_UINT64_C(0xff51afd7ed558ccd);
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/**
+ * @private
+ *
+ * Hashes a string to 32 bits for a hash table. The low bits are well mixed
+ * so the table size can be a power of two.
+ */
+MPACK_INLINE uint32_t mpack_hash_str(const char* data, size_t length) {
+    return (uint32_t)mpack_hash_mix(0, mpack_hash_bytes(MPACK_HASH_SEED, data, length));
+}
+
 /** @endcond */
 
 
@@ -1109,6 +1492,509 @@ MPACK_INLINE float mpack_shorten_raw_double_to_float(uint64_t d) {
 
 
 
+/**
+ * @name Tag Encoding and Decoding
+ *
+ * These are trusted kernels for encoding and decoding single tags directly
+ * in memory. They do no bounds checking: the caller must guarantee that the
+ * whole tag is available (or, for encoding, that there is room for it.) The
+ * reader, writer and node parser use them on their fast paths once enough
+ * bytes are known to be buffered.
+ *
+ * @{
+ */
+
+/**
+ * @private
+ *
+ * The header size in bytes of a tag, indexed by its first byte. This does not
+ * include the data of fixext types. It is 0 for the reserved byte 0xc1, and
+ * for ext types if @ref MPACK_EXTENSIONS is disabled.
+ */
+extern const uint8_t mpack_tag_sizes[256];
+
+/**
+ * Returns the size in bytes of the tag that starts with the given byte, or
+ * zero if the byte is not the start of a valid or supported tag.
+ *
+ * The size does not include the data of fixext types.
+ */
+MPACK_INLINE size_t mpack_decode_tag_size(char first_byte) {
+    return mpack_tag_sizes[(uint8_t)first_byte];
+}
+
+/**
+ * Decodes the tag at the given data without any bounds checks.
+ *
+ * The data must contain at least mpack_decode_tag_size() bytes, which is at
+ * most @ref MPACK_MAXIMUM_TAG_SIZE.
+ *
+ * @return The size of the tag, or zero if the data does not start with a
+ *     valid or supported tag, in which case the tag is unchanged.
+ */
+MPACK_INLINE size_t mpack_decode_tag(const char* data, mpack_tag_t* tag) {
+    uint8_t type = mpack_load_u8(data);
+
+    // unfortunately, by far the fastest way to parse a tag is to switch
+    // on the first byte, and to explicitly list every possible byte. so for
+    // infix types, the list of cases is quite large.
+    //
+    // in size-optimized builds, we switch on the top four bits first to
+    // handle most infix types with a smaller jump table to save space.
+
+    #if MPACK_OPTIMIZE_FOR_SIZE
+    switch (type >> 4) {
+
+        // positive fixnum
+        case 0x0: case 0x1: case 0x2: case 0x3:
+        case 0x4: case 0x5: case 0x6: case 0x7:
+            *tag = mpack_tag_make_uint(type);
+            return 1;
+
+        // negative fixnum
+        case 0xe: case 0xf:
+            *tag = mpack_tag_make_int((int8_t)type);
+            return 1;
+
+        // fixmap
+        case 0x8:
+            *tag = mpack_tag_make_map(type & ~0xf0u);
+            return 1;
+
+        // fixarray
+        case 0x9:
+            *tag = mpack_tag_make_array(type & ~0xf0u);
+            return 1;
+
+        // fixstr
+        case 0xa: case 0xb:
+            *tag = mpack_tag_make_str(type & ~0xe0u);
+            return 1;
+
+        // not one of the common infix types
+        default:
+            break;
+
+    }
+    #endif
+
+    // handle individual type tags
+    switch (type) {
+
+        #if !MPACK_OPTIMIZE_FOR_SIZE
+        // positive fixnum
+        case 0x00: case 0x01: case 0x02: case 0x03: case 0x04: case 0x05: case 0x06: case 0x07:
+        case 0x08: case 0x09: case 0x0a: case 0x0b: case 0x0c: case 0x0d: case 0x0e: case 0x0f:
+        case 0x10: case 0x11: case 0x12: case 0x13: case 0x14: case 0x15: case 0x16: case 0x17:
+        case 0x18: case 0x19: case 0x1a: case 0x1b: case 0x1c: case 0x1d: case 0x1e: case 0x1f:
+        case 0x20: case 0x21: case 0x22: case 0x23: case 0x24: case 0x25: case 0x26: case 0x27:
+        case 0x28: case 0x29: case 0x2a: case 0x2b: case 0x2c: case 0x2d: case 0x2e: case 0x2f:
+        case 0x30: case 0x31: case 0x32: case 0x33: case 0x34: case 0x35: case 0x36: case 0x37:
+        case 0x38: case 0x39: case 0x3a: case 0x3b: case 0x3c: case 0x3d: case 0x3e: case 0x3f:
+        case 0x40: case 0x41: case 0x42: case 0x43: case 0x44: case 0x45: case 0x46: case 0x47:
+        case 0x48: case 0x49: case 0x4a: case 0x4b: case 0x4c: case 0x4d: case 0x4e: case 0x4f:
+        case 0x50: case 0x51: case 0x52: case 0x53: case 0x54: case 0x55: case 0x56: case 0x57:
+        case 0x58: case 0x59: case 0x5a: case 0x5b: case 0x5c: case 0x5d: case 0x5e: case 0x5f:
+        case 0x60: case 0x61: case 0x62: case 0x63: case 0x64: case 0x65: case 0x66: case 0x67:
+        case 0x68: case 0x69: case 0x6a: case 0x6b: case 0x6c: case 0x6d: case 0x6e: case 0x6f:
+        case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: case 0x77:
+        case 0x78: case 0x79: case 0x7a: case 0x7b: case 0x7c: case 0x7d: case 0x7e: case 0x7f:
+            *tag = mpack_tag_make_uint(type);
+            return 1;
+
+        // negative fixnum
+        case 0xe0: case 0xe1: case 0xe2: case 0xe3: case 0xe4: case 0xe5: case 0xe6: case 0xe7:
+        case 0xe8: case 0xe9: case 0xea: case 0xeb: case 0xec: case 0xed: case 0xee: case 0xef:
+        case 0xf0: case 0xf1: case 0xf2: case 0xf3: case 0xf4: case 0xf5: case 0xf6: case 0xf7:
+        case 0xf8: case 0xf9: case 0xfa: case 0xfb: case 0xfc: case 0xfd: case 0xfe: case 0xff:
+            *tag = mpack_tag_make_int((int8_t)type);
+            return 1;
+
+        // fixmap
+        case 0x80: case 0x81: case 0x82: case 0x83: case 0x84: case 0x85: case 0x86: case 0x87:
+        case 0x88: case 0x89: case 0x8a: case 0x8b: case 0x8c: case 0x8d: case 0x8e: case 0x8f:
+            *tag = mpack_tag_make_map(type & ~0xf0u);
+            return 1;
+
+        // fixarray
+        case 0x90: case 0x91: case 0x92: case 0x93: case 0x94: case 0x95: case 0x96: case 0x97:
+        case 0x98: case 0x99: case 0x9a: case 0x9b: case 0x9c: case 0x9d: case 0x9e: case 0x9f:
+            *tag = mpack_tag_make_array(type & ~0xf0u);
+            return 1;
+
+        // fixstr
+        case 0xa0: case 0xa1: case 0xa2: case 0xa3: case 0xa4: case 0xa5: case 0xa6: case 0xa7:
+        case 0xa8: case 0xa9: case 0xaa: case 0xab: case 0xac: case 0xad: case 0xae: case 0xaf:
+        case 0xb0: case 0xb1: case 0xb2: case 0xb3: case 0xb4: case 0xb5: case 0xb6: case 0xb7:
+        case 0xb8: case 0xb9: case 0xba: case 0xbb: case 0xbc: case 0xbd: case 0xbe: case 0xbf:
+            *tag = mpack_tag_make_str(type & ~0xe0u);
+            return 1;
+        #endif
+
+        // nil
+        case 0xc0:
+            *tag = mpack_tag_make_nil();
+            return 1;
+
+        // bool
+        case 0xc2: case 0xc3:
+            *tag = mpack_tag_make_bool((bool)(type & 1));
+            return 1;
+
+        // bin8
+        case 0xc4:
+            *tag = mpack_tag_make_bin(mpack_load_u8(data + 1));
+            return MPACK_TAG_SIZE_BIN8;
+
+        // bin16
+        case 0xc5:
+            *tag = mpack_tag_make_bin(mpack_load_u16(data + 1));
+            return MPACK_TAG_SIZE_BIN16;
+
+        // bin32
+        case 0xc6:
+            *tag = mpack_tag_make_bin(mpack_load_u32(data + 1));
+            return MPACK_TAG_SIZE_BIN32;
+
+        #if MPACK_EXTENSIONS
+        // ext8
+        case 0xc7:
+            *tag = mpack_tag_make_ext(mpack_load_i8(data + 2), mpack_load_u8(data + 1));
+            return MPACK_TAG_SIZE_EXT8;
+
+        // ext16
+        case 0xc8:
+            *tag = mpack_tag_make_ext(mpack_load_i8(data + 3), mpack_load_u16(data + 1));
+            return MPACK_TAG_SIZE_EXT16;
+
+        // ext32
+        case 0xc9:
+            *tag = mpack_tag_make_ext(mpack_load_i8(data + 5), mpack_load_u32(data + 1));
+            return MPACK_TAG_SIZE_EXT32;
+        #endif
+
+        // float
+        case 0xca:
+            #if MPACK_FLOAT
+            *tag = mpack_tag_make_float(mpack_load_float(data + 1));
+            #else
+            *tag = mpack_tag_make_raw_float(mpack_load_u32(data + 1));
+            #endif
+            return MPACK_TAG_SIZE_FLOAT;
+
+        // double
+        case 0xcb:
+            #if MPACK_DOUBLE
+            *tag = mpack_tag_make_double(mpack_load_double(data + 1));
+            #else
+            *tag = mpack_tag_make_raw_double(mpack_load_u64(data + 1));
+            #endif
+            return MPACK_TAG_SIZE_DOUBLE;
+
+        // uint8
+        case 0xcc:
+            *tag = mpack_tag_make_uint(mpack_load_u8(data + 1));
+            return MPACK_TAG_SIZE_U8;
+
+        // uint16
+        case 0xcd:
+            *tag = mpack_tag_make_uint(mpack_load_u16(data + 1));
+            return MPACK_TAG_SIZE_U16;
+
+        // uint32
+        case 0xce:
+            *tag = mpack_tag_make_uint(mpack_load_u32(data + 1));
+            return MPACK_TAG_SIZE_U32;
+
+        // uint64
+        case 0xcf:
+            *tag = mpack_tag_make_uint(mpack_load_u64(data + 1));
+            return MPACK_TAG_SIZE_U64;
+
+        // int8
+        case 0xd0:
+            *tag = mpack_tag_make_int(mpack_load_i8(data + 1));
+            return MPACK_TAG_SIZE_I8;
+
+        // int16
+        case 0xd1:
+            *tag = mpack_tag_make_int(mpack_load_i16(data + 1));
+            return MPACK_TAG_SIZE_I16;
+
+        // int32
+        case 0xd2:
+            *tag = mpack_tag_make_int(mpack_load_i32(data + 1));
+            return MPACK_TAG_SIZE_I32;
+
+        // int64
+        case 0xd3:
+            *tag = mpack_tag_make_int(mpack_load_i64(data + 1));
+            return MPACK_TAG_SIZE_I64;
+
+        #if MPACK_EXTENSIONS
+        // fixext1
+        case 0xd4:
+            *tag = mpack_tag_make_ext(mpack_load_i8(data + 1), 1);
+            return MPACK_TAG_SIZE_FIXEXT1;
+
+        // fixext2
+        case 0xd5:
+            *tag = mpack_tag_make_ext(mpack_load_i8(data + 1), 2);
+            return MPACK_TAG_SIZE_FIXEXT2;
+
+        // fixext4
+        case 0xd6:
+            *tag = mpack_tag_make_ext(mpack_load_i8(data + 1), 4);
+            return MPACK_TAG_SIZE_FIXEXT4;
+
+        // fixext8
+        case 0xd7:
+            *tag = mpack_tag_make_ext(mpack_load_i8(data + 1), 8);
+            return MPACK_TAG_SIZE_FIXEXT8;
+
+        // fixext16
+        case 0xd8:
+            *tag = mpack_tag_make_ext(mpack_load_i8(data + 1), 16);
+            return MPACK_TAG_SIZE_FIXEXT16;
+        #endif
+
+        // str8
+        case 0xd9:
+            *tag = mpack_tag_make_str(mpack_load_u8(data + 1));
+            return MPACK_TAG_SIZE_STR8;
+
+        // str16
+        case 0xda:
+            *tag = mpack_tag_make_str(mpack_load_u16(data + 1));
+            return MPACK_TAG_SIZE_STR16;
+
+        // str32
+        case 0xdb:
+            *tag = mpack_tag_make_str(mpack_load_u32(data + 1));
+            return MPACK_TAG_SIZE_STR32;
+
+        // array16
+        case 0xdc:
+            *tag = mpack_tag_make_array(mpack_load_u16(data + 1));
+            return MPACK_TAG_SIZE_ARRAY16;
+
+        // array32
+        case 0xdd:
+            *tag = mpack_tag_make_array(mpack_load_u32(data + 1));
+            return MPACK_TAG_SIZE_ARRAY32;
+
+        // map16
+        case 0xde:
+            *tag = mpack_tag_make_map(mpack_load_u16(data + 1));
+            return MPACK_TAG_SIZE_MAP16;
+
+        // map32
+        case 0xdf:
+            *tag = mpack_tag_make_map(mpack_load_u32(data + 1));
+            return MPACK_TAG_SIZE_MAP32;
+
+        // reserved, or ext types with extensions disabled
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Encodes the given tag in its smallest form without any bounds checks.
+ *
+ * The data must have room for @ref MPACK_MAXIMUM_TAG_SIZE bytes. Only the
+ * tag is written; the contents of compound types must follow. The tag is
+ * encoded according to the current version of the MessagePack spec.
+ *
+ * @return The size of the encoded tag, or zero if the tag type cannot be
+ *     encoded (i.e. @ref mpack_type_missing.)
+ */
+MPACK_INLINE size_t mpack_encode_tag(char* data, mpack_tag_t tag) {
+    switch (tag.type) {
+        case mpack_type_nil:
+            mpack_store_u8(data, 0xc0);
+            return 1;
+
+        case mpack_type_bool:
+            mpack_store_u8(data, (uint8_t)(0xc2 | (tag.v.b ? 1 : 0)));
+            return 1;
+
+        case mpack_type_int:
+            if (tag.v.i >= 0) {
+                tag.v.u = (uint64_t)tag.v.i;
+                break;
+            }
+            if (tag.v.i >= -32) {
+                mpack_store_i8(data, (int8_t)tag.v.i);
+                return MPACK_TAG_SIZE_FIXINT;
+            }
+            if (tag.v.i >= MPACK_INT8_MIN) {
+                mpack_store_u8(data, 0xd0);
+                mpack_store_i8(data + 1, (int8_t)tag.v.i);
+                return MPACK_TAG_SIZE_I8;
+            }
+            if (tag.v.i >= MPACK_INT16_MIN) {
+                mpack_store_u8(data, 0xd1);
+                mpack_store_i16(data + 1, (int16_t)tag.v.i);
+                return MPACK_TAG_SIZE_I16;
+            }
+            if (tag.v.i >= MPACK_INT32_MIN) {
+                mpack_store_u8(data, 0xd2);
+                mpack_store_i32(data + 1, (int32_t)tag.v.i);
+                return MPACK_TAG_SIZE_I32;
+            }
+            mpack_store_u8(data, 0xd3);
+            mpack_store_i64(data + 1, tag.v.i);
+            return MPACK_TAG_SIZE_I64;
+
+        case mpack_type_uint:
+            break;
+
+        case mpack_type_float:
+            mpack_store_u8(data, 0xca);
+            #if MPACK_FLOAT
+            mpack_store_float(data + 1, tag.v.f);
+            #else
+            mpack_store_u32(data + 1, tag.v.f);
+            #endif
+            return MPACK_TAG_SIZE_FLOAT;
+
+        case mpack_type_double:
+            mpack_store_u8(data, 0xcb);
+            #if MPACK_DOUBLE
+            mpack_store_double(data + 1, tag.v.d);
+            #else
+            mpack_store_u64(data + 1, tag.v.d);
+            #endif
+            return MPACK_TAG_SIZE_DOUBLE;
+
+        case mpack_type_str:
+            if (tag.v.l <= 31) {
+                mpack_store_u8(data, (uint8_t)(0xa0 | tag.v.l));
+                return MPACK_TAG_SIZE_FIXSTR;
+            }
+            if (tag.v.l <= MPACK_UINT8_MAX) {
+                mpack_store_u8(data, 0xd9);
+                mpack_store_u8(data + 1, (uint8_t)tag.v.l);
+                return MPACK_TAG_SIZE_STR8;
+            }
+            if (tag.v.l <= MPACK_UINT16_MAX) {
+                mpack_store_u8(data, 0xda);
+                mpack_store_u16(data + 1, (uint16_t)tag.v.l);
+                return MPACK_TAG_SIZE_STR16;
+            }
+            mpack_store_u8(data, 0xdb);
+            mpack_store_u32(data + 1, tag.v.l);
+            return MPACK_TAG_SIZE_STR32;
+
+        case mpack_type_bin:
+            if (tag.v.l <= MPACK_UINT8_MAX) {
+                mpack_store_u8(data, 0xc4);
+                mpack_store_u8(data + 1, (uint8_t)tag.v.l);
+                return MPACK_TAG_SIZE_BIN8;
+            }
+            if (tag.v.l <= MPACK_UINT16_MAX) {
+                mpack_store_u8(data, 0xc5);
+                mpack_store_u16(data + 1, (uint16_t)tag.v.l);
+                return MPACK_TAG_SIZE_BIN16;
+            }
+            mpack_store_u8(data, 0xc6);
+            mpack_store_u32(data + 1, tag.v.l);
+            return MPACK_TAG_SIZE_BIN32;
+
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+            switch (tag.v.l) {
+                case 1:  mpack_store_u8(data, 0xd4); break;
+                case 2:  mpack_store_u8(data, 0xd5); break;
+                case 4:  mpack_store_u8(data, 0xd6); break;
+                case 8:  mpack_store_u8(data, 0xd7); break;
+                case 16: mpack_store_u8(data, 0xd8); break;
+                default:
+                    if (tag.v.l <= MPACK_UINT8_MAX) {
+                        mpack_store_u8(data, 0xc7);
+                        mpack_store_u8(data + 1, (uint8_t)tag.v.l);
+                        mpack_store_i8(data + 2, tag.exttype);
+                        return MPACK_TAG_SIZE_EXT8;
+                    }
+                    if (tag.v.l <= MPACK_UINT16_MAX) {
+                        mpack_store_u8(data, 0xc8);
+                        mpack_store_u16(data + 1, (uint16_t)tag.v.l);
+                        mpack_store_i8(data + 3, tag.exttype);
+                        return MPACK_TAG_SIZE_EXT16;
+                    }
+                    mpack_store_u8(data, 0xc9);
+                    mpack_store_u32(data + 1, tag.v.l);
+                    mpack_store_i8(data + 5, tag.exttype);
+                    return MPACK_TAG_SIZE_EXT32;
+            }
+            mpack_store_i8(data + 1, tag.exttype);
+            return MPACK_TAG_SIZE_FIXEXT1;
+        #endif
+
+        case mpack_type_array:
+            if (tag.v.n <= 15) {
+                mpack_store_u8(data, (uint8_t)(0x90 | tag.v.n));
+                return MPACK_TAG_SIZE_FIXARRAY;
+            }
+            if (tag.v.n <= MPACK_UINT16_MAX) {
+                mpack_store_u8(data, 0xdc);
+                mpack_store_u16(data + 1, (uint16_t)tag.v.n);
+                return MPACK_TAG_SIZE_ARRAY16;
+            }
+            mpack_store_u8(data, 0xdd);
+            mpack_store_u32(data + 1, tag.v.n);
+            return MPACK_TAG_SIZE_ARRAY32;
+
+        case mpack_type_map:
+            if (tag.v.n <= 15) {
+                mpack_store_u8(data, (uint8_t)(0x80 | tag.v.n));
+                return MPACK_TAG_SIZE_FIXMAP;
+            }
+            if (tag.v.n <= MPACK_UINT16_MAX) {
+                mpack_store_u8(data, 0xde);
+                mpack_store_u16(data + 1, (uint16_t)tag.v.n);
+                return MPACK_TAG_SIZE_MAP16;
+            }
+            mpack_store_u8(data, 0xdf);
+            mpack_store_u32(data + 1, tag.v.n);
+            return MPACK_TAG_SIZE_MAP32;
+
+        default:
+            return 0;
+    }
+
+    // unsigned ints, and signed ints that are non-negative
+    if (tag.v.u <= 127) {
+        mpack_store_u8(data, (uint8_t)tag.v.u);
+        return MPACK_TAG_SIZE_FIXUINT;
+    }
+    if (tag.v.u <= MPACK_UINT8_MAX) {
+        mpack_store_u8(data, 0xcc);
+        mpack_store_u8(data + 1, (uint8_t)tag.v.u);
+        return MPACK_TAG_SIZE_U8;
+    }
+    if (tag.v.u <= MPACK_UINT16_MAX) {
+        mpack_store_u8(data, 0xcd);
+        mpack_store_u16(data + 1, (uint16_t)tag.v.u);
+        return MPACK_TAG_SIZE_U16;
+    }
+    if (tag.v.u <= MPACK_UINT32_MAX) {
+        mpack_store_u8(data, 0xce);
+        mpack_store_u32(data + 1, (uint32_t)tag.v.u);
+        return MPACK_TAG_SIZE_U32;
+    }
+    mpack_store_u8(data, 0xcf);
+    mpack_store_u64(data + 1, tag.v.u);
+    return MPACK_TAG_SIZE_U64;
+}
+
+/**
+ * @}
+ */
+
+
+
 #if MPACK_READ_TRACKING || MPACK_WRITE_TRACKING
 /* Tracks the write state of compound elements (maps, arrays, */
 /* strings, binary blobs and extension types) */
@@ -1130,13 +2016,19 @@ typedef struct mpack_track_element_t {
 
 typedef struct mpack_track_t {
     size_t count;
+    #if !MPACK_TRACKING_DEPTH_ONLY
     size_t capacity;
+
+    // the elements are stored inline until they grow past
+    // MPACK_TRACKING_INITIAL_CAPACITY, after which they are moved to the
+    // heap. elements is NULL while they are inline.
     mpack_track_element_t* elements;
+    mpack_track_element_t inline_elements[MPACK_TRACKING_INITIAL_CAPACITY];
+    #endif
 } mpack_track_t;
 
 #if MPACK_INTERNAL
 mpack_error_t mpack_track_init(mpack_track_t* track);
-mpack_error_t mpack_track_grow(mpack_track_t* track);
 mpack_error_t mpack_track_push(mpack_track_t* track, mpack_type_t type, uint32_t count);
 mpack_error_t mpack_track_push_builder(mpack_track_t* track, mpack_type_t type);
 mpack_error_t mpack_track_pop(mpack_track_t* track, mpack_type_t type);
@@ -1147,6 +2039,7 @@ mpack_error_t mpack_track_bytes(mpack_track_t* track, bool read, size_t count);
 mpack_error_t mpack_track_str_bytes_all(mpack_track_t* track, bool read, size_t count);
 mpack_error_t mpack_track_check_empty(mpack_track_t* track);
 mpack_error_t mpack_track_destroy(mpack_track_t* track, bool cancel);
+mpack_error_t mpack_track_copy(mpack_track_t* dest, const mpack_track_t* src);
 #endif
 
 /** @endcond */
@@ -1159,6 +2052,18 @@ mpack_error_t mpack_track_destroy(mpack_track_t* track, bool cancel);
 
 
 
+/* Instrumentation */
+
+// Adds to a counter of an mpack_*_stats_t if MPACK_STATS is enabled. The
+// count is not evaluated otherwise.
+#if MPACK_STATS
+#define MPACK_STATS_ADD(stats, field, count) ((stats).field += (size_t)(count))
+#else
+#define MPACK_STATS_ADD(stats, field, count) ((void)0)
+#endif
+
+
+
 /* Miscellaneous string functions */
 
 /**
@@ -1178,6 +2083,104 @@ bool mpack_str_check_no_null(const char* str, size_t bytes);
 
 
 
+/* Allocators */
+
+#ifdef MPACK_MALLOC
+/**
+ * Allocates with the given allocator, or with MPACK_MALLOC() if it has no
+ * alloc function.
+ */
+void* mpack_allocator_alloc(const mpack_allocator_t* allocator, size_t size);
+
+/**
+ * Resizes an allocation made with the given allocator.
+ */
+void* mpack_allocator_realloc(const mpack_allocator_t* allocator, void* ptr,
+        size_t used_size, size_t new_size);
+
+/**
+ * Frees an allocation made with the given allocator.
+ */
+void mpack_allocator_free(const mpack_allocator_t* allocator, void* ptr);
+#endif
+
+
+
+/* Perfect hashing */
+
+#ifdef MPACK_MALLOC
+/**
+ * Returns the key of the given index for mpack_perfect_hash_init().
+ */
+typedef const char* (*mpack_perfect_hash_key_t)(const void* context, size_t index, size_t* length);
+
+/**
+ * Builds a perfect hash of @p count keys (at most 65535.) If a key appears
+ * more than once, only its first index is placed.
+ *
+ * @return @ref mpack_ok, @ref mpack_error_memory, or @ref mpack_error_bug
+ *     if no perfect hash could be found. The table does not need to be
+ *     destroyed if an error is returned.
+ */
+mpack_error_t mpack_perfect_hash_init(mpack_perfect_hash_t* table, size_t count,
+        mpack_perfect_hash_key_t key, const void* context, const mpack_allocator_t* allocator);
+
+/**
+ * Frees a perfect hash with the allocator it was built with.
+ */
+void mpack_perfect_hash_destroy(mpack_perfect_hash_t* table, const mpack_allocator_t* allocator);
+
+MPACK_INLINE uint64_t mpack_perfect_hash_key(const char* key, size_t length) {
+    return mpack_hash_mix(0, mpack_hash_bytes(MPACK_HASH_SEED, key, length));
+}
+
+MPACK_INLINE uint32_t mpack_perfect_hash_slot(const mpack_perfect_hash_t* table, uint64_t hash) {
+    uint8_t displacement = table->displacements[(uint32_t)hash & table->bucket_mask];
+    return (uint32_t)mpack_hash_mix(hash, displacement) & table->slot_mask;
+}
+
+/**
+ * Returns the only index whose key could be the given key, plus one, or 0 if
+ * no key matches. The caller must compare the key at the returned index.
+ */
+MPACK_INLINE size_t mpack_perfect_hash_find(const mpack_perfect_hash_t* table, const char* key, size_t length) {
+    if (table->slots == NULL)
+        return 0;
+    return table->slots[mpack_perfect_hash_slot(table, mpack_perfect_hash_key(key, length))];
+}
+#endif
+
+
+
+/* Element scanning */
+
+/**
+ * Parses the tag at the start of the given data for the purpose of skipping
+ * it, without decoding its value.
+ *
+ * On success, returns the size of the tag, and sets @p children to the number
+ * of child elements that follow it (twice the pair count for a map) and
+ * @p bytes to the number of str, bin or ext data bytes that follow it.
+ *
+ * Returns 0 and sets @p error if the tag is truncated or invalid, or if it
+ * is an ext type and @ref MPACK_EXTENSIONS is disabled.
+ */
+size_t mpack_scan_tag(const char* data, size_t length,
+        uint64_t* children, uint64_t* bytes, mpack_error_t* error);
+
+/**
+ * Returns the total size of the given number of consecutive elements at the
+ * start of the given data, including all of their children, without
+ * decoding them. This uses constant memory regardless of nesting depth.
+ *
+ * Returns 0 and sets @p error if the data is truncated or invalid, or if an
+ * element is an ext type and @ref MPACK_EXTENSIONS is disabled. (Zero elements
+ * also have size 0, but do not set @p error.)
+ */
+size_t mpack_scan_elements(const char* data, size_t length, size_t count, mpack_error_t* error);
+
+
+
 /** @endcond */
 #endif
 
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define MPACK_INTERNAL 1
+
+#include "mpack-compress.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+
+#if MPACK_COMPRESS
+
+#if MPACK_WRITER
+
+void mpack_compressor_init(mpack_compressor_t* compressor, mpack_codec_t codec, void* codec_context,
+        char* buffer, size_t size, mpack_compressor_output_t output, void* output_context)
+{
+    mpack_memset(compressor, 0, sizeof(*compressor));
+    compressor->codec = codec;
+    compressor->codec_context = codec_context;
+    compressor->buffer = buffer;
+    compressor->size = size;
+    compressor->output = output;
+    compressor->output_context = output_context;
+}
+
+static bool mpack_compressor_drain(mpack_writer_t* writer, mpack_compressor_t* compressor) {
+    if (compressor->used == 0)
+        return true;
+    if (!compressor->output(compressor->output_context, compressor->buffer, compressor->used)) {
+        mpack_writer_flag_error(writer, mpack_error_io);
+        return false;
+    }
+    compressor->used = 0;
+    return true;
+}
+
+/*
+ * Compresses the given data, or ends the current frame if end is true. In
+ * framed mode the whole frame is kept in the buffer until it ends so that
+ * its size can be placed in the header in front of it.
+ */
+static void mpack_compressor_run(mpack_writer_t* writer, mpack_compressor_t* compressor,
+        const char* data, size_t count, bool end)
+{
+    if (compressor->framed && !compressor->in_frame)
+        compressor->used = (compressor->size < MPACK_FRAME_HEADER_SIZE) ?
+                compressor->size : MPACK_FRAME_HEADER_SIZE;
+    compressor->in_frame = true;
+
+    mpack_codec_io_t io;
+    io.in = data;
+    io.in_end = (count == 0) ? data : data + count;
+
+    while (true) {
+        const char* in = io.in;
+        io.out = compressor->buffer + compressor->used;
+        io.out_end = compressor->buffer + compressor->size;
+
+        mpack_codec_status_t status = compressor->codec(compressor->codec_context, &io, end);
+        bool progress = io.in != in || io.out != compressor->buffer + compressor->used;
+        compressor->used = (size_t)(io.out - compressor->buffer);
+
+        if (status == mpack_codec_failed) {
+            mpack_writer_flag_error(writer, mpack_error_io);
+            return;
+        }
+        if (end ? status == mpack_codec_frame_end : io.in == io.in_end)
+            break;
+
+        // if the codec is out of room we write out what it has produced so
+        // far. this isn't possible in framed mode, so the frame is too big.
+        if (!progress || compressor->used == compressor->size) {
+            if (compressor->framed || compressor->used == 0) {
+                mpack_writer_flag_error(writer, mpack_error_too_big);
+                return;
+            }
+            if (!mpack_compressor_drain(writer, compressor))
+                return;
+        }
+    }
+
+    if (!end)
+        return;
+
+    if (compressor->framed) {
+        size_t frame_size = compressor->used - MPACK_FRAME_HEADER_SIZE;
+        if (frame_size > MPACK_UINT32_MAX) {
+            mpack_writer_flag_error(writer, mpack_error_too_big);
+            return;
+        }
+        mpack_store_u32(compressor->buffer, (uint32_t)frame_size);
+    }
+    if (mpack_compressor_drain(writer, compressor))
+        compressor->in_frame = false;
+}
+
+static void mpack_compressor_flush(mpack_writer_t* writer, const char* buffer, size_t count) {
+    mpack_compressor_run(writer, (mpack_compressor_t*)writer->context, buffer, count, false);
+}
+
+static void mpack_compressor_teardown(mpack_writer_t* writer) {
+    mpack_compressor_t* compressor = (mpack_compressor_t*)writer->context;
+    if (mpack_writer_error(writer) == mpack_ok && compressor->in_frame)
+        mpack_compressor_run(writer, compressor, compressor->buffer, 0, true);
+}
+
+void mpack_writer_set_compressor(mpack_writer_t* writer, mpack_compressor_t* compressor) {
+    mpack_writer_set_context(writer, compressor);
+    mpack_writer_set_flush(writer, mpack_compressor_flush);
+    mpack_writer_set_teardown(writer, mpack_compressor_teardown);
+}
+
+void mpack_writer_end_compressed_frame(mpack_writer_t* writer) {
+    if (writer->flush != mpack_compressor_flush) {
+        mpack_break("cannot end a compressed frame on a writer without a compressor!");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+
+    mpack_writer_flush_message(writer);
+    if (mpack_writer_error(writer) != mpack_ok)
+        return;
+
+    mpack_compressor_t* compressor = (mpack_compressor_t*)writer->context;
+    if (compressor->in_frame)
+        mpack_compressor_run(writer, compressor, compressor->buffer, 0, true);
+}
+
+#endif
+
+#if MPACK_READER || MPACK_NODE
+
+void mpack_decompressor_init(mpack_decompressor_t* decompressor, mpack_codec_t codec, void* codec_context,
+        char* buffer, size_t size, mpack_decompressor_input_t input, void* input_context)
+{
+    mpack_memset(decompressor, 0, sizeof(*decompressor));
+    decompressor->codec = codec;
+    decompressor->codec_context = codec_context;
+    decompressor->buffer = buffer;
+    decompressor->size = size;
+    decompressor->data = buffer;
+    decompressor->end = buffer;
+    decompressor->input = input;
+    decompressor->input_context = input_context;
+    decompressor->frame_ended = true;
+}
+
+void mpack_decompressor_init_data(mpack_decompressor_t* decompressor, mpack_codec_t codec, void* codec_context,
+        const char* data, size_t length)
+{
+    mpack_memset(decompressor, 0, sizeof(*decompressor));
+    decompressor->codec = codec;
+    decompressor->codec_context = codec_context;
+    decompressor->data = data;
+    decompressor->end = data + length;
+    decompressor->frame_ended = true;
+}
+
+// Reads more compressed data once the previous data has all been consumed.
+static bool mpack_decompressor_fill(mpack_decompressor_t* decompressor) {
+    mpack_assert(decompressor->data == decompressor->end, "compressed data has not been consumed!");
+    if (decompressor->input == NULL)
+        return false;
+
+    size_t count = decompressor->input(decompressor->input_context, decompressor->buffer, decompressor->size);
+    mpack_assert(count <= decompressor->size, "input function read %i bytes, more than the %i requested!",
+            (int)count, (int)decompressor->size);
+    if (count == 0)
+        return false;
+
+    decompressor->data = decompressor->buffer;
+    decompressor->end = decompressor->buffer + count;
+    return true;
+}
+
+// Reads the header of the next frame in framed mode. Returns false at the
+// end of the data or on error.
+static bool mpack_decompressor_next_frame(mpack_decompressor_t* decompressor) {
+    if (!decompressor->frame_ended) {
+        decompressor->error = mpack_error_invalid;
+        return false;
+    }
+
+    char header[MPACK_FRAME_HEADER_SIZE];
+    size_t i;
+    for (i = 0; i < sizeof(header); ++i) {
+        if (decompressor->data == decompressor->end && !mpack_decompressor_fill(decompressor)) {
+            if (i != 0)
+                decompressor->error = mpack_error_invalid;
+            return false;
+        }
+        header[i] = *decompressor->data++;
+    }
+
+    decompressor->frame_left = mpack_load_u32(header);
+    if (decompressor->frame_left == 0) {
+        decompressor->error = mpack_error_invalid;
+        return false;
+    }
+    return true;
+}
+
+size_t mpack_decompressor_read(mpack_decompressor_t* decompressor, char* buffer, size_t count) {
+    mpack_codec_io_t io;
+    io.out = buffer;
+    io.out_end = buffer + count;
+
+    while (decompressor->error == mpack_ok) {
+        size_t available = (size_t)(decompressor->end - decompressor->data);
+        if (decompressor->framed && available > decompressor->frame_left)
+            available = decompressor->frame_left;
+        io.in = decompressor->data;
+        io.in_end = decompressor->data + available;
+
+        mpack_codec_status_t status = decompressor->codec(decompressor->codec_context, &io, false);
+        size_t consumed = (size_t)(io.in - decompressor->data);
+        decompressor->data = io.in;
+        if (decompressor->framed)
+            decompressor->frame_left -= consumed;
+
+        if (status == mpack_codec_failed) {
+            decompressor->error = mpack_error_invalid;
+            break;
+        }
+        if (status == mpack_codec_frame_end) {
+            if (decompressor->framed && decompressor->frame_left != 0) {
+                decompressor->error = mpack_error_invalid;
+                break;
+            }
+            decompressor->frame_ended = true;
+        } else if (consumed != 0) {
+            decompressor->frame_ended = false;
+        }
+
+        if (io.out != buffer)
+            return (size_t)(io.out - buffer);
+        if (consumed != 0)
+            continue;
+        if (available != 0) {
+            // the codec is stuck
+            decompressor->error = mpack_error_invalid;
+            break;
+        }
+
+        // the codec needs more input
+        if (decompressor->framed && decompressor->frame_left == 0) {
+            if (!mpack_decompressor_next_frame(decompressor))
+                break;
+        } else if (!mpack_decompressor_fill(decompressor)) {
+            // the data ended within a frame
+            if (decompressor->framed)
+                decompressor->error = mpack_error_invalid;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+#if MPACK_READER
+static size_t mpack_decompressor_reader_fill(mpack_reader_t* reader, char* buffer, size_t count) {
+    mpack_decompressor_t* decompressor = (mpack_decompressor_t*)reader->context;
+    size_t read = mpack_decompressor_read(decompressor, buffer, count);
+    if (decompressor->error != mpack_ok)
+        mpack_reader_flag_error(reader, decompressor->error);
+    return read;
+}
+
+void mpack_reader_set_decompressor(mpack_reader_t* reader, mpack_decompressor_t* decompressor) {
+    mpack_reader_set_context(reader, decompressor);
+    mpack_reader_set_fill(reader, mpack_decompressor_reader_fill);
+
+    // compressed data can't be skipped without decompressing it, so we let
+    // the reader skip by filling its buffer
+    mpack_reader_set_skip(reader, NULL);
+}
+#endif
+
+#if MPACK_NODE && defined(MPACK_MALLOC)
+static size_t mpack_decompressor_tree_read(mpack_tree_t* tree, char* buffer, size_t count) {
+    mpack_decompressor_t* decompressor = (mpack_decompressor_t*)mpack_tree_context(tree);
+    size_t read = mpack_decompressor_read(decompressor, buffer, count);
+    if (decompressor->error != mpack_ok)
+        mpack_tree_flag_error(tree, decompressor->error);
+    return read;
+}
+
+void mpack_tree_init_decompressor(mpack_tree_t* tree, mpack_decompressor_t* decompressor,
+        size_t max_message_size, size_t max_message_nodes)
+{
+    mpack_tree_init_stream(tree, mpack_decompressor_tree_read, decompressor,
+            max_message_size, max_message_nodes);
+}
+#endif
+
+#endif
+
+#endif
+
+MPACK_SILENCE_WARNINGS_END
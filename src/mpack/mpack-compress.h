@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file
+ *
+ * Declares the MPack compression adapters.
+ */
+
+#ifndef MPACK_COMPRESS_H
+#define MPACK_COMPRESS_H 1
+
+#include "mpack-writer.h"
+#include "mpack-reader.h"
+#include "mpack-node.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+MPACK_EXTERN_C_BEGIN
+
+#if MPACK_COMPRESS
+
+/**
+ * @defgroup compress Compression Adapters
+ *
+ * The compression adapters compress the output of a Writer, and decompress
+ * the input of a Reader or a Node tree stream. They plug into the writer's
+ * flush function and the reader's fill function, so data is compressed
+ * straight out of the writer's buffer and decompressed straight into the
+ * reader's or tree's buffer without any intermediate copies.
+ *
+ * MPack does not contain any compression algorithms itself. A compression
+ * library such as zstd or LZ4 is attached with a @ref mpack_codec_t, a small
+ * function that wraps its streaming API. For example, a zstd compressor:
+ *
+ * @code{.c}
+ * static mpack_codec_status_t zstd_compress(void* context, mpack_codec_io_t* io, bool end) {
+ *     ZSTD_inBuffer in = {io->in, (size_t)(io->in_end - io->in), 0};
+ *     ZSTD_outBuffer out = {io->out, (size_t)(io->out_end - io->out), 0};
+ *     size_t left = ZSTD_compressStream2((ZSTD_CCtx*)context, &out, &in,
+ *             end ? ZSTD_e_end : ZSTD_e_continue);
+ *     io->in += in.pos;
+ *     io->out += out.pos;
+ *     if (ZSTD_isError(left))
+ *         return mpack_codec_failed;
+ *     return (end && left == 0) ? mpack_codec_frame_end : mpack_codec_more;
+ * }
+ * @endcode
+ *
+ * Compressed output is normally a single stream. In framed mode, each
+ * compressed frame is instead preceded by a header of @ref
+ * MPACK_FRAME_HEADER_SIZE bytes containing its size, just like the frames of
+ * mpack_writer_begin_frame(). A compressed file can then be split into frames
+ * with mpack_read_frame() without decompressing it, and the frames can be
+ * decompressed in parallel with mpack_decompressor_init_data().
+ *
+ * @{
+ */
+
+/**
+ * The input and output buffers of a @ref mpack_codec_t.
+ *
+ * The codec advances @p in past the bytes it consumes, and @p out past the
+ * bytes it produces.
+ */
+typedef struct mpack_codec_io_t {
+    const char* in;     /**< The next byte of input. */
+    const char* in_end; /**< The end of the input. */
+    char* out;          /**< Where to place the next byte of output. */
+    char* out_end;      /**< The end of the output space. */
+} mpack_codec_io_t;
+
+/**
+ * The result of a call to a @ref mpack_codec_t.
+ */
+typedef enum mpack_codec_status_t {
+    mpack_codec_more,      /**< The codec needs more input or more output space. */
+    mpack_codec_frame_end, /**< The codec finished a frame, and all of its output has been produced. */
+    mpack_codec_failed,    /**< The codec failed, for example because its input is corrupt. */
+} mpack_codec_status_t;
+
+/**
+ * A streaming compression or decompression function.
+ *
+ * It should consume as much input and produce as much output as it can,
+ * advancing the pointers in @p io. It may keep data internally between
+ * calls, and is called again with more output space when it filled the
+ * output.
+ *
+ * When compressing, @p end is true when the current frame should be ended.
+ * The compressor should return @ref mpack_codec_frame_end once all of the
+ * frame has been output, and should then start a new frame on the next call.
+ *
+ * When decompressing, @p end is always false. The decompressor must accept
+ * any number of consecutive frames. In framed mode, it must return @ref
+ * mpack_codec_frame_end at the end of each frame so that truncated frames
+ * can be detected.
+ *
+ * @param context The codec context given to mpack_compressor_init() or
+ *     mpack_decompressor_init()
+ * @param io The input and output buffers
+ * @param end Whether the compressor should end the current frame
+ */
+typedef mpack_codec_status_t (*mpack_codec_t)(void* context, mpack_codec_io_t* io, bool end);
+
+#if MPACK_WRITER
+
+/**
+ * @name Compressor
+ * @{
+ */
+
+/**
+ * A function that receives the compressed output of a compressor. It should
+ * return false if the data could not be written, in which case @ref
+ * mpack_error_io is flagged on the writer.
+ */
+typedef bool (*mpack_compressor_output_t)(void* context, const char* data, size_t size);
+
+/**
+ * A compressor for the output of a Writer.
+ *
+ * The members of this structure are private. Use the functions of the
+ * compression adapters to access it.
+ */
+typedef struct mpack_compressor_t {
+    /** @cond */
+    mpack_codec_t codec;
+    void* codec_context;
+    mpack_compressor_output_t output;
+    void* output_context;
+
+    char* buffer; // compressed output
+    size_t size;
+    size_t used;
+
+    bool framed;
+    bool in_frame; // whether anything has been compressed since the last frame ended
+    /** @endcond */
+} mpack_compressor_t;
+
+/**
+ * Initializes a compressor.
+ *
+ * The compressed data is collected in the given buffer and passed to @p
+ * output whenever it fills. In framed mode, the buffer must be large
+ * enough to hold a whole compressed frame plus its header.
+ *
+ * @param compressor The compressor to initialize
+ * @param codec The compression function
+ * @param codec_context The context for @p codec
+ * @param buffer The buffer for compressed data
+ * @param size The size of the buffer
+ * @param output The function that writes out compressed data
+ * @param output_context The context for @p output
+ */
+void mpack_compressor_init(mpack_compressor_t* compressor, mpack_codec_t codec, void* codec_context,
+        char* buffer, size_t size, mpack_compressor_output_t output, void* output_context);
+
+/**
+ * Sets whether each compressed frame is preceded by a frame header.
+ *
+ * This must be called before any data is compressed.
+ */
+MPACK_INLINE void mpack_compressor_set_framed(mpack_compressor_t* compressor, bool framed) {
+    compressor->framed = framed;
+}
+
+/**
+ * Compresses the output of the writer with the given compressor.
+ *
+ * This replaces the writer's flush function, teardown function and context.
+ * The writer must have been initialized with a buffer, for example with
+ * mpack_writer_init(). Data is compressed directly out of the writer's
+ * buffer whenever it is flushed.
+ *
+ * When the writer is destroyed without error, the last frame is ended and
+ * all remaining compressed data is output. The compressor must remain valid
+ * until then; it does not need to be destroyed.
+ */
+void mpack_writer_set_compressor(mpack_writer_t* writer, mpack_compressor_t* compressor);
+
+/**
+ * Flushes the writer and ends the current compressed frame, writing out all
+ * of its compressed data.
+ *
+ * In framed mode, call this between messages to divide the output into
+ * frames that can be decompressed independently. Frames should be kept small
+ * enough to fit in the compressor's buffer, otherwise @ref
+ * mpack_error_too_big is flagged.
+ *
+ * This does nothing if nothing has been written since the last frame ended.
+ * There must be no open elements.
+ */
+void mpack_writer_end_compressed_frame(mpack_writer_t* writer);
+
+/**
+ * @}
+ */
+
+#endif
+
+#if MPACK_READER || MPACK_NODE
+
+/**
+ * @name Decompressor
+ * @{
+ */
+
+/**
+ * A function that reads compressed data. It should read at least one and at
+ * most @p count bytes into @p buffer and return the number of bytes read,
+ * or 0 at the end of the data or on error.
+ */
+typedef size_t (*mpack_decompressor_input_t)(void* context, char* buffer, size_t count);
+
+/**
+ * A decompressor for the input of a Reader or a Node tree.
+ *
+ * The members of this structure are private. Use the functions of the
+ * compression adapters to access it.
+ */
+typedef struct mpack_decompressor_t {
+    /** @cond */
+    mpack_codec_t codec;
+    void* codec_context;
+    mpack_decompressor_input_t input;
+    void* input_context;
+
+    char* buffer; // compressed input
+    size_t size;
+    const char* data; // compressed input not yet decompressed
+    const char* end;
+
+    bool framed;
+    bool frame_ended;  // whether the codec ended the current frame
+    size_t frame_left; // compressed bytes left in the current frame
+    mpack_error_t error;
+    /** @endcond */
+} mpack_decompressor_t;
+
+/**
+ * Initializes a decompressor that reads compressed data with the given input
+ * function into the given buffer.
+ *
+ * @param decompressor The decompressor to initialize
+ * @param codec The decompression function
+ * @param codec_context The context for @p codec
+ * @param buffer The buffer for compressed data
+ * @param size The size of the buffer
+ * @param input The function that reads compressed data
+ * @param input_context The context for @p input
+ */
+void mpack_decompressor_init(mpack_decompressor_t* decompressor, mpack_codec_t codec, void* codec_context,
+        char* buffer, size_t size, mpack_decompressor_input_t input, void* input_context);
+
+/**
+ * Initializes a decompressor that decompresses the given data in memory,
+ * such as a frame returned by mpack_read_frame().
+ *
+ * The data is not copied; it must remain valid while the decompressor is
+ * in use.
+ */
+void mpack_decompressor_init_data(mpack_decompressor_t* decompressor, mpack_codec_t codec, void* codec_context,
+        const char* data, size_t length);
+
+/**
+ * Sets whether the compressed data is divided into frames with frame headers,
+ * as written by a framed @ref mpack_compressor_t.
+ *
+ * This must be called before any data is decompressed. It should not be
+ * set when decompressing the contents of a single frame returned by
+ * mpack_read_frame(), since its header has already been removed.
+ */
+MPACK_INLINE void mpack_decompressor_set_framed(mpack_decompressor_t* decompressor, bool framed) {
+    decompressor->framed = framed;
+}
+
+/**
+ * Decompresses up to @p count bytes into @p buffer.
+ *
+ * @return The number of bytes decompressed, which is at least one unless the
+ *     data has ended or an error occurred.
+ */
+size_t mpack_decompressor_read(mpack_decompressor_t* decompressor, char* buffer, size_t count);
+
+/**
+ * Returns the error state of the decompressor: @ref mpack_error_invalid if
+ * the compressed data is corrupt or ends within a frame, or @ref mpack_ok.
+ */
+MPACK_INLINE mpack_error_t mpack_decompressor_error(mpack_decompressor_t* decompressor) {
+    return decompressor->error;
+}
+
+#if MPACK_READER
+/**
+ * Decompresses the input of the reader with the given decompressor.
+ *
+ * This replaces the reader's fill function and context. The reader must
+ * have been initialized with a buffer, for example with mpack_reader_init().
+ * Data is decompressed directly into the reader's buffer. Skipped data is
+ * decompressed into the reader's buffer and discarded.
+ *
+ * If the compressed data is corrupt, @ref mpack_error_invalid is flagged on
+ * the reader.
+ */
+void mpack_reader_set_decompressor(mpack_reader_t* reader, mpack_decompressor_t* decompressor);
+#endif
+
+#if MPACK_NODE && defined(MPACK_MALLOC)
+/**
+ * Initializes a tree parser that parses messages from the given decompressor.
+ * This is a stream tree as with mpack_tree_init_stream(); data is
+ * decompressed directly into the tree's buffer.
+ *
+ * If the compressed data is corrupt, @ref mpack_error_invalid is flagged on
+ * the tree.
+ *
+ * @param tree The tree parser
+ * @param decompressor The decompressor
+ * @param max_message_size The maximum size of a message in bytes
+ * @param max_message_nodes The maximum number of nodes per message
+ */
+void mpack_tree_init_decompressor(mpack_tree_t* tree, mpack_decompressor_t* decompressor,
+        size_t max_message_size, size_t max_message_nodes);
+#endif
+
+/**
+ * @}
+ */
+
+#endif
+
+/**
+ * @}
+ */
+
+#endif
+
+MPACK_EXTERN_C_END
+MPACK_SILENCE_WARNINGS_END
+
+#endif
+
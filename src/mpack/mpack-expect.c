@@ -474,7 +474,7 @@ void* mpack_expect_array_alloc_impl(mpack_reader_t* reader, size_t element_size,
         return NULL;
     }
 
-    void* p = MPACK_MALLOC(element_size * count);
+    void* p = mpack_allocator_alloc(&reader->allocator, element_size * count);
     if (p == NULL) {
         mpack_reader_flag_error(reader, mpack_error_memory);
         return NULL;
@@ -486,6 +486,169 @@ void* mpack_expect_array_alloc_impl(mpack_reader_t* reader, size_t element_size,
 #endif
 
 
+// Typed Array Functions
+
+static size_t mpack_expect_typed_array(mpack_reader_t* reader, size_t max_count) {
+    uint32_t count = mpack_expect_array(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return 0;
+    if (count > max_count) {
+        mpack_reader_flag_error(reader, mpack_error_too_big);
+        return 0;
+    }
+    return count;
+}
+
+static size_t mpack_expect_typed_array_done(mpack_reader_t* reader, size_t count) {
+    mpack_done_array(reader);
+    return (mpack_reader_error(reader) == mpack_ok) ? count : 0;
+}
+
+#if !MPACK_OPTIMIZE_FOR_SIZE
+MPACK_STATIC_INLINE void mpack_expect_track_elements(mpack_reader_t* reader, size_t count) {
+    #if MPACK_READ_TRACKING
+    for (; count > 0; --count)
+        mpack_reader_track_element(reader);
+    #else
+    MPACK_UNUSED(reader);
+    MPACK_UNUSED(count);
+    #endif
+}
+
+// Returns true if the next count elements are all in the buffer and all
+// encoded with the given type byte and total size.
+MPACK_STATIC_INLINE bool mpack_expect_uniform_array(mpack_reader_t* reader, size_t count,
+        uint8_t type, size_t size)
+{
+    if (count > (size_t)(reader->end - reader->data) / size)
+        return false;
+    const char* p = reader->data;
+    size_t i;
+    for (i = 0; i < count; ++i, p += size)
+        if ((uint8_t)*p != type)
+            return false;
+    return true;
+}
+#endif
+
+size_t mpack_expect_u32_array(mpack_reader_t* reader, uint32_t* values, size_t max_count) {
+    size_t count = mpack_expect_typed_array(reader, max_count);
+    size_t i = 0;
+
+    #if !MPACK_OPTIMIZE_FOR_SIZE
+    while (i < count && (size_t)(reader->end - reader->data) >= MPACK_TAG_SIZE_U32) {
+        const char* p = reader->data;
+        uint8_t type = (uint8_t)*p;
+        size_t size;
+        if (type <= 0x7f) {
+            values[i] = type;
+            size = 1;
+        } else if (type == 0xcc) {
+            values[i] = mpack_load_u8(p + 1);
+            size = MPACK_TAG_SIZE_U8;
+        } else if (type == 0xcd) {
+            values[i] = mpack_load_u16(p + 1);
+            size = MPACK_TAG_SIZE_U16;
+        } else if (type == 0xce) {
+            values[i] = mpack_load_u32(p + 1);
+            size = MPACK_TAG_SIZE_U32;
+        } else {
+            break;
+        }
+        mpack_expect_track_elements(reader, 1);
+        reader->data += size;
+        ++i;
+    }
+    #endif
+
+    for (; i < count && mpack_reader_error(reader) == mpack_ok; ++i)
+        values[i] = mpack_expect_u32(reader);
+    return mpack_expect_typed_array_done(reader, count);
+}
+
+size_t mpack_expect_i64_array(mpack_reader_t* reader, int64_t* values, size_t max_count) {
+    size_t count = mpack_expect_typed_array(reader, max_count);
+    size_t i = 0;
+
+    #if !MPACK_OPTIMIZE_FOR_SIZE
+    while (i < count && (size_t)(reader->end - reader->data) >= MPACK_TAG_SIZE_I64) {
+        const char* p = reader->data;
+        uint8_t type = (uint8_t)*p;
+        size_t size;
+        if (type <= 0x7f) {
+            values[i] = type;
+            size = 1;
+        } else if (type >= 0xe0) {
+            values[i] = (int8_t)type;
+            size = 1;
+        } else {
+            switch (type) {
+                case 0xcc: values[i] = mpack_load_u8(p + 1);  size = MPACK_TAG_SIZE_U8;  break;
+                case 0xcd: values[i] = mpack_load_u16(p + 1); size = MPACK_TAG_SIZE_U16; break;
+                case 0xce: values[i] = mpack_load_u32(p + 1); size = MPACK_TAG_SIZE_U32; break;
+                case 0xd0: values[i] = mpack_load_i8(p + 1);  size = MPACK_TAG_SIZE_I8;  break;
+                case 0xd1: values[i] = mpack_load_i16(p + 1); size = MPACK_TAG_SIZE_I16; break;
+                case 0xd2: values[i] = mpack_load_i32(p + 1); size = MPACK_TAG_SIZE_I32; break;
+                case 0xd3: values[i] = mpack_load_i64(p + 1); size = MPACK_TAG_SIZE_I64; break;
+                default: size = 0; break;
+            }
+            if (size == 0)
+                break;
+        }
+        mpack_expect_track_elements(reader, 1);
+        reader->data += size;
+        ++i;
+    }
+    #endif
+
+    for (; i < count && mpack_reader_error(reader) == mpack_ok; ++i)
+        values[i] = mpack_expect_i64(reader);
+    return mpack_expect_typed_array_done(reader, count);
+}
+
+#if MPACK_FLOAT
+size_t mpack_expect_float_array(mpack_reader_t* reader, float* values, size_t max_count) {
+    size_t count = mpack_expect_typed_array(reader, max_count);
+    size_t i = 0;
+
+    #if !MPACK_OPTIMIZE_FOR_SIZE
+    if (count > 0 && mpack_expect_uniform_array(reader, count, 0xca, MPACK_TAG_SIZE_FLOAT)) {
+        const char* p = reader->data;
+        for (; i < count; ++i, p += MPACK_TAG_SIZE_FLOAT)
+            values[i] = mpack_load_float(p + 1);
+        mpack_expect_track_elements(reader, count);
+        reader->data = p;
+    }
+    #endif
+
+    for (; i < count && mpack_reader_error(reader) == mpack_ok; ++i)
+        values[i] = mpack_expect_float(reader);
+    return mpack_expect_typed_array_done(reader, count);
+}
+#endif
+
+#if MPACK_DOUBLE
+size_t mpack_expect_double_array(mpack_reader_t* reader, double* values, size_t max_count) {
+    size_t count = mpack_expect_typed_array(reader, max_count);
+    size_t i = 0;
+
+    #if !MPACK_OPTIMIZE_FOR_SIZE
+    if (count > 0 && mpack_expect_uniform_array(reader, count, 0xcb, MPACK_TAG_SIZE_DOUBLE)) {
+        const char* p = reader->data;
+        for (; i < count; ++i, p += MPACK_TAG_SIZE_DOUBLE)
+            values[i] = mpack_load_double(p + 1);
+        mpack_expect_track_elements(reader, count);
+        reader->data = p;
+    }
+    #endif
+
+    for (; i < count && mpack_reader_error(reader) == mpack_ok; ++i)
+        values[i] = mpack_expect_double(reader);
+    return mpack_expect_typed_array_done(reader, count);
+}
+#endif
+
+
 // Str, Bin and Ext Functions
 
 uint32_t mpack_expect_str(mpack_reader_t* reader) {
@@ -663,7 +826,7 @@ char* mpack_expect_cstr_alloc(mpack_reader_t* reader, size_t maxsize) {
     char* str = mpack_expect_cstr_alloc_unchecked(reader, maxsize, &length);
 
     if (str && !mpack_str_check_no_null(str, length)) {
-        MPACK_FREE(str);
+        mpack_allocator_free(&reader->allocator, str);
         mpack_reader_flag_error(reader, mpack_error_type);
         return NULL;
     }
@@ -676,7 +839,7 @@ char* mpack_expect_utf8_cstr_alloc(mpack_reader_t* reader, size_t maxsize) {
     char* str = mpack_expect_cstr_alloc_unchecked(reader, maxsize, &length);
 
     if (str && !mpack_utf8_check_no_null(str, length)) {
-        MPACK_FREE(str);
+        mpack_allocator_free(&reader->allocator, str);
         mpack_reader_flag_error(reader, mpack_error_type);
         return NULL;
     }
@@ -878,6 +1041,67 @@ size_t mpack_expect_key_cstr(mpack_reader_t* reader, const char* keys[], bool fo
     return i;
 }
 
+#ifdef MPACK_MALLOC
+// Reads a string and matches it, returning count if it doesn't match. The
+// string is only read in-place if it could match.
+static size_t mpack_expect_matched_str(mpack_reader_t* reader, const mpack_enum_matcher_t* matcher) {
+    size_t keylen = mpack_expect_str(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return matcher->count;
+
+    if (keylen > matcher->max_length) {
+        mpack_skip_bytes(reader, keylen);
+        mpack_done_str(reader);
+        return matcher->count;
+    }
+
+    const char* key = mpack_read_bytes_inplace(reader, keylen);
+    mpack_done_str(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return matcher->count;
+
+    return mpack_enum_matcher_find(matcher, key, keylen);
+}
+
+size_t mpack_expect_enum_matcher(mpack_reader_t* reader, const mpack_enum_matcher_t* matcher) {
+    size_t i = mpack_expect_matched_str(reader, matcher);
+    if (i == matcher->count)
+        mpack_reader_flag_error(reader, mpack_error_type);
+    return i;
+}
+
+size_t mpack_expect_enum_matcher_optional(mpack_reader_t* reader, const mpack_enum_matcher_t* matcher) {
+    if (mpack_reader_error(reader) != mpack_ok)
+        return matcher->count;
+
+    // the key is only recognized if it is a string
+    if (mpack_peek_tag(reader).type != mpack_type_str) {
+        mpack_discard(reader);
+        return matcher->count;
+    }
+
+    return mpack_expect_matched_str(reader, matcher);
+}
+
+size_t mpack_expect_key_matcher(mpack_reader_t* reader, const mpack_enum_matcher_t* matcher, bool found[]) {
+    size_t i = mpack_expect_enum_matcher_optional(reader, matcher);
+
+    // unrecognized keys are fine, we just return count
+    if (i == matcher->count)
+        return i;
+
+    // check if this key is a duplicate
+    mpack_assert(found != NULL, "found cannot be NULL");
+    if (found[i]) {
+        mpack_reader_flag_error(reader, mpack_error_invalid);
+        return matcher->count;
+    }
+
+    found[i] = true;
+    return i;
+}
+#endif
+
 #endif
 
 MPACK_SILENCE_WARNINGS_END
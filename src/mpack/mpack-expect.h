@@ -167,6 +167,9 @@ float mpack_expect_float(mpack_reader_t* reader);
  * @note Reading a very large integer with this function can incur a
  * loss of precision.
  *
+ * Doubles written in compact form (see mpack_writer_set_compact_floats())
+ * are always read back exactly.
+ *
  * @throws mpack_error_type if the underlying value is not a float, double or integer.
  */
 double mpack_expect_double(mpack_reader_t* reader);
@@ -868,7 +871,8 @@ bool mpack_expect_array_max_or_nil(mpack_reader_t* reader, uint32_t max_count, u
  * check the reader's error state.
  *
  * The allocated array must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the reader's
+ * allocator if one was set with mpack_reader_set_allocator().
  *
  * @throws mpack_error_type if the value is not an array or if its size is
  * greater than max_count.
@@ -892,7 +896,8 @@ bool mpack_expect_array_max_or_nil(mpack_reader_t* reader, uint32_t max_count, u
  * to check for errors; only check the reader's error state.
  *
  * The allocated array must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the reader's
+ * allocator if one was set with mpack_reader_set_allocator().
  *
  * @warning You must call @ref mpack_done_array() if and only if a non-zero
  * element count is read. This function does not differentiate between nil
@@ -916,6 +921,78 @@ void* mpack_expect_array_alloc_impl(mpack_reader_t* reader,
 #endif
 /** @endcond */
 
+/**
+ * @name Typed Array Functions
+ * @{
+ */
+
+/**
+ * Reads an array of unsigned integers into the given buffer, returning the
+ * number of elements read.
+ *
+ * Each element is read as with mpack_expect_u32(), so it may be encoded as
+ * any integer type as long as its value fits. The whole array is read,
+ * including mpack_done_array(); no further calls are needed.
+ *
+ * Elements that are entirely in the reader's buffer are decoded directly
+ * from the buffer without parsing a tag for each element, so this is much
+ * faster than reading each element individually.
+ *
+ * @throws mpack_error_type if the value is not an array or if any element
+ * is not an integer in range.
+ * @throws mpack_error_too_big if the array has more than @a max_count
+ * elements.
+ *
+ * @param reader The reader
+ * @param values A buffer for at least @a max_count elements
+ * @param max_count The maximum number of elements to read
+ * @return The number of elements read, or zero if an error occurs
+ */
+size_t mpack_expect_u32_array(mpack_reader_t* reader, uint32_t* values, size_t max_count);
+
+/**
+ * Reads an array of signed integers into the given buffer, returning the
+ * number of elements read.
+ *
+ * Each element is read as with mpack_expect_i64(). See
+ * mpack_expect_u32_array() for details.
+ */
+size_t mpack_expect_i64_array(mpack_reader_t* reader, int64_t* values, size_t max_count);
+
+#if MPACK_FLOAT
+/**
+ * Reads an array of numbers as floats into the given buffer, returning the
+ * number of elements read.
+ *
+ * Each element is read as with mpack_expect_float(). See
+ * mpack_expect_u32_array() for details. If the array is entirely in the
+ * buffer and every element is a float, the elements are decoded in a single
+ * pass with no per-element type checks.
+ *
+ * @note This requires @ref MPACK_FLOAT.
+ */
+size_t mpack_expect_float_array(mpack_reader_t* reader, float* values, size_t max_count);
+#endif
+
+#if MPACK_DOUBLE
+/**
+ * Reads an array of numbers as doubles into the given buffer, returning the
+ * number of elements read.
+ *
+ * Each element is read as with mpack_expect_double(). See
+ * mpack_expect_u32_array() for details. If the array is entirely in the
+ * buffer and every element is a double, the elements are decoded in a
+ * single pass with no per-element type checks.
+ *
+ * @note This requires @ref MPACK_DOUBLE.
+ */
+size_t mpack_expect_double_array(mpack_reader_t* reader, double* values, size_t max_count);
+#endif
+
+/**
+ * @}
+ */
+
 
 /**
  * @name String Functions
@@ -1037,7 +1114,8 @@ void mpack_expect_utf8_cstr(mpack_reader_t* reader, char* buf, size_t size);
  * returned pointer if reading succeeds.
  *
  * The allocated string must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the reader's
+ * allocator if one was set with mpack_reader_set_allocator().
  *
  * @throws mpack_error_too_big If the string plus null-terminator is larger than the given maxsize.
  * @throws mpack_error_type If the value is not a string or contains a null byte.
@@ -1058,7 +1136,8 @@ char* mpack_expect_cstr_alloc(mpack_reader_t* reader, size_t maxsize);
  * it cannot be represented in a null-terminated string.
  *
  * The allocated string must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the reader's
+ * allocator if one was set with mpack_reader_set_allocator().
  * if you want a null-terminator.
  *
  * @throws mpack_error_too_big If the string plus null-terminator is larger
@@ -1471,6 +1550,48 @@ size_t mpack_expect_key_uint(mpack_reader_t* reader, bool found[], size_t count)
 size_t mpack_expect_key_cstr(mpack_reader_t* reader, const char* keys[],
         bool found[], size_t count);
 
+#ifdef MPACK_MALLOC
+/**
+ * Expects a string matching one of the strings of the given matcher,
+ * returning its index.
+ *
+ * This is the same as mpack_expect_enum() except that the string is found
+ * with a prebuilt @ref mpack_enum_matcher_t rather than by comparing it to
+ * each string in turn. Strings longer than any in the table are skipped
+ * rather than read in-place, so they do not need to fit in the buffer.
+ *
+ * @note This requires @ref MPACK_MALLOC.
+ *
+ * @return The index of the matched string, or the number of strings in the
+ * matcher in case of error
+ */
+size_t mpack_expect_enum_matcher(mpack_reader_t* reader, const mpack_enum_matcher_t* matcher);
+
+/**
+ * Expects a string matching one of the strings of the given matcher,
+ * returning its index, or the number of strings in the matcher if no
+ * strings match.
+ *
+ * This is the same as mpack_expect_enum_optional() except that the string is
+ * found with a prebuilt @ref mpack_enum_matcher_t.
+ *
+ * @note This requires @ref MPACK_MALLOC.
+ */
+size_t mpack_expect_enum_matcher_optional(mpack_reader_t* reader, const mpack_enum_matcher_t* matcher);
+
+/**
+ * Expects a string map key matching one of the strings of the given matcher,
+ * marking it as found in the given bool array and returning its index.
+ *
+ * This is the same as mpack_expect_key_cstr() except that the key is found
+ * with a prebuilt @ref mpack_enum_matcher_t. The found array must have one
+ * flag for each string in the matcher.
+ *
+ * @note This requires @ref MPACK_MALLOC.
+ */
+size_t mpack_expect_key_matcher(mpack_reader_t* reader, const mpack_enum_matcher_t* matcher, bool found[]);
+#endif
+
 /**
  * @}
  */
@@ -0,0 +1,995 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define MPACK_INTERNAL 1
+
+#include "mpack-json.h"
+
+#if MPACK_JSON
+#include <locale.h>
+#endif
+
+MPACK_SILENCE_WARNINGS_BEGIN
+
+#if MPACK_JSON
+
+/*
+ * JSON output
+ *
+ * The JSON text is written to the writer's buffer with mpack_write_native(),
+ * which bypasses write tracking.
+ */
+
+#if MPACK_READER || MPACK_NODE
+
+// For each byte, the character that follows a backslash to escape it in a
+// JSON string, 'u' if it must be escaped as \u00XX, or 0 if it is written
+// as is. Bytes 0x80 and above are UTF-8 and are never escaped.
+static const char mpack_json_escapes[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+      0,   0, '"',   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,'\\',   0,   0,   0,
+};
+
+static const char mpack_json_hex[] = "0123456789abcdef";
+
+static const char mpack_json_digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char mpack_json_base64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+MPACK_STATIC_INLINE void mpack_json_write_char(mpack_writer_t* writer, char c) {
+    mpack_write_native(writer, &c, 1);
+}
+
+// Writes the contents of a string, escaping it where needed. Runs of bytes
+// that don't need escaping are written all at once.
+static void mpack_json_write_escaped(mpack_writer_t* writer, const char* p, size_t count) {
+    const char* end = p + count;
+    while (p != end) {
+        const char* run = p;
+        while (p != end && mpack_json_escapes[(uint8_t)*p] == 0)
+            ++p;
+        if (p != run)
+            mpack_write_native(writer, run, (size_t)(p - run));
+        if (p == end)
+            return;
+
+        char escape[6];
+        escape[0] = '\\';
+        escape[1] = mpack_json_escapes[(uint8_t)*p];
+        size_t size = 2;
+        if (escape[1] == 'u') {
+            escape[2] = '0';
+            escape[3] = '0';
+            escape[4] = mpack_json_hex[(uint8_t)*p >> 4];
+            escape[5] = mpack_json_hex[(uint8_t)*p & 0xf];
+            size = 6;
+        }
+        mpack_write_native(writer, escape, size);
+        ++p;
+    }
+}
+
+// Formats an integer into the end of the given buffer two digits at a time,
+// returning a pointer to its first digit.
+static char* mpack_json_format_uint(char* end, uint64_t value) {
+    char* p = end;
+    while (value >= 100) {
+        size_t i = (size_t)(value % 100) * 2;
+        value /= 100;
+        p -= 2;
+        p[0] = mpack_json_digit_pairs[i];
+        p[1] = mpack_json_digit_pairs[i + 1];
+    }
+    if (value >= 10) {
+        size_t i = (size_t)value * 2;
+        p -= 2;
+        p[0] = mpack_json_digit_pairs[i];
+        p[1] = mpack_json_digit_pairs[i + 1];
+    } else {
+        *--p = (char)('0' + value);
+    }
+    return p;
+}
+
+static void mpack_json_write_uint(mpack_writer_t* writer, uint64_t value) {
+    char buffer[20];
+    char* end = buffer + sizeof(buffer);
+    char* p = mpack_json_format_uint(end, value);
+    mpack_write_native(writer, p, (size_t)(end - p));
+}
+
+static void mpack_json_write_int(mpack_writer_t* writer, int64_t value) {
+    if (value >= 0) {
+        mpack_json_write_uint(writer, (uint64_t)value);
+        return;
+    }
+    char buffer[21];
+    char* end = buffer + sizeof(buffer);
+    char* p = mpack_json_format_uint(end, (uint64_t)0 - (uint64_t)value);
+    *--p = '-';
+    mpack_write_native(writer, p, (size_t)(end - p));
+}
+
+// Writes a floating point number with the fewest significant digits that
+// convert back to the same value. Whole numbers are formatted as integers
+// with a trailing ".0", which also keeps them doubles in mpack_write_json().
+static void mpack_json_write_real(mpack_writer_t* writer, double value, bool single) {
+
+    // NaN and infinities have no JSON representation. They are found from
+    // the exponent bits since float comparisons may be optimized out under
+    // finite math, and they must not reach the integer conversion below.
+    union {
+        double d;
+        uint64_t u;
+    } bits;
+    bits.d = value;
+    if ((bits.u & MPACK_UINT64_C(0x7ff0000000000000)) == MPACK_UINT64_C(0x7ff0000000000000)) {
+        mpack_write_native(writer, "null", 4);
+        return;
+    }
+
+    char buffer[32];
+    size_t size;
+
+    if (value >= -9007199254740992.0 && value <= 9007199254740992.0 && value == (double)(int64_t)value) {
+        char* end = buffer + sizeof(buffer) - 2;
+        char* p = mpack_json_format_uint(end, (uint64_t)(value < 0 ? -value : value));
+        if (value < 0)
+            *--p = '-';
+        end[0] = '.';
+        end[1] = '0';
+        mpack_write_native(writer, p, (size_t)(end + 2 - p));
+        return;
+    }
+
+    // Otherwise we try increasing precision until the value round-trips.
+    // Most values need the fewest digits so this usually formats once.
+    int digits = single ? 6 : 15;
+    int max_digits = single ? 9 : 17;
+    for (;; ++digits) {
+        mpack_snprintf(buffer, sizeof(buffer), "%.*g", digits, value);
+        if (digits == max_digits)
+            break;
+        double parsed = strtod(buffer, NULL);
+        if (single ? (float)parsed == (float)value : parsed == value)
+            break;
+    }
+
+    // the number must look like a double (and the locale may have given us
+    // a comma for a decimal point)
+    bool real = false;
+    for (size = 0; buffer[size] != '\0'; ++size) {
+        if (buffer[size] == ',')
+            buffer[size] = '.';
+        if (buffer[size] == '.' || buffer[size] == 'e')
+            real = true;
+    }
+    if (!real) {
+        buffer[size++] = '.';
+        buffer[size++] = '0';
+    }
+    mpack_write_native(writer, buffer, size);
+}
+
+// Writes bin data in base64. Unless this is the end of the data, the size
+// must be a multiple of 3.
+static void mpack_json_write_base64(mpack_writer_t* writer, const char* data, size_t size) {
+    char buffer[256];
+    size_t pos = 0;
+
+    for (; size >= 3; data += 3, size -= 3) {
+        uint32_t bits = ((uint32_t)(uint8_t)data[0] << 16) |
+                ((uint32_t)(uint8_t)data[1] << 8) | (uint32_t)(uint8_t)data[2];
+        buffer[pos] = mpack_json_base64[bits >> 18];
+        buffer[pos + 1] = mpack_json_base64[(bits >> 12) & 0x3f];
+        buffer[pos + 2] = mpack_json_base64[(bits >> 6) & 0x3f];
+        buffer[pos + 3] = mpack_json_base64[bits & 0x3f];
+        pos += 4;
+        if (pos == sizeof(buffer)) {
+            mpack_write_native(writer, buffer, pos);
+            pos = 0;
+        }
+    }
+
+    if (size > 0) {
+        uint32_t bits = (uint32_t)(uint8_t)data[0] << 16;
+        if (size == 2)
+            bits |= (uint32_t)(uint8_t)data[1] << 8;
+        buffer[pos] = mpack_json_base64[bits >> 18];
+        buffer[pos + 1] = mpack_json_base64[(bits >> 12) & 0x3f];
+        buffer[pos + 2] = (size == 2) ? mpack_json_base64[(bits >> 6) & 0x3f] : '=';
+        buffer[pos + 3] = '=';
+        pos += 4;
+    }
+
+    mpack_write_native(writer, buffer, pos);
+}
+
+// Writes an integer map key as a string.
+static void mpack_json_write_key(mpack_writer_t* writer, mpack_tag_t tag) {
+    mpack_json_write_char(writer, '"');
+    if (tag.type == mpack_type_int)
+        mpack_json_write_int(writer, tag.v.i);
+    else
+        mpack_json_write_uint(writer, tag.v.u);
+    mpack_json_write_char(writer, '"');
+}
+
+// Writes a scalar element, returning false if it is not a scalar that
+// can be written directly.
+static bool mpack_json_write_scalar(mpack_writer_t* writer, mpack_tag_t tag) {
+    switch (tag.type) {
+        case mpack_type_nil:
+            mpack_write_native(writer, "null", 4);
+            return true;
+        case mpack_type_bool:
+            if (tag.v.b)
+                mpack_write_native(writer, "true", 4);
+            else
+                mpack_write_native(writer, "false", 5);
+            return true;
+        case mpack_type_int:
+            mpack_json_write_int(writer, tag.v.i);
+            return true;
+        case mpack_type_uint:
+            mpack_json_write_uint(writer, tag.v.u);
+            return true;
+        case mpack_type_float:
+            mpack_json_write_real(writer, (double)tag.v.f, true);
+            return true;
+        case mpack_type_double:
+            mpack_json_write_real(writer, tag.v.d, false);
+            return true;
+        default:
+            return false;
+    }
+}
+
+#endif
+
+
+
+/*
+ * Reader transcoding
+ */
+
+#if MPACK_READER
+
+// The size of the chunks in which large strs and bins are copied out of the
+// reader. This must be a multiple of 3 for base64.
+#define MPACK_JSON_CHUNK_SIZE 192
+
+// Returns the size of the given data without an incomplete UTF-8 sequence
+// at its end.
+static size_t mpack_json_utf8_complete(const char* data, size_t size) {
+    size_t i;
+    for (i = 1; i <= 3 && i <= size; ++i) {
+        uint8_t c = (uint8_t)data[size - i];
+        if ((c & 0xc0) == 0x80)
+            continue;
+        size_t length = (c >= 0xf0) ? 4 : (c >= 0xe0) ? 3 : (c >= 0xc0) ? 2 : 1;
+        return (length > i) ? size - i : size;
+    }
+    return size;
+}
+
+static void mpack_transcode_json_str(mpack_reader_t* reader, mpack_writer_t* writer, uint32_t count) {
+    mpack_json_write_char(writer, '"');
+
+    if (mpack_should_read_bytes_inplace(reader, count)) {
+        const char* data = mpack_read_utf8_inplace(reader, count);
+        if (mpack_reader_error(reader) != mpack_ok)
+            return;
+        mpack_json_write_escaped(writer, data, count);
+
+    } else {
+        // Large strings are copied out in chunks. A UTF-8 sequence split
+        // between chunks is carried over to the next one to be checked.
+        char buffer[MPACK_JSON_CHUNK_SIZE];
+        size_t carry = 0;
+        size_t left = count;
+        while (left > 0) {
+            size_t step = sizeof(buffer) - carry;
+            if (step > left)
+                step = left;
+            mpack_read_bytes(reader, buffer + carry, step);
+            if (mpack_reader_error(reader) != mpack_ok)
+                return;
+            left -= step;
+
+            size_t size = carry + step;
+            size_t complete = (left == 0) ? size : mpack_json_utf8_complete(buffer, size);
+            if (!mpack_utf8_check(buffer, complete)) {
+                mpack_reader_flag_error(reader, mpack_error_type);
+                return;
+            }
+            mpack_json_write_escaped(writer, buffer, complete);
+            carry = size - complete;
+            mpack_memmove(buffer, buffer + complete, carry);
+        }
+    }
+
+    mpack_json_write_char(writer, '"');
+    mpack_done_str(reader);
+}
+
+static void mpack_transcode_json_bin(mpack_reader_t* reader, mpack_writer_t* writer, uint32_t count) {
+    mpack_json_write_char(writer, '"');
+
+    if (mpack_should_read_bytes_inplace(reader, count)) {
+        const char* data = mpack_read_bytes_inplace(reader, count);
+        if (mpack_reader_error(reader) != mpack_ok)
+            return;
+        mpack_json_write_base64(writer, data, count);
+
+    } else {
+        char buffer[MPACK_JSON_CHUNK_SIZE];
+        size_t left = count;
+        while (left > 0) {
+            size_t step = (left < sizeof(buffer)) ? left : sizeof(buffer);
+            mpack_read_bytes(reader, buffer, step);
+            if (mpack_reader_error(reader) != mpack_ok)
+                return;
+            mpack_json_write_base64(writer, buffer, step);
+            left -= step;
+        }
+    }
+
+    mpack_json_write_char(writer, '"');
+    mpack_done_bin(reader);
+}
+
+static void mpack_transcode_json_element(mpack_reader_t* reader, mpack_writer_t* writer, size_t depth, bool key) {
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+
+    if (key) {
+        if (tag.type == mpack_type_str) {
+            mpack_transcode_json_str(reader, writer, tag.v.l);
+        } else if (tag.type == mpack_type_int || tag.type == mpack_type_uint) {
+            mpack_json_write_key(writer, tag);
+        } else {
+            mpack_reader_flag_error(reader, mpack_error_type);
+        }
+        return;
+    }
+
+    if (mpack_json_write_scalar(writer, tag))
+        return;
+
+    uint32_t i;
+    switch (tag.type) {
+        case mpack_type_str:
+            mpack_transcode_json_str(reader, writer, tag.v.l);
+            return;
+
+        case mpack_type_bin:
+            mpack_transcode_json_bin(reader, writer, tag.v.l);
+            return;
+
+        case mpack_type_array:
+            if (depth == MPACK_JSON_MAX_DEPTH) {
+                mpack_reader_flag_error(reader, mpack_error_too_big);
+                return;
+            }
+            mpack_json_write_char(writer, '[');
+            for (i = 0; i < tag.v.n; ++i) {
+                if (i > 0)
+                    mpack_json_write_char(writer, ',');
+                mpack_transcode_json_element(reader, writer, depth + 1, false);
+                if (mpack_reader_error(reader) != mpack_ok || mpack_writer_error(writer) != mpack_ok)
+                    return;
+            }
+            mpack_json_write_char(writer, ']');
+            mpack_done_array(reader);
+            return;
+
+        case mpack_type_map:
+            if (depth == MPACK_JSON_MAX_DEPTH) {
+                mpack_reader_flag_error(reader, mpack_error_too_big);
+                return;
+            }
+            mpack_json_write_char(writer, '{');
+            for (i = 0; i < tag.v.n; ++i) {
+                if (i > 0)
+                    mpack_json_write_char(writer, ',');
+                mpack_transcode_json_element(reader, writer, depth + 1, true);
+                if (mpack_reader_error(reader) != mpack_ok)
+                    return;
+                mpack_json_write_char(writer, ':');
+                mpack_transcode_json_element(reader, writer, depth + 1, false);
+                if (mpack_reader_error(reader) != mpack_ok || mpack_writer_error(writer) != mpack_ok)
+                    return;
+            }
+            mpack_json_write_char(writer, '}');
+            mpack_done_map(reader);
+            return;
+
+        default:
+            // ext types have no JSON representation
+            mpack_reader_flag_error(reader, mpack_error_type);
+            return;
+    }
+}
+
+void mpack_transcode_json(mpack_reader_t* reader, mpack_writer_t* writer) {
+    if (mpack_writer_error(writer) != mpack_ok) {
+        mpack_reader_flag_error(reader, mpack_writer_error(writer));
+        return;
+    }
+
+    mpack_transcode_json_element(reader, writer, 0, false);
+
+    if (mpack_reader_error(reader) != mpack_ok)
+        mpack_writer_flag_error(writer, mpack_reader_error(reader));
+    else if (mpack_writer_error(writer) != mpack_ok)
+        mpack_reader_flag_error(reader, mpack_writer_error(writer));
+}
+
+#endif
+
+
+
+/*
+ * Node transcoding
+ */
+
+#if MPACK_NODE
+
+static void mpack_node_transcode_json_element(mpack_node_t node, mpack_writer_t* writer, size_t depth, bool key) {
+    mpack_tag_t tag = mpack_node_tag(node);
+
+    if (key) {
+        if (tag.type == mpack_type_str) {
+            // handled below
+        } else if (tag.type == mpack_type_int || tag.type == mpack_type_uint) {
+            mpack_json_write_key(writer, tag);
+            return;
+        } else {
+            mpack_node_flag_error(node, mpack_error_type);
+            return;
+        }
+    } else if (mpack_json_write_scalar(writer, tag)) {
+        return;
+    }
+
+    size_t i;
+    switch (tag.type) {
+        case mpack_type_str: {
+            const char* data = mpack_node_str(node);
+            if (!mpack_utf8_check(data, tag.v.l)) {
+                mpack_node_flag_error(node, mpack_error_type);
+                return;
+            }
+            mpack_json_write_char(writer, '"');
+            mpack_json_write_escaped(writer, data, tag.v.l);
+            mpack_json_write_char(writer, '"');
+            return;
+        }
+
+        case mpack_type_bin:
+            mpack_json_write_char(writer, '"');
+            mpack_json_write_base64(writer, mpack_node_bin_data(node), tag.v.l);
+            mpack_json_write_char(writer, '"');
+            return;
+
+        case mpack_type_array:
+            if (depth == MPACK_JSON_MAX_DEPTH) {
+                mpack_node_flag_error(node, mpack_error_too_big);
+                return;
+            }
+            mpack_json_write_char(writer, '[');
+            for (i = 0; i < tag.v.n; ++i) {
+                if (i > 0)
+                    mpack_json_write_char(writer, ',');
+                mpack_node_transcode_json_element(mpack_node_array_at(node, i), writer, depth + 1, false);
+                if (mpack_node_error(node) != mpack_ok || mpack_writer_error(writer) != mpack_ok)
+                    return;
+            }
+            mpack_json_write_char(writer, ']');
+            return;
+
+        case mpack_type_map:
+            if (depth == MPACK_JSON_MAX_DEPTH) {
+                mpack_node_flag_error(node, mpack_error_too_big);
+                return;
+            }
+            mpack_json_write_char(writer, '{');
+            for (i = 0; i < tag.v.n; ++i) {
+                if (i > 0)
+                    mpack_json_write_char(writer, ',');
+                mpack_node_transcode_json_element(mpack_node_map_key_at(node, i), writer, depth + 1, true);
+                if (mpack_node_error(node) != mpack_ok)
+                    return;
+                mpack_json_write_char(writer, ':');
+                mpack_node_transcode_json_element(mpack_node_map_value_at(node, i), writer, depth + 1, false);
+                if (mpack_node_error(node) != mpack_ok || mpack_writer_error(writer) != mpack_ok)
+                    return;
+            }
+            mpack_json_write_char(writer, '}');
+            return;
+
+        default:
+            mpack_node_flag_error(node, mpack_error_type);
+            return;
+    }
+}
+
+void mpack_node_transcode_json(mpack_node_t node, mpack_writer_t* writer) {
+    if (mpack_node_error(node) == mpack_ok && mpack_writer_error(writer) == mpack_ok)
+        mpack_node_transcode_json_element(node, writer, 0, false);
+
+    if (mpack_node_error(node) != mpack_ok)
+        mpack_writer_flag_error(writer, mpack_node_error(node));
+    else if (mpack_writer_error(writer) != mpack_ok)
+        mpack_node_flag_error(node, mpack_writer_error(writer));
+}
+
+#endif
+
+
+
+/*
+ * JSON parsing
+ */
+
+typedef struct mpack_json_parser_t {
+    mpack_writer_t* writer;
+    const char* p;
+    const char* end;
+
+    // the locale's decimal point for strtod(), found once per parse
+    const char* point;
+    size_t point_length;
+} mpack_json_parser_t;
+
+MPACK_STATIC_INLINE bool mpack_json_parser_ok(mpack_json_parser_t* parser) {
+    return mpack_writer_error(parser->writer) == mpack_ok;
+}
+
+static void mpack_json_parser_invalid(mpack_json_parser_t* parser) {
+    mpack_writer_flag_error(parser->writer, mpack_error_invalid);
+}
+
+static void mpack_json_skip_space(mpack_json_parser_t* parser) {
+    while (parser->p != parser->end && (*parser->p == ' ' || *parser->p == '\n' ||
+                *parser->p == '\r' || *parser->p == '\t'))
+        ++parser->p;
+}
+
+// Skips the given character (after any whitespace), returning false if
+// it's not next.
+static bool mpack_json_skip_char(mpack_json_parser_t* parser, char c) {
+    mpack_json_skip_space(parser);
+    if (parser->p == parser->end || *parser->p != c)
+        return false;
+    ++parser->p;
+    return true;
+}
+
+static bool mpack_json_parse_literal(mpack_json_parser_t* parser, const char* literal, size_t length) {
+    if ((size_t)(parser->end - parser->p) < length || mpack_memcmp(parser->p, literal, length) != 0) {
+        mpack_json_parser_invalid(parser);
+        return false;
+    }
+    parser->p += length;
+    return true;
+}
+
+static int mpack_json_hex_digit(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Parses the four hex digits of a \u escape, returning -1 if they are
+// invalid.
+static int32_t mpack_json_parse_hex4(const char* p, const char* end) {
+    if (end - p < 4)
+        return -1;
+    int32_t value = 0;
+    int i;
+    for (i = 0; i < 4; ++i) {
+        int digit = mpack_json_hex_digit(p[i]);
+        if (digit < 0)
+            return -1;
+        value = (value << 4) | digit;
+    }
+    return value;
+}
+
+static size_t mpack_json_encode_utf8(char* out, uint32_t c) {
+    if (c < 0x80) {
+        out[0] = (char)c;
+        return 1;
+    }
+    if (c < 0x800) {
+        out[0] = (char)(0xc0 | (c >> 6));
+        out[1] = (char)(0x80 | (c & 0x3f));
+        return 2;
+    }
+    if (c < 0x10000) {
+        out[0] = (char)(0xe0 | (c >> 12));
+        out[1] = (char)(0x80 | ((c >> 6) & 0x3f));
+        out[2] = (char)(0x80 | (c & 0x3f));
+        return 3;
+    }
+    out[0] = (char)(0xf0 | (c >> 18));
+    out[1] = (char)(0x80 | ((c >> 12) & 0x3f));
+    out[2] = (char)(0x80 | ((c >> 6) & 0x3f));
+    out[3] = (char)(0x80 | (c & 0x3f));
+    return 4;
+}
+
+/*
+ * Decodes a string with escapes, starting after its opening quote. If the
+ * writer is NULL, the string is only checked and its decoded size is
+ * returned in size; otherwise the decoded bytes are written to the writer
+ * and the parser is moved past the closing quote.
+ */
+static bool mpack_json_decode_string(mpack_json_parser_t* parser, mpack_writer_t* writer, size_t* size) {
+    const char* p = parser->p;
+    const char* end = parser->end;
+    *size = 0;
+
+    while (true) {
+        const char* run = p;
+        while (p != end && *p != '"' && *p != '\\' && (uint8_t)*p >= 0x20)
+            ++p;
+        if (p != run) {
+            if (writer == NULL && !mpack_utf8_check(run, (size_t)(p - run)))
+                return false;
+            if (writer != NULL)
+                mpack_write_bytes(writer, run, (size_t)(p - run));
+            *size += (size_t)(p - run);
+        }
+
+        if (p == end || (uint8_t)*p < 0x20)
+            return false;
+        if (*p == '"')
+            break;
+
+        // escape
+        if (++p == end)
+            return false;
+        char decoded[4];
+        size_t length = 1;
+        switch (*p++) {
+            case '"':  decoded[0] = '"';  break;
+            case '\\': decoded[0] = '\\'; break;
+            case '/':  decoded[0] = '/';  break;
+            case 'b':  decoded[0] = '\b'; break;
+            case 'f':  decoded[0] = '\f'; break;
+            case 'n':  decoded[0] = '\n'; break;
+            case 'r':  decoded[0] = '\r'; break;
+            case 't':  decoded[0] = '\t'; break;
+            case 'u': {
+                int32_t c = mpack_json_parse_hex4(p, end);
+                if (c < 0 || (c >= 0xdc00 && c <= 0xdfff))
+                    return false;
+                p += 4;
+
+                // a high surrogate must be followed by an escaped low surrogate
+                if (c >= 0xd800 && c <= 0xdbff) {
+                    if (end - p < 2 || p[0] != '\\' || p[1] != 'u')
+                        return false;
+                    int32_t low = mpack_json_parse_hex4(p + 2, end);
+                    if (low < 0xdc00 || low > 0xdfff)
+                        return false;
+                    p += 6;
+                    c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+                }
+
+                length = mpack_json_encode_utf8(decoded, (uint32_t)c);
+                break;
+            }
+            default:
+                return false;
+        }
+
+        if (writer != NULL)
+            mpack_write_bytes(writer, decoded, length);
+        *size += length;
+    }
+
+    if (writer != NULL)
+        parser->p = p + 1;
+    return true;
+}
+
+// Parses a string, starting after its opening quote.
+static void mpack_json_parse_string(mpack_json_parser_t* parser) {
+
+    // Most strings have no escapes so we look for that first, in which case
+    // we can write it directly.
+    const char* p = parser->p;
+    while (p != parser->end && *p != '"' && *p != '\\' && (uint8_t)*p >= 0x20)
+        ++p;
+    if (p != parser->end && *p == '"') {
+        size_t size = (size_t)(p - parser->p);
+        if (!mpack_utf8_check(parser->p, size)) {
+            mpack_json_parser_invalid(parser);
+            return;
+        }
+        if (size > MPACK_UINT32_MAX) {
+            mpack_writer_flag_error(parser->writer, mpack_error_too_big);
+            return;
+        }
+        mpack_write_str(parser->writer, parser->p, (uint32_t)size);
+        parser->p = p + 1;
+        return;
+    }
+
+    // Otherwise we decode it twice: once to measure it and once to write it.
+    size_t size;
+    if (!mpack_json_decode_string(parser, NULL, &size)) {
+        mpack_json_parser_invalid(parser);
+        return;
+    }
+    if (size > MPACK_UINT32_MAX) {
+        mpack_writer_flag_error(parser->writer, mpack_error_too_big);
+        return;
+    }
+    mpack_start_str(parser->writer, (uint32_t)size);
+    mpack_json_decode_string(parser, parser->writer, &size);
+    mpack_finish_str(parser->writer);
+}
+
+static bool mpack_json_skip_digits(mpack_json_parser_t* parser) {
+    const char* start = parser->p;
+    while (parser->p != parser->end && *parser->p >= '0' && *parser->p <= '9')
+        ++parser->p;
+    return parser->p != start;
+}
+
+static void mpack_json_parse_number(mpack_json_parser_t* parser) {
+    const char* start = parser->p;
+    bool negative = false;
+    if (*parser->p == '-') {
+        negative = true;
+        ++parser->p;
+    }
+
+    // leading zeroes are not allowed
+    const char* digits = parser->p;
+    if (parser->p != parser->end && *parser->p == '0') {
+        ++parser->p;
+    } else if (!mpack_json_skip_digits(parser)) {
+        mpack_json_parser_invalid(parser);
+        return;
+    }
+    const char* digits_end = parser->p;
+
+    bool integer = true;
+    if (parser->p != parser->end && *parser->p == '.') {
+        integer = false;
+        ++parser->p;
+        if (!mpack_json_skip_digits(parser)) {
+            mpack_json_parser_invalid(parser);
+            return;
+        }
+    }
+    if (parser->p != parser->end && (*parser->p == 'e' || *parser->p == 'E')) {
+        integer = false;
+        ++parser->p;
+        if (parser->p != parser->end && (*parser->p == '+' || *parser->p == '-'))
+            ++parser->p;
+        if (!mpack_json_skip_digits(parser)) {
+            mpack_json_parser_invalid(parser);
+            return;
+        }
+    }
+
+    if (integer) {
+        uint64_t value = 0;
+        const char* p;
+        for (p = digits; p != digits_end; ++p) {
+            uint64_t digit = (uint64_t)(*p - '0');
+            if (value > (MPACK_UINT64_MAX - digit) / 10)
+                break;
+            value = value * 10 + digit;
+        }
+
+        if (p == digits_end) {
+            if (!negative) {
+                mpack_write_uint(parser->writer, value);
+                return;
+            }
+            if (value <= (uint64_t)MPACK_INT64_MAX + 1) {
+                mpack_write_int(parser->writer, (value == (uint64_t)MPACK_INT64_MAX + 1) ?
+                        MPACK_INT64_MIN : -(int64_t)value);
+                return;
+            }
+        }
+
+        // otherwise it's too big so we fall back to a double
+    }
+
+    // strtod() needs a null-terminated copy with the locale's decimal point
+    // in place of the (at most one) JSON '.'
+    size_t size = (size_t)(parser->p - start) + parser->point_length;
+    char buffer[64];
+    char* copy = buffer;
+    if (size > sizeof(buffer)) {
+        copy = (char*)MPACK_MALLOC(size);
+        if (copy == NULL) {
+            mpack_writer_flag_error(parser->writer, mpack_error_memory);
+            return;
+        }
+    }
+    char* copy_end = copy;
+    for (; start != parser->p; ++start) {
+        if (*start == '.') {
+            mpack_memcpy(copy_end, parser->point, parser->point_length);
+            copy_end += parser->point_length;
+        } else {
+            *copy_end++ = *start;
+        }
+    }
+    *copy_end = '\0';
+
+    char* parsed_end;
+    double value = strtod(copy, &parsed_end);
+    bool consumed = parsed_end == copy_end;
+    if (copy != buffer)
+        MPACK_FREE(copy);
+
+    if (!consumed) {
+        mpack_json_parser_invalid(parser);
+        return;
+    }
+    mpack_write_double(parser->writer, value);
+}
+
+static void mpack_json_parse_value(mpack_json_parser_t* parser, size_t depth);
+
+static void mpack_json_parse_array(mpack_json_parser_t* parser, size_t depth) {
+    mpack_build_array(parser->writer);
+    if (!mpack_json_skip_char(parser, ']')) {
+        do {
+            mpack_json_parse_value(parser, depth + 1);
+            if (!mpack_json_parser_ok(parser))
+                return;
+        } while (mpack_json_skip_char(parser, ','));
+        if (!mpack_json_skip_char(parser, ']')) {
+            mpack_json_parser_invalid(parser);
+            return;
+        }
+    }
+    mpack_complete_array(parser->writer);
+}
+
+static void mpack_json_parse_object(mpack_json_parser_t* parser, size_t depth) {
+    mpack_build_map(parser->writer);
+    if (!mpack_json_skip_char(parser, '}')) {
+        do {
+            if (!mpack_json_skip_char(parser, '"')) {
+                mpack_json_parser_invalid(parser);
+                return;
+            }
+            mpack_json_parse_string(parser);
+            if (!mpack_json_parser_ok(parser))
+                return;
+            if (!mpack_json_skip_char(parser, ':')) {
+                mpack_json_parser_invalid(parser);
+                return;
+            }
+            mpack_json_parse_value(parser, depth + 1);
+            if (!mpack_json_parser_ok(parser))
+                return;
+        } while (mpack_json_skip_char(parser, ','));
+        if (!mpack_json_skip_char(parser, '}')) {
+            mpack_json_parser_invalid(parser);
+            return;
+        }
+    }
+    mpack_complete_map(parser->writer);
+}
+
+static void mpack_json_parse_value(mpack_json_parser_t* parser, size_t depth) {
+    mpack_json_skip_space(parser);
+    if (parser->p == parser->end) {
+        mpack_json_parser_invalid(parser);
+        return;
+    }
+
+    switch (*parser->p) {
+        case 'n':
+            if (mpack_json_parse_literal(parser, "null", 4))
+                mpack_write_nil(parser->writer);
+            return;
+        case 't':
+            if (mpack_json_parse_literal(parser, "true", 4))
+                mpack_write_true(parser->writer);
+            return;
+        case 'f':
+            if (mpack_json_parse_literal(parser, "false", 5))
+                mpack_write_false(parser->writer);
+            return;
+        case '"':
+            ++parser->p;
+            mpack_json_parse_string(parser);
+            return;
+        case '[':
+        case '{':
+            if (depth == MPACK_JSON_MAX_DEPTH) {
+                mpack_writer_flag_error(parser->writer, mpack_error_too_big);
+                return;
+            }
+            if (*parser->p++ == '[')
+                mpack_json_parse_array(parser, depth);
+            else
+                mpack_json_parse_object(parser, depth);
+            return;
+        default:
+            if (*parser->p == '-' || (*parser->p >= '0' && *parser->p <= '9')) {
+                mpack_json_parse_number(parser);
+                return;
+            }
+            mpack_json_parser_invalid(parser);
+            return;
+    }
+}
+
+void mpack_write_json(mpack_writer_t* writer, const char* json, size_t length) {
+    mpack_json_parser_t parser;
+    parser.writer = writer;
+    parser.p = json;
+    parser.end = json + length;
+    parser.point = localeconv()->decimal_point;
+    parser.point_length = mpack_strlen(parser.point);
+    if (parser.point_length == 0) {
+        parser.point = ".";
+        parser.point_length = 1;
+    }
+
+    mpack_json_parse_value(&parser, 0);
+    if (!mpack_json_parser_ok(&parser))
+        return;
+
+    mpack_json_skip_space(&parser);
+    if (parser.p != parser.end)
+        mpack_json_parser_invalid(&parser);
+}
+
+#endif
+
+MPACK_SILENCE_WARNINGS_END
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file
+ *
+ * Declares the MPack JSON API.
+ */
+
+#ifndef MPACK_JSON_H
+#define MPACK_JSON_H 1
+
+#include "mpack-writer.h"
+#include "mpack-reader.h"
+#include "mpack-node.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+MPACK_EXTERN_C_BEGIN
+
+#if MPACK_JSON
+
+#if !MPACK_BUILDER || !MPACK_STDLIB || !MPACK_STDIO || !MPACK_DOUBLE
+#error "MPACK_JSON requires MPACK_BUILDER, MPACK_STDLIB, MPACK_STDIO and MPACK_DOUBLE."
+#endif
+
+#if MPACK_JSON_MAX_DEPTH < 1
+#error "MPACK_JSON_MAX_DEPTH must be at least 1."
+#endif
+
+/**
+ * @defgroup json JSON API
+ *
+ * The MPack JSON API converts between MessagePack and JSON.
+ *
+ * MessagePack is transcoded to JSON directly from a Reader or from a Node
+ * tree. The JSON text is written to an @ref mpack_writer_t, so it can be
+ * written to a fixed buffer, a growable buffer, a file or a flush callback
+ * in the same way as MessagePack. The writer is used only as a buffered
+ * output stream; the text is not tracked as MessagePack elements.
+ *
+ * JSON text is encoded to MessagePack on an @ref mpack_writer_t using the
+ * Builder to count the elements of arrays and objects.
+ *
+ * For example, to convert a MessagePack message to a JSON string:
+ *
+ * @code{.c}
+ * char* json;
+ * size_t json_size;
+ * mpack_writer_t writer;
+ * mpack_writer_init_growable(&writer, &json, &json_size);
+ *
+ * mpack_reader_t reader;
+ * mpack_reader_init_data(&reader, data, size);
+ * mpack_transcode_json(&reader, &writer);
+ * mpack_reader_destroy(&reader);
+ *
+ * if (mpack_writer_destroy(&writer) != mpack_ok) {
+ *     fprintf(stderr, "An error occurred converting the data!\n");
+ *     return;
+ * }
+ *
+ * // json contains json_size bytes of JSON text (not null-terminated)
+ * MPACK_FREE(json);
+ * @endcode
+ *
+ * MessagePack types are converted to JSON as follows:
+ *
+ * - nil, bool, int and uint are written as null, true, false and integers.
+ * - float and double are written with the fewest digits that convert back
+ *   to the same value. Whole numbers are written with a trailing @c .0 so
+ *   that they are encoded as doubles again. NaN and infinities are written as
+ *   null since JSON cannot represent them.
+ * - str is written as a string. It must be valid UTF-8.
+ * - bin is written as a string containing its data in base64.
+ * - array and map are written as arrays and objects. The keys of a map must
+ *   be strs or integers; integer keys are written as strings.
+ *
+ * Any other data (ext types, invalid UTF-8, or other kinds of map keys)
+ * flags @ref mpack_error_type. Maps and arrays can be nested at most @ref
+ * MPACK_JSON_MAX_DEPTH deep; deeper data flags @ref mpack_error_too_big.
+ *
+ * The output contains no whitespace.
+ *
+ * @{
+ */
+
+#if MPACK_READER
+/**
+ * Reads the next element from the reader and writes it to the writer as
+ * JSON text.
+ *
+ * If an error occurs on either the reader or the writer, it is flagged on
+ * both. Errors in the data (see @ref json) are flagged as @ref mpack_error_type.
+ *
+ * This can be called repeatedly to transcode a stream of messages. No
+ * separator is written between them.
+ */
+void mpack_transcode_json(mpack_reader_t* reader, mpack_writer_t* writer);
+#endif
+
+#if MPACK_NODE
+/**
+ * Writes the given node and all of its children to the writer as JSON text.
+ *
+ * If an error occurs on either the tree or the writer, it is flagged on
+ * both. Errors in the data (see @ref json) are flagged as @ref mpack_error_type.
+ */
+void mpack_node_transcode_json(mpack_node_t node, mpack_writer_t* writer);
+#endif
+
+/**
+ * Parses the given JSON text and writes it to the writer as a MessagePack
+ * element.
+ *
+ * The text must contain exactly one JSON value, optionally surrounded by
+ * whitespace. It does not need to be null-terminated.
+ *
+ * JSON values are converted to MessagePack as follows:
+ *
+ * - null, true and false are written as nil and bool.
+ * - Numbers without a fraction or exponent are written as int or uint in
+ *   the smallest encoding. Any other number (including integers that are
+ *   too large for 64 bits) is written as a double.
+ * - Strings are written as strs, with escapes decoded to UTF-8.
+ * - Arrays and objects are written as arrays and maps.
+ *
+ * If the text is not valid JSON, @ref mpack_error_invalid is flagged on the
+ * writer. If arrays and objects are nested more than @ref MPACK_JSON_MAX_DEPTH
+ * deep, @ref mpack_error_too_big is flagged.
+ *
+ * @param writer The writer for the MessagePack output
+ * @param json The JSON text
+ * @param length The length of the JSON text in bytes
+ */
+void mpack_write_json(mpack_writer_t* writer, const char* json, size_t length);
+
+/**
+ * @}
+ */
+
+#endif
+
+MPACK_EXTERN_C_END
+MPACK_SILENCE_WARNINGS_END
+
+#endif
+
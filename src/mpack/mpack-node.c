@@ -30,7 +30,7 @@ MPACK_SILENCE_WARNINGS_BEGIN
 MPACK_STATIC_INLINE const char* mpack_node_data_unchecked(mpack_node_t node) {
     mpack_assert(mpack_node_error(node) == mpack_ok, "tree is in an error state!");
 
-    mpack_type_t type = node.data->type;
+    mpack_type_t type = (mpack_type_t)node.data->type;
     MPACK_UNUSED(type);
     #if MPACK_EXTENSIONS
     mpack_assert(type == mpack_type_str || type == mpack_type_bin || type == mpack_type_ext,
@@ -47,7 +47,7 @@ MPACK_STATIC_INLINE const char* mpack_node_data_unchecked(mpack_node_t node) {
 MPACK_STATIC_INLINE int8_t mpack_node_exttype_unchecked(mpack_node_t node) {
     mpack_assert(mpack_node_error(node) == mpack_ok, "tree is in an error state!");
 
-    mpack_type_t type = node.data->type;
+    mpack_type_t type = (mpack_type_t)node.data->type;
     MPACK_UNUSED(type);
     mpack_assert(type == mpack_type_ext, "node of type %i (%s) is not an ext type!",
             type, mpack_type_to_string(type));
@@ -57,6 +57,197 @@ MPACK_STATIC_INLINE int8_t mpack_node_exttype_unchecked(mpack_node_t node) {
 }
 #endif
 
+#if MPACK_NODE_COMPACT
+// The value of an int or uint node is stored in the data at value.offset.
+#define MPACK_NODE_FLAG_EXTERNAL 0x1
+// A non-empty map or array whose children start at value.offset in the data
+// has not yet been materialized.
+#define MPACK_NODE_FLAG_LAZY 0x2
+#endif
+
+MPACK_STATIC_INLINE uint64_t mpack_node_value_u(mpack_node_t node) {
+    #if MPACK_NODE_COMPACT
+    if (node.data->flags & MPACK_NODE_FLAG_EXTERNAL)
+        return mpack_load_u64(node.tree->data + node.data->value.offset);
+    #endif
+    return node.data->value.u;
+}
+
+MPACK_STATIC_INLINE int64_t mpack_node_value_i(mpack_node_t node) {
+    #if MPACK_NODE_COMPACT
+    if (node.data->flags & MPACK_NODE_FLAG_EXTERNAL)
+        return mpack_load_i64(node.tree->data + node.data->value.offset);
+    #endif
+    return node.data->value.i;
+}
+
+#if MPACK_DOUBLE
+MPACK_STATIC_INLINE double mpack_node_value_d(mpack_node_t node) {
+    #if MPACK_NODE_COMPACT
+    return mpack_load_double(node.tree->data + node.data->value.offset);
+    #else
+    return node.data->value.d;
+    #endif
+}
+#else
+MPACK_STATIC_INLINE uint64_t mpack_node_value_d(mpack_node_t node) {
+    #if MPACK_NODE_COMPACT
+    return mpack_load_u64(node.tree->data + node.data->value.offset);
+    #else
+    return node.data->value.d;
+    #endif
+}
+#endif
+
+
+
+/*
+ * Key Interning
+ */
+
+#ifdef MPACK_MALLOC
+
+void mpack_key_table_init(mpack_key_table_t* table, size_t max_length) {
+    mpack_memset(table, 0, sizeof(*table));
+    mpack_arena_init(&table->strings);
+    table->max_length = max_length;
+}
+
+void mpack_key_table_destroy(mpack_key_table_t* table) {
+    mpack_arena_destroy(&table->strings);
+    if (table->entries)
+        MPACK_FREE(table->entries);
+    if (table->slots)
+        MPACK_FREE(table->slots);
+    mpack_memset(table, 0, sizeof(*table));
+}
+
+/*
+ * Returns the slot containing the ID of the given key, or the empty slot in
+ * which it would be placed. The table must have slots.
+ */
+static size_t mpack_key_table_slot(const mpack_key_table_t* table, const char* key, size_t length) {
+    size_t slot = mpack_hash_str(key, length) & table->mask;
+    while (table->slots[slot] != 0) {
+        const mpack_key_table_entry_t* entry = &table->entries[table->slots[slot] - 1];
+        if (entry->length == length && mpack_memcmp(entry->key, key, length) == 0)
+            break;
+        slot = (slot + 1) & table->mask;
+    }
+    return slot;
+}
+
+/*
+ * Doubles the capacity of the table's entries, rebuilding its slots to keep
+ * them at most half full.
+ */
+static bool mpack_key_table_grow(mpack_key_table_t* table) {
+    size_t capacity = table->capacity == 0 ? 16 : table->capacity * 2;
+    mpack_key_table_entry_t* entries;
+    if (table->entries == NULL)
+        entries = (mpack_key_table_entry_t*)MPACK_MALLOC(sizeof(mpack_key_table_entry_t) * capacity);
+    else
+        entries = (mpack_key_table_entry_t*)mpack_realloc(table->entries,
+                sizeof(mpack_key_table_entry_t) * table->count, sizeof(mpack_key_table_entry_t) * capacity);
+    if (entries == NULL)
+        return false;
+    table->entries = entries;
+
+    // the capacity only changes once the slots have grown to match it
+    uint16_t* slots = (uint16_t*)MPACK_MALLOC(sizeof(uint16_t) * capacity * 2);
+    if (slots == NULL)
+        return false;
+    mpack_memset(slots, 0, sizeof(uint16_t) * capacity * 2);
+    if (table->slots)
+        MPACK_FREE(table->slots);
+    table->slots = slots;
+    table->mask = capacity * 2 - 1;
+    table->capacity = capacity;
+
+    size_t i;
+    for (i = 0; i < table->count; ++i)
+        table->slots[mpack_key_table_slot(table, table->entries[i].key, table->entries[i].length)] = (uint16_t)(i + 1);
+    return true;
+}
+
+static mpack_error_t mpack_key_table_add(mpack_key_table_t* table, const char* key, size_t length, uint16_t* id) {
+    *id = 0;
+    if (length > table->max_length)
+        return mpack_ok;
+
+    size_t slot = 0;
+    if (table->slots != NULL) {
+        slot = mpack_key_table_slot(table, key, length);
+        if (table->slots[slot] != 0) {
+            *id = table->slots[slot];
+            return mpack_ok;
+        }
+    }
+
+    if (table->count == MPACK_UINT16_MAX)
+        return mpack_ok;
+    if (table->count == table->capacity) {
+        if (!mpack_key_table_grow(table))
+            return mpack_error_memory;
+        slot = mpack_key_table_slot(table, key, length);
+    }
+
+    char* copy = (char*)mpack_arena_alloc(&table->strings, length + 1);
+    if (copy == NULL)
+        return mpack_error_memory;
+    mpack_memcpy(copy, key, length);
+    copy[length] = '\0';
+
+    table->entries[table->count].key = copy;
+    table->entries[table->count].length = length;
+    ++table->count;
+    *id = (uint16_t)table->count;
+    table->slots[slot] = *id;
+    return mpack_ok;
+}
+
+uint16_t mpack_key_table_intern(mpack_key_table_t* table, const char* key, size_t length) {
+    uint16_t id;
+    mpack_key_table_add(table, key, length, &id);
+    return id;
+}
+
+uint16_t mpack_key_table_find(const mpack_key_table_t* table, const char* key, size_t length) {
+    if (table->slots == NULL || length > table->max_length)
+        return 0;
+    return table->slots[mpack_key_table_slot(table, key, length)];
+}
+
+const char* mpack_key_table_key(const mpack_key_table_t* table, uint16_t id, size_t* length) {
+    if (id == 0 || id > table->count) {
+        mpack_break("key ID %i is not in the table!", (int)id);
+        return NULL;
+    }
+    const mpack_key_table_entry_t* entry = &table->entries[id - 1];
+    if (length)
+        *length = entry->length;
+    return entry->key;
+}
+
+/*
+ * Interns the given map key if it is a str, returning false if an error
+ * occurred.
+ */
+static bool mpack_tree_intern_key(mpack_tree_t* tree, mpack_node_data_t* node) {
+    if (node->type != mpack_type_str)
+        return true;
+    uint16_t id;
+    mpack_error_t error = mpack_key_table_add(tree->key_table, tree->data + node->value.offset, node->len, &id);
+    if (error != mpack_ok) {
+        mpack_tree_flag_error(tree, error);
+        return false;
+    }
+    node->key = id;
+    return true;
+}
+
+#endif
+
 
 
 /*
@@ -78,6 +269,38 @@ MPACK_STATIC_INLINE int8_t mpack_node_exttype_unchecked(mpack_node_t node) {
 #endif
 
 #ifdef MPACK_MALLOC
+/*
+ * Grows the buffer of a stream tree to hold at least the given number of
+ * bytes, keeping its current data.
+ */
+static bool mpack_tree_grow_buffer(mpack_tree_t* tree, size_t size) {
+    // TODO: check for overflow?
+    size_t new_capacity = (tree->buffer_capacity == 0) ? MPACK_BUFFER_SIZE : tree->buffer_capacity;
+    while (new_capacity < size)
+        new_capacity *= 2;
+    if (new_capacity > tree->max_size)
+        new_capacity = tree->max_size;
+
+    mpack_log("expanding buffer from %i to %i\n", (int)tree->buffer_capacity, (int)new_capacity);
+    MPACK_STATS_ADD(tree->stats, buffer_grows, 1);
+
+    char* new_buffer;
+    if (tree->buffer == NULL)
+        new_buffer = (char*)mpack_allocator_alloc(&tree->allocator, new_capacity);
+    else
+        new_buffer = (char*)mpack_allocator_realloc(&tree->allocator, tree->buffer, tree->data_length, new_capacity);
+
+    if (new_buffer == NULL) {
+        mpack_tree_flag_error(tree, mpack_error_memory);
+        return false;
+    }
+
+    tree->data = new_buffer;
+    tree->buffer = new_buffer;
+    tree->buffer_capacity = new_capacity;
+    return true;
+}
+
 /*
  * Fills the tree until we have at least enough bytes for the current node.
  */
@@ -107,37 +330,15 @@ static bool mpack_tree_reserve_fill(mpack_tree_t* tree) {
     }
 
     // expand the buffer if needed
-    if (tree->data_length + bytes > tree->buffer_capacity) {
-
-        // TODO: check for overflow?
-        size_t new_capacity = (tree->buffer_capacity == 0) ? MPACK_BUFFER_SIZE : tree->buffer_capacity;
-        while (new_capacity < tree->data_length + bytes)
-            new_capacity *= 2;
-        if (new_capacity > tree->max_size)
-            new_capacity = tree->max_size;
-
-        mpack_log("expanding buffer from %i to %i\n", (int)tree->buffer_capacity, (int)new_capacity);
-
-        char* new_buffer;
-        if (tree->buffer == NULL)
-            new_buffer = (char*)MPACK_MALLOC(new_capacity);
-        else
-            new_buffer = (char*)mpack_realloc(tree->buffer, tree->data_length, new_capacity);
-
-        if (new_buffer == NULL) {
-            mpack_tree_flag_error(tree, mpack_error_memory);
+    if (tree->data_length + bytes > tree->buffer_capacity)
+        if (!mpack_tree_grow_buffer(tree, tree->data_length + bytes))
             return false;
-        }
-
-        tree->data = new_buffer;
-        tree->buffer = new_buffer;
-        tree->buffer_capacity = new_capacity;
-    }
 
     // request as much data as possible, looping until we have
     // all the data we need
     do {
         size_t read = tree->read_fn(tree, tree->buffer + tree->data_length, tree->buffer_capacity - tree->data_length);
+        MPACK_STATS_ADD(tree->stats, fills, 1);
 
         // If the fill function encounters an error, it should flag an error on
         // the tree.
@@ -158,6 +359,7 @@ static bool mpack_tree_reserve_fill(mpack_tree_t* tree) {
         }
 
         mpack_log("read %" PRIu32 " more bytes\n", (uint32_t)read);
+        MPACK_STATS_ADD(tree->stats, fill_bytes, read);
         tree->data_length += read;
         tree->parser.possible_nodes_left += read;
     } while (tree->parser.possible_nodes_left < bytes);
@@ -230,10 +432,11 @@ static bool mpack_tree_push_stack(mpack_tree_t* tree, mpack_node_data_t* first_c
         #ifdef MPACK_MALLOC
         size_t new_capacity = parser->stack_capacity * 2;
         mpack_log("growing parse stack to capacity %i\n", (int)new_capacity);
+        MPACK_STATS_ADD(tree->stats, stack_grows, 1);
 
         // Replace the stack-allocated parsing stack
         if (!parser->stack_owned) {
-            mpack_level_t* new_stack = (mpack_level_t*)MPACK_MALLOC(sizeof(mpack_level_t) * new_capacity);
+            mpack_level_t* new_stack = (mpack_level_t*)mpack_allocator_alloc(&tree->allocator, sizeof(mpack_level_t) * new_capacity);
             if (!new_stack) {
                 mpack_tree_flag_error(tree, mpack_error_memory);
                 return false;
@@ -244,7 +447,7 @@ static bool mpack_tree_push_stack(mpack_tree_t* tree, mpack_node_data_t* first_c
 
         // Realloc the allocated parsing stack
         } else {
-            mpack_level_t* new_stack = (mpack_level_t*)mpack_realloc(parser->stack,
+            mpack_level_t* new_stack = (mpack_level_t*)mpack_allocator_realloc(&tree->allocator, parser->stack,
                     sizeof(mpack_level_t) * parser->stack_capacity, sizeof(mpack_level_t) * new_capacity);
             if (!new_stack) {
                 mpack_tree_flag_error(tree, mpack_error_memory);
@@ -266,11 +469,270 @@ static bool mpack_tree_push_stack(mpack_tree_t* tree, mpack_node_data_t* first_c
     return true;
 }
 
+#ifdef MPACK_MALLOC
+/*
+ * Allocates a page of MPACK_NODES_PER_PAGE nodes and adds it to the tree,
+ * reusing a page kept from a previous message if possible.
+ */
+MPACK_STATIC_INLINE size_t mpack_tree_page_size(size_t capacity) {
+    return sizeof(mpack_tree_page_t) + sizeof(mpack_node_data_t) * (capacity - 1);
+}
+
+static mpack_tree_page_t* mpack_tree_alloc_page(mpack_tree_t* tree) {
+    mpack_tree_page_t* page = tree->spare;
+    if (page != NULL) {
+        mpack_log("reusing page %p\n", (void*)page);
+        tree->spare = page->next;
+        tree->spare_bytes -= MPACK_PAGE_ALLOC_SIZE;
+    } else {
+        page = (mpack_tree_page_t*)mpack_allocator_alloc(&tree->allocator, MPACK_PAGE_ALLOC_SIZE);
+        if (page == NULL) {
+            mpack_tree_flag_error(tree, mpack_error_memory);
+            return NULL;
+        }
+        MPACK_STATS_ADD(tree->stats, pages, 1);
+        page->capacity = MPACK_NODES_PER_PAGE;
+    }
+
+    page->next = tree->next;
+    tree->next = page;
+    return page;
+}
+/*
+ * Returns a page holding the given number of nodes, reusing the first kept
+ * separate page that is large enough. The page is added to the separate list.
+ */
+static mpack_tree_page_t* mpack_tree_alloc_separate(mpack_tree_t* tree, size_t total) {
+    mpack_tree_page_t** link = &tree->spare_separate;
+    while (*link != NULL && (*link)->capacity < total)
+        link = &(*link)->next;
+    mpack_tree_page_t* page = *link;
+
+    if (page != NULL) {
+        *link = page->next;
+        tree->spare_bytes -= mpack_tree_page_size(page->capacity);
+        mpack_log("reusing seperate page %p of %i for %i nodes\n",
+                (void*)page, (int)page->capacity, (int)total);
+    } else {
+        // TODO: this should check for overflow
+        page = (mpack_tree_page_t*)mpack_allocator_alloc(&tree->allocator, mpack_tree_page_size(total));
+        if (page == NULL) {
+            mpack_tree_flag_error(tree, mpack_error_memory);
+            return NULL;
+        }
+        MPACK_STATS_ADD(tree->stats, pages, 1);
+        page->capacity = total;
+        mpack_log("allocated seperate page %p for %i nodes\n", (void*)page, (int)total);
+    }
+
+    // separate pages are in their own list since they aren't reused
+    page->next = tree->separate;
+    tree->separate = page;
+    return page;
+}
+#endif
+
+/*
+ * Allocates contiguous storage for the given number of child nodes from the
+ * current page or pool, allocating a new page if needed.
+ */
+static mpack_node_data_t* mpack_tree_alloc_children(mpack_tree_t* tree, size_t total) {
+    mpack_tree_parser_t* parser = &tree->parser;
+
+    // If there are enough nodes left in the current page, no need to grow
+    if (total <= parser->nodes_left) {
+        mpack_node_data_t* children = parser->nodes;
+        parser->nodes += total;
+        parser->nodes_left -= total;
+        return children;
+    }
+
+    #ifdef MPACK_MALLOC
+
+    // We can't grow if we're using a fixed pool
+    if (tree->pool != NULL) {
+        mpack_tree_flag_error(tree, mpack_error_too_big);
+        return NULL;
+    }
+
+    // Otherwise we need to grow, and the node's children need to be contiguous.
+    // This is a heuristic to decide whether we should waste the remaining space
+    // in the current page and start a new one, or give the children their
+    // own page. With a fraction of 1/8, this causes at most 12% additional
+    // waste. Note that reducing this too much causes less cache coherence and
+    // more malloc() overhead due to smaller allocations, so there's a tradeoff
+    // here. This heuristic could use some improvement, especially with custom
+    // page sizes.
+
+    mpack_tree_page_t* page;
+
+    if (total > MPACK_NODES_PER_PAGE || parser->nodes_left > MPACK_NODES_PER_PAGE / 8) {
+        page = mpack_tree_alloc_separate(tree, total);
+        if (page == NULL)
+            return NULL;
+    } else {
+        page = mpack_tree_alloc_page(tree);
+        if (page == NULL)
+            return NULL;
+        mpack_log("allocated new page %p for %i children, wasting %i in page of %i total\n",
+                (void*)page, (int)total, (int)parser->nodes_left, (int)MPACK_NODES_PER_PAGE);
+
+        parser->nodes = page->nodes + total;
+        parser->nodes_left = MPACK_NODES_PER_PAGE - total;
+    }
+
+    return page->nodes;
+
+    #else
+    // We can't grow if we don't have an allocator
+    mpack_tree_flag_error(tree, mpack_error_too_big);
+    return NULL;
+    #endif
+}
+
+#if MPACK_NODE_COMPACT && defined(MPACK_MALLOC)
+static bool mpack_tree_blocks_grow(mpack_tree_t* tree) {
+    size_t new_capacity = (tree->blocks_capacity == 0) ? 16 : tree->blocks_capacity * 2;
+    if (new_capacity > SIZE_MAX / sizeof(mpack_node_data_t*)) {
+        mpack_tree_flag_error(tree, mpack_error_too_big);
+        return false;
+    }
+
+    mpack_node_data_t** new_blocks;
+    if (tree->blocks == NULL)
+        new_blocks = (mpack_node_data_t**)mpack_allocator_alloc(&tree->allocator, new_capacity * sizeof(mpack_node_data_t*));
+    else
+        new_blocks = (mpack_node_data_t**)mpack_allocator_realloc(&tree->allocator, tree->blocks,
+                tree->blocks_count * sizeof(mpack_node_data_t*), new_capacity * sizeof(mpack_node_data_t*));
+    if (new_blocks == NULL) {
+        mpack_tree_flag_error(tree, mpack_error_memory);
+        return false;
+    }
+
+    tree->blocks = new_blocks;
+    tree->blocks_capacity = new_capacity;
+    return true;
+}
+#endif
+
+/*
+ * Stores the children of a map or array. In the compact layout this can fail
+ * if the table of child blocks can't grow.
+ */
+MPACK_STATIC_INLINE bool mpack_tree_set_children(mpack_tree_t* tree, mpack_node_data_t* node,
+        mpack_node_data_t* children, size_t total)
+{
+    #if MPACK_NODE_COMPACT
+    node->flags = 0;
+
+    // empty containers don't need a block since their children are never
+    // accessed
+    if (total == 0) {
+        node->value.children = 0;
+        return true;
+    }
+
+    #ifdef MPACK_MALLOC
+    if (tree->pool == NULL) {
+        if (tree->blocks_count == MPACK_UINT32_MAX) {
+            mpack_tree_flag_error(tree, mpack_error_too_big);
+            return false;
+        }
+        if (tree->blocks_count == tree->blocks_capacity && !mpack_tree_blocks_grow(tree))
+            return false;
+        tree->blocks[tree->blocks_count] = children;
+        node->value.children = (uint32_t)tree->blocks_count++;
+        return true;
+    }
+    #endif
+
+    // the pool has at most MPACK_UINT32_MAX nodes (see mpack_tree_init_pool())
+    node->value.children = (uint32_t)(children - tree->pool);
+    return true;
+
+    #else
+    MPACK_UNUSED(tree);
+    MPACK_UNUSED(total);
+    node->value.children = children;
+    return true;
+    #endif
+}
+
+MPACK_STATIC_INLINE bool mpack_tree_node_is_lazy(mpack_tree_t* tree, mpack_node_data_t* node) {
+    #if MPACK_NODE_COMPACT
+    MPACK_UNUSED(tree);
+    return (node->flags & MPACK_NODE_FLAG_LAZY) != 0;
+    #else
+    return tree->lazy && (node->type == mpack_type_array || node->type == mpack_type_map) &&
+            (node->value.offset & 1) != 0;
+    #endif
+}
+
+// Returns the offset of the first child of a lazy container.
+MPACK_STATIC_INLINE size_t mpack_tree_node_lazy_offset(mpack_node_data_t* node) {
+    #if MPACK_NODE_COMPACT
+    return node->value.offset;
+    #else
+    return node->value.offset >> 1;
+    #endif
+}
+
+/*
+ * In a lazy tree, the children of a non-empty container are validated and
+ * skipped rather than parsed. The container stores the offset of its first
+ * child and is materialized on first access (see mpack_tree_materialize().)
+ */
+static bool mpack_tree_skip_children(mpack_tree_t* tree, mpack_node_data_t* node, size_t total) {
+    mpack_tree_parser_t* parser = &tree->parser;
+    mpack_assert(parser->current_node_reserved <= parser->possible_nodes_left);
+
+    size_t offset = tree->size + parser->current_node_reserved + 1;
+    #if !MPACK_NODE_COMPACT
+    if (offset > SIZE_MAX / 2) {
+        mpack_tree_flag_error(tree, mpack_error_too_big);
+        return false;
+    }
+    #endif
+
+    // The children can't extend into bytes reserved for the siblings of this
+    // node (or of its parents.)
+    mpack_error_t error = mpack_ok;
+    size_t bytes = mpack_scan_elements(tree->data + offset,
+            parser->possible_nodes_left - parser->current_node_reserved, total, &error);
+    if (error != mpack_ok) {
+        mpack_tree_flag_error(tree, error);
+        return false;
+    }
+
+    #if MPACK_NODE_COMPACT
+    node->flags = MPACK_NODE_FLAG_LAZY;
+    node->value.offset = (uint32_t)offset;
+    #else
+    node->value.offset = offset * 2 + 1;
+    #endif
+    return mpack_tree_reserve_bytes(tree, bytes);
+}
+
+/*
+ * When spans are recorded, a non-empty container's children are followed by a
+ * span node that stores the offset of the container's tag and (once all its
+ * children are parsed) its total size in bytes, or zero if it doesn't fit.
+ */
+MPACK_STATIC_INLINE bool mpack_tree_records_spans(mpack_tree_t* tree) {
+    // the children of a lazy container are materialized without a span.
+    return tree->spans && !(tree->lazy && tree->read_fn == NULL);
+}
+
+MPACK_STATIC_INLINE void mpack_tree_close_span(mpack_tree_t* tree, mpack_node_data_t* span) {
+    size_t bytes = tree->size - span->value.offset;
+    span->len = (bytes > MPACK_UINT32_MAX) ? 0 : (uint32_t)bytes;
+}
+
 static bool mpack_tree_parse_children(mpack_tree_t* tree, mpack_node_data_t* node) {
     mpack_tree_parser_t* parser = &tree->parser;
     mpack_assert(parser->state == mpack_tree_parse_state_in_progress);
 
-    mpack_type_t type = node->type;
+    mpack_type_t type = (mpack_type_t)node->type;
     size_t total = node->len;
 
     // Calculate total elements to read
@@ -282,6 +744,9 @@ static bool mpack_tree_parse_children(mpack_tree_t* tree, mpack_node_data_t* nod
         total *= 2;
     }
 
+    if (tree->lazy && tree->read_fn == NULL && total > 0)
+        return mpack_tree_skip_children(tree, node, total);
+
     // Make sure we are under our total node limit (TODO can this overflow?)
     tree->node_count += total;
     if (tree->node_count > tree->max_nodes) {
@@ -294,75 +759,37 @@ static bool mpack_tree_parse_children(mpack_tree_t* tree, mpack_node_data_t* nod
     if (!mpack_tree_reserve_bytes(tree, total))
         return false;
 
-    // If there are enough nodes left in the current page, no need to grow
-    if (total <= parser->nodes_left) {
-        node->value.children = parser->nodes;
-        parser->nodes += total;
-        parser->nodes_left -= total;
-
-    } else {
-
-        #ifdef MPACK_MALLOC
-
-        // We can't grow if we're using a fixed pool (i.e. we didn't start with a page)
-        if (!tree->next) {
-            mpack_tree_flag_error(tree, mpack_error_too_big);
-            return false;
-        }
-
-        // Otherwise we need to grow, and the node's children need to be contiguous.
-        // This is a heuristic to decide whether we should waste the remaining space
-        // in the current page and start a new one, or give the children their
-        // own page. With a fraction of 1/8, this causes at most 12% additional
-        // waste. Note that reducing this too much causes less cache coherence and
-        // more malloc() overhead due to smaller allocations, so there's a tradeoff
-        // here. This heuristic could use some improvement, especially with custom
-        // page sizes.
-
-        mpack_tree_page_t* page;
-
-        if (total > MPACK_NODES_PER_PAGE || parser->nodes_left > MPACK_NODES_PER_PAGE / 8) {
-            // TODO: this should check for overflow
-            page = (mpack_tree_page_t*)MPACK_MALLOC(
-                    sizeof(mpack_tree_page_t) + sizeof(mpack_node_data_t) * (total - 1));
-            if (page == NULL) {
-                mpack_tree_flag_error(tree, mpack_error_memory);
-                return false;
-            }
-            mpack_log("allocated seperate page %p for %i children, %i left in page of %i total\n",
-                    (void*)page, (int)total, (int)parser->nodes_left, (int)MPACK_NODES_PER_PAGE);
-
-            node->value.children = page->nodes;
-
-        } else {
-            page = (mpack_tree_page_t*)MPACK_MALLOC(MPACK_PAGE_ALLOC_SIZE);
-            if (page == NULL) {
-                mpack_tree_flag_error(tree, mpack_error_memory);
-                return false;
-            }
-            mpack_log("allocated new page %p for %i children, wasting %i in page of %i total\n",
-                    (void*)page, (int)total, (int)parser->nodes_left, (int)MPACK_NODES_PER_PAGE);
-
-            node->value.children = page->nodes;
-            parser->nodes = page->nodes + total;
-            parser->nodes_left = MPACK_NODES_PER_PAGE - total;
-        }
-
-        page->next = tree->next;
-        tree->next = page;
+    bool span = tree->spans && total > 0;
+    mpack_node_data_t* children = mpack_tree_alloc_children(tree, total + (span ? 1 : 0));
+    if (children == NULL || !mpack_tree_set_children(tree, node, children, total))
+        return false;
 
+    if (span) {
+        // tree->size is still the offset of this container's tag.
+        children[total].type = mpack_type_missing;
+        children[total].len = 0;
+        #if MPACK_NODE_COMPACT
+        children[total].value.offset = (uint32_t)tree->size;
         #else
-        // We can't grow if we don't have an allocator
-        mpack_tree_flag_error(tree, mpack_error_too_big);
-        return false;
+        children[total].value.offset = tree->size;
         #endif
     }
 
-    return mpack_tree_push_stack(tree, node->value.children, total);
+    if (!mpack_tree_push_stack(tree, children, total))
+        return false;
+    #ifdef MPACK_MALLOC
+    if (total > 0)
+        parser->stack[parser->level].keys = type == mpack_type_map && tree->key_table != NULL;
+    #endif
+    return true;
 }
 
 static bool mpack_tree_parse_bytes(mpack_tree_t* tree, mpack_node_data_t* node) {
+    #if MPACK_NODE_COMPACT
+    node->value.offset = (uint32_t)(tree->size + tree->parser.current_node_reserved + 1);
+    #else
     node->value.offset = tree->size + tree->parser.current_node_reserved + 1;
+    #endif
     return mpack_tree_reserve_bytes(tree, node->len);
 }
 
@@ -386,6 +813,10 @@ static bool mpack_tree_parse_node_contents(mpack_tree_t* tree, mpack_node_data_t
     uint8_t type = mpack_load_u8(tree->data + tree->size);
     mpack_log("node type %x\n", type);
     tree->parser.current_node_reserved = 0;
+    #if MPACK_NODE_COMPACT
+    node->flags = 0;
+    #endif
+    node->key = 0;
 
     // as with mpack_read_tag(), the fastest way to parse a node is to switch
     // on the first byte, and to explicitly list every possible byte. we switch
@@ -562,7 +993,11 @@ static bool mpack_tree_parse_node_contents(mpack_tree_t* tree, mpack_node_data_t
 
         // double
         case 0xcb:
-            #if MPACK_DOUBLE
+            #if MPACK_NODE_COMPACT
+            if (!mpack_tree_reserve_bytes(tree, sizeof(uint64_t)))
+                return false;
+            node->value.offset = (uint32_t)(tree->size + 1);
+            #elif MPACK_DOUBLE
             if (!mpack_tree_reserve_bytes(tree, sizeof(double)))
                 return false;
             node->value.d = mpack_load_double(tree->data + tree->size + 1);
@@ -603,7 +1038,19 @@ static bool mpack_tree_parse_node_contents(mpack_tree_t* tree, mpack_node_data_t
             node->type = mpack_type_uint;
             if (!mpack_tree_reserve_bytes(tree, sizeof(uint64_t)))
                 return false;
+            #if MPACK_NODE_COMPACT
+            {
+                uint64_t u = mpack_load_u64(tree->data + tree->size + 1);
+                if (u > MPACK_UINT32_MAX) {
+                    node->flags = MPACK_NODE_FLAG_EXTERNAL;
+                    node->value.offset = (uint32_t)(tree->size + 1);
+                    return true;
+                }
+                node->value.u = (uint32_t)u;
+            }
+            #else
             node->value.u = mpack_load_u64(tree->data + tree->size + 1);
+            #endif
             return true;
 
         // int8
@@ -635,7 +1082,19 @@ static bool mpack_tree_parse_node_contents(mpack_tree_t* tree, mpack_node_data_t
             node->type = mpack_type_int;
             if (!mpack_tree_reserve_bytes(tree, sizeof(int64_t)))
                 return false;
+            #if MPACK_NODE_COMPACT
+            {
+                int64_t i = mpack_load_i64(tree->data + tree->size + 1);
+                if (i < MPACK_INT32_MIN || i > MPACK_INT32_MAX) {
+                    node->flags = MPACK_NODE_FLAG_EXTERNAL;
+                    node->value.offset = (uint32_t)(tree->size + 1);
+                    return true;
+                }
+                node->value.i = (int32_t)i;
+            }
+            #else
             node->value.i = mpack_load_i64(tree->data + tree->size + 1);
+            #endif
             return true;
 
         #if MPACK_EXTENSIONS
@@ -769,16 +1228,19 @@ static bool mpack_tree_parse_node(mpack_tree_t* tree, mpack_node_data_t* node) {
 
     // If the parsed type is a map or array, the reserve includes one byte for
     // each child. We want to subtract these out of possible_nodes_left, but
-    // not out of the current size of the tree.
-    if (node->type == mpack_type_array)
-        node_size -= node->len;
-    else if (node->type == mpack_type_map)
-        node_size -= node->len * 2;
+    // not out of the current size of the tree. (A lazy container instead
+    // reserves all of its skipped children, which are part of its size.)
+    if (!mpack_tree_node_is_lazy(tree, node)) {
+        if (node->type == mpack_type_array)
+            node_size -= node->len;
+        else if (node->type == mpack_type_map)
+            node_size -= node->len * 2;
+    }
     tree->size += node_size;
 
     mpack_log("parsed a node of type %s of %i bytes and "
             "%i additional bytes reserved for children.\n",
-            mpack_type_to_string(node->type), (int)node_size,
+            mpack_type_to_string((mpack_type_t)node->type), (int)node_size,
             (int)tree->parser.current_node_reserved + 1 - (int)node_size);
 
     return true;
@@ -804,6 +1266,12 @@ static bool mpack_tree_continue_parsing(mpack_tree_t* tree) {
         size_t level = parser->level;
         if (!mpack_tree_parse_node(tree, node))
             return false;
+        #ifdef MPACK_MALLOC
+        // keys are the children of a map parsed with an even number left
+        if (parser->stack[level].keys && (parser->stack[level].left & 1) == 0 &&
+                !mpack_tree_intern_key(tree, node))
+            return false;
+        #endif
         --parser->stack[level].left;
         ++parser->stack[level].child;
 
@@ -817,33 +1285,339 @@ static bool mpack_tree_continue_parsing(mpack_tree_t* tree) {
         // better error messages that contain the location of the error, so
         // it needs to be complete.)
         while (parser->stack[parser->level].left == 0) {
-            if (parser->level == 0)
+            if (parser->level == 0) {
+                #if MPACK_NODE_COMPACT && SIZE_MAX > 0xffffffffu
+                // Compact nodes store 32-bit offsets into the message. They
+                // are truncated while parsing a message that is too large.
+                if (tree->size > MPACK_UINT32_MAX) {
+                    mpack_tree_flag_error(tree, mpack_error_too_big);
+                    return false;
+                }
+                #endif
                 return true;
+            }
+            // the level's child is now the span node after its last child.
+            if (tree->spans)
+                mpack_tree_close_span(tree, parser->stack[parser->level].child);
             --parser->level;
         }
     }
 }
 
-static void mpack_tree_cleanup(mpack_tree_t* tree) {
-    MPACK_UNUSED(tree);
+/*
+ * Parses the children of a lazy container. The whole message has already been
+ * validated, so this can only fail if the nodes can't be allocated.
+ */
+static bool mpack_tree_materialize(mpack_tree_t* tree, mpack_node_data_t* node) {
+    mpack_tree_parser_t* parser = &tree->parser;
+    mpack_assert(parser->state == mpack_tree_parse_state_parsed, "tree is not parsed!");
 
-    #ifdef MPACK_MALLOC
-    if (tree->parser.stack_owned) {
-        MPACK_FREE(tree->parser.stack);
-        tree->parser.stack = NULL;
-        tree->parser.stack_owned = false;
+    size_t offset = mpack_tree_node_lazy_offset(node);
+    size_t total = node->len;
+    if (node->type == mpack_type_map)
+        total *= 2;
+    mpack_log("materializing %i children at offset %i\n", (int)total, (int)offset);
+
+    tree->node_count += total;
+    if (tree->node_count > tree->max_nodes) {
+        mpack_tree_flag_error(tree, mpack_error_too_big);
+        return false;
+    }
+
+    mpack_node_data_t* children = mpack_tree_alloc_children(tree, total);
+    if (children == NULL)
+        return false;
+
+    // We parse the children as a sequence of elements with the finished
+    // parser, reserving one byte for each as their parent would have.
+    size_t size = tree->size;
+    size_t possible_nodes_left = parser->possible_nodes_left;
+    parser->state = mpack_tree_parse_state_in_progress;
+    tree->size = offset;
+    parser->possible_nodes_left = size - offset - total;
+
+    size_t i;
+    for (i = 0; i < total; ++i)
+        if (!mpack_tree_parse_node(tree, children + i))
+            break;
+
+    tree->size = size;
+    parser->possible_nodes_left = possible_nodes_left;
+    parser->state = mpack_tree_parse_state_parsed;
+
+    if (i < total) {
+        mpack_break("lazy container failed to parse after validation!");
+        if (mpack_tree_error(tree) == mpack_ok)
+            mpack_tree_flag_error(tree, mpack_error_bug);
+        return false;
     }
 
-    mpack_tree_page_t* page = tree->next;
+    #ifdef MPACK_MALLOC
+    if (node->type == mpack_type_map && tree->key_table != NULL)
+        for (i = 0; i < total; i += 2)
+            if (!mpack_tree_intern_key(tree, children + i))
+                return false;
+    #endif
+
+    return mpack_tree_set_children(tree, node, children, total);
+}
+
+/*
+ * Ensures the children of the given map or array are parsed, returning false
+ * if an error occurred.
+ */
+MPACK_STATIC_INLINE bool mpack_node_materialize(mpack_node_t node) {
+    if (!mpack_tree_node_is_lazy(node.tree, node.data))
+        return true;
+    return mpack_tree_materialize(node.tree, node.data);
+}
+
+#ifdef MPACK_MALLOC
+static void mpack_tree_free_pages(mpack_tree_t* tree, mpack_tree_page_t* page) {
     while (page != NULL) {
         mpack_tree_page_t* next = page->next;
         mpack_log("freeing page %p\n", (void*)page);
-        MPACK_FREE(page);
+        mpack_allocator_free(&tree->allocator, page);
         page = next;
     }
+}
+
+// Moves the given pages to a spare list, freeing those over the reuse limit.
+static void mpack_tree_recycle_pages(mpack_tree_t* tree, mpack_tree_page_t* page, mpack_tree_page_t** spare) {
+    while (page != NULL) {
+        mpack_tree_page_t* next = page->next;
+        size_t size = mpack_tree_page_size(page->capacity);
+        if (tree->spare_bytes <= tree->reuse_limit && size <= tree->reuse_limit - tree->spare_bytes) {
+            page->next = *spare;
+            *spare = page;
+            tree->spare_bytes += size;
+        } else {
+            mpack_log("freeing page %p\n", (void*)page);
+            mpack_allocator_free(&tree->allocator, page);
+        }
+        page = next;
+    }
+}
+#endif
+
+/*
+ * Releases the nodes and other allocations of the previous message. If recycle
+ * is true, the node pages and parse stack are kept for the next message (up to
+ * the reuse limit); otherwise everything is freed.
+ */
+static void mpack_tree_cleanup(mpack_tree_t* tree, bool recycle) {
+    MPACK_UNUSED(tree);
+    MPACK_UNUSED(recycle);
+
+    #ifdef MPACK_MALLOC
+    if (tree->parser.stack_owned && (!recycle ||
+            tree->parser.stack_capacity > tree->reuse_limit / sizeof(mpack_level_t)))
+    {
+        mpack_allocator_free(&tree->allocator, tree->parser.stack);
+        tree->parser.stack = NULL;
+        tree->parser.stack_owned = false;
+    }
+
+    if (recycle) {
+        mpack_tree_recycle_pages(tree, tree->next, &tree->spare);
+        mpack_tree_recycle_pages(tree, tree->separate, &tree->spare_separate);
+    } else {
+        mpack_tree_free_pages(tree, tree->next);
+        mpack_tree_free_pages(tree, tree->separate);
+        mpack_tree_free_pages(tree, tree->spare);
+        mpack_tree_free_pages(tree, tree->spare_separate);
+        tree->spare = NULL;
+        tree->spare_separate = NULL;
+        tree->spare_bytes = 0;
+    }
     tree->next = NULL;
+    tree->separate = NULL;
+
+    if (tree->map_indices != NULL) {
+        size_t i;
+        for (i = 0; i < tree->map_indices_capacity; ++i)
+            if (tree->map_indices[i] != NULL)
+                mpack_allocator_free(&tree->allocator, tree->map_indices[i]);
+        mpack_allocator_free(&tree->allocator, tree->map_indices);
+        tree->map_indices = NULL;
+    }
+    tree->map_indices_capacity = 0;
+    tree->map_indices_count = 0;
+
+    #if MPACK_NODE_COMPACT
+    tree->blocks_count = 0;
+    if (!recycle && tree->blocks != NULL) {
+        mpack_allocator_free(&tree->allocator, tree->blocks);
+        tree->blocks = NULL;
+        tree->blocks_capacity = 0;
+    }
+    #endif
+    #endif
+}
+
+/*
+ * Scans the first message in the given data without building any nodes,
+ * counting its elements, its non-empty maps and arrays and the depth of its
+ * deepest element (the root being at depth 1.) This skips elements the same
+ * way as mpack_scan_elements(), but keeps the number of elements left at each
+ * level in order to track the depth.
+ *
+ * Deep messages grow the scan stack with the tree's allocator, or with
+ * MPACK_MALLOC() if there is no tree.
+ */
+static mpack_error_t mpack_tree_scan_nodes(mpack_tree_t* tree,
+        const char* data, size_t length, size_t* count, size_t* containers, size_t* max_depth)
+{
+    #ifdef MPACK_MALLOC
+    mpack_allocator_t default_allocator;
+    const mpack_allocator_t* allocator = &default_allocator;
+    if (tree != NULL)
+        allocator = &tree->allocator;
+    else
+        mpack_memset(&default_allocator, 0, sizeof(default_allocator));
+    size_t local[MPACK_NODE_INITIAL_DEPTH];
+    #else
+    MPACK_UNUSED(tree);
+    size_t local[MPACK_NODE_MAX_DEPTH_WITHOUT_MALLOC];
+    #endif
+    size_t* left = local;
+    size_t capacity = sizeof(local) / sizeof(*local);
+    size_t depth = 1;
+    left[0] = 1;
+
+    mpack_error_t error = mpack_ok;
+    size_t pos = 0;
+    *count = 0;
+    *containers = 0;
+    *max_depth = 1;
+
+    while (depth > 0) {
+        if (left[depth - 1] == 0) {
+            --depth;
+            continue;
+        }
+        --left[depth - 1];
+
+        uint64_t children;
+        uint64_t bytes;
+        size_t size = mpack_scan_tag(data + pos, length - pos, &children, &bytes, &error);
+        if (size == 0)
+            break;
+        pos += size;
+        ++*count;
+
+        if (bytes > (uint64_t)(length - pos)) {
+            error = mpack_error_invalid;
+            break;
+        }
+        pos += (size_t)bytes;
+
+        if (children == 0)
+            continue;
+
+        // each element is at least one byte
+        if (children > (uint64_t)(length - pos)) {
+            error = mpack_error_invalid;
+            break;
+        }
+
+        if (depth == capacity) {
+            #ifdef MPACK_MALLOC
+            size_t* new_left;
+            if (left == local) {
+                new_left = (size_t*)mpack_allocator_alloc(allocator, sizeof(size_t) * capacity * 2);
+                if (new_left != NULL)
+                    mpack_memcpy(new_left, local, sizeof(local));
+            } else {
+                new_left = (size_t*)mpack_allocator_realloc(allocator, left,
+                        sizeof(size_t) * capacity, sizeof(size_t) * capacity * 2);
+            }
+            if (new_left == NULL) {
+                error = mpack_error_memory;
+                break;
+            }
+            left = new_left;
+            capacity *= 2;
+            #else
+            error = mpack_error_too_big;
+            break;
+            #endif
+        }
+
+        ++*containers;
+        left[depth++] = (size_t)children;
+        if (depth > *max_depth)
+            *max_depth = depth;
+    }
+
+    #ifdef MPACK_MALLOC
+    if (left != local)
+        mpack_allocator_free(allocator, left);
     #endif
+    return error;
+}
+
+mpack_error_t mpack_tree_count_nodes(const char* data, size_t length, size_t* count, size_t* max_depth) {
+    size_t containers;
+    mpack_error_t error = mpack_tree_scan_nodes(NULL, data, length, count, &containers, max_depth);
+    if (error != mpack_ok) {
+        *count = 0;
+        *max_depth = 0;
+    }
+    return error;
+}
+
+#ifdef MPACK_MALLOC
+/*
+ * In an exact tree, the message is scanned before parsing so that all of its
+ * nodes (including spans) fit in a single separate page and the parse stack
+ * is allocated at its final size. If the message is truncated or invalid,
+ * nothing is allocated and the parser falls back to pages; it will flag the
+ * appropriate error as it reaches the problem.
+ *
+ * Returns false if an error was flagged.
+ */
+static bool mpack_tree_start_exact(mpack_tree_t* tree) {
+    mpack_tree_parser_t* parser = &tree->parser;
+
+    size_t count, containers, depth;
+    mpack_error_t error = mpack_tree_scan_nodes(tree, tree->data, tree->data_length, &count, &containers, &depth);
+    if (error == mpack_error_memory) {
+        mpack_tree_flag_error(tree, error);
+        return false;
+    }
+    if (error != mpack_ok)
+        return true;
+    if (tree->spans)
+        count += containers;
+    if (count > tree->max_nodes || count > (SIZE_MAX - sizeof(mpack_tree_page_t)) / sizeof(mpack_node_data_t))
+        return true;
+
+    if (depth > parser->stack_capacity) {
+        MPACK_STATS_ADD(tree->stats, stack_grows, 1);
+        mpack_level_t* new_stack;
+        if (!parser->stack_owned)
+            new_stack = (mpack_level_t*)mpack_allocator_alloc(&tree->allocator, sizeof(mpack_level_t) * depth);
+        else
+            new_stack = (mpack_level_t*)mpack_allocator_realloc(&tree->allocator, parser->stack,
+                    sizeof(mpack_level_t) * parser->stack_capacity, sizeof(mpack_level_t) * depth);
+        if (new_stack == NULL) {
+            mpack_tree_flag_error(tree, mpack_error_memory);
+            return false;
+        }
+        parser->stack = new_stack;
+        parser->stack_capacity = depth;
+        parser->stack_owned = true;
+    }
+
+    mpack_tree_page_t* page = mpack_tree_alloc_separate(tree, count);
+    if (page == NULL)
+        return false;
+    parser->nodes = page->nodes;
+    parser->nodes_left = count;
+    return true;
 }
+#endif
 
 static bool mpack_tree_parse_start(mpack_tree_t* tree) {
     if (mpack_tree_error(tree) != mpack_ok)
@@ -854,7 +1628,7 @@ static bool mpack_tree_parse_start(mpack_tree_t* tree) {
             "previous parsing was not finished!");
 
     if (parser->state == mpack_tree_parse_state_parsed)
-        mpack_tree_cleanup(tree);
+        mpack_tree_cleanup(tree, true);
 
     mpack_log("starting parse\n");
     tree->parser.state = mpack_tree_parse_state_in_progress;
@@ -896,27 +1670,30 @@ static bool mpack_tree_parse_start(mpack_tree_t* tree) {
     tree->node_count = 1;
 
     #ifdef MPACK_MALLOC
-    parser->stack = parser->stack_local;
-    parser->stack_owned = false;
-    parser->stack_capacity = sizeof(parser->stack_local) / sizeof(*parser->stack_local);
+    // a parse stack kept from a previous message is reused
+    if (!parser->stack_owned) {
+        parser->stack = parser->stack_local;
+        parser->stack_capacity = sizeof(parser->stack_local) / sizeof(*parser->stack_local);
+    }
 
-    if (tree->pool == NULL) {
+    parser->nodes = NULL;
+    if (tree->exact && !mpack_tree_start_exact(tree))
+        return false;
+
+    if (tree->pool == NULL && parser->nodes == NULL) {
 
         // allocate first page
-        mpack_tree_page_t* page = (mpack_tree_page_t*)MPACK_MALLOC(MPACK_PAGE_ALLOC_SIZE);
+        mpack_assert(tree->next == NULL, "pages were not cleaned up?");
+        mpack_tree_page_t* page = mpack_tree_alloc_page(tree);
         mpack_log("allocated initial page %p of size %i count %i\n",
                 (void*)page, (int)MPACK_PAGE_ALLOC_SIZE, (int)MPACK_NODES_PER_PAGE);
-        if (page == NULL) {
-            tree->error = mpack_error_memory;
+        if (page == NULL)
             return false;
-        }
-        page->next = NULL;
-        tree->next = page;
 
         parser->nodes = page->nodes;
         parser->nodes_left = MPACK_NODES_PER_PAGE;
     }
-    else
+    else if (tree->pool != NULL)
     #endif
     {
         // otherwise use the provided pool
@@ -932,6 +1709,9 @@ static bool mpack_tree_parse_start(mpack_tree_t* tree) {
     parser->level = 0;
     parser->stack[0].child = tree->root;
     parser->stack[0].left = 1;
+    #ifdef MPACK_MALLOC
+    parser->stack[0].keys = false;
+    #endif
 
     return true;
 }
@@ -963,10 +1743,159 @@ void mpack_tree_parse(mpack_tree_t* tree) {
     mpack_assert(mpack_tree_error(tree) == mpack_ok);
     mpack_assert(tree->parser.level == 0);
     tree->parser.state = mpack_tree_parse_state_parsed;
+    MPACK_STATS_ADD(tree->stats, messages, 1);
+    MPACK_STATS_ADD(tree->stats, bytes, tree->size);
+    MPACK_STATS_ADD(tree->stats, nodes, tree->node_count);
     mpack_log("parsed tree of %i bytes, %i bytes left\n", (int)tree->size, (int)tree->parser.possible_nodes_left);
     mpack_log("%i nodes in final page\n", (int)tree->parser.nodes_left);
 }
 
+/*
+ * Starts parsing the next message of a batch. Unlike mpack_tree_parse_start(),
+ * the nodes of previous messages are kept: the new root is allocated from the
+ * current page, and the tree size keeps counting from the start of the batch
+ * so that the data offsets of all roots remain relative to tree->data.
+ */
+static bool mpack_tree_parse_batch_next(mpack_tree_t* tree) {
+    mpack_tree_parser_t* parser = &tree->parser;
+    mpack_assert(tree->size < tree->data_length, "no data left for another message");
+
+    parser->state = mpack_tree_parse_state_in_progress;
+    parser->current_node_reserved = 0;
+    parser->possible_nodes_left = tree->data_length - tree->size - 1;
+    tree->node_count = 1;
+
+    if (parser->nodes_left == 0) {
+        #ifdef MPACK_MALLOC
+        // We can't grow if we're using a fixed pool
+        if (tree->pool != NULL) {
+            mpack_tree_flag_error(tree, mpack_error_too_big);
+            return false;
+        }
+
+        mpack_tree_page_t* page = mpack_tree_alloc_page(tree);
+        if (page == NULL)
+            return false;
+        mpack_log("allocated new page %p for batch root\n", (void*)page);
+
+        parser->nodes = page->nodes;
+        parser->nodes_left = MPACK_NODES_PER_PAGE;
+        #else
+        mpack_tree_flag_error(tree, mpack_error_too_big);
+        return false;
+        #endif
+    }
+
+    tree->root = parser->nodes;
+    ++parser->nodes;
+    --parser->nodes_left;
+
+    parser->level = 0;
+    parser->stack[0].child = tree->root;
+    parser->stack[0].left = 1;
+    #ifdef MPACK_MALLOC
+    parser->stack[0].keys = false;
+    #endif
+
+    return true;
+}
+
+size_t mpack_tree_parse_batch(mpack_tree_t* tree, mpack_node_t* roots, size_t max_roots) {
+    if (mpack_tree_error(tree) != mpack_ok)
+        return 0;
+
+    if (max_roots == 0) {
+        mpack_break("batch must have room for at least one root!");
+        mpack_tree_flag_error(tree, mpack_error_bug);
+        return 0;
+    }
+
+    if (tree->read_fn != NULL) {
+        mpack_break("batch parsing is not supported on streams!");
+        mpack_tree_flag_error(tree, mpack_error_bug);
+        return 0;
+    }
+
+    if (!mpack_tree_parse_start(tree)) {
+        mpack_tree_flag_error(tree, mpack_error_invalid);
+        return 0;
+    }
+
+    size_t count = 0;
+    while (true) {
+        if (!mpack_tree_continue_parsing(tree)) {
+            mpack_tree_flag_error(tree, mpack_error_invalid);
+            return 0;
+        }
+
+        mpack_assert(mpack_tree_error(tree) == mpack_ok);
+        mpack_assert(tree->parser.level == 0);
+        tree->parser.state = mpack_tree_parse_state_parsed;
+        roots[count++] = mpack_node(tree, tree->root);
+        MPACK_STATS_ADD(tree->stats, messages, 1);
+        MPACK_STATS_ADD(tree->stats, nodes, tree->node_count);
+
+        if (count == max_roots || tree->size == tree->data_length)
+            break;
+        if (!mpack_tree_parse_batch_next(tree))
+            return 0;
+    }
+
+    mpack_log("parsed batch of %i messages in %i bytes\n", (int)count, (int)tree->size);
+    MPACK_STATS_ADD(tree->stats, bytes, tree->size);
+    tree->root = roots[0].data;
+    return count;
+}
+
+mpack_error_t mpack_tree_split_data(const char* data, size_t length,
+        mpack_tree_chunk_t* chunks, size_t max_chunks, size_t* chunk_count)
+{
+    *chunk_count = 0;
+    if (max_chunks == 0) {
+        mpack_break("there must be room for at least one chunk!");
+        return mpack_error_bug;
+    }
+
+    mpack_error_t error = mpack_ok;
+    uint64_t children;
+    uint64_t bytes;
+    size_t pos = mpack_scan_tag(data, length, &children, &bytes, &error);
+    if (pos == 0)
+        return error;
+
+    // chunks are divided by map pairs rather than by keys and values
+    uint8_t type = (uint8_t)data[0];
+    size_t per_unit;
+    if ((type >= 0x80 && type <= 0x8f) || type == 0xde || type == 0xdf)
+        per_unit = 2;
+    else if ((type >= 0x90 && type <= 0x9f) || type == 0xdc || type == 0xdd)
+        per_unit = 1;
+    else
+        return mpack_error_type;
+
+    // each element is at least one byte
+    if (children > (uint64_t)(length - pos))
+        return mpack_error_invalid;
+
+    size_t units = (size_t)children / per_unit;
+    size_t used = (units < max_chunks) ? units : max_chunks;
+
+    size_t i;
+    for (i = 0; i < used; ++i) {
+        size_t count = (units / used + (i < units % used ? 1 : 0)) * per_unit;
+        size_t size = mpack_scan_elements(data + pos, length - pos, count, &error);
+        if (error != mpack_ok)
+            return error;
+        chunks[i].data = data + pos;
+        chunks[i].size = size;
+        chunks[i].count = count;
+        pos += size;
+    }
+
+    *chunk_count = used;
+    return mpack_ok;
+}
+
 bool mpack_tree_try_parse(mpack_tree_t* tree) {
     if (mpack_tree_error(tree) != mpack_ok)
         return false;
@@ -981,9 +1910,65 @@ bool mpack_tree_try_parse(mpack_tree_t* tree) {
     mpack_assert(mpack_tree_error(tree) == mpack_ok);
     mpack_assert(tree->parser.level == 0);
     tree->parser.state = mpack_tree_parse_state_parsed;
+    MPACK_STATS_ADD(tree->stats, messages, 1);
+    MPACK_STATS_ADD(tree->stats, bytes, tree->size);
+    MPACK_STATS_ADD(tree->stats, nodes, tree->node_count);
     return true;
 }
 
+#ifdef MPACK_MALLOC
+void mpack_tree_pipeline(mpack_tree_t* tree, mpack_tree_t* next) {
+    if (mpack_tree_error(next) != mpack_ok)
+        return;
+    if (mpack_tree_error(tree) != mpack_ok) {
+        mpack_tree_flag_error(next, mpack_tree_error(tree));
+        return;
+    }
+
+    if (tree->read_fn == NULL || next->read_fn == NULL) {
+        mpack_break("pipelining is only supported on streams!");
+        mpack_tree_flag_error(next, mpack_error_bug);
+        return;
+    }
+    if (tree->parser.state != mpack_tree_parse_state_parsed) {
+        mpack_break("tree has not been parsed!");
+        mpack_tree_flag_error(next, mpack_error_bug);
+        return;
+    }
+    if (next->parser.state == mpack_tree_parse_state_in_progress || next->data_length != next->size) {
+        mpack_break("next tree has data that has not been parsed!");
+        mpack_tree_flag_error(next, mpack_error_bug);
+        return;
+    }
+
+    // anything parsed in the next tree is discarded
+    if (next->parser.state == mpack_tree_parse_state_parsed)
+        mpack_tree_cleanup(next, true);
+    next->parser.state = mpack_tree_parse_state_not_started;
+    next->data_length = 0;
+    next->size = 0;
+    next->node_count = 0;
+    next->root = NULL;
+
+    // the next tree's buffer only needs to hold what we've already read
+    size_t left = tree->data_length - tree->size;
+    mpack_log("pipelining %i bytes from tree %p to tree %p\n", (int)left, (void*)tree, (void*)next);
+    if (left > next->max_size) {
+        mpack_tree_flag_error(next, mpack_error_too_big);
+        return;
+    }
+    if (left > next->buffer_capacity && !mpack_tree_grow_buffer(next, left))
+        return;
+    if (left > 0)
+        mpack_memcpy(next->buffer, tree->data + tree->size, left);
+    next->data = next->buffer;
+    next->data_length = left;
+
+    // the data is no longer part of this tree's stream
+    tree->data_length = tree->size;
+}
+#endif
+
 
 
 /*
@@ -1007,12 +1992,21 @@ mpack_node_t mpack_tree_root(mpack_tree_t* tree) {
     return mpack_node(tree, tree->root);
 }
 
+#if MPACK_STATS
+void mpack_tree_reset_stats(mpack_tree_t* tree) {
+    mpack_memset(&tree->stats, 0, sizeof(tree->stats));
+}
+#endif
+
 static void mpack_tree_init_clear(mpack_tree_t* tree) {
     mpack_memset(tree, 0, sizeof(*tree));
     tree->nil_node.type = mpack_type_nil;
     tree->missing_node.type = mpack_type_missing;
     tree->max_size = SIZE_MAX;
     tree->max_nodes = SIZE_MAX;
+    #ifdef MPACK_MALLOC
+    tree->reuse_limit = SIZE_MAX;
+    #endif
 }
 
 #ifdef MPACK_MALLOC
@@ -1036,6 +2030,13 @@ void mpack_tree_init_data(mpack_tree_t* tree, const char* data, size_t length) {
 }
 #endif
 
+#ifdef MPACK_MALLOC
+void mpack_tree_init_exact(mpack_tree_t* tree, const char* data, size_t length) {
+    mpack_tree_init_data(tree, data, length);
+    tree->exact = true;
+}
+#endif
+
 void mpack_tree_init_pool(mpack_tree_t* tree, const char* data, size_t length,
         mpack_node_data_t* node_pool, size_t node_pool_count)
 {
@@ -1050,6 +2051,12 @@ void mpack_tree_init_pool(mpack_tree_t* tree, const char* data, size_t length,
         return;
     }
 
+    #if MPACK_NODE_COMPACT && SIZE_MAX > 0xffffffffu
+    // compact nodes reference their children by 32-bit indices into the pool
+    if (node_pool_count > MPACK_UINT32_MAX)
+        node_pool_count = MPACK_UINT32_MAX;
+    #endif
+
     tree->data = data;
     tree->data_length = length;
     tree->pool = node_pool;
@@ -1093,6 +2100,76 @@ void mpack_tree_set_limits(mpack_tree_t* tree, size_t max_message_size, size_t m
     tree->max_nodes = max_message_nodes;
 }
 
+#ifdef MPACK_MALLOC
+void mpack_tree_set_map_index(mpack_tree_t* tree, size_t min_count) {
+    tree->map_index_threshold = min_count;
+}
+
+void mpack_tree_set_key_table(mpack_tree_t* tree, mpack_key_table_t* table) {
+    tree->key_table = table;
+}
+
+void mpack_tree_set_allocator(mpack_tree_t* tree, const mpack_allocator_t* allocator) {
+    mpack_assert(tree->parser.state == mpack_tree_parse_state_not_started,
+            "the allocator must be set before parsing!");
+    mpack_assert(tree->buffer == NULL, "the tree has already allocated a buffer!");
+
+    // memory kept by mpack_tree_reset() belongs to the old allocator
+    mpack_tree_cleanup(tree, false);
+    if (allocator == NULL)
+        mpack_memset(&tree->allocator, 0, sizeof(tree->allocator));
+    else
+        tree->allocator = *allocator;
+}
+
+void mpack_tree_set_reuse_limit(mpack_tree_t* tree, size_t max_bytes) {
+    tree->reuse_limit = max_bytes;
+}
+#endif
+
+void mpack_tree_reset(mpack_tree_t* tree, const char* data, size_t length) {
+    mpack_log("===========================\n");
+    mpack_log("resetting tree with data of size %i\n", (int)length);
+    mpack_tree_cleanup(tree, true);
+
+    tree->error = mpack_ok;
+    tree->parser.state = mpack_tree_parse_state_not_started;
+    tree->size = 0;
+    tree->node_count = 0;
+    tree->root = NULL;
+
+    if (tree->read_fn == NULL) {
+        tree->data = data;
+        tree->data_length = length;
+        return;
+    }
+
+    // a stream tree discards its buffered data, keeping the buffer unless it
+    // exceeds the reuse limit.
+    mpack_assert(data == NULL && length == 0, "a tree with a read function can't be reset with data!");
+    #ifdef MPACK_MALLOC
+    if (tree->buffer != NULL && tree->buffer_capacity > tree->reuse_limit) {
+        mpack_allocator_free(&tree->allocator, tree->buffer);
+        tree->buffer = NULL;
+        tree->buffer_capacity = 0;
+    }
+    tree->data = tree->buffer;
+    #endif
+    tree->data_length = 0;
+}
+
+void mpack_tree_set_lazy(mpack_tree_t* tree, bool lazy) {
+    mpack_assert(tree->parser.state == mpack_tree_parse_state_not_started,
+            "lazy parsing must be set before parsing!");
+    tree->lazy = lazy;
+}
+
+void mpack_tree_set_spans(mpack_tree_t* tree, bool spans) {
+    mpack_assert(tree->parser.state == mpack_tree_parse_state_not_started,
+            "span recording must be set before parsing!");
+    tree->spans = spans;
+}
+
 #if MPACK_STDIO
 typedef struct mpack_file_tree_t {
     char* data;
@@ -1215,12 +2292,143 @@ void mpack_tree_init_filename(mpack_tree_t* tree, const char* filename, size_t m
 }
 #endif
 
+#if MPACK_MMAP
+typedef struct mpack_mmap_tree_t {
+    void* data;
+    size_t size;
+    #ifdef _WIN32
+    HANDLE mapping;
+    #endif
+} mpack_mmap_tree_t;
+
+static void mpack_mmap_tree_teardown(mpack_tree_t* tree) {
+    mpack_mmap_tree_t* mmap_tree = (mpack_mmap_tree_t*)tree->context;
+    #ifdef _WIN32
+    UnmapViewOfFile(mmap_tree->data);
+    CloseHandle(mmap_tree->mapping);
+    #else
+    munmap(mmap_tree->data, mmap_tree->size);
+    #endif
+    MPACK_FREE(mmap_tree);
+}
+
+static bool mpack_tree_mmap_check_size(mpack_tree_t* tree, uint64_t size, size_t max_bytes) {
+    if (size == 0) {
+        mpack_tree_init_error(tree, mpack_error_invalid);
+        return false;
+    }
+    if (size > (uint64_t)SIZE_MAX || (max_bytes != 0 && size > (uint64_t)max_bytes)) {
+        mpack_tree_init_error(tree, mpack_error_too_big);
+        return false;
+    }
+    return true;
+}
+
+#ifdef _WIN32
+static bool mpack_tree_mmap_file(mpack_tree_t* tree, mpack_mmap_tree_t* mmap_tree,
+        const char* filename, size_t max_bytes)
+{
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        mpack_tree_init_error(tree, mpack_error_io);
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart < 0) {
+        CloseHandle(file);
+        mpack_tree_init_error(tree, mpack_error_io);
+        return false;
+    }
+    if (!mpack_tree_mmap_check_size(tree, (uint64_t)size.QuadPart, max_bytes)) {
+        CloseHandle(file);
+        return false;
+    }
+
+    // the mapping holds its own reference to the file
+    mmap_tree->mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mmap_tree->mapping == NULL) {
+        mpack_tree_init_error(tree, mpack_error_io);
+        return false;
+    }
+
+    mmap_tree->data = MapViewOfFile(mmap_tree->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (mmap_tree->data == NULL) {
+        CloseHandle(mmap_tree->mapping);
+        mpack_tree_init_error(tree, mpack_error_io);
+        return false;
+    }
+
+    mmap_tree->size = (size_t)size.QuadPart;
+    return true;
+}
+#else
+static bool mpack_tree_mmap_file(mpack_tree_t* tree, mpack_mmap_tree_t* mmap_tree,
+        const char* filename, size_t max_bytes)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        mpack_tree_init_error(tree, mpack_error_io);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 0) {
+        close(fd);
+        mpack_tree_init_error(tree, mpack_error_io);
+        return false;
+    }
+    if (!mpack_tree_mmap_check_size(tree, (uint64_t)st.st_size, max_bytes)) {
+        close(fd);
+        return false;
+    }
+
+    // the mapping remains valid after the file descriptor is closed
+    size_t size = (size_t)st.st_size;
+    void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        mpack_tree_init_error(tree, mpack_error_io);
+        return false;
+    }
+
+    // the tree is parsed front to back so we hint for aggressive read-ahead.
+    #ifdef POSIX_MADV_SEQUENTIAL
+    posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+    #endif
+
+    mmap_tree->data = data;
+    mmap_tree->size = size;
+    return true;
+}
+#endif
+
+void mpack_tree_init_mmap(mpack_tree_t* tree, const char* filename, size_t max_bytes) {
+    mpack_mmap_tree_t* mmap_tree = (mpack_mmap_tree_t*) MPACK_MALLOC(sizeof(mpack_mmap_tree_t));
+    if (mmap_tree == NULL) {
+        mpack_tree_init_error(tree, mpack_error_memory);
+        return;
+    }
+
+    if (!mpack_tree_mmap_file(tree, mmap_tree, filename, max_bytes)) {
+        MPACK_FREE(mmap_tree);
+        return;
+    }
+
+    mpack_tree_init_data(tree, (const char*)mmap_tree->data, mmap_tree->size);
+    mpack_tree_set_context(tree, mmap_tree);
+    mpack_tree_set_teardown(tree, mpack_mmap_tree_teardown);
+}
+#endif
+
 mpack_error_t mpack_tree_destroy(mpack_tree_t* tree) {
-    mpack_tree_cleanup(tree);
+    mpack_tree_cleanup(tree, false);
 
     #ifdef MPACK_MALLOC
     if (tree->buffer)
-        MPACK_FREE(tree->buffer);
+        mpack_allocator_free(&tree->allocator, tree->buffer);
     #endif
 
     if (tree->teardown)
@@ -1242,54 +2450,227 @@ void mpack_tree_flag_error(mpack_tree_t* tree, mpack_error_t error) {
 
 
 
-/*
- * Node misc functions
- */
+/*
+ * Node misc functions
+ */
+
+void mpack_node_flag_error(mpack_node_t node, mpack_error_t error) {
+    mpack_tree_flag_error(node.tree, error);
+}
+
+mpack_tag_t mpack_node_tag(mpack_node_t node) {
+    if (mpack_node_error(node) != mpack_ok)
+        return mpack_tag_nil();
+
+    mpack_tag_t tag = MPACK_TAG_ZERO;
+
+    tag.type = (mpack_type_t)node.data->type;
+    switch (node.data->type) {
+        case mpack_type_missing:
+            // If a node is missing, I don't know if it makes sense to ask for
+            // a tag for it. We'll return a missing tag to match the missing
+            // node I guess, but attempting to use the tag for anything (like
+            // writing it for example) will flag mpack_error_bug.
+            break;
+        case mpack_type_nil:                                            break;
+        case mpack_type_bool:    tag.v.b = node.data->value.b;          break;
+        case mpack_type_float:   tag.v.f = node.data->value.f;          break;
+        case mpack_type_double:  tag.v.d = mpack_node_value_d(node);          break;
+        case mpack_type_int:     tag.v.i = mpack_node_value_i(node);          break;
+        case mpack_type_uint:    tag.v.u = mpack_node_value_u(node);          break;
+
+        case mpack_type_str:     tag.v.l = node.data->len;     break;
+        case mpack_type_bin:     tag.v.l = node.data->len;     break;
+
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+            tag.v.l = node.data->len;
+            tag.exttype = mpack_node_exttype_unchecked(node);
+            break;
+        #endif
+
+        case mpack_type_array:   tag.v.n = node.data->len;  break;
+        case mpack_type_map:     tag.v.n = node.data->len;  break;
+
+        default:
+            mpack_assert(0, "unrecognized type %i", (int)node.data->type);
+            break;
+    }
+    return tag;
+}
+
+const char* mpack_node_span(mpack_node_t node, size_t* size) {
+    *size = 0;
+    if (mpack_node_error(node) != mpack_ok || !mpack_tree_records_spans(node.tree))
+        return NULL;
+
+    size_t total = node.data->len;
+    if (node.data->type == mpack_type_map)
+        total *= 2;
+    else if (node.data->type != mpack_type_array)
+        return NULL;
+    if (total == 0)
+        return NULL;
+
+    mpack_node_data_t* span = mpack_node_child(node, total);
+    if (span->len == 0)
+        return NULL;
+    *size = span->len;
+    return node.tree->data + span->value.offset;
+}
+
+// Encodes the tag of a node as a canonical build would write it. The contents
+// of strs, bins, exts, maps and arrays are not included.
+static size_t mpack_node_canonical_tag(mpack_node_t node, char* data) {
+    mpack_tag_t tag = mpack_node_tag(node);
+    #if MPACK_FLOAT && MPACK_DOUBLE
+    float f;
+    if (tag.type == mpack_type_double && mpack_narrow_double_to_float(tag.v.d, &f))
+        tag = mpack_tag_make_float(f);
+    #endif
+    return mpack_encode_tag(data, tag);
+}
+
+static bool mpack_node_map_has_entry(mpack_node_t map, size_t hint, mpack_node_t key, mpack_node_t value) {
+    // maps are usually in the same order, so we check the same index first
+    if (mpack_node_equal(mpack_node_map_key_at(map, hint), key))
+        return mpack_node_equal(mpack_node_map_value_at(map, hint), value);
+
+    size_t i;
+    for (i = 0; i < map.data->len; ++i) {
+        if (i != hint && mpack_node_equal(mpack_node_map_key_at(map, i), key))
+            return mpack_node_equal(mpack_node_map_value_at(map, i), value);
+    }
+    return false;
+}
+
+bool mpack_node_equal(mpack_node_t left, mpack_node_t right) {
+    if (mpack_node_error(left) != mpack_ok || mpack_node_error(right) != mpack_ok)
+        return false;
+
+    // matching tags have the same type and the same length or count
+    char left_tag[MPACK_MAXIMUM_TAG_SIZE];
+    char right_tag[MPACK_MAXIMUM_TAG_SIZE];
+    size_t size = mpack_node_canonical_tag(left, left_tag);
+    if (size != mpack_node_canonical_tag(right, right_tag) || mpack_memcmp(left_tag, right_tag, size) != 0)
+        return false;
+
+    size_t i;
+    switch (left.data->type) {
+        case mpack_type_str:
+        case mpack_type_bin:
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+        #endif
+            return mpack_memcmp(mpack_node_data_unchecked(left), mpack_node_data_unchecked(right),
+                    left.data->len) == 0;
+
+        case mpack_type_array:
+            for (i = 0; i < left.data->len; ++i)
+                if (!mpack_node_equal(mpack_node_array_at(left, i), mpack_node_array_at(right, i)))
+                    return false;
+            return true;
+
+        case mpack_type_map:
+            for (i = 0; i < left.data->len; ++i)
+                if (!mpack_node_map_has_entry(right, i,
+                            mpack_node_map_key_at(left, i), mpack_node_map_value_at(left, i)))
+                    return false;
+            return true;
+
+        default:
+            return true;
+    }
+}
+
+uint64_t mpack_node_hash(mpack_node_t node) {
+    if (mpack_node_error(node) != mpack_ok)
+        return 0;
+
+    char tag[MPACK_MAXIMUM_TAG_SIZE];
+    uint64_t hash = mpack_hash_bytes(MPACK_HASH_SEED, tag, mpack_node_canonical_tag(node, tag));
+
+    size_t i;
+    uint64_t sum;
+    switch (node.data->type) {
+        case mpack_type_str:
+        case mpack_type_bin:
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+        #endif
+            hash = mpack_hash_bytes(hash, mpack_node_data_unchecked(node), node.data->len);
+            break;
+
+        case mpack_type_array:
+            for (i = 0; i < node.data->len; ++i)
+                hash = mpack_hash_mix(hash, mpack_node_hash(mpack_node_array_at(node, i)));
+            break;
+
+        case mpack_type_map:
+            // the entries are summed so that their order doesn't matter
+            sum = 0;
+            for (i = 0; i < node.data->len; ++i)
+                sum += mpack_hash_mix(mpack_node_hash(mpack_node_map_key_at(node, i)),
+                        mpack_node_hash(mpack_node_map_value_at(node, i)));
+            hash = mpack_hash_mix(hash, sum);
+            break;
+
+        default:
+            break;
+    }
 
-void mpack_node_flag_error(mpack_node_t node, mpack_error_t error) {
-    mpack_tree_flag_error(node.tree, error);
+    // a child may have flagged an error in a lazy tree
+    return (mpack_node_error(node) == mpack_ok) ? hash : 0;
 }
 
-mpack_tag_t mpack_node_tag(mpack_node_t node) {
-    if (mpack_node_error(node) != mpack_ok)
-        return mpack_tag_nil();
-
-    mpack_tag_t tag = MPACK_TAG_ZERO;
-
-    tag.type = node.data->type;
-    switch (node.data->type) {
-        case mpack_type_missing:
-            // If a node is missing, I don't know if it makes sense to ask for
-            // a tag for it. We'll return a missing tag to match the missing
-            // node I guess, but attempting to use the tag for anything (like
-            // writing it for example) will flag mpack_error_bug.
-            break;
-        case mpack_type_nil:                                            break;
-        case mpack_type_bool:    tag.v.b = node.data->value.b;          break;
-        case mpack_type_float:   tag.v.f = node.data->value.f;          break;
-        case mpack_type_double:  tag.v.d = node.data->value.d;          break;
-        case mpack_type_int:     tag.v.i = node.data->value.i;          break;
-        case mpack_type_uint:    tag.v.u = node.data->value.u;          break;
+#if MPACK_WRITER
+void mpack_write_node(mpack_writer_t* writer, mpack_node_t node) {
+    if (mpack_node_error(node) != mpack_ok) {
+        mpack_writer_flag_error(writer, mpack_node_error(node));
+        return;
+    }
+    if (mpack_writer_error(writer) != mpack_ok)
+        return;
 
-        case mpack_type_str:     tag.v.l = node.data->len;     break;
-        case mpack_type_bin:     tag.v.l = node.data->len;     break;
+    mpack_type_t type = (mpack_type_t)node.data->type;
+    size_t size;
+    const char* span = mpack_node_span(node, &size);
+    if (span != NULL) {
+        mpack_write_object_bytes(writer, span, size);
+        return;
+    }
 
+    mpack_write_tag(writer, mpack_node_tag(node));
+    size_t i;
+    switch (type) {
+        case mpack_type_str:
+        case mpack_type_bin:
         #if MPACK_EXTENSIONS
         case mpack_type_ext:
-            tag.v.l = node.data->len;
-            tag.exttype = mpack_node_exttype_unchecked(node);
-            break;
         #endif
+            mpack_write_bytes(writer, mpack_node_data_unchecked(node), node.data->len);
+            mpack_finish_type(writer, type);
+            break;
 
-        case mpack_type_array:   tag.v.n = node.data->len;  break;
-        case mpack_type_map:     tag.v.n = node.data->len;  break;
+        case mpack_type_array:
+            for (i = 0; i < node.data->len; ++i)
+                mpack_write_node(writer, mpack_node_array_at(node, i));
+            mpack_finish_array(writer);
+            break;
+
+        case mpack_type_map:
+            for (i = 0; i < node.data->len; ++i) {
+                mpack_write_node(writer, mpack_node_map_key_at(node, i));
+                mpack_write_node(writer, mpack_node_map_value_at(node, i));
+            }
+            mpack_finish_map(writer);
+            break;
 
         default:
-            mpack_assert(0, "unrecognized type %i", (int)node.data->type);
             break;
     }
-    return tag;
 }
+#endif
 
 #if MPACK_DEBUG && MPACK_STDIO
 static void mpack_node_print_element(mpack_node_t node, mpack_print_t* print, size_t depth) {
@@ -1507,7 +2888,7 @@ size_t mpack_node_copy_data(mpack_node_t node, char* buffer, size_t bufsize) {
 
     mpack_assert(bufsize == 0 || buffer != NULL, "buffer is NULL for maximum of %i bytes", (int)bufsize);
 
-    mpack_type_t type = node.data->type;
+    mpack_type_t type = (mpack_type_t)node.data->type;
     if (type != mpack_type_str && type != mpack_type_bin
             #if MPACK_EXTENSIONS
             && type != mpack_type_ext
@@ -1532,7 +2913,7 @@ size_t mpack_node_copy_utf8(mpack_node_t node, char* buffer, size_t bufsize) {
 
     mpack_assert(bufsize == 0 || buffer != NULL, "buffer is NULL for maximum of %i bytes", (int)bufsize);
 
-    mpack_type_t type = node.data->type;
+    mpack_type_t type = (mpack_type_t)node.data->type;
     if (type != mpack_type_str) {
         mpack_node_flag_error(node, mpack_error_type);
         return 0;
@@ -1626,7 +3007,7 @@ char* mpack_node_data_alloc(mpack_node_t node, size_t maxlen) {
         return NULL;
 
     // make sure this is a valid data type
-    mpack_type_t type = node.data->type;
+    mpack_type_t type = (mpack_type_t)node.data->type;
     if (type != mpack_type_str && type != mpack_type_bin
             #if MPACK_EXTENSIONS
             && type != mpack_type_ext
@@ -1641,7 +3022,7 @@ char* mpack_node_data_alloc(mpack_node_t node, size_t maxlen) {
         return NULL;
     }
 
-    char* ret = (char*) MPACK_MALLOC((size_t)node.data->len);
+    char* ret = (char*) mpack_allocator_alloc(&node.tree->allocator, (size_t)node.data->len);
     if (ret == NULL) {
         mpack_node_flag_error(node, mpack_error_memory);
         return NULL;
@@ -1677,7 +3058,7 @@ char* mpack_node_cstr_alloc(mpack_node_t node, size_t maxlen) {
         return NULL;
     }
 
-    char* ret = (char*) MPACK_MALLOC((size_t)(node.data->len + 1));
+    char* ret = (char*) mpack_allocator_alloc(&node.tree->allocator, (size_t)(node.data->len + 1));
     if (ret == NULL) {
         mpack_node_flag_error(node, mpack_error_memory);
         return NULL;
@@ -1714,7 +3095,7 @@ char* mpack_node_utf8_cstr_alloc(mpack_node_t node, size_t maxlen) {
         return NULL;
     }
 
-    char* ret = (char*) MPACK_MALLOC((size_t)(node.data->len + 1));
+    char* ret = (char*) mpack_allocator_alloc(&node.tree->allocator, (size_t)(node.data->len + 1));
     if (ret == NULL) {
         mpack_node_flag_error(node, mpack_error_memory);
         return NULL;
@@ -1731,6 +3112,247 @@ char* mpack_node_utf8_cstr_alloc(mpack_node_t node, size_t maxlen) {
  * Compound Node Functions
  */
 
+#ifdef MPACK_MALLOC
+
+/*
+ * Map key index
+ *
+ * A map index is an open-addressed hash table of the int, uint and str keys
+ * of a single map. Equal keys hash to the same chain so duplicates are found
+ * while building the index; a key with duplicates is marked so that looking
+ * it up still flags mpack_error_data.
+ *
+ * The indices of a tree are themselves stored in an open-addressed table
+ * keyed by map node pointer.
+ */
+
+typedef struct mpack_tree_map_slot_t {
+    uint32_t pair; // index of the key/value pair plus one, or 0 if empty
+    uint32_t hash;
+    bool duplicate;
+} mpack_tree_map_slot_t;
+
+struct mpack_tree_map_index_t {
+    mpack_node_data_t* map;
+    size_t mask;
+    mpack_tree_map_slot_t slots[1]; // variable size
+};
+
+// A key in normalized form. Non-negative ints are stored as uints so that
+// they compare equal regardless of how they were encoded.
+typedef struct mpack_map_key_t {
+    mpack_type_t type; // mpack_type_uint, mpack_type_int (negative) or mpack_type_str
+    uint64_t u;
+    const char* str;
+    size_t length;
+} mpack_map_key_t;
+
+static mpack_map_key_t mpack_map_key_int(int64_t num) {
+    mpack_map_key_t key;
+    key.type = (num >= 0) ? mpack_type_uint : mpack_type_int;
+    key.u = (uint64_t)num;
+    key.str = NULL;
+    key.length = 0;
+    return key;
+}
+
+static mpack_map_key_t mpack_map_key_uint(uint64_t num) {
+    mpack_map_key_t key;
+    key.type = mpack_type_uint;
+    key.u = num;
+    key.str = NULL;
+    key.length = 0;
+    return key;
+}
+
+static mpack_map_key_t mpack_map_key_str(const char* str, size_t length) {
+    mpack_map_key_t key;
+    key.type = mpack_type_str;
+    key.u = 0;
+    key.str = str;
+    key.length = length;
+    return key;
+}
+
+static uint32_t mpack_map_key_hash(const mpack_map_key_t* key) {
+    if (key->type != mpack_type_str)
+        return (uint32_t)mpack_hash_mix(0, key->u);
+
+    return mpack_hash_str(key->str, key->length);
+}
+
+static bool mpack_map_key_equal(const mpack_map_key_t* left, const mpack_map_key_t* right) {
+    if (left->type != right->type)
+        return false;
+    if (left->type != mpack_type_str)
+        return left->u == right->u;
+    return left->length == right->length &&
+        mpack_memcmp(left->str, right->str, left->length) == 0;
+}
+
+// Returns false if the key node cannot match any lookup.
+static bool mpack_map_key_from_node(mpack_tree_t* tree, mpack_node_data_t* data, mpack_map_key_t* key) {
+    switch (data->type) {
+        case mpack_type_int:
+            *key = mpack_map_key_int(mpack_node_value_i(mpack_node(tree, data)));
+            return true;
+        case mpack_type_uint:
+            *key = mpack_map_key_uint(mpack_node_value_u(mpack_node(tree, data)));
+            return true;
+        case mpack_type_str:
+            *key = mpack_map_key_str(mpack_node_data_unchecked(mpack_node(tree, data)), data->len);
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
+static mpack_tree_map_index_t* mpack_tree_map_index_build(mpack_tree_t* tree, mpack_node_data_t* map) {
+    size_t count = map->len;
+
+    size_t capacity = 8;
+    while (capacity / 2 < count) {
+        if (capacity > (SIZE_MAX - sizeof(mpack_tree_map_index_t)) / sizeof(mpack_tree_map_slot_t) / 2)
+            return NULL;
+        capacity *= 2;
+    }
+
+    size_t size = sizeof(mpack_tree_map_index_t) + (capacity - 1) * sizeof(mpack_tree_map_slot_t);
+    mpack_tree_map_index_t* index = (mpack_tree_map_index_t*)mpack_allocator_alloc(&tree->allocator, size);
+    if (index == NULL)
+        return NULL;
+    mpack_memset(index, 0, size);
+    index->map = map;
+    index->mask = capacity - 1;
+    mpack_log("built index %p of %i slots for map %p\n", (void*)index, (int)capacity, (void*)map);
+
+    mpack_node_t node = mpack_node(tree, map);
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        mpack_map_key_t key;
+        if (!mpack_map_key_from_node(tree, mpack_node_child(node, i * 2), &key))
+            continue;
+
+        uint32_t hash = mpack_map_key_hash(&key);
+        size_t pos = hash & index->mask;
+        while (index->slots[pos].pair != 0) {
+            mpack_tree_map_slot_t* slot = &index->slots[pos];
+            if (slot->hash == hash) {
+                mpack_map_key_t other;
+                if (mpack_map_key_from_node(tree, mpack_node_child(node, (size_t)(slot->pair - 1) * 2), &other) &&
+                        mpack_map_key_equal(&key, &other)) {
+                    slot->duplicate = true;
+                    break;
+                }
+            }
+            pos = (pos + 1) & index->mask;
+        }
+
+        if (index->slots[pos].pair == 0) {
+            index->slots[pos].pair = (uint32_t)(i + 1);
+            index->slots[pos].hash = hash;
+        }
+    }
+
+    return index;
+}
+
+MPACK_STATIC_INLINE size_t mpack_tree_map_indices_pos(mpack_tree_t* tree, mpack_node_data_t* map) {
+    return (size_t)mpack_hash_mix(0, (uint64_t)(uintptr_t)map) & (tree->map_indices_capacity - 1);
+}
+
+static bool mpack_tree_map_indices_grow(mpack_tree_t* tree) {
+    size_t old_capacity = tree->map_indices_capacity;
+    size_t new_capacity = (old_capacity == 0) ? 8 : old_capacity * 2;
+    if (new_capacity > SIZE_MAX / sizeof(mpack_tree_map_index_t*))
+        return false;
+
+    mpack_tree_map_index_t** old_indices = tree->map_indices;
+    mpack_tree_map_index_t** new_indices = (mpack_tree_map_index_t**)
+            mpack_allocator_alloc(&tree->allocator, new_capacity * sizeof(mpack_tree_map_index_t*));
+    if (new_indices == NULL)
+        return false;
+    mpack_memset(new_indices, 0, new_capacity * sizeof(mpack_tree_map_index_t*));
+
+    tree->map_indices = new_indices;
+    tree->map_indices_capacity = new_capacity;
+
+    size_t i;
+    for (i = 0; i < old_capacity; ++i) {
+        mpack_tree_map_index_t* index = old_indices[i];
+        if (index == NULL)
+            continue;
+        size_t pos = mpack_tree_map_indices_pos(tree, index->map);
+        while (new_indices[pos] != NULL)
+            pos = (pos + 1) & (new_capacity - 1);
+        new_indices[pos] = index;
+    }
+
+    if (old_indices != NULL)
+        mpack_allocator_free(&tree->allocator, old_indices);
+    return true;
+}
+
+// Returns the index for the given map, building it if necessary, or NULL if
+// the map should be searched linearly.
+static mpack_tree_map_index_t* mpack_tree_map_index(mpack_tree_t* tree, mpack_node_data_t* map) {
+    if (tree->map_index_threshold == 0 || map->len < tree->map_index_threshold)
+        return NULL;
+
+    size_t pos = 0;
+    if (tree->map_indices_capacity > 0) {
+        pos = mpack_tree_map_indices_pos(tree, map);
+        while (tree->map_indices[pos] != NULL) {
+            if (tree->map_indices[pos]->map == map)
+                return tree->map_indices[pos];
+            pos = (pos + 1) & (tree->map_indices_capacity - 1);
+        }
+    }
+
+    // keep the table at most half full
+    if ((tree->map_indices_count + 1) * 2 > tree->map_indices_capacity) {
+        if (!mpack_tree_map_indices_grow(tree))
+            return NULL;
+        pos = mpack_tree_map_indices_pos(tree, map);
+        while (tree->map_indices[pos] != NULL)
+            pos = (pos + 1) & (tree->map_indices_capacity - 1);
+    }
+
+    mpack_tree_map_index_t* index = mpack_tree_map_index_build(tree, map);
+    if (index == NULL)
+        return NULL;
+    tree->map_indices[pos] = index;
+    ++tree->map_indices_count;
+    return index;
+}
+
+static mpack_node_data_t* mpack_tree_map_index_find(mpack_node_t node,
+        mpack_tree_map_index_t* index, const mpack_map_key_t* key)
+{
+    uint32_t hash = mpack_map_key_hash(key);
+    size_t pos = hash & index->mask;
+    while (index->slots[pos].pair != 0) {
+        mpack_tree_map_slot_t* slot = &index->slots[pos];
+        if (slot->hash == hash) {
+            size_t pair = (size_t)(slot->pair - 1);
+            mpack_map_key_t other;
+            if (mpack_map_key_from_node(node.tree, mpack_node_child(node, pair * 2), &other) &&
+                    mpack_map_key_equal(key, &other)) {
+                if (slot->duplicate) {
+                    mpack_node_flag_error(node, mpack_error_data);
+                    return NULL;
+                }
+                return mpack_node_child(node, pair * 2 + 1);
+            }
+        }
+        pos = (pos + 1) & index->mask;
+    }
+    return NULL;
+}
+
+#endif
+
 static mpack_node_data_t* mpack_node_map_int_impl(mpack_node_t node, int64_t num) {
     if (mpack_node_error(node) != mpack_ok)
         return NULL;
@@ -1740,14 +3362,25 @@ static mpack_node_data_t* mpack_node_map_int_impl(mpack_node_t node, int64_t num
         return NULL;
     }
 
+    if (!mpack_node_materialize(node))
+        return NULL;
+
+    #ifdef MPACK_MALLOC
+    mpack_tree_map_index_t* index = mpack_tree_map_index(node.tree, node.data);
+    if (index != NULL) {
+        mpack_map_key_t key = mpack_map_key_int(num);
+        return mpack_tree_map_index_find(node, index, &key);
+    }
+    #endif
+
     mpack_node_data_t* found = NULL;
 
     size_t i;
     for (i = 0; i < node.data->len; ++i) {
         mpack_node_data_t* key = mpack_node_child(node, i * 2);
 
-        if ((key->type == mpack_type_int && key->value.i == num) ||
-            (key->type == mpack_type_uint && num >= 0 && key->value.u == (uint64_t)num))
+        if ((key->type == mpack_type_int && mpack_node_value_i(mpack_node(node.tree, key)) == num) ||
+            (key->type == mpack_type_uint && num >= 0 && mpack_node_value_u(mpack_node(node.tree, key)) == (uint64_t)num))
         {
             if (found) {
                 mpack_node_flag_error(node, mpack_error_data);
@@ -1772,14 +3405,26 @@ static mpack_node_data_t* mpack_node_map_uint_impl(mpack_node_t node, uint64_t n
         return NULL;
     }
 
+    if (!mpack_node_materialize(node))
+        return NULL;
+
+    #ifdef MPACK_MALLOC
+    mpack_tree_map_index_t* index = mpack_tree_map_index(node.tree, node.data);
+    if (index != NULL) {
+        mpack_map_key_t key = mpack_map_key_uint(num);
+        return mpack_tree_map_index_find(node, index, &key);
+    }
+    #endif
+
     mpack_node_data_t* found = NULL;
 
     size_t i;
     for (i = 0; i < node.data->len; ++i) {
         mpack_node_data_t* key = mpack_node_child(node, i * 2);
 
-        if ((key->type == mpack_type_uint && key->value.u == num) ||
-            (key->type == mpack_type_int && key->value.i >= 0 && (uint64_t)key->value.i == num))
+        if ((key->type == mpack_type_uint && mpack_node_value_u(mpack_node(node.tree, key)) == num) ||
+            (key->type == mpack_type_int && mpack_node_value_i(mpack_node(node.tree, key)) >= 0 &&
+                (uint64_t)mpack_node_value_i(mpack_node(node.tree, key)) == num))
         {
             if (found) {
                 mpack_node_flag_error(node, mpack_error_data);
@@ -1806,6 +3451,17 @@ static mpack_node_data_t* mpack_node_map_str_impl(mpack_node_t node, const char*
         return NULL;
     }
 
+    if (!mpack_node_materialize(node))
+        return NULL;
+
+    #ifdef MPACK_MALLOC
+    mpack_tree_map_index_t* index = mpack_tree_map_index(node.tree, node.data);
+    if (index != NULL) {
+        mpack_map_key_t key = mpack_map_key_str(str, length);
+        return mpack_tree_map_index_find(node, index, &key);
+    }
+    #endif
+
     mpack_tree_t* tree = node.tree;
     mpack_node_data_t* found = NULL;
 
@@ -1829,6 +3485,44 @@ static mpack_node_data_t* mpack_node_map_str_impl(mpack_node_t node, const char*
     return NULL;
 }
 
+#ifdef MPACK_MALLOC
+static mpack_node_data_t* mpack_node_map_key_id_impl(mpack_node_t node, uint16_t id) {
+    if (mpack_node_error(node) != mpack_ok)
+        return NULL;
+
+    if (id == 0 || node.tree->key_table == NULL) {
+        mpack_break("key ID %i is invalid or the tree has no key table!", (int)id);
+        mpack_node_flag_error(node, mpack_error_bug);
+        return NULL;
+    }
+
+    if (node.data->type != mpack_type_map) {
+        mpack_node_flag_error(node, mpack_error_type);
+        return NULL;
+    }
+
+    if (!mpack_node_materialize(node))
+        return NULL;
+
+    mpack_node_data_t* found = NULL;
+
+    size_t i;
+    for (i = 0; i < node.data->len; ++i) {
+        mpack_node_data_t* key = mpack_node_child(node, i * 2);
+
+        if (key->key == id) {
+            if (found) {
+                mpack_node_flag_error(node, mpack_error_data);
+                return NULL;
+            }
+            found = mpack_node_child(node, i * 2 + 1);
+        }
+    }
+
+    return found;
+}
+#endif
+
 static mpack_node_t mpack_node_wrap_lookup(mpack_tree_t* tree, mpack_node_data_t* data) {
     if (!data) {
         if (tree->error == mpack_ok)
@@ -1881,6 +3575,22 @@ mpack_node_t mpack_node_map_cstr_optional(mpack_node_t node, const char* cstr) {
     return mpack_node_map_str_optional(node, cstr, mpack_strlen(cstr));
 }
 
+#ifdef MPACK_MALLOC
+uint16_t mpack_node_key_id(mpack_node_t node) {
+    if (mpack_node_error(node) != mpack_ok || node.data->type != mpack_type_str)
+        return 0;
+    return node.data->key;
+}
+
+mpack_node_t mpack_node_map_key_id(mpack_node_t node, uint16_t id) {
+    return mpack_node_wrap_lookup(node.tree, mpack_node_map_key_id_impl(node, id));
+}
+
+mpack_node_t mpack_node_map_key_id_optional(mpack_node_t node, uint16_t id) {
+    return mpack_node_wrap_lookup_optional(node.tree, mpack_node_map_key_id_impl(node, id));
+}
+#endif
+
 bool mpack_node_map_contains_int(mpack_node_t node, int64_t num) {
     return mpack_node_map_int_impl(node, num) != NULL;
 }
@@ -1931,10 +3641,30 @@ size_t mpack_node_enum(mpack_node_t node, const char* strings[], size_t count) {
     return value;
 }
 
+#ifdef MPACK_MALLOC
+size_t mpack_node_enum_matcher_optional(mpack_node_t node, const mpack_enum_matcher_t* matcher) {
+    if (mpack_node_error(node) != mpack_ok)
+        return matcher->count;
+
+    // the value is only recognized if it is a string
+    if (mpack_node_type(node) != mpack_type_str)
+        return matcher->count;
+
+    return mpack_enum_matcher_find(matcher, mpack_node_str(node), mpack_node_strlen(node));
+}
+
+size_t mpack_node_enum_matcher(mpack_node_t node, const mpack_enum_matcher_t* matcher) {
+    size_t value = mpack_node_enum_matcher_optional(node, matcher);
+    if (value == matcher->count)
+        mpack_node_flag_error(node, mpack_error_type);
+    return value;
+}
+#endif
+
 mpack_type_t mpack_node_type(mpack_node_t node) {
     if (mpack_node_error(node) != mpack_ok)
         return mpack_type_nil;
-    return node.data->type;
+    return (mpack_type_t)node.data->type;
 }
 
 bool mpack_node_is_nil(mpack_node_t node) {
@@ -1993,11 +3723,11 @@ uint8_t mpack_node_u8(mpack_node_t node) {
         return 0;
 
     if (node.data->type == mpack_type_uint) {
-        if (node.data->value.u <= MPACK_UINT8_MAX)
-            return (uint8_t)node.data->value.u;
+        if (mpack_node_value_u(node) <= MPACK_UINT8_MAX)
+            return (uint8_t)mpack_node_value_u(node);
     } else if (node.data->type == mpack_type_int) {
-        if (node.data->value.i >= 0 && node.data->value.i <= MPACK_UINT8_MAX)
-            return (uint8_t)node.data->value.i;
+        if (mpack_node_value_i(node) >= 0 && mpack_node_value_i(node) <= MPACK_UINT8_MAX)
+            return (uint8_t)mpack_node_value_i(node);
     }
 
     mpack_node_flag_error(node, mpack_error_type);
@@ -2009,11 +3739,11 @@ int8_t mpack_node_i8(mpack_node_t node) {
         return 0;
 
     if (node.data->type == mpack_type_uint) {
-        if (node.data->value.u <= MPACK_INT8_MAX)
-            return (int8_t)node.data->value.u;
+        if (mpack_node_value_u(node) <= MPACK_INT8_MAX)
+            return (int8_t)mpack_node_value_u(node);
     } else if (node.data->type == mpack_type_int) {
-        if (node.data->value.i >= MPACK_INT8_MIN && node.data->value.i <= MPACK_INT8_MAX)
-            return (int8_t)node.data->value.i;
+        if (mpack_node_value_i(node) >= MPACK_INT8_MIN && mpack_node_value_i(node) <= MPACK_INT8_MAX)
+            return (int8_t)mpack_node_value_i(node);
     }
 
     mpack_node_flag_error(node, mpack_error_type);
@@ -2025,11 +3755,11 @@ uint16_t mpack_node_u16(mpack_node_t node) {
         return 0;
 
     if (node.data->type == mpack_type_uint) {
-        if (node.data->value.u <= MPACK_UINT16_MAX)
-            return (uint16_t)node.data->value.u;
+        if (mpack_node_value_u(node) <= MPACK_UINT16_MAX)
+            return (uint16_t)mpack_node_value_u(node);
     } else if (node.data->type == mpack_type_int) {
-        if (node.data->value.i >= 0 && node.data->value.i <= MPACK_UINT16_MAX)
-            return (uint16_t)node.data->value.i;
+        if (mpack_node_value_i(node) >= 0 && mpack_node_value_i(node) <= MPACK_UINT16_MAX)
+            return (uint16_t)mpack_node_value_i(node);
     }
 
     mpack_node_flag_error(node, mpack_error_type);
@@ -2041,11 +3771,11 @@ int16_t mpack_node_i16(mpack_node_t node) {
         return 0;
 
     if (node.data->type == mpack_type_uint) {
-        if (node.data->value.u <= MPACK_INT16_MAX)
-            return (int16_t)node.data->value.u;
+        if (mpack_node_value_u(node) <= MPACK_INT16_MAX)
+            return (int16_t)mpack_node_value_u(node);
     } else if (node.data->type == mpack_type_int) {
-        if (node.data->value.i >= MPACK_INT16_MIN && node.data->value.i <= MPACK_INT16_MAX)
-            return (int16_t)node.data->value.i;
+        if (mpack_node_value_i(node) >= MPACK_INT16_MIN && mpack_node_value_i(node) <= MPACK_INT16_MAX)
+            return (int16_t)mpack_node_value_i(node);
     }
 
     mpack_node_flag_error(node, mpack_error_type);
@@ -2057,11 +3787,11 @@ uint32_t mpack_node_u32(mpack_node_t node) {
         return 0;
 
     if (node.data->type == mpack_type_uint) {
-        if (node.data->value.u <= MPACK_UINT32_MAX)
-            return (uint32_t)node.data->value.u;
+        if (mpack_node_value_u(node) <= MPACK_UINT32_MAX)
+            return (uint32_t)mpack_node_value_u(node);
     } else if (node.data->type == mpack_type_int) {
-        if (node.data->value.i >= 0 && node.data->value.i <= MPACK_UINT32_MAX)
-            return (uint32_t)node.data->value.i;
+        if (mpack_node_value_i(node) >= 0 && mpack_node_value_i(node) <= MPACK_UINT32_MAX)
+            return (uint32_t)mpack_node_value_i(node);
     }
 
     mpack_node_flag_error(node, mpack_error_type);
@@ -2073,11 +3803,11 @@ int32_t mpack_node_i32(mpack_node_t node) {
         return 0;
 
     if (node.data->type == mpack_type_uint) {
-        if (node.data->value.u <= MPACK_INT32_MAX)
-            return (int32_t)node.data->value.u;
+        if (mpack_node_value_u(node) <= MPACK_INT32_MAX)
+            return (int32_t)mpack_node_value_u(node);
     } else if (node.data->type == mpack_type_int) {
-        if (node.data->value.i >= MPACK_INT32_MIN && node.data->value.i <= MPACK_INT32_MAX)
-            return (int32_t)node.data->value.i;
+        if (mpack_node_value_i(node) >= MPACK_INT32_MIN && mpack_node_value_i(node) <= MPACK_INT32_MAX)
+            return (int32_t)mpack_node_value_i(node);
     }
 
     mpack_node_flag_error(node, mpack_error_type);
@@ -2089,10 +3819,10 @@ uint64_t mpack_node_u64(mpack_node_t node) {
         return 0;
 
     if (node.data->type == mpack_type_uint) {
-        return node.data->value.u;
+        return mpack_node_value_u(node);
     } else if (node.data->type == mpack_type_int) {
-        if (node.data->value.i >= 0)
-            return (uint64_t)node.data->value.i;
+        if (mpack_node_value_i(node) >= 0)
+            return (uint64_t)mpack_node_value_i(node);
     }
 
     mpack_node_flag_error(node, mpack_error_type);
@@ -2104,10 +3834,10 @@ int64_t mpack_node_i64(mpack_node_t node) {
         return 0;
 
     if (node.data->type == mpack_type_uint) {
-        if (node.data->value.u <= (uint64_t)MPACK_INT64_MAX)
-            return (int64_t)node.data->value.u;
+        if (mpack_node_value_u(node) <= (uint64_t)MPACK_INT64_MAX)
+            return (int64_t)mpack_node_value_u(node);
     } else if (node.data->type == mpack_type_int) {
-        return node.data->value.i;
+        return mpack_node_value_i(node);
     }
 
     mpack_node_flag_error(node, mpack_error_type);
@@ -2150,17 +3880,17 @@ float mpack_node_float(mpack_node_t node) {
         return 0.0f;
 
     if (node.data->type == mpack_type_uint)
-        return (float)node.data->value.u;
+        return (float)mpack_node_value_u(node);
     if (node.data->type == mpack_type_int)
-        return (float)node.data->value.i;
+        return (float)mpack_node_value_i(node);
     if (node.data->type == mpack_type_float)
         return node.data->value.f;
 
     if (node.data->type == mpack_type_double) {
         #if MPACK_DOUBLE
-        return (float)node.data->value.d;
+        return (float)mpack_node_value_d(node);
         #else
-        return mpack_shorten_raw_double_to_float(node.data->value.d);
+        return mpack_shorten_raw_double_to_float(mpack_node_value_d(node));
         #endif
     }
 
@@ -2175,13 +3905,13 @@ double mpack_node_double(mpack_node_t node) {
         return 0.0;
 
     if (node.data->type == mpack_type_uint)
-        return (double)node.data->value.u;
+        return (double)mpack_node_value_u(node);
     else if (node.data->type == mpack_type_int)
-        return (double)node.data->value.i;
+        return (double)mpack_node_value_i(node);
     else if (node.data->type == mpack_type_float)
         return (double)node.data->value.f;
     else if (node.data->type == mpack_type_double)
-        return node.data->value.d;
+        return mpack_node_value_d(node);
 
     mpack_node_flag_error(node, mpack_error_type);
     return 0.0;
@@ -2209,7 +3939,7 @@ double mpack_node_double_strict(mpack_node_t node) {
     if (node.data->type == mpack_type_float)
         return (double)node.data->value.f;
     else if (node.data->type == mpack_type_double)
-        return node.data->value.d;
+        return mpack_node_value_d(node);
 
     mpack_node_flag_error(node, mpack_error_type);
     return 0.0;
@@ -2235,7 +3965,7 @@ uint64_t mpack_node_raw_double(mpack_node_t node) {
         return 0;
 
     if (node.data->type == mpack_type_double)
-        return node.data->value.d;
+        return mpack_node_value_d(node);
 
     mpack_node_flag_error(node, mpack_error_type);
     return 0;
@@ -2259,7 +3989,7 @@ uint32_t mpack_node_data_len(mpack_node_t node) {
     if (mpack_node_error(node) != mpack_ok)
         return 0;
 
-    mpack_type_t type = node.data->type;
+    mpack_type_t type = (mpack_type_t)node.data->type;
     if (type == mpack_type_str || type == mpack_type_bin
             #if MPACK_EXTENSIONS
             || type == mpack_type_ext
@@ -2286,7 +4016,7 @@ const char* mpack_node_str(mpack_node_t node) {
     if (mpack_node_error(node) != mpack_ok)
         return NULL;
 
-    mpack_type_t type = node.data->type;
+    mpack_type_t type = (mpack_type_t)node.data->type;
     if (type == mpack_type_str)
         return mpack_node_data_unchecked(node);
 
@@ -2298,7 +4028,7 @@ const char* mpack_node_data(mpack_node_t node) {
     if (mpack_node_error(node) != mpack_ok)
         return NULL;
 
-    mpack_type_t type = node.data->type;
+    mpack_type_t type = (mpack_type_t)node.data->type;
     if (type == mpack_type_str || type == mpack_type_bin
             #if MPACK_EXTENSIONS
             || type == mpack_type_ext
@@ -2358,9 +4088,95 @@ mpack_node_t mpack_node_array_at(mpack_node_t node, size_t index) {
         return mpack_tree_nil_node(node.tree);
     }
 
+    if (!mpack_node_materialize(node))
+        return mpack_tree_nil_node(node.tree);
+
     return mpack_node(node.tree, mpack_node_child(node, index));
 }
 
+// Checks that the node is an array that fits in a buffer of max_count
+// elements and materializes it, returning its length or zero on error.
+static size_t mpack_node_typed_array(mpack_node_t node, size_t max_count) {
+    size_t count = mpack_node_array_length(node);
+    if (mpack_node_error(node) != mpack_ok)
+        return 0;
+    if (count > max_count) {
+        mpack_node_flag_error(node, mpack_error_too_big);
+        return 0;
+    }
+    if (!mpack_node_materialize(node))
+        return 0;
+    return count;
+}
+
+size_t mpack_node_array_u32(mpack_node_t node, uint32_t* values, size_t max_count) {
+    size_t count = mpack_node_typed_array(node, max_count);
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        mpack_node_t child = mpack_node(node.tree, mpack_node_child(node, i));
+        if (child.data->type == mpack_type_uint && mpack_node_value_u(child) <= MPACK_UINT32_MAX) {
+            values[i] = (uint32_t)mpack_node_value_u(child);
+        } else {
+            values[i] = mpack_node_u32(child);
+            if (mpack_node_error(node) != mpack_ok)
+                return 0;
+        }
+    }
+    return count;
+}
+
+size_t mpack_node_array_i64(mpack_node_t node, int64_t* values, size_t max_count) {
+    size_t count = mpack_node_typed_array(node, max_count);
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        mpack_node_t child = mpack_node(node.tree, mpack_node_child(node, i));
+        if (child.data->type == mpack_type_int) {
+            values[i] = mpack_node_value_i(child);
+        } else {
+            values[i] = mpack_node_i64(child);
+            if (mpack_node_error(node) != mpack_ok)
+                return 0;
+        }
+    }
+    return count;
+}
+
+#if MPACK_FLOAT
+size_t mpack_node_array_float(mpack_node_t node, float* values, size_t max_count) {
+    size_t count = mpack_node_typed_array(node, max_count);
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        mpack_node_t child = mpack_node(node.tree, mpack_node_child(node, i));
+        if (child.data->type == mpack_type_float) {
+            values[i] = child.data->value.f;
+        } else {
+            values[i] = mpack_node_float(child);
+            if (mpack_node_error(node) != mpack_ok)
+                return 0;
+        }
+    }
+    return count;
+}
+#endif
+
+#if MPACK_DOUBLE
+size_t mpack_node_array_double(mpack_node_t node, double* values, size_t max_count) {
+    size_t count = mpack_node_typed_array(node, max_count);
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        mpack_node_t child = mpack_node(node.tree, mpack_node_child(node, i));
+        if (child.data->type == mpack_type_double) {
+            values[i] = mpack_node_value_d(child);
+        } else {
+            values[i] = mpack_node_double(child);
+            if (mpack_node_error(node) != mpack_ok)
+                return 0;
+        }
+    }
+    return count;
+}
+#endif
+
 size_t mpack_node_map_count(mpack_node_t node) {
     if (mpack_node_error(node) != mpack_ok)
         return 0;
@@ -2388,6 +4204,9 @@ static mpack_node_t mpack_node_map_at(mpack_node_t node, size_t index, size_t of
         return mpack_tree_nil_node(node.tree);
     }
 
+    if (!mpack_node_materialize(node))
+        return mpack_tree_nil_node(node.tree);
+
     return mpack_node(node.tree, mpack_node_child(node, index * 2 + offset));
 }
 
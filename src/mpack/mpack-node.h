@@ -29,6 +29,7 @@
 #define MPACK_NODE_H 1
 
 #include "mpack-reader.h"
+#include "mpack-writer.h"
 
 MPACK_SILENCE_WARNINGS_BEGIN
 MPACK_EXTERN_C_BEGIN
@@ -69,7 +70,7 @@ typedef struct mpack_node_t mpack_node_t;
  * for nodes instead of letting the tree allocate it.
  *
  * @ref mpack_node_data_t is 16 bytes on most common architectures (32-bit
- * and 64-bit.)
+ * and 64-bit), or 12 bytes if @ref MPACK_NODE_COMPACT is enabled.
  */
 typedef struct mpack_node_data_t mpack_node_data_t;
 
@@ -135,6 +136,58 @@ typedef size_t (*mpack_tree_read_t)(mpack_tree_t* tree, char* buffer, size_t cou
  */
 typedef void (*mpack_tree_teardown_t)(mpack_tree_t* tree);
 
+#ifdef MPACK_MALLOC
+/**
+ * An entry in a key table.
+ */
+typedef struct mpack_key_table_entry_t {
+    const char* key; /* The interned key, null-terminated. */
+    size_t length;   /* The length of the key in bytes. */
+} mpack_key_table_entry_t;
+
+/**
+ * A table of interned map keys.
+ *
+ * When a key table is attached to a tree with mpack_tree_set_key_table(),
+ * the tree interns every short str key of every map it parses: each distinct
+ * key is copied into the table once and given a small integer ID, which is
+ * stored in its node. Maps can then be searched by ID with
+ * mpack_node_map_key_id(), which compares integers rather than key bytes,
+ * and the table's copy of a key can be used instead of allocating one for
+ * each message.
+ *
+ * IDs start at 1 and are assigned in the order keys are first seen. They are
+ * stable for the lifetime of the table, so the keys you look up can be
+ * interned once up front with mpack_key_table_intern():
+ *
+ * @code{.c}
+ * mpack_key_table_t keys;
+ * mpack_key_table_init(&keys, 32);
+ * uint16_t temperature = mpack_key_table_intern(&keys, "temperature", 11);
+ *
+ * // for each message:
+ * mpack_tree_set_key_table(&tree, &keys);
+ * mpack_tree_parse(&tree);
+ * double t = mpack_node_double(mpack_node_map_key_id(mpack_tree_root(&tree), temperature));
+ * @endcode
+ *
+ * A key table can be shared by any number of trees, but parsing adds keys
+ * to it, so it must not be used by trees on different threads at the same
+ * time. It must outlive the trees that use it.
+ *
+ * @note This requires @ref MPACK_MALLOC.
+ */
+typedef struct mpack_key_table_t {
+    mpack_arena_t strings;            /* The storage for interned keys. */
+    mpack_key_table_entry_t* entries; /* The interned keys by ID minus one. */
+    size_t count;                     /* The number of interned keys. */
+    size_t capacity;                  /* The capacity of entries. */
+    uint16_t* slots;                  /* The hash table of key IDs. */
+    size_t mask;                      /* The number of slots minus one. */
+    size_t max_length;                /* The length of the longest key interned. */
+} mpack_key_table_t;
+#endif
+
 
 
 /* Hide internals from documentation */
@@ -145,8 +198,51 @@ struct mpack_node_t {
     mpack_tree_t* tree;
 };
 
+#if MPACK_NODE_COMPACT
+/*
+ * In the compact layout, a node's value is 32 bits. Integers that don't fit
+ * and doubles are loaded from the message data at the given offset. The
+ * children of a map or array are referenced by their index in the node pool,
+ * or by their index in the tree's table of child blocks if the tree
+ * allocates pages.
+ */
 struct mpack_node_data_t {
-    mpack_type_t type;
+    uint8_t type; /* The mpack_type_t of the node. */
+    uint8_t flags; /* MPACK_NODE_FLAG_* bits; see mpack-node.c */
+    uint16_t key; /* The interned key ID of a str map key, or 0 */
+
+    /*
+     * The element count if the type is an array;
+     * the number of key/value pairs if the type is map;
+     * or the number of bytes if the type is str, bin or ext.
+     */
+    uint32_t len;
+
+    union {
+        bool     b; /* The value if the type is bool. */
+
+        #if MPACK_FLOAT
+        float    f; /* The value if the type is float. */
+        #else
+        uint32_t f; /*< The raw value if the type is float. */
+        #endif
+
+        int32_t  i; /* The value if the type is signed int and it fits. */
+        uint32_t u; /* The value if the type is unsigned int and it fits. */
+
+        /*
+         * The byte offset for str, bin and ext, for the value of a double or
+         * a large int, or for the first child of a lazy map or array
+         */
+        uint32_t offset;
+
+        uint32_t children; /* The index of the children for map or array */
+    } value;
+};
+#else
+struct mpack_node_data_t {
+    uint8_t type; /* The mpack_type_t of the node. */
+    uint16_t key; /* The interned key ID of a str map key, or 0 */
 
     /*
      * The element count if the type is an array;
@@ -174,15 +270,28 @@ struct mpack_node_data_t {
         uint64_t u; /* The value if the type is unsigned int. */
         size_t offset; /* The byte offset for str, bin and ext */
 
-        mpack_node_data_t* children; /* The children for map or array */
+        /*
+         * The children for map or array. In a lazy tree, a non-empty map or
+         * array that has not yet been materialized instead stores the byte
+         * offset of its first child, shifted left by one with the low bit set.
+         */
+        mpack_node_data_t* children;
     } value;
 };
+#endif
 
 typedef struct mpack_tree_page_t {
     struct mpack_tree_page_t* next;
+    size_t capacity; // number of nodes in this page
     mpack_node_data_t nodes[1]; // variable size
 } mpack_tree_page_t;
 
+#ifdef MPACK_MALLOC
+// A hashed key index for a single map. These are built lazily on lookup in
+// maps that have at least tree->map_index_threshold pairs.
+typedef struct mpack_tree_map_index_t mpack_tree_map_index_t;
+#endif
+
 typedef enum mpack_tree_parse_state_t {
     mpack_tree_parse_state_not_started,
     mpack_tree_parse_state_in_progress,
@@ -192,8 +301,30 @@ typedef enum mpack_tree_parse_state_t {
 typedef struct mpack_level_t {
     mpack_node_data_t* child;
     size_t left; // children left in level
+    #ifdef MPACK_MALLOC
+    bool keys; // whether the level is a map whose keys are interned
+    #endif
 } mpack_level_t;
 
+#if MPACK_STATS
+/**
+ * Instrumentation counters for a tree.
+ *
+ * @see MPACK_STATS
+ * @see mpack_tree_stats()
+ */
+typedef struct mpack_tree_stats_t {
+    size_t messages;     /**< Messages parsed */
+    size_t bytes;        /**< Bytes of parsed messages */
+    size_t nodes;        /**< Nodes of parsed messages */
+    size_t pages;        /**< Node pages allocated */
+    size_t buffer_grows; /**< Allocations and reallocations of the data buffer */
+    size_t stack_grows;  /**< Allocations and reallocations of the parsing stack */
+    size_t fills;        /**< Calls to the read function */
+    size_t fill_bytes;   /**< Bytes returned by the read function */
+} mpack_tree_stats_t;
+#endif
+
 typedef struct mpack_tree_parser_t {
     mpack_tree_parse_state_t state;
 
@@ -261,6 +392,9 @@ struct mpack_tree_t {
     size_t max_size;  // maximum message size
     size_t max_nodes; // maximum nodes in a message
 
+    bool lazy; // whether containers are materialized on first access
+    bool spans; // whether the source bytes of containers are recorded
+
     mpack_tree_parser_t parser;
     mpack_node_data_t* root;
 
@@ -268,7 +402,31 @@ struct mpack_tree_t {
     size_t pool_count;
 
     #ifdef MPACK_MALLOC
+    mpack_allocator_t allocator;
     mpack_tree_page_t* next;
+    mpack_tree_page_t* separate; // pages holding the children of a single large container
+    mpack_tree_page_t* spare; // normal pages kept from previous messages for reuse
+    mpack_tree_page_t* spare_separate; // separate pages kept from previous messages for reuse
+    size_t spare_bytes; // total size of the kept pages
+    size_t reuse_limit; // maximum bytes kept in each of the spare pages, parse stack and buffer
+    bool exact; // whether each message is scanned to allocate its nodes in one block
+
+    size_t map_index_threshold; // minimum pair count to index a map, or 0 if disabled
+    mpack_tree_map_index_t** map_indices; // open-addressed table of map indices keyed by map node
+    size_t map_indices_capacity;
+    size_t map_indices_count;
+
+    mpack_key_table_t* key_table; // table in which map keys are interned, or NULL
+
+    #if MPACK_NODE_COMPACT
+    mpack_node_data_t** blocks; // children of compact containers when allocating pages
+    size_t blocks_capacity;
+    size_t blocks_count;
+    #endif
+    #endif
+
+    #if MPACK_STATS
+    mpack_tree_stats_t stats; /* Instrumentation counters */
     #endif
 };
 
@@ -282,7 +440,15 @@ MPACK_INLINE mpack_node_t mpack_node(mpack_tree_t* tree, mpack_node_data_t* data
 }
 
 MPACK_INLINE mpack_node_data_t* mpack_node_child(mpack_node_t node, size_t child) {
+    #if MPACK_NODE_COMPACT
+    #ifdef MPACK_MALLOC
+    if (node.tree->pool == NULL)
+        return node.tree->blocks[node.data->value.children] + child;
+    #endif
+    return node.tree->pool + node.data->value.children + child;
+    #else
     return node.data->value.children + child;
+    #endif
 }
 
 MPACK_INLINE mpack_node_t mpack_tree_nil_node(mpack_tree_t* tree) {
@@ -317,6 +483,31 @@ MPACK_INLINE mpack_node_t mpack_tree_missing_node(mpack_tree_t* tree) {
  */
 void mpack_tree_init_data(mpack_tree_t* tree, const char* data, size_t length);
 
+/**
+ * Initializes a tree parser with the given data, allocating the nodes of each
+ * message in a single block.
+ *
+ * This behaves like @ref mpack_tree_init_data(), except that each message is
+ * first scanned with @ref mpack_tree_count_nodes() so that all of its nodes
+ * can be allocated in one contiguous block of exactly the right size, and the
+ * parse stack can be allocated at exactly the depth of the message. Nodes are
+ * then stored in parse order without any page chain, and a kept block is
+ * reused for the next message if it is large enough (see @ref
+ * mpack_tree_set_reuse_limit().)
+ *
+ * This costs an additional pass over the data, so it is best suited to
+ * messages whose nodes span many pages or that are traversed repeatedly. If a
+ * message can't be scanned (e.g. it is truncated or invalid) the tree falls
+ * back to allocating pages, and parsing flags the error as usual. With @ref
+ * mpack_tree_parse_batch(), only the first message of each batch is counted.
+ *
+ * The tree must be destroyed with mpack_tree_destroy().
+ *
+ * Any string or blob data types reference the original data, so the given data
+ * pointer must remain valid until after the tree is destroyed.
+ */
+void mpack_tree_init_exact(mpack_tree_t* tree, const char* data, size_t length);
+
 /**
  * Deprecated.
  *
@@ -424,6 +615,28 @@ MPACK_INLINE void mpack_tree_init_file(mpack_tree_t* tree, const char* filename,
 void mpack_tree_init_stdfile(mpack_tree_t* tree, FILE* stdfile, size_t max_bytes, bool close_when_done);
 #endif
 
+#if MPACK_MMAP
+/**
+ * Initializes a tree to parse the given file in place by mapping it into
+ * memory. The tree must be destroyed with mpack_tree_destroy(), even if
+ * parsing fails.
+ *
+ * Unlike @ref mpack_tree_init_filename(), the file is not copied into a
+ * buffer. The parsed nodes point directly into the mapped file, and pages are
+ * loaded by the operating system as the tree is parsed. The file is unmapped
+ * when the tree is destroyed.
+ *
+ * The file must not be modified while the tree is in use.
+ *
+ * This requires @ref MPACK_MMAP.
+ *
+ * @param tree The tree to initialize
+ * @param filename The path of the file to map
+ * @param max_bytes The maximum size of file to map, or 0 for unlimited size.
+ */
+void mpack_tree_init_mmap(mpack_tree_t* tree, const char* filename, size_t max_bytes);
+#endif
+
 /**
  * @}
  */
@@ -450,6 +663,170 @@ void mpack_tree_init_stdfile(mpack_tree_t* tree, FILE* stdfile, size_t max_bytes
 void mpack_tree_set_limits(mpack_tree_t* tree, size_t max_message_size,
         size_t max_message_nodes);
 
+#ifdef MPACK_MALLOC
+/**
+ * Enables hashed key lookups in maps of at least the given number of
+ * key/value pairs.
+ *
+ * By default, looking up a key in a map (e.g. with @ref mpack_node_map_cstr()
+ * or @ref mpack_node_map_contains_int()) is a linear search over all keys in
+ * the map. If this is enabled, the first lookup in a map that is large enough
+ * builds a hash table of its keys, and subsequent lookups in that map take
+ * constant time. This can be much faster if you look up many keys in large
+ * maps.
+ *
+ * Duplicate keys are still detected: looking up a key that appears more than
+ * once in a map flags @ref mpack_error_data, as without an index.
+ *
+ * Indices are allocated with @ref MPACK_MALLOC() and are freed when the next
+ * message is parsed or when the tree is destroyed. If an index cannot be
+ * allocated, lookups in that map fall back to a linear search.
+ *
+ * This requires @ref MPACK_MALLOC.
+ *
+ * @param tree The tree parser
+ * @param min_count The minimum number of key/value pairs a map must contain
+ *        to be indexed, or 0 to disable indexing (the default.)
+ */
+void mpack_tree_set_map_index(mpack_tree_t* tree, size_t min_count);
+
+/**
+ * Sets the key table in which the tree interns the str keys of maps.
+ *
+ * While parsing, every str key of a map that is no longer than the table's
+ * maximum length is interned in the table, and its ID is stored in its node.
+ * Maps can then be searched with @ref mpack_node_map_key_id(). See @ref
+ * mpack_key_table_t for details.
+ *
+ * The table is referenced, not copied. It must outlive the tree (or be
+ * replaced before it is destroyed.) If a new key cannot be added to the table
+ * because memory could not be allocated, @ref mpack_error_memory is flagged
+ * on the tree.
+ *
+ * This must be called before parsing.
+ *
+ * This requires @ref MPACK_MALLOC.
+ *
+ * @param tree The tree parser
+ * @param table The key table, or NULL to stop interning keys (the default.)
+ */
+void mpack_tree_set_key_table(mpack_tree_t* tree, mpack_key_table_t* table);
+
+/**
+ * Sets the allocator for the tree's dynamic memory.
+ *
+ * This is used for node pages, the parsing stack, map indices, the buffer of
+ * a stream and the results of @ref mpack_node_data_alloc() and friends. It
+ * does not apply to memory allocated by the tree's initializer itself (for
+ * example the file contents of @ref mpack_tree_init_filename().)
+ *
+ * The allocator is copied into the tree. This must be called before parsing.
+ *
+ * This requires @ref MPACK_MALLOC.
+ *
+ * @see mpack_arena_allocator() to parse each message out of an arena that is
+ *      reset between messages.
+ *
+ * @param tree The tree parser
+ * @param allocator The allocator, or NULL to use MPACK_MALLOC() and
+ *        MPACK_FREE()
+ */
+void mpack_tree_set_allocator(mpack_tree_t* tree, const mpack_allocator_t* allocator);
+
+/**
+ * Sets the maximum memory the tree keeps from one message for reuse by the
+ * next.
+ *
+ * When a new message is parsed (or the tree is reset with @ref
+ * mpack_tree_reset()), the node pages of the previous message are kept for
+ * reuse up to this many bytes, and a grown parse stack is kept if it is no
+ * larger than this. A stream tree reset with mpack_tree_reset() also frees
+ * its buffer if it is larger than this. Everything is freed when the tree is
+ * destroyed.
+ *
+ * The default is SIZE_MAX (no limit), so a long-lived tree allocates nothing
+ * in steady state. Pass 0 to free everything between messages.
+ *
+ * This requires @ref MPACK_MALLOC.
+ *
+ * @param tree The tree parser
+ * @param max_bytes The high-water mark of memory kept for reuse
+ */
+void mpack_tree_set_reuse_limit(mpack_tree_t* tree, size_t max_bytes);
+#endif
+
+/**
+ * Resets the tree to parse new data, keeping its settings and the memory it
+ * has allocated.
+ *
+ * This clears any error and discards the previous message, whose nodes are
+ * invalidated. Unlike destroying and re-initializing the tree, the node
+ * pages, parse stack and buffer are kept (up to the limit set by @ref
+ * mpack_tree_set_reuse_limit()) so that a long-lived tree can parse messages
+ * in steady state without allocating. The error handler, teardown, allocator
+ * and other settings are unchanged.
+ *
+ * A tree with a read function (see @ref mpack_tree_init_stream()) discards
+ * its buffered data and then reads from its read function again; data must be
+ * NULL and length must be zero. Otherwise the tree will parse the given data.
+ *
+ * @param tree The tree parser
+ * @param data The new data to parse, or NULL for a stream tree
+ * @param length The length of the data in bytes
+ */
+void mpack_tree_reset(mpack_tree_t* tree, const char* data, size_t length);
+
+/**
+ * Enables or disables lazy parsing of maps and arrays.
+ *
+ * By default, mpack_tree_parse() creates a node for every element in the
+ * message. In a lazy tree, parsing only validates the structure of the
+ * message and creates its root node. The children of a map or array are
+ * parsed the first time they are reached through @ref mpack_node_array_at(),
+ * @ref mpack_node_map_key_at(), @ref mpack_node_map_value_at() or any map
+ * lookup (e.g. @ref mpack_node_map_cstr()). This can be much faster and use
+ * much less memory if you only access a small part of large messages.
+ *
+ * Nodes behave the same in a lazy tree: node handles remain valid until the
+ * next message is parsed, and errors are flagged on the tree as usual. Note
+ * however that the node limit (see @ref mpack_tree_set_limits()) applies to
+ * the nodes materialized so far, so @ref mpack_error_too_big or @ref
+ * mpack_error_memory can be flagged when a container is first accessed
+ * rather than during parsing.
+ *
+ * Lazy parsing only applies to trees of complete data (see @ref
+ * mpack_tree_init_data() and @ref mpack_tree_init_pool()). A tree with a read
+ * function always parses every element.
+ *
+ * This must be called before parsing.
+ *
+ * @param tree The tree parser
+ * @param lazy Whether maps and arrays should be parsed on first access
+ */
+void mpack_tree_set_lazy(mpack_tree_t* tree, bool lazy);
+
+/**
+ * Enables or disables recording the source byte span of each map and array.
+ *
+ * When enabled, the parser records where each non-empty map and array starts
+ * and ends in the message. This allows @ref mpack_node_span() to return the
+ * original encoding of a container, and allows @ref mpack_write_node() to
+ * copy untouched subtrees verbatim rather than re-encoding them.
+ *
+ * This uses one extra node for each non-empty map and array. This does not
+ * count towards the node limit (see @ref mpack_tree_set_limits()) but it does
+ * use space in a node pool (see @ref mpack_tree_init_pool().)
+ *
+ * Spans are not recorded in a lazy tree of complete data (see @ref
+ * mpack_tree_set_lazy().)
+ *
+ * This must be called before parsing.
+ *
+ * @param tree The tree parser
+ * @param spans Whether the spans of maps and arrays should be recorded
+ */
+void mpack_tree_set_spans(mpack_tree_t* tree, bool spans);
+
 /**
  * Parses a MessagePack message into a tree of immutable nodes.
  *
@@ -469,6 +846,97 @@ void mpack_tree_set_limits(mpack_tree_t* tree, size_t max_message_size,
  */
 void mpack_tree_parse(mpack_tree_t* tree);
 
+/**
+ * Parses a series of consecutive MessagePack messages into a single tree,
+ * storing the root node of each message in the given array.
+ *
+ * Messages are parsed until @p max_roots messages have been parsed or the
+ * data is exhausted. The nodes of all messages share the tree's pages, so
+ * the cost of allocating pages and setting up the parser is shared among all
+ * messages of the batch. All roots remain valid together until the next time
+ * a parse is started.
+ *
+ * After this returns, @ref mpack_tree_root() returns the first root and
+ * @ref mpack_tree_size() returns the total size of all messages in the batch.
+ * This can be called again to parse the next batch of messages. The tree
+ * limits set by @ref mpack_tree_set_limits() apply to each message
+ * individually.
+ *
+ * This is only supported on trees parsing data in memory (i.e. with
+ * @ref mpack_tree_init_data() or @ref mpack_tree_init_pool()), not on streams.
+ *
+ * If any message is incomplete or invalid, an error is flagged and this
+ * returns 0. There is no way to recover a tree in an error state. It must be
+ * destroyed.
+ *
+ * @param tree The tree parser
+ * @param roots An array in which to store the root node of each message
+ * @param max_roots The maximum number of messages to parse. This must be at
+ *        least 1.
+ * @return The number of messages parsed
+ */
+size_t mpack_tree_parse_batch(mpack_tree_t* tree, mpack_node_t* roots, size_t max_roots);
+
+/**
+ * Counts the nodes of the first message in the given data without parsing it.
+ *
+ * The data is scanned like @ref mpack_discard() skips elements, without
+ * allocating or building any nodes. On success, @p count is set to the number
+ * of elements in the message (the number of nodes mpack_tree_parse() would
+ * create for it, not counting spans) and @p max_depth is set to the depth of
+ * its deepest element, where the root is at depth 1.
+ *
+ * Any data following the first message is ignored.
+ *
+ * @param data The data to scan
+ * @param length The length of the data in bytes
+ * @param count Set to the number of nodes in the message, or 0 on error
+ * @param max_depth Set to the nesting depth of the message, or 0 on error
+ * @return @ref mpack_ok, @ref mpack_error_invalid if the message is
+ *         truncated or invalid, or @ref mpack_error_unsupported if it contains
+ *         an ext type and @ref MPACK_EXTENSIONS is disabled. Without @ref
+ *         MPACK_MALLOC, messages nested deeper than @ref
+ *         MPACK_NODE_MAX_DEPTH_WITHOUT_MALLOC return @ref mpack_error_too_big.
+ */
+mpack_error_t mpack_tree_count_nodes(const char* data, size_t length, size_t* count, size_t* max_depth);
+
+/**
+ * A contiguous range of elements of a root array or map, as found by
+ * @ref mpack_tree_split_data().
+ */
+typedef struct mpack_tree_chunk_t {
+    const char* data; /**< The first element of the chunk. */
+    size_t size;      /**< The total size in bytes of the elements of the chunk. */
+    size_t count;     /**< The number of elements. Keys and values of a map are counted separately. */
+} mpack_tree_chunk_t;
+
+/**
+ * Splits the elements of a message whose root is an array or map into
+ * contiguous chunks that can be parsed independently, for example on separate
+ * threads.
+ *
+ * The data is scanned without allocating or building any nodes. The elements
+ * are divided as evenly as possible among at most @p max_chunks chunks; the
+ * key and value of a map pair are always placed in the same chunk.
+ *
+ * Each chunk is a series of consecutive messages. It can be parsed by
+ * initializing a tree with @ref mpack_tree_init_data() on the chunk's data and
+ * calling @ref mpack_tree_parse_batch() with the chunk's count.
+ *
+ * @param data The message to split
+ * @param length The length of the data. Any data after the message is ignored.
+ * @param chunks An array in which to store the chunks
+ * @param max_chunks The maximum number of chunks
+ * @param chunk_count The number of chunks stored. This is less than
+ *        @p max_chunks if the root has fewer elements (or pairs for a map),
+ *        and zero if the root is empty.
+ * @return @ref mpack_error_type if the root is not an array or map,
+ *         @ref mpack_error_invalid if the message is truncated or invalid,
+ *         or @ref mpack_ok otherwise.
+ */
+mpack_error_t mpack_tree_split_data(const char* data, size_t length,
+        mpack_tree_chunk_t* chunks, size_t max_chunks, size_t* chunk_count);
+
 /**
  * Attempts to parse a MessagePack message from a non-blocking stream into a
  * tree of immutable nodes.
@@ -493,6 +961,41 @@ void mpack_tree_parse(mpack_tree_t* tree);
  */
 bool mpack_tree_try_parse(mpack_tree_t* tree);
 
+#ifdef MPACK_MALLOC
+/**
+ * Hands the buffered data that follows the parsed message of a stream tree
+ * over to another stream tree, so that the next message can be parsed into
+ * @p next while the nodes and data of @p tree are still in use.
+ *
+ * Normally a stream tree's nodes and data are only valid until the next parse
+ * is started. With two or more trees (and therefore two or more buffers)
+ * reading from the same stream, a message can be handed to a consumer (for
+ * example on another thread) while the next is being read and parsed:
+ *
+ * @code{.c}
+ * mpack_tree_parse(&trees[i]);
+ * mpack_tree_pipeline(&trees[i], &trees[(i + 1) % count]);
+ * // consume trees[i], then parse trees[(i + 1) % count]
+ * @endcode
+ *
+ * Only the bytes of the next message that were already read are copied; the
+ * rest is read into @p next by its own read function. Both trees must have
+ * been initialized with mpack_tree_init_stream() on the same stream, and all
+ * data previously handed to @p next must have been parsed. Anything parsed
+ * in @p next is discarded, so its consumer must be done with it. The parsed
+ * message of @p tree is unaffected, and @p tree can later be parsed again
+ * once another tree hands data back to it.
+ *
+ * If @p tree is in an error state, the error is flagged on @p next.
+ *
+ * @param tree A stream tree which has parsed a message
+ * @param next The stream tree in which to parse the following message
+ *
+ * @see mpack_tree_init_stream()
+ */
+void mpack_tree_pipeline(mpack_tree_t* tree, mpack_tree_t* next);
+#endif
+
 /**
  * Returns the root node of the tree, if the tree is not in an error state.
  * Returns a nil node otherwise.
@@ -509,6 +1012,33 @@ MPACK_INLINE mpack_error_t mpack_tree_error(mpack_tree_t* tree) {
     return tree->error;
 }
 
+#if MPACK_STATS
+/**
+ * Returns the instrumentation counters of the tree since it was
+ * initialized or since they were last reset.
+ *
+ * @see MPACK_STATS
+ */
+MPACK_INLINE mpack_tree_stats_t mpack_tree_stats(const mpack_tree_t* tree) {
+    return tree->stats;
+}
+
+/**
+ * Resets the instrumentation counters of the tree to zero.
+ */
+void mpack_tree_reset_stats(mpack_tree_t* tree);
+#endif
+
+/**
+ * Returns the data of the current parsed message.
+ *
+ * This points to the first byte of the message. The data is valid until the
+ * next message is parsed or the tree is destroyed.
+ */
+MPACK_INLINE const char* mpack_tree_data(mpack_tree_t* tree) {
+    return tree->data;
+}
+
 /**
  * Returns the size in bytes of the current parsed message.
  *
@@ -596,6 +1126,67 @@ void mpack_tree_flag_error(mpack_tree_t* tree, mpack_error_t error);
  * @}
  */
 
+#ifdef MPACK_MALLOC
+/**
+ * @name Key Interning
+ * @{
+ */
+
+/**
+ * Initializes an empty key table.
+ *
+ * No memory is allocated until the first key is interned. The table must be
+ * destroyed with mpack_key_table_destroy().
+ *
+ * @param table The key table
+ * @param max_length The length in bytes of the longest key to intern. Longer
+ *        keys are not interned, so they can't be searched by ID.
+ */
+void mpack_key_table_init(mpack_key_table_t* table, size_t max_length);
+
+/**
+ * Frees all memory owned by the key table.
+ *
+ * All IDs and key pointers from the table are invalidated.
+ */
+void mpack_key_table_destroy(mpack_key_table_t* table);
+
+/**
+ * Interns the given key, returning its ID.
+ *
+ * If the key is already in the table its existing ID is returned; otherwise
+ * it is copied into the table and given the next ID.
+ *
+ * @return The ID of the key, or 0 if the key is longer than the table's
+ *     maximum length, if the table already holds 65535 keys, or if memory
+ *     could not be allocated.
+ */
+uint16_t mpack_key_table_intern(mpack_key_table_t* table, const char* key, size_t length);
+
+/**
+ * Returns the ID of the given key, or 0 if it has not been interned.
+ */
+uint16_t mpack_key_table_find(const mpack_key_table_t* table, const char* key, size_t length);
+
+/**
+ * Returns the table's null-terminated copy of the key with the given ID.
+ *
+ * The pointer is valid until the table is destroyed. Use this instead of
+ * @ref mpack_node_cstr_alloc() to get keys that are parsed repeatedly.
+ *
+ * @param table The key table
+ * @param id The ID of an interned key
+ * @param length If not NULL, the length of the key is placed here.
+ *
+ * @return The key, or NULL if the ID is not valid.
+ */
+const char* mpack_key_table_key(const mpack_key_table_t* table, uint16_t id, size_t* length);
+
+/**
+ * @}
+ */
+#endif
+
 /**
  * @name Node Core Functions
  * @{
@@ -626,6 +1217,21 @@ MPACK_INLINE mpack_error_t mpack_node_error(mpack_node_t node) {
  */
 mpack_tag_t mpack_node_tag(mpack_node_t node);
 
+/**
+ * Returns the source bytes of a map or array in the message data, storing
+ * their size in the given pointer.
+ *
+ * This is only available if spans were recorded with @ref
+ * mpack_tree_set_spans(). NULL is returned without flagging an error if the
+ * node is not a non-empty map or array, if its span was not recorded, or if
+ * the tree is in an error state.
+ *
+ * The returned pointer is valid until the next message is parsed.
+ *
+ * @see mpack_write_node()
+ */
+const char* mpack_node_span(mpack_node_t node, size_t* size);
+
 /** @cond */
 
 #if MPACK_DEBUG && MPACK_STDIO
@@ -835,6 +1441,9 @@ float mpack_node_float(mpack_node_t node);
  * @note Reading a very large integer with this function can incur a
  * loss of precision.
  *
+ * Doubles written in compact form (see mpack_writer_set_compact_floats())
+ * are always read back exactly.
+ *
  * @throws mpack_error_type if the underlying value is not a float, double or integer.
  */
 double mpack_node_double(mpack_node_t node);
@@ -1110,7 +1719,8 @@ void mpack_node_copy_utf8_cstr(mpack_node_t node, char* buffer, size_t size);
  * contained by this node.
  *
  * The allocated data must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the tree's allocator
+ * if one was set with @ref mpack_tree_set_allocator().
  *
  * @throws mpack_error_type If this node is not a str, bin or ext type
  * @throws mpack_error_too_big If the size of the data is larger than the
@@ -1129,7 +1739,8 @@ char* mpack_node_data_alloc(mpack_node_t node, size_t maxsize);
  * contained by this node.
  *
  * The allocated string must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the tree's allocator
+ * if one was set with @ref mpack_tree_set_allocator().
  *
  * @throws mpack_error_type If this node is not a string or contains NUL bytes
  * @throws mpack_error_too_big If the size of the string plus null-terminator
@@ -1148,7 +1759,8 @@ char* mpack_node_cstr_alloc(mpack_node_t node, size_t maxsize);
  * string contained by this node.
  *
  * The allocated string must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the tree's allocator
+ * if one was set with @ref mpack_tree_set_allocator().
  *
  * @throws mpack_error_type If this node is not a string, is not valid UTF-8,
  *     or contains NUL bytes
@@ -1223,6 +1835,35 @@ size_t mpack_node_enum(mpack_node_t node, const char* strings[], size_t count);
  */
 size_t mpack_node_enum_optional(mpack_node_t node, const char* strings[], size_t count);
 
+#ifdef MPACK_MALLOC
+/**
+ * Finds the string of the given matcher that matches the given node,
+ * returning its index.
+ *
+ * This is the same as mpack_node_enum() except that the string is found
+ * with a prebuilt @ref mpack_enum_matcher_t rather than by comparing it to
+ * each string in turn.
+ *
+ * @note This requires @ref MPACK_MALLOC.
+ *
+ * @return The index of the matched string, or the number of strings in the
+ * matcher in case of error
+ */
+size_t mpack_node_enum_matcher(mpack_node_t node, const mpack_enum_matcher_t* matcher);
+
+/**
+ * Finds the string of the given matcher that matches the given node,
+ * returning its index or the number of strings in the matcher if no strings
+ * match.
+ *
+ * This is the same as mpack_node_enum_optional() except that the string is
+ * found with a prebuilt @ref mpack_enum_matcher_t.
+ *
+ * @note This requires @ref MPACK_MALLOC.
+ */
+size_t mpack_node_enum_matcher_optional(mpack_node_t node, const mpack_enum_matcher_t* matcher);
+#endif
+
 /**
  * @}
  */
@@ -1246,6 +1887,59 @@ size_t mpack_node_array_length(mpack_node_t node);
  */
 mpack_node_t mpack_node_array_at(mpack_node_t node, size_t index);
 
+/**
+ * Copies the elements of the given array node into the given buffer as
+ * unsigned integers, returning the number of elements copied.
+ *
+ * Each element is converted as with mpack_node_u32(). This is much faster
+ * than calling mpack_node_u32() on each element with mpack_node_array_at().
+ *
+ * If the node is not an array or any element is not an integer in range,
+ * @ref mpack_error_type is raised. If the array has more than @a max_count
+ * elements, @ref mpack_error_too_big is raised. In either case zero is
+ * returned.
+ *
+ * @param node The array node
+ * @param values A buffer for at least @a max_count elements
+ * @param max_count The maximum number of elements to copy
+ */
+size_t mpack_node_array_u32(mpack_node_t node, uint32_t* values, size_t max_count);
+
+/**
+ * Copies the elements of the given array node into the given buffer as
+ * signed integers, returning the number of elements copied.
+ *
+ * Each element is converted as with mpack_node_i64(). See
+ * mpack_node_array_u32() for details.
+ */
+size_t mpack_node_array_i64(mpack_node_t node, int64_t* values, size_t max_count);
+
+#if MPACK_FLOAT
+/**
+ * Copies the elements of the given array node into the given buffer as
+ * floats, returning the number of elements copied.
+ *
+ * Each element is converted as with mpack_node_float(). See
+ * mpack_node_array_u32() for details.
+ *
+ * @note This requires @ref MPACK_FLOAT.
+ */
+size_t mpack_node_array_float(mpack_node_t node, float* values, size_t max_count);
+#endif
+
+#if MPACK_DOUBLE
+/**
+ * Copies the elements of the given array node into the given buffer as
+ * doubles, returning the number of elements copied.
+ *
+ * Each element is converted as with mpack_node_double(). See
+ * mpack_node_array_u32() for details.
+ *
+ * @note This requires @ref MPACK_DOUBLE.
+ */
+size_t mpack_node_array_double(mpack_node_t node, double* values, size_t max_count);
+#endif
+
 /**
  * Returns the number of key/value pairs in the given map node. Raises
  * mpack_error_type and returns 0 if the given node is not a map.
@@ -1405,6 +2099,57 @@ mpack_node_t mpack_node_map_cstr(mpack_node_t node, const char* cstr);
  */
 mpack_node_t mpack_node_map_cstr_optional(mpack_node_t node, const char* cstr);
 
+#ifdef MPACK_MALLOC
+/**
+ * Returns the interned key ID of the given str node, or 0 if it was not
+ * interned.
+ *
+ * Only the str keys of maps are interned, and only if the tree has a key
+ * table (see @ref mpack_tree_set_key_table().) This does not flag an error.
+ */
+uint16_t mpack_node_key_id(mpack_node_t node);
+
+/**
+ * Returns the value node in the given map for the str key with the given
+ * interned ID.
+ *
+ * This matches the same keys as @ref mpack_node_map_str() would for the
+ * interned key, but compares IDs rather than key bytes. The tree must have a
+ * key table (see @ref mpack_tree_set_key_table()) and the ID must come from
+ * it.
+ *
+ * The key must exist within the map. Use mpack_node_map_key_id_optional() to
+ * check for optional keys.
+ *
+ * The key must be unique. An error is flagged if the node has multiple
+ * entries with the given key.
+ *
+ * @throws mpack_error_type If the node is not a map
+ * @throws mpack_error_data If the node does not contain exactly one entry with the given key
+ *
+ * @return The value node for the given key, or a nil node in case of error
+ */
+mpack_node_t mpack_node_map_key_id(mpack_node_t node, uint16_t id);
+
+/**
+ * Returns the value node in the given map for the str key with the given
+ * interned ID, or a missing node if the map does not contain the key.
+ *
+ * The key must be unique. An error is flagged if the node has multiple
+ * entries with the given key.
+ *
+ * @throws mpack_error_type If the node is not a map
+ * @throws mpack_error_data If the node contains more than one entry with the given key
+ *
+ * @return The value node for the given key, or a missing node if the key does
+ *         not exist, or a nil node in case of error
+ *
+ * @see mpack_node_map_key_id()
+ * @see mpack_node_is_missing()
+ */
+mpack_node_t mpack_node_map_key_id_optional(mpack_node_t node, uint16_t id);
+#endif
+
 /**
  * Returns true if the given node map contains exactly one entry with the
  * given integer key.
@@ -1457,6 +2202,86 @@ bool mpack_node_map_contains_cstr(mpack_node_t node, const char* cstr);
  * @}
  */
 
+/**
+ * @name Node Comparison Functions
+ * @{
+ */
+
+/**
+ * Returns true if the given nodes contain equal data.
+ *
+ * Nodes are compared as they would be written by a canonical build (see @ref
+ * mpack_writer_set_canonical()), so two nodes are equal if and only if their
+ * canonical encodings are identical. This means that:
+ *
+ * - Integers are equal if they have the same value, regardless of whether
+ *   they are signed or unsigned and of the size of their encoding;
+ * - Floats and doubles are equal if they have the same bits once doubles are
+ *   narrowed to floats where this is exact. Unlike the == operator, a NaN is
+ *   equal to itself and 0.0 differs from -0.0. Integers never equal reals;
+ * - Strings, binary blobs and extensions are equal if they have the same type,
+ *   extension type and bytes;
+ * - Arrays are equal if their elements are equal in order;
+ * - Maps are equal if they have the same number of entries and each key of
+ *   one map has an equal key in the other with an equal value, regardless of
+ *   the order of the entries.
+ *
+ * Maps whose entries are in the same order are compared in linear time, but
+ * reordered maps may take quadratic time. The result is unspecified if either
+ * map contains duplicate keys.
+ *
+ * The nodes can be in different trees. False is returned if either tree is in
+ * an error state.
+ *
+ * @see mpack_node_hash()
+ */
+bool mpack_node_equal(mpack_node_t left, mpack_node_t right);
+
+/**
+ * Returns a hash of the data in the given node.
+ *
+ * The hash agrees with @ref mpack_node_equal(): equal nodes always have the
+ * same hash, including maps whose entries are in different orders. The hash
+ * is stable across platforms and versions of MPack built with the same float
+ * configuration, so it can be used to identify or deduplicate messages.
+ *
+ * Zero is returned if the tree is in an error state.
+ */
+uint64_t mpack_node_hash(mpack_node_t node);
+
+/**
+ * @}
+ */
+
+#if MPACK_WRITER
+/**
+ * @name Node Writing Functions
+ * @{
+ */
+
+/**
+ * Writes the given node and all of its contents to the writer.
+ *
+ * Maps and arrays whose spans were recorded (see @ref mpack_tree_set_spans())
+ * are copied verbatim from the message data as with @ref
+ * mpack_write_object_bytes(). Everything else is re-encoded, so integers and
+ * headers are written in their smallest encoding. Strings, binary blobs and
+ * extensions are copied from the message data.
+ *
+ * This allows a modified message to be re-encoded by writing the changed
+ * elements directly and splicing in the untouched ones with this.
+ *
+ * If the node's tree is in an error state, its error is flagged on the writer.
+ *
+ * @note This requires @ref MPACK_WRITER.
+ */
+void mpack_write_node(mpack_writer_t* writer, mpack_node_t node);
+
+/**
+ * @}
+ */
+#endif
+
 /**
  * @}
  */
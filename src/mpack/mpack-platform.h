@@ -170,6 +170,24 @@
 #define MPACK_NODE 1
 #endif
 
+/**
+ * @def MPACK_SAX
+ *
+ * Enables compilation of the SAX API.
+ *
+ * The SAX API is an event-based parser that is fed data in chunks and calls
+ * a callback for each element. It does not allocate, so it can parse streams
+ * of any length in constant memory.
+ *
+ * This is enabled by default if MPACK_READER is enabled.
+ *
+ * @see mpack_sax_init()
+ * @see mpack_sax_parse()
+ */
+#ifndef MPACK_SAX
+#define MPACK_SAX MPACK_READER
+#endif
+
 /**
  * @def MPACK_WRITER
  *
@@ -198,6 +216,44 @@
  */
 // This is defined furthur below after we've resolved whether we have malloc().
 
+/**
+ * @def MPACK_SCHEMA
+ *
+ * Enables compilation of the Schema API.
+ *
+ * The Schema API encodes and decodes C structs as maps according to a table
+ * of field descriptors, and extracts arrays of maps into columns. Decoding
+ * requires MPACK_EXPECT and encoding requires MPACK_WRITER.
+ *
+ * This requires a @c malloc(). It is enabled by default if MPACK_EXPECT or
+ * MPACK_WRITER is enabled and MPACK_MALLOC is defined.
+ *
+ * @see mpack_schema_init()
+ * @see mpack_encode_struct()
+ * @see mpack_decode_struct()
+ * @see mpack_node_columns()
+ * @see mpack_decode_columns()
+ */
+// This is defined furthur below after we've resolved whether we have malloc().
+
+/**
+ * @def MPACK_JSON
+ *
+ * Enables compilation of the JSON API.
+ *
+ * The JSON API transcodes MessagePack to JSON from a Reader or a Node tree,
+ * and encodes JSON text to MessagePack with a Writer. It requires the Builder
+ * (and therefore a @c malloc()), MPACK_STDIO and MPACK_STDLIB for formatting
+ * and parsing floating point numbers, and MPACK_DOUBLE.
+ *
+ * This is enabled by default if all of these are enabled.
+ *
+ * @see mpack_transcode_json()
+ * @see mpack_node_transcode_json()
+ * @see mpack_write_json()
+ */
+// This is defined furthur below after we've resolved whether we have malloc().
+
 /**
  * @def MPACK_COMPATIBILITY
  *
@@ -330,6 +386,43 @@
     #endif
 #endif
 
+/**
+ * @def MPACK_MMAP
+ *
+ * Enables @ref mpack_tree_init_mmap(), which parses a file in place by
+ * mapping it into memory rather than reading it into a buffer.
+ *
+ * This requires POSIX @c mmap() or Windows file mappings, as well as
+ * @ref MPACK_MALLOC. It is disabled by default.
+ *
+ * MPack does not define any feature test macros for this. If your platform
+ * hides the POSIX declarations in strict ISO C modes, define
+ * @c _POSIX_C_SOURCE (or similar) in your build system so that it applies
+ * before any system headers, including those in your @c mpack-config.h.
+ * The @c posix_madvise() read-ahead hint is skipped if the headers do not
+ * define @c POSIX_MADV_SEQUENTIAL.
+ */
+#ifndef MPACK_MMAP
+    #define MPACK_MMAP 0
+#endif
+
+/**
+ * @def MPACK_COMPRESS
+ *
+ * Enables the compression adapters, which compress the output of a Writer
+ * and decompress the input of a Reader or Node tree with a user-supplied
+ * codec such as zstd or LZ4.
+ *
+ * This is disabled by default.
+ *
+ * @see mpack_writer_set_compressor()
+ * @see mpack_reader_set_decompressor()
+ * @see mpack_tree_init_decompressor()
+ */
+#ifndef MPACK_COMPRESS
+    #define MPACK_COMPRESS 0
+#endif
+
 /**
  * Whether the 'float' type and floating point operations are supported.
  *
@@ -477,6 +570,22 @@
     #endif
 #endif
 
+#ifndef MPACK_SCHEMA
+    #if defined(MPACK_MALLOC) && (MPACK_EXPECT || MPACK_WRITER)
+        #define MPACK_SCHEMA 1
+    #else
+        #define MPACK_SCHEMA 0
+    #endif
+#endif
+
+#ifndef MPACK_JSON
+    #if MPACK_BUILDER && MPACK_STDLIB && MPACK_STDIO && MPACK_DOUBLE
+        #define MPACK_JSON 1
+    #else
+        #define MPACK_JSON 0
+    #endif
+#endif
+
 
 
 /**
@@ -719,6 +828,60 @@
     #error "MPACK_WRITE_TRACKING requires MPACK_WRITER."
 #endif
 
+/**
+ * @def MPACK_TRACKING_INITIAL_CAPACITY
+ *
+ * The number of nested compound types (maps, arrays, strs, bins and exts)
+ * that read and write tracking can track without allocating.
+ *
+ * The tracking state is stored inline in the reader or writer up to this
+ * depth, so most readers and writers never allocate for tracking. If
+ * elements are nested deeper than this, the state is moved to the heap and
+ * grown as needed. Without @c malloc(), deeper nesting flags @ref
+ * mpack_error_too_big instead.
+ */
+#ifndef MPACK_TRACKING_INITIAL_CAPACITY
+#define MPACK_TRACKING_INITIAL_CAPACITY 8
+#endif
+#if MPACK_TRACKING_INITIAL_CAPACITY < 1
+    #error "MPACK_TRACKING_INITIAL_CAPACITY must be at least 1."
+#endif
+
+/**
+ * @def MPACK_TRACKING_DEPTH_ONLY
+ *
+ * Enables a cheaper mode for read and write tracking that only counts the
+ * depth of open compound types.
+ *
+ * In this mode, tracking checks only that no more compound types are closed
+ * than were opened, and that none are left open when the reader or writer is
+ * destroyed. It does not check element counts, byte counts or types. The
+ * tracking state is a single counter so it never allocates and adds almost
+ * no overhead.
+ *
+ * This is useful to keep some tracking enabled in builds where performance
+ * matters.
+ */
+#ifndef MPACK_TRACKING_DEPTH_ONLY
+#define MPACK_TRACKING_DEPTH_ONLY 0
+#endif
+
+/**
+ * @def MPACK_STATS
+ *
+ * Enables instrumentation counters on readers, writers and trees. These
+ * count the work done on slow paths, such as calls to fill and flush
+ * functions, data straddling the end of a buffer, buffer growth and page
+ * allocations. They can be queried with mpack_reader_stats(),
+ * mpack_writer_stats() and mpack_tree_stats().
+ *
+ * This is disabled by default. When disabled, the counters and their query
+ * functions are compiled out entirely.
+ */
+#ifndef MPACK_STATS
+#define MPACK_STATS 0
+#endif
+
 /**
  * @}
  */
@@ -772,6 +935,16 @@
 #define MPACK_BUFFER_SIZE 4096
 #endif
 
+/**
+ * The minimum size in bytes of a str, bin or ext payload for a writer with an
+ * iovec flush function to reference it instead of copying it into its buffer.
+ *
+ * @see mpack_writer_set_flush_iov()
+ */
+#ifndef MPACK_WRITER_IOV_MIN_SIZE
+#define MPACK_WRITER_IOV_MIN_SIZE 1024
+#endif
+
 /**
  * Minimum size for paged allocations in bytes.
  *
@@ -809,6 +982,17 @@
 #define MPACK_BUILDER_PAGE_SIZE MPACK_PAGE_SIZE
 #endif
 
+/**
+ * Minimum size of a chunk allocated by an @ref mpack_arena_t in bytes.
+ *
+ * This should fit several node or builder pages so that most arena
+ * allocations are carved out of an existing chunk. Larger allocations get a
+ * chunk of their own.
+ */
+#ifndef MPACK_ARENA_CHUNK_SIZE
+#define MPACK_ARENA_CHUNK_SIZE (MPACK_PAGE_SIZE * 16)
+#endif
+
 /**
  * @def MPACK_BUILDER_INTERNAL_STORAGE
  *
@@ -862,6 +1046,73 @@
 #define MPACK_NODE_MAX_DEPTH_WITHOUT_MALLOC 32
 #endif
 
+/**
+ * The maximum number of steps in a compiled path query.
+ *
+ * An @ref mpack_path_t stores its steps inline, and evaluating a path recurses
+ * once per step, so this should not be set too large.
+ *
+ * @see mpack_path_compile()
+ */
+#ifndef MPACK_PATH_MAX_STEPS
+#define MPACK_PATH_MAX_STEPS 16
+#endif
+
+/**
+ * The maximum depth of maps and arrays for the SAX parser.
+ *
+ * The SAX parser keeps the state of each open map and array in the @ref
+ * mpack_sax_t, so this determines its size. Deeper messages flag @ref
+ * mpack_error_too_big.
+ */
+#ifndef MPACK_SAX_MAX_DEPTH
+#define MPACK_SAX_MAX_DEPTH 32
+#endif
+
+/**
+ * The maximum depth of maps and arrays for the JSON API.
+ *
+ * Transcoding and parsing JSON recurse once per level, so this limits their
+ * stack usage. Deeper data flags @ref mpack_error_too_big.
+ */
+#ifndef MPACK_JSON_MAX_DEPTH
+#define MPACK_JSON_MAX_DEPTH 64
+#endif
+
+/**
+ * The maximum number of fields in a schema.
+ *
+ * Decoding a struct keeps a flag for each field on the call stack to detect
+ * missing and duplicate keys, so this should not be set too large.
+ *
+ * @see mpack_schema_init()
+ */
+#ifndef MPACK_SCHEMA_MAX_FIELDS
+#define MPACK_SCHEMA_MAX_FIELDS 64
+#endif
+
+/**
+ * @def MPACK_NODE_COMPACT
+ *
+ * Enables a compact layout for @ref mpack_node_data_t.
+ *
+ * By default, a node stores its type as an enum and its value as a 64-bit
+ * union that can hold a full integer, a double or a pointer to its children.
+ * This is 16 bytes per node on most platforms.
+ *
+ * The compact layout stores the type in a byte and the value in 32 bits,
+ * which is 12 bytes per node. Integers that don't fit in 32 bits and doubles
+ * are read from the message data when accessed, and the children of maps and
+ * arrays are referenced by 32-bit indices rather than pointers. This limits
+ * messages to 4 GiB; larger messages flag @ref mpack_error_too_big.
+ *
+ * This is disabled by default. Enable it to fit more nodes in each page (or
+ * pool) at a small cost in access time for large numbers and for children.
+ */
+#ifndef MPACK_NODE_COMPACT
+#define MPACK_NODE_COMPACT 0
+#endif
+
 /**
  * @def MPACK_NO_BUILTINS
  *
@@ -961,6 +1212,18 @@ void mpack_assert_fail(const char* message);
     #endif
 #endif
 
+#if MPACK_MMAP && MPACK_INTERNAL
+    #ifdef _WIN32
+        #include <windows.h>
+    #else
+        #include <sys/types.h>
+        #include <sys/stat.h>
+        #include <sys/mman.h>
+        #include <fcntl.h>
+        #include <unistd.h>
+    #endif
+#endif
+
 
 
 /*
@@ -1801,11 +2064,8 @@ MPACK_EXTERN_C_BEGIN
     #if MPACK_STDIO
         #error "MPACK_STDIO requires preprocessor definitions for MPACK_MALLOC and MPACK_FREE."
     #endif
-    #if MPACK_READ_TRACKING
-        #error "MPACK_READ_TRACKING requires preprocessor definitions for MPACK_MALLOC and MPACK_FREE."
-    #endif
-    #if MPACK_WRITE_TRACKING
-        #error "MPACK_WRITE_TRACKING requires preprocessor definitions for MPACK_MALLOC and MPACK_FREE."
+    #if MPACK_MMAP
+        #error "MPACK_MMAP requires preprocessor definitions for MPACK_MALLOC and MPACK_FREE."
     #endif
 #endif
 
@@ -69,6 +69,22 @@ void mpack_reader_init_data(mpack_reader_t* reader, const char* data, size_t cou
     mpack_log("initializing reader with data size %i\n", (int)count);
 }
 
+void mpack_reader_init_segments(mpack_reader_t* reader, char* buffer, size_t size,
+        mpack_reader_segment_t segment_fn)
+{
+    mpack_assert(segment_fn != NULL, "segment function is NULL");
+    mpack_reader_init(reader, buffer, size, 0);
+
+    if (size < MPACK_READER_MINIMUM_BUFFER_SIZE) {
+        mpack_break("buffer size is %i, but minimum buffer size for segments is %i",
+                (int)size, MPACK_READER_MINIMUM_BUFFER_SIZE);
+        mpack_reader_flag_error(reader, mpack_error_bug);
+        return;
+    }
+
+    reader->segment_fn = segment_fn;
+}
+
 void mpack_reader_set_fill(mpack_reader_t* reader, mpack_reader_fill_t fill) {
     MPACK_STATIC_ASSERT(MPACK_READER_MINIMUM_BUFFER_SIZE >= MPACK_MAXIMUM_TAG_SIZE,
             "minimum buffer size must fit any tag!");
@@ -94,6 +110,15 @@ void mpack_reader_set_skip(mpack_reader_t* reader, mpack_reader_skip_t skip) {
     reader->skip = skip;
 }
 
+#ifdef MPACK_MALLOC
+void mpack_reader_set_allocator(mpack_reader_t* reader, const mpack_allocator_t* allocator) {
+    if (allocator == NULL)
+        mpack_memset(&reader->allocator, 0, sizeof(reader->allocator));
+    else
+        reader->allocator = *allocator;
+}
+#endif
+
 #if MPACK_STDIO
 static size_t mpack_file_reader_fill(mpack_reader_t* reader, char* buffer, size_t count) {
     if (feof((FILE *)reader->context)) {
@@ -187,6 +212,7 @@ mpack_error_t mpack_reader_destroy(mpack_reader_t* reader) {
     // clean up tracking, asserting if we're not already in an error state
     #if MPACK_READ_TRACKING
     mpack_reader_flag_if_error(reader, mpack_track_destroy(&reader->track, mpack_reader_error(reader) != mpack_ok));
+    mpack_track_destroy(&reader->checkpoint_track, true);
     #endif
 
     if (reader->teardown)
@@ -210,10 +236,29 @@ size_t mpack_reader_remaining(mpack_reader_t* reader, const char** data) {
     return (size_t)(reader->end - reader->data);
 }
 
+#if MPACK_STATS
+void mpack_reader_reset_stats(mpack_reader_t* reader) {
+    mpack_memset(&reader->stats, 0, sizeof(reader->stats));
+}
+#endif
+
 void mpack_reader_flag_error(mpack_reader_t* reader, mpack_error_t error) {
     mpack_log("reader %p setting error %i: %s\n", (void*)reader, (int)error, mpack_error_to_string(error));
 
     if (reader->error == mpack_ok) {
+
+        // a reader can only resume from a checkpoint. would-block is not
+        // reported to the error handler since it's not a failure.
+        if (error == mpack_error_would_block) {
+            if (reader->checkpoint != NULL) {
+                reader->error = error;
+                reader->blocked_end = reader->end;
+                reader->end = reader->data;
+                return;
+            }
+            error = mpack_error_io;
+        }
+
         reader->error = error;
         reader->end = reader->data;
         if (reader->error_fn)
@@ -221,6 +266,37 @@ void mpack_reader_flag_error(mpack_reader_t* reader, mpack_error_t error) {
     }
 }
 
+void mpack_reader_checkpoint(mpack_reader_t* reader) {
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+
+    if (reader->fill == NULL) {
+        mpack_break("cannot set a checkpoint on a reader without a fill function!");
+        mpack_reader_flag_error(reader, mpack_error_bug);
+        return;
+    }
+
+    reader->checkpoint = reader->data;
+    #if MPACK_READ_TRACKING
+    mpack_reader_flag_if_error(reader, mpack_track_copy(&reader->checkpoint_track, &reader->track));
+    #endif
+}
+
+bool mpack_reader_resume(mpack_reader_t* reader) {
+    if (mpack_reader_error(reader) != mpack_error_would_block)
+        return false;
+
+    mpack_log("resuming reader from checkpoint, %i bytes buffered\n",
+            (int)(reader->blocked_end - reader->checkpoint));
+    reader->error = mpack_ok;
+    reader->data = reader->checkpoint;
+    reader->end = reader->blocked_end;
+    #if MPACK_READ_TRACKING
+    mpack_reader_flag_if_error(reader, mpack_track_copy(&reader->track, &reader->checkpoint_track));
+    #endif
+    return mpack_reader_error(reader) == mpack_ok;
+}
+
 // Loops on the fill function, reading between the minimum and
 // maximum number of bytes and flagging an error if it fails.
 MPACK_NOINLINE static size_t mpack_fill_range(mpack_reader_t* reader, char* p, size_t min_bytes, size_t max_bytes) {
@@ -232,6 +308,7 @@ MPACK_NOINLINE static size_t mpack_fill_range(mpack_reader_t* reader, char* p, s
     size_t count = 0;
     while (count < min_bytes) {
         size_t read = reader->fill(reader, p + count, max_bytes - count);
+        MPACK_STATS_ADD(reader->stats, fills, 1);
 
         // Reader fill functions can flag an error or return 0 on failure. We
         // also guard against functions that return -1 just in case.
@@ -242,11 +319,119 @@ MPACK_NOINLINE static size_t mpack_fill_range(mpack_reader_t* reader, char* p, s
             return 0;
         }
 
+        MPACK_STATS_ADD(reader->stats, fill_bytes, read);
         count += read;
     }
     return count;
 }
 
+// Makes sure the rest of the current segment is non-empty, getting the next
+// segment if needed.
+static bool mpack_reader_pull_segment(mpack_reader_t* reader) {
+    if (reader->segment != reader->segment_end)
+        return true;
+
+    size_t size = 0;
+    const char* segment = reader->segment_fn(reader, &size);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return false;
+    if (segment == NULL || size == 0) {
+        mpack_reader_flag_error(reader, mpack_error_io);
+        return false;
+    }
+
+    mpack_log("got segment of %i bytes at %p\n", (int)size, segment);
+    MPACK_STATS_ADD(reader->stats, segments, 1);
+    reader->segment = segment;
+    reader->segment_end = segment + size;
+    return true;
+}
+
+// Moves the reader to the rest of the current segment (or the next segment)
+// once everything before it has been read.
+static bool mpack_reader_next_segment(mpack_reader_t* reader) {
+    mpack_assert(reader->data == reader->end, "there are bytes left to read!");
+    if (!mpack_reader_pull_segment(reader))
+        return false;
+    reader->data = reader->segment;
+    reader->end = reader->segment_end;
+    reader->segment = reader->segment_end;
+    return true;
+}
+
+MPACK_NOINLINE static bool mpack_reader_ensure_segments(mpack_reader_t* reader, size_t count) {
+    size_t left = (size_t)(reader->end - reader->data);
+
+    // at the end of a segment, the data is likely to be contiguous in the next
+    if (left == 0) {
+        if (!mpack_reader_next_segment(reader))
+            return false;
+        left = (size_t)(reader->end - reader->data);
+        if (left >= count)
+            return true;
+    }
+
+    // the data straddles segments, so we need to reassemble it in the buffer
+    if (count > reader->size) {
+        mpack_reader_flag_error(reader, mpack_error_too_big);
+        return false;
+    }
+
+    mpack_log("reassembling %i bytes straddling segments\n", (int)count);
+    MPACK_STATS_ADD(reader->stats, straddle_bytes, left);
+    mpack_memmove(reader->buffer, reader->data, left);
+    while (left < count) {
+        if (!mpack_reader_pull_segment(reader))
+            return false;
+        size_t step = (size_t)(reader->segment_end - reader->segment);
+        if (step > count - left)
+            step = count - left;
+        mpack_memcpy(reader->buffer + left, reader->segment, step);
+        reader->segment += step;
+        left += step;
+    }
+
+    reader->data = reader->buffer;
+    reader->end = reader->buffer + count;
+    return true;
+}
+
+// Ensures count bytes are available for a reader with a checkpoint. All data
+// since the checkpoint is kept in the buffer, and the fill function is called
+// once for each chunk so that partial data is kept if it would block.
+MPACK_NOINLINE static bool mpack_reader_ensure_checkpoint(mpack_reader_t* reader, size_t count) {
+    size_t offset = (size_t)(reader->data - reader->checkpoint);
+    if (count > reader->size - offset) {
+        mpack_reader_flag_error(reader, mpack_error_too_big);
+        return false;
+    }
+
+    // move the data since the checkpoint to the start of the buffer
+    size_t used = (size_t)(reader->end - reader->checkpoint);
+    if (reader->checkpoint != reader->buffer) {
+        MPACK_STATS_ADD(reader->stats, straddle_bytes, used);
+        mpack_memmove(reader->buffer, reader->checkpoint, used);
+        reader->checkpoint = reader->buffer;
+        reader->data = reader->buffer + offset;
+        reader->end = reader->buffer + used;
+    }
+
+    while (used - offset < count) {
+        size_t read = reader->fill(reader, reader->buffer + used, reader->size - used);
+        MPACK_STATS_ADD(reader->stats, fills, 1);
+        if (mpack_reader_error(reader) != mpack_ok)
+            return false;
+        if (read == 0 || read == ((size_t)(-1))) {
+            mpack_reader_flag_error(reader, mpack_error_io);
+            return false;
+        }
+        MPACK_STATS_ADD(reader->stats, fill_bytes, read);
+        used += read;
+        reader->end = reader->buffer + used;
+    }
+    return true;
+}
+
 MPACK_NOINLINE bool mpack_reader_ensure_straddle(mpack_reader_t* reader, size_t count) {
     mpack_assert(count != 0, "cannot ensure zero bytes!");
     mpack_assert(reader->error == mpack_ok, "reader cannot be in an error state!");
@@ -256,6 +441,11 @@ MPACK_NOINLINE bool mpack_reader_ensure_straddle(mpack_reader_t* reader, size_t
             "left in buffer. call mpack_reader_ensure() instead",
             (int)count, (int)(reader->end - reader->data));
 
+    MPACK_STATS_ADD(reader->stats, straddles, 1);
+
+    if (reader->segment_fn != NULL)
+        return mpack_reader_ensure_segments(reader, count);
+
     // we'll need a fill function to get more data. if there's no
     // fill function, the buffer should contain an entire MessagePack
     // object, so we raise mpack_error_invalid instead of mpack_error_io
@@ -265,6 +455,9 @@ MPACK_NOINLINE bool mpack_reader_ensure_straddle(mpack_reader_t* reader, size_t
         return false;
     }
 
+    if (reader->checkpoint != NULL)
+        return mpack_reader_ensure_checkpoint(reader, count);
+
     // we need enough space in the buffer. if the buffer is not
     // big enough, we return mpack_error_too_big (since this is
     // for an in-place read larger than the buffer size.)
@@ -275,6 +468,7 @@ MPACK_NOINLINE bool mpack_reader_ensure_straddle(mpack_reader_t* reader, size_t
 
     // move the existing data to the start of the buffer
     size_t left = (size_t)(reader->end - reader->data);
+    MPACK_STATS_ADD(reader->stats, straddle_bytes, left);
     mpack_memmove(reader->buffer, reader->data, left);
     reader->end -= reader->data - reader->buffer;
     reader->data = reader->buffer;
@@ -302,6 +496,7 @@ MPACK_NOINLINE void mpack_read_native_straddle(mpack_reader_t* reader, char* p,
     size_t left = (size_t)(reader->end - reader->data);
     mpack_log("big read for %i bytes into %p, %i left in buffer, buffer size %i\n",
             (int)count, p, (int)left, (int)reader->size);
+    MPACK_STATS_ADD(reader->stats, straddles, 1);
 
     if (count <= left) {
         mpack_assert(0,
@@ -313,6 +508,25 @@ MPACK_NOINLINE void mpack_read_native_straddle(mpack_reader_t* reader, char* p,
         return;
     }
 
+    // segmented input is copied straight out of the segments
+    if (reader->segment_fn != NULL) {
+        while (true) {
+            size_t step = (size_t)(reader->end - reader->data);
+            if (step > count)
+                step = count;
+            mpack_memcpy(p, reader->data, step);
+            reader->data += step;
+            p += step;
+            count -= step;
+            if (count == 0)
+                return;
+            if (!mpack_reader_next_segment(reader)) {
+                mpack_memset(p, 0, count);
+                return;
+            }
+        }
+    }
+
     // we'll need a fill function to get more data. if there's no
     // fill function, the buffer should contain an entire MessagePack
     // object, so we raise mpack_error_invalid instead of mpack_error_io
@@ -334,6 +548,17 @@ MPACK_NOINLINE void mpack_read_native_straddle(mpack_reader_t* reader, char* p,
         return;
     }
 
+    // with a checkpoint, the data must be kept in the buffer
+    if (reader->checkpoint != NULL) {
+        if (!mpack_reader_ensure_checkpoint(reader, count)) {
+            mpack_memset(p, 0, count);
+            return;
+        }
+        mpack_memcpy(p, reader->data, count);
+        reader->data += count;
+        return;
+    }
+
     // flush what's left of the buffer
     if (left > 0) {
         mpack_log("flushing %i bytes remaining in buffer\n", (int)left);
@@ -363,6 +588,21 @@ MPACK_NOINLINE void mpack_read_native_straddle(mpack_reader_t* reader, char* p,
 
 MPACK_NOINLINE static void mpack_skip_bytes_straddle(mpack_reader_t* reader, size_t count) {
 
+    // segmented input is skipped without touching the skipped segments
+    if (reader->segment_fn != NULL) {
+        while (true) {
+            size_t step = (size_t)(reader->end - reader->data);
+            if (step > count)
+                step = count;
+            reader->data += step;
+            count -= step;
+            if (count == 0)
+                return;
+            if (!mpack_reader_next_segment(reader))
+                return;
+        }
+    }
+
     // we'll need at least a fill function to skip more data. if there's
     // no fill function, the buffer should contain an entire MessagePack
     // object, so we raise mpack_error_invalid instead of mpack_error_io
@@ -373,6 +613,13 @@ MPACK_NOINLINE static void mpack_skip_bytes_straddle(mpack_reader_t* reader, siz
         return;
     }
 
+    // with a checkpoint, the skipped data must be kept in the buffer
+    if (reader->checkpoint != NULL) {
+        if (mpack_reader_ensure_checkpoint(reader, count))
+            reader->data += count;
+        return;
+    }
+
     // discard whatever's left in the buffer
     size_t left = (size_t)(reader->end - reader->data);
     mpack_log("discarding %i bytes still in buffer\n", (int)left);
@@ -517,7 +764,8 @@ char* mpack_read_bytes_alloc_impl(mpack_reader_t* reader, size_t count, bool nul
         return NULL;
 
     // allocate data
-    char* data = (char*)MPACK_MALLOC(count + (null_terminated ? 1 : 0)); // TODO: can this overflow?
+    char* data = (char*)mpack_allocator_alloc(&reader->allocator,
+            count + (null_terminated ? 1 : 0)); // TODO: can this overflow?
     if (data == NULL) {
         mpack_reader_flag_error(reader, mpack_error_memory);
         return NULL;
@@ -528,7 +776,7 @@ char* mpack_read_bytes_alloc_impl(mpack_reader_t* reader, size_t count, bool nul
 
     // report flagged errors
     if (mpack_reader_error(reader) != mpack_ok) {
-        MPACK_FREE(data);
+        mpack_allocator_free(&reader->allocator, data);
         if (reader->error_fn)
             reader->error_fn(reader, mpack_reader_error(reader));
         return NULL;
@@ -581,353 +829,30 @@ const char* mpack_read_utf8_inplace(mpack_reader_t* reader, size_t count) {
 static size_t mpack_parse_tag(mpack_reader_t* reader, mpack_tag_t* tag) {
     mpack_assert(reader->error == mpack_ok, "reader cannot be in an error state!");
 
-    if (!mpack_reader_ensure(reader, 1))
-        return 0;
-    uint8_t type = mpack_load_u8(reader->data);
-
-    // unfortunately, by far the fastest way to parse a tag is to switch
-    // on the first byte, and to explicitly list every possible byte. so for
-    // infix types, the list of cases is quite large.
-    //
-    // in size-optimized builds, we switch on the top four bits first to
-    // handle most infix types with a smaller jump table to save space.
-
-    #if MPACK_OPTIMIZE_FOR_SIZE
-    switch (type >> 4) {
-
-        // positive fixnum
-        case 0x0: case 0x1: case 0x2: case 0x3:
-        case 0x4: case 0x5: case 0x6: case 0x7:
-            *tag = mpack_tag_make_uint(type);
-            return 1;
-
-        // negative fixnum
-        case 0xe: case 0xf:
-            *tag = mpack_tag_make_int((int8_t)type);
-            return 1;
-
-        // fixmap
-        case 0x8:
-            *tag = mpack_tag_make_map(type & ~0xf0u);
-            return 1;
-
-        // fixarray
-        case 0x9:
-            *tag = mpack_tag_make_array(type & ~0xf0u);
-            return 1;
-
-        // fixstr
-        case 0xa: case 0xb:
-            *tag = mpack_tag_make_str(type & ~0xe0u);
-            return 1;
-
-        // not one of the common infix types
-        default:
-            break;
-
-    }
-    #endif
-
-    // handle individual type tags
-    switch (type) {
-
-        #if !MPACK_OPTIMIZE_FOR_SIZE
-        // positive fixnum
-        case 0x00: case 0x01: case 0x02: case 0x03: case 0x04: case 0x05: case 0x06: case 0x07:
-        case 0x08: case 0x09: case 0x0a: case 0x0b: case 0x0c: case 0x0d: case 0x0e: case 0x0f:
-        case 0x10: case 0x11: case 0x12: case 0x13: case 0x14: case 0x15: case 0x16: case 0x17:
-        case 0x18: case 0x19: case 0x1a: case 0x1b: case 0x1c: case 0x1d: case 0x1e: case 0x1f:
-        case 0x20: case 0x21: case 0x22: case 0x23: case 0x24: case 0x25: case 0x26: case 0x27:
-        case 0x28: case 0x29: case 0x2a: case 0x2b: case 0x2c: case 0x2d: case 0x2e: case 0x2f:
-        case 0x30: case 0x31: case 0x32: case 0x33: case 0x34: case 0x35: case 0x36: case 0x37:
-        case 0x38: case 0x39: case 0x3a: case 0x3b: case 0x3c: case 0x3d: case 0x3e: case 0x3f:
-        case 0x40: case 0x41: case 0x42: case 0x43: case 0x44: case 0x45: case 0x46: case 0x47:
-        case 0x48: case 0x49: case 0x4a: case 0x4b: case 0x4c: case 0x4d: case 0x4e: case 0x4f:
-        case 0x50: case 0x51: case 0x52: case 0x53: case 0x54: case 0x55: case 0x56: case 0x57:
-        case 0x58: case 0x59: case 0x5a: case 0x5b: case 0x5c: case 0x5d: case 0x5e: case 0x5f:
-        case 0x60: case 0x61: case 0x62: case 0x63: case 0x64: case 0x65: case 0x66: case 0x67:
-        case 0x68: case 0x69: case 0x6a: case 0x6b: case 0x6c: case 0x6d: case 0x6e: case 0x6f:
-        case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: case 0x77:
-        case 0x78: case 0x79: case 0x7a: case 0x7b: case 0x7c: case 0x7d: case 0x7e: case 0x7f:
-            *tag = mpack_tag_make_uint(type);
-            return 1;
-
-        // negative fixnum
-        case 0xe0: case 0xe1: case 0xe2: case 0xe3: case 0xe4: case 0xe5: case 0xe6: case 0xe7:
-        case 0xe8: case 0xe9: case 0xea: case 0xeb: case 0xec: case 0xed: case 0xee: case 0xef:
-        case 0xf0: case 0xf1: case 0xf2: case 0xf3: case 0xf4: case 0xf5: case 0xf6: case 0xf7:
-        case 0xf8: case 0xf9: case 0xfa: case 0xfb: case 0xfc: case 0xfd: case 0xfe: case 0xff:
-            *tag = mpack_tag_make_int((int8_t)type);
-            return 1;
-
-        // fixmap
-        case 0x80: case 0x81: case 0x82: case 0x83: case 0x84: case 0x85: case 0x86: case 0x87:
-        case 0x88: case 0x89: case 0x8a: case 0x8b: case 0x8c: case 0x8d: case 0x8e: case 0x8f:
-            *tag = mpack_tag_make_map(type & ~0xf0u);
-            return 1;
-
-        // fixarray
-        case 0x90: case 0x91: case 0x92: case 0x93: case 0x94: case 0x95: case 0x96: case 0x97:
-        case 0x98: case 0x99: case 0x9a: case 0x9b: case 0x9c: case 0x9d: case 0x9e: case 0x9f:
-            *tag = mpack_tag_make_array(type & ~0xf0u);
-            return 1;
-
-        // fixstr
-        case 0xa0: case 0xa1: case 0xa2: case 0xa3: case 0xa4: case 0xa5: case 0xa6: case 0xa7:
-        case 0xa8: case 0xa9: case 0xaa: case 0xab: case 0xac: case 0xad: case 0xae: case 0xaf:
-        case 0xb0: case 0xb1: case 0xb2: case 0xb3: case 0xb4: case 0xb5: case 0xb6: case 0xb7:
-        case 0xb8: case 0xb9: case 0xba: case 0xbb: case 0xbc: case 0xbd: case 0xbe: case 0xbf:
-            *tag = mpack_tag_make_str(type & ~0xe0u);
-            return 1;
-        #endif
-
-        // nil
-        case 0xc0:
-            *tag = mpack_tag_make_nil();
-            return 1;
-
-        // bool
-        case 0xc2: case 0xc3:
-            *tag = mpack_tag_make_bool((bool)(type & 1));
-            return 1;
-
-        // bin8
-        case 0xc4:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_BIN8))
-                return 0;
-            *tag = mpack_tag_make_bin(mpack_load_u8(reader->data + 1));
-            return MPACK_TAG_SIZE_BIN8;
-
-        // bin16
-        case 0xc5:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_BIN16))
-                return 0;
-            *tag = mpack_tag_make_bin(mpack_load_u16(reader->data + 1));
-            return MPACK_TAG_SIZE_BIN16;
-
-        // bin32
-        case 0xc6:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_BIN32))
-                return 0;
-            *tag = mpack_tag_make_bin(mpack_load_u32(reader->data + 1));
-            return MPACK_TAG_SIZE_BIN32;
-
-        #if MPACK_EXTENSIONS
-        // ext8
-        case 0xc7:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_EXT8))
-                return 0;
-            *tag = mpack_tag_make_ext(mpack_load_i8(reader->data + 2), mpack_load_u8(reader->data + 1));
-            return MPACK_TAG_SIZE_EXT8;
-
-        // ext16
-        case 0xc8:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_EXT16))
-                return 0;
-            *tag = mpack_tag_make_ext(mpack_load_i8(reader->data + 3), mpack_load_u16(reader->data + 1));
-            return MPACK_TAG_SIZE_EXT16;
-
-        // ext32
-        case 0xc9:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_EXT32))
-                return 0;
-            *tag = mpack_tag_make_ext(mpack_load_i8(reader->data + 5), mpack_load_u32(reader->data + 1));
-            return MPACK_TAG_SIZE_EXT32;
-        #endif
-
-        // float
-        case 0xca:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_FLOAT))
-                return 0;
-            #if MPACK_FLOAT
-            *tag = mpack_tag_make_float(mpack_load_float(reader->data + 1));
-            #else
-            *tag = mpack_tag_make_raw_float(mpack_load_u32(reader->data + 1));
-            #endif
-            return MPACK_TAG_SIZE_FLOAT;
-
-        // double
-        case 0xcb:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_DOUBLE))
-                return 0;
-            #if MPACK_DOUBLE
-            *tag = mpack_tag_make_double(mpack_load_double(reader->data + 1));
-            #else
-            *tag = mpack_tag_make_raw_double(mpack_load_u64(reader->data + 1));
-            #endif
-            return MPACK_TAG_SIZE_DOUBLE;
-
-        // uint8
-        case 0xcc:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_U8))
-                return 0;
-            *tag = mpack_tag_make_uint(mpack_load_u8(reader->data + 1));
-            return MPACK_TAG_SIZE_U8;
-
-        // uint16
-        case 0xcd:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_U16))
-                return 0;
-            *tag = mpack_tag_make_uint(mpack_load_u16(reader->data + 1));
-            return MPACK_TAG_SIZE_U16;
-
-        // uint32
-        case 0xce:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_U32))
-                return 0;
-            *tag = mpack_tag_make_uint(mpack_load_u32(reader->data + 1));
-            return MPACK_TAG_SIZE_U32;
-
-        // uint64
-        case 0xcf:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_U64))
-                return 0;
-            *tag = mpack_tag_make_uint(mpack_load_u64(reader->data + 1));
-            return MPACK_TAG_SIZE_U64;
-
-        // int8
-        case 0xd0:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_I8))
-                return 0;
-            *tag = mpack_tag_make_int(mpack_load_i8(reader->data + 1));
-            return MPACK_TAG_SIZE_I8;
-
-        // int16
-        case 0xd1:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_I16))
-                return 0;
-            *tag = mpack_tag_make_int(mpack_load_i16(reader->data + 1));
-            return MPACK_TAG_SIZE_I16;
-
-        // int32
-        case 0xd2:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_I32))
-                return 0;
-            *tag = mpack_tag_make_int(mpack_load_i32(reader->data + 1));
-            return MPACK_TAG_SIZE_I32;
-
-        // int64
-        case 0xd3:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_I64))
-                return 0;
-            *tag = mpack_tag_make_int(mpack_load_i64(reader->data + 1));
-            return MPACK_TAG_SIZE_I64;
-
-        #if MPACK_EXTENSIONS
-        // fixext1
-        case 0xd4:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_FIXEXT1))
-                return 0;
-            *tag = mpack_tag_make_ext(mpack_load_i8(reader->data + 1), 1);
-            return MPACK_TAG_SIZE_FIXEXT1;
-
-        // fixext2
-        case 0xd5:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_FIXEXT2))
-                return 0;
-            *tag = mpack_tag_make_ext(mpack_load_i8(reader->data + 1), 2);
-            return MPACK_TAG_SIZE_FIXEXT2;
-
-        // fixext4
-        case 0xd6:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_FIXEXT4))
-                return 0;
-            *tag = mpack_tag_make_ext(mpack_load_i8(reader->data + 1), 4);
-            return 2;
-
-        // fixext8
-        case 0xd7:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_FIXEXT8))
-                return 0;
-            *tag = mpack_tag_make_ext(mpack_load_i8(reader->data + 1), 8);
-            return MPACK_TAG_SIZE_FIXEXT8;
-
-        // fixext16
-        case 0xd8:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_FIXEXT16))
-                return 0;
-            *tag = mpack_tag_make_ext(mpack_load_i8(reader->data + 1), 16);
-            return MPACK_TAG_SIZE_FIXEXT16;
-        #endif
-
-        // str8
-        case 0xd9:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_STR8))
-                return 0;
-            *tag = mpack_tag_make_str(mpack_load_u8(reader->data + 1));
-            return MPACK_TAG_SIZE_STR8;
-
-        // str16
-        case 0xda:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_STR16))
-                return 0;
-            *tag = mpack_tag_make_str(mpack_load_u16(reader->data + 1));
-            return MPACK_TAG_SIZE_STR16;
-
-        // str32
-        case 0xdb:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_STR32))
-                return 0;
-            *tag = mpack_tag_make_str(mpack_load_u32(reader->data + 1));
-            return MPACK_TAG_SIZE_STR32;
-
-        // array16
-        case 0xdc:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_ARRAY16))
-                return 0;
-            *tag = mpack_tag_make_array(mpack_load_u16(reader->data + 1));
-            return MPACK_TAG_SIZE_ARRAY16;
-
-        // array32
-        case 0xdd:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_ARRAY32))
-                return 0;
-            *tag = mpack_tag_make_array(mpack_load_u32(reader->data + 1));
-            return MPACK_TAG_SIZE_ARRAY32;
-
-        // map16
-        case 0xde:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_MAP16))
-                return 0;
-            *tag = mpack_tag_make_map(mpack_load_u16(reader->data + 1));
-            return MPACK_TAG_SIZE_MAP16;
-
-        // map32
-        case 0xdf:
-            if (!mpack_reader_ensure(reader, MPACK_TAG_SIZE_MAP32))
-                return 0;
-            *tag = mpack_tag_make_map(mpack_load_u32(reader->data + 1));
-            return MPACK_TAG_SIZE_MAP32;
-
-        // reserved
-        case 0xc1:
-            mpack_reader_flag_error(reader, mpack_error_invalid);
-            return 0;
-
-        #if !MPACK_EXTENSIONS
-        // ext
-        case 0xc7: // fallthrough
-        case 0xc8: // fallthrough
-        case 0xc9: // fallthrough
-        // fixext
-        case 0xd4: // fallthrough
-        case 0xd5: // fallthrough
-        case 0xd6: // fallthrough
-        case 0xd7: // fallthrough
-        case 0xd8:
-            mpack_reader_flag_error(reader, mpack_error_unsupported);
+    // if a tag of any size is already buffered, we can decode it directly
+    // without checking its size first. otherwise we look up the size from
+    // the first byte and make sure that many bytes are available.
+    size_t size;
+    if (MPACK_LIKELY((size_t)(reader->end - reader->data) >= MPACK_MAXIMUM_TAG_SIZE)) {
+        size = mpack_decode_tag(reader->data, tag);
+    } else {
+        if (!mpack_reader_ensure(reader, 1))
             return 0;
-        #endif
-
-        #if MPACK_OPTIMIZE_FOR_SIZE
-        // any other bytes should have been handled by the infix switch
-        default:
-            break;
-        #endif
+        size = mpack_decode_tag_size(*reader->data);
+        if (size != 0) {
+            if (!mpack_reader_ensure(reader, size))
+                return 0;
+            size = mpack_decode_tag(reader->data, tag);
+        }
     }
 
-    mpack_assert(0, "unreachable");
-    return 0;
+    if (MPACK_UNLIKELY(size == 0)) {
+        // reserved, or ext types with extensions disabled
+        mpack_reader_flag_error(reader, ((uint8_t)*reader->data == 0xc1) ?
+                mpack_error_invalid : mpack_error_unsupported);
+        return 0;
+    }
+    return size;
 }
 
 mpack_tag_t mpack_read_tag(mpack_reader_t* reader) {
@@ -989,6 +914,23 @@ mpack_tag_t mpack_peek_tag(mpack_reader_t* reader) {
 }
 
 void mpack_discard(mpack_reader_t* reader) {
+    #if !MPACK_OPTIMIZE_FOR_SIZE
+    // If the whole element is already in the buffer, we can skip over it in
+    // a single pass without reading and tracking each nested tag. Otherwise
+    // (or if the data is invalid) we fall back to reading it tag by tag,
+    // filling as needed and flagging the appropriate error.
+    if (mpack_reader_error(reader) == mpack_ok) {
+        mpack_error_t error = mpack_ok;
+        size_t size = mpack_scan_elements(reader->data, (size_t)(reader->end - reader->data), 1, &error);
+        if (size != 0) {
+            if (mpack_reader_track_element(reader) != mpack_ok)
+                return;
+            reader->data += size;
+            return;
+        }
+    }
+    #endif
+
     mpack_tag_t var = mpack_read_tag(reader);
     if (mpack_reader_error(reader))
         return;
@@ -1085,6 +1027,170 @@ void mpack_done_type(mpack_reader_t* reader, mpack_type_t type) {
 }
 #endif
 
+mpack_error_t mpack_path_compile(mpack_path_t* path, const char* expression) {
+    path->count = 0;
+    const char* p = expression;
+
+    while (*p != '\0') {
+        if (path->count == MPACK_PATH_MAX_STEPS)
+            return mpack_error_too_big;
+        mpack_path_step_t* step = &path->steps[path->count];
+
+        if (*p == '[') {
+            ++p;
+            if (*p == '*') {
+                step->type = mpack_path_step_wildcard;
+                ++p;
+            } else {
+                if (*p < '0' || *p > '9')
+                    return mpack_error_invalid;
+                uint64_t index = 0;
+                while (*p >= '0' && *p <= '9') {
+                    index = index * 10 + (uint64_t)(*p - '0');
+                    if (index > MPACK_UINT32_MAX)
+                        return mpack_error_invalid;
+                    ++p;
+                }
+                step->type = mpack_path_step_index;
+                step->length = (uint32_t)index;
+            }
+            if (*p != ']')
+                return mpack_error_invalid;
+            ++p;
+
+        } else {
+            // keys after the first step are preceded by a period
+            if (path->count > 0) {
+                if (*p != '.')
+                    return mpack_error_invalid;
+                ++p;
+            }
+
+            const char* key = p;
+            while (*p != '\0' && *p != '.' && *p != '[' && *p != ']')
+                ++p;
+            if (p == key || (size_t)(p - key) > MPACK_UINT32_MAX)
+                return mpack_error_invalid;
+
+            if (p - key == 1 && *key == '*') {
+                step->type = mpack_path_step_wildcard;
+            } else {
+                step->type = mpack_path_step_key;
+                step->key = key;
+                step->length = (uint32_t)(p - key);
+            }
+        }
+
+        ++path->count;
+    }
+
+    return mpack_ok;
+}
+
+typedef struct mpack_path_search_t {
+    const mpack_path_t* path;
+    mpack_path_match_t* matches;
+    size_t max_matches;
+    size_t count;
+} mpack_path_search_t;
+
+// Returns true if the next element is a str equal to the key of the given
+// step, reading it if so and discarding it otherwise.
+static bool mpack_path_read_key(mpack_reader_t* reader, const mpack_path_step_t* step) {
+    mpack_tag_t tag = mpack_peek_tag(reader);
+    if (tag.type != mpack_type_str || tag.v.l != step->length) {
+        mpack_discard(reader);
+        return false;
+    }
+
+    mpack_read_tag(reader);
+    const char* key = mpack_read_bytes_inplace(reader, step->length);
+    mpack_done_str(reader);
+    return mpack_reader_error(reader) == mpack_ok && mpack_memcmp(key, step->key, step->length) == 0;
+}
+
+// Evaluates the given step and all following steps on the next element. The
+// recursion is bounded by the number of steps.
+static void mpack_path_search(mpack_reader_t* reader, mpack_path_search_t* search, size_t index) {
+    if (index == search->path->count) {
+        const char* start = reader->data;
+        mpack_tag_t tag = mpack_peek_tag(reader);
+        mpack_discard(reader);
+        if (mpack_reader_error(reader) != mpack_ok)
+            return;
+
+        if (search->count == search->max_matches) {
+            mpack_reader_flag_error(reader, mpack_error_too_big);
+            return;
+        }
+        mpack_path_match_t* match = &search->matches[search->count++];
+        match->data = start;
+        match->size = (size_t)(reader->data - start);
+        match->tag = tag;
+        return;
+    }
+
+    const mpack_path_step_t* step = &search->path->steps[index];
+    mpack_tag_t tag = mpack_peek_tag(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+
+    // elements that can't contain the step are skipped
+    if (!(tag.type == mpack_type_array && step->type != mpack_path_step_key) &&
+            !(tag.type == mpack_type_map && step->type != mpack_path_step_index))
+    {
+        mpack_discard(reader);
+        return;
+    }
+
+    mpack_read_tag(reader);
+    uint32_t i;
+
+    if (tag.type == mpack_type_array) {
+        for (i = 0; i < tag.v.n && mpack_reader_error(reader) == mpack_ok; ++i) {
+            if (step->type == mpack_path_step_wildcard || i == step->length)
+                mpack_path_search(reader, search, index + 1);
+            else
+                mpack_discard(reader);
+        }
+        mpack_done_array(reader);
+        return;
+    }
+
+    for (i = 0; i < tag.v.n && mpack_reader_error(reader) == mpack_ok; ++i) {
+        bool matched;
+        if (step->type == mpack_path_step_key) {
+            matched = mpack_path_read_key(reader, step);
+        } else {
+            mpack_discard(reader);
+            matched = true;
+        }
+
+        if (matched)
+            mpack_path_search(reader, search, index + 1);
+        else
+            mpack_discard(reader);
+    }
+    mpack_done_map(reader);
+}
+
+mpack_error_t mpack_path_find(const mpack_path_t* path, const char* data, size_t length,
+        mpack_path_match_t* matches, size_t max_matches, size_t* match_count)
+{
+    mpack_path_search_t search;
+    search.path = path;
+    search.matches = matches;
+    search.max_matches = max_matches;
+    search.count = 0;
+
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, data, length);
+    mpack_path_search(&reader, &search, 0);
+
+    *match_count = search.count;
+    return mpack_reader_destroy(&reader);
+}
+
 #if MPACK_DEBUG && MPACK_STDIO
 static size_t mpack_print_read_prefix(mpack_reader_t* reader, size_t length, char* buffer, size_t buffer_size) {
     if (length == 0)
@@ -102,6 +102,24 @@ typedef struct mpack_reader_t mpack_reader_t;
  */
 typedef size_t (*mpack_reader_fill_t)(mpack_reader_t* reader, char* buffer, size_t count);
 
+/**
+ * The MPack reader's segment function for readers of segmented input. It
+ * should return a pointer to the next segment of input and store its size in
+ * @p size.
+ *
+ * In case of error or end of input, it should flag an appropriate error on
+ * the reader, or simply return NULL (or a zero size.) In that case,
+ * mpack_error_io is raised.
+ *
+ * The reader references the segment in place. A segment must remain valid
+ * until the next call, and for as long as any data read from it in place
+ * (such as with mpack_read_bytes_inplace()) is in use.
+ *
+ * @see mpack_reader_init_segments()
+ * @see mpack_reader_context()
+ */
+typedef const char* (*mpack_reader_segment_t)(mpack_reader_t* reader, size_t* size);
+
 /**
  * The MPack reader's skip function. It should discard the given number
  * of bytes from the source (for example by seeking forward.)
@@ -143,6 +161,22 @@ typedef void (*mpack_reader_error_t)(mpack_reader_t* reader, mpack_error_t error
  */
 typedef void (*mpack_reader_teardown_t)(mpack_reader_t* reader);
 
+#if MPACK_STATS
+/**
+ * Instrumentation counters for a reader.
+ *
+ * @see MPACK_STATS
+ * @see mpack_reader_stats()
+ */
+typedef struct mpack_reader_stats_t {
+    size_t fills;          /**< Calls to the fill function */
+    size_t fill_bytes;     /**< Bytes returned by the fill function */
+    size_t straddles;      /**< Reads that did not fit in the remaining buffer */
+    size_t straddle_bytes; /**< Bytes moved to the start of the buffer by straddling reads */
+    size_t segments;       /**< Segments returned by the segment function */
+} mpack_reader_stats_t;
+#endif
+
 /* Hide internals from documentation */
 /** @cond */
 
@@ -152,6 +186,10 @@ struct mpack_reader_t {
     mpack_reader_error_t error_fn;    /* Function to call on error */
     mpack_reader_teardown_t teardown; /* Function to teardown the context on destroy */
     mpack_reader_skip_t skip;         /* Function to skip bytes from the source */
+    mpack_reader_segment_t segment_fn; /* Function to get the next segment of input */
+
+    const char* segment;     /* Rest of the current segment not yet in data..end */
+    const char* segment_end; /* The end of the current segment */
 
     char* buffer;       /* Writeable byte buffer */
     size_t size;        /* Size of the buffer */
@@ -161,8 +199,20 @@ struct mpack_reader_t {
 
     mpack_error_t error;  /* Error state */
 
+    const char* checkpoint;  /* Position to resume from after mpack_error_would_block */
+    const char* blocked_end; /* The end of available data while blocked */
+
+    #ifdef MPACK_MALLOC
+    mpack_allocator_t allocator; /* Allocator for *_alloc() reads */
+    #endif
+
     #if MPACK_READ_TRACKING
     mpack_track_t track; /* Stack of map/array/str/bin/ext reads */
+    mpack_track_t checkpoint_track; /* Tracking state at the checkpoint */
+    #endif
+
+    #if MPACK_STATS
+    mpack_reader_stats_t stats; /* Instrumentation counters */
     #endif
 };
 
@@ -201,6 +251,26 @@ void mpack_reader_init_error(mpack_reader_t* reader, mpack_error_t error);
  */
 void mpack_reader_init_data(mpack_reader_t* reader, const char* data, size_t count);
 
+/**
+ * Initializes an MPack reader to parse input split into segments that already
+ * exist in memory, such as the fixed-size segments of a socket ring buffer.
+ *
+ * The reader references the segments in place. The given buffer is only used
+ * to reassemble a tag or an in-place read that straddles two segments, so it
+ * need only be big enough for the largest such read (and at least @ref
+ * MPACK_READER_MINIMUM_BUFFER_SIZE.) Other reads copy directly from the
+ * segments, and in-place reads within a segment don't copy at all.
+ *
+ * @param reader The MPack reader.
+ * @param buffer A buffer for reads straddling segments.
+ * @param size The size of the buffer.
+ * @param segment_fn The function to get the next segment of input.
+ *
+ * @see mpack_reader_segment_t
+ */
+void mpack_reader_init_segments(mpack_reader_t* reader, char* buffer, size_t size,
+        mpack_reader_segment_t segment_fn);
+
 #if MPACK_STDIO
 /**
  * Initializes an MPack reader that reads from a file.
@@ -373,6 +443,72 @@ MPACK_INLINE void mpack_reader_set_teardown(mpack_reader_t* reader, mpack_reader
     reader->teardown = teardown;
 }
 
+#ifdef MPACK_MALLOC
+/**
+ * Sets the allocator for data allocated by the reader, such as by
+ * mpack_read_bytes_alloc(), mpack_expect_cstr_alloc() or
+ * mpack_expect_array_alloc().
+ *
+ * Allocations returned to you must then be freed with this allocator. The
+ * reader's own buffer (e.g. of @ref mpack_reader_init_filename()) is not
+ * affected.
+ *
+ * The allocator is copied into the reader.
+ *
+ * This requires @ref MPACK_MALLOC.
+ *
+ * @param reader The MPack reader.
+ * @param allocator The allocator, or NULL to use MPACK_MALLOC() and
+ *        MPACK_FREE()
+ */
+void mpack_reader_set_allocator(mpack_reader_t* reader, const mpack_allocator_t* allocator);
+#endif
+
+/**
+ * @}
+ */
+
+/**
+ * @name Non-Blocking Reading
+ * @{
+ */
+
+/**
+ * Marks the current position of a reader with a fill function as the
+ * position from which to resume reading if it would block.
+ *
+ * A non-blocking fill function (for example one that reads from a
+ * non-blocking socket) can flag @ref mpack_error_would_block on the reader
+ * instead of waiting for more data. All reads then fail as usual, without
+ * calling the error handler. Once more data is available, call
+ * mpack_reader_resume() to go back to the checkpoint and repeat the reads
+ * made since then.
+ *
+ * Typically a checkpoint is set before each element or group of elements
+ * that is handled as a unit, for example before each message or before each
+ * entry of a large array. All data read since the last checkpoint is kept in
+ * the reader's buffer so it must fit in the buffer; otherwise
+ * @ref mpack_error_too_big is flagged.
+ *
+ * If the fill function flags mpack_error_would_block on a reader without a
+ * checkpoint, it is flagged as @ref mpack_error_io instead.
+ *
+ * @see mpack_reader_resume()
+ */
+void mpack_reader_checkpoint(mpack_reader_t* reader);
+
+/**
+ * Clears @ref mpack_error_would_block and rewinds the reader to its last
+ * checkpoint, so that the reads made since then can be repeated.
+ *
+ * This does nothing if the reader is not in the would-block state.
+ *
+ * @return true if the reader was resumed, false otherwise.
+ *
+ * @see mpack_reader_checkpoint()
+ */
+bool mpack_reader_resume(mpack_reader_t* reader);
+
 /**
  * @}
  */
@@ -386,12 +522,30 @@ MPACK_INLINE void mpack_reader_set_teardown(mpack_reader_t* reader, mpack_reader
  * Queries the error state of the MPack reader.
  *
  * If a reader is in an error state, you should discard all data since the
- * last time the error flag was checked. The error flag cannot be cleared.
+ * last time the error flag was checked. The error flag cannot be cleared
+ * (except for @ref mpack_error_would_block; see mpack_reader_resume().)
  */
 MPACK_INLINE mpack_error_t mpack_reader_error(mpack_reader_t* reader) {
     return reader->error;
 }
 
+#if MPACK_STATS
+/**
+ * Returns the instrumentation counters of the reader since it was
+ * initialized or since they were last reset.
+ *
+ * @see MPACK_STATS
+ */
+MPACK_INLINE mpack_reader_stats_t mpack_reader_stats(const mpack_reader_t* reader) {
+    return reader->stats;
+}
+
+/**
+ * Resets the instrumentation counters of the reader to zero.
+ */
+void mpack_reader_reset_stats(mpack_reader_t* reader);
+#endif
+
 /**
  * Places the reader in the given error state, calling the error callback if one
  * is set.
@@ -432,6 +586,10 @@ MPACK_INLINE mpack_error_t mpack_reader_flag_if_error(mpack_reader_t* reader, mp
  * have your fill function limit the data it reads so that the reader does not
  * have extra data. In this case you can simply check that this returns zero.
  *
+ * For a reader of segmented input (see mpack_reader_init_segments()), this
+ * does not include the rest of the current segment if the last read straddled
+ * segments.
+ *
  * Returns 0 if the reader is in an error state.
  *
  * @param reader The MPack reader from which to query remaining data.
@@ -614,7 +772,8 @@ char* mpack_read_bytes_alloc_impl(mpack_reader_t* reader, size_t count, bool nul
  * storage for them and returning the allocated pointer.
  *
  * The allocated string must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the reader's
+ * allocator if one was set with mpack_reader_set_allocator().
  *
  * Returns NULL if any error occurs, or if count is zero.
  */
@@ -816,6 +975,118 @@ MPACK_INLINE void mpack_done_ext(mpack_reader_t* reader) {
  */
 void mpack_discard(mpack_reader_t* reader);
 
+/**
+ * @}
+ */
+
+/**
+ * @name Path Queries
+ *
+ * A path query finds the elements at a given path in a message without
+ * building a tree. The path is compiled once into an @ref mpack_path_t and
+ * can then be evaluated over any number of messages. Subtrees that don't
+ * match the path are skipped with mpack_discard(), so evaluation does a
+ * single pass over the message and does not allocate.
+ *
+ * For example, to find the user id of each event in a message like
+ * <tt>{"events": [{"user": {"id": 1}}, {"user": {"id": 2}}]}</tt>:
+ *
+ * @code{.c}
+ * mpack_path_t path;
+ * mpack_path_compile(&path, "events[*].user.id");
+ *
+ * mpack_path_match_t matches[64];
+ * size_t count, i;
+ * if (mpack_path_find(&path, data, length, matches, 64, &count) == mpack_ok) {
+ *     for (i = 0; i < count; ++i)
+ *         handle_user_id(mpack_tag_uint_value(&matches[i].tag));
+ * }
+ * @endcode
+ *
+ * @{
+ */
+
+/**
+ * The kind of a step of a path query.
+ */
+typedef enum mpack_path_step_type_t {
+    mpack_path_step_key,      /**< The value of a map with the given str key. */
+    mpack_path_step_index,    /**< The element of an array at the given index. */
+    mpack_path_step_wildcard  /**< Every element of an array or value of a map. */
+} mpack_path_step_type_t;
+
+/**
+ * A step of a path query.
+ */
+typedef struct mpack_path_step_t {
+    mpack_path_step_type_t type; /**< The kind of step. */
+    const char* key;             /**< The key of a key step. This points into the expression. */
+    uint32_t length;             /**< The length of the key of a key step, or the index of an index step. */
+} mpack_path_step_t;
+
+/**
+ * A compiled path query.
+ *
+ * @see mpack_path_compile()
+ */
+typedef struct mpack_path_t {
+    mpack_path_step_t steps[MPACK_PATH_MAX_STEPS]; /**< The steps from the root. */
+    size_t count;                                  /**< The number of steps. */
+} mpack_path_t;
+
+/**
+ * An element found by a path query.
+ */
+typedef struct mpack_path_match_t {
+    const char* data; /**< The encoded element, including its tag and all of its children or data. */
+    size_t size;      /**< The size in bytes of the encoded element. */
+    mpack_tag_t tag;  /**< The tag of the element. */
+} mpack_path_match_t;
+
+/**
+ * Compiles a path query.
+ *
+ * A path is a series of steps from the root of a message:
+ *
+ * - A map key is written as is, and is preceded by a period unless it is the
+ *   first step, e.g. <tt>user.id</tt>. It matches the value of every str key
+ *   with the same bytes. Keys can't contain periods or brackets.
+ * - An array index is written in brackets, e.g. <tt>events[0]</tt>.
+ * - A wildcard is written as <tt>[*]</tt> or as a key of <tt>*</tt>. It
+ *   matches every element of an array and every value of a map.
+ *
+ * An empty expression matches the root.
+ *
+ * Keys are not copied, so the expression must remain valid as long as the
+ * path is used.
+ *
+ * @return @ref mpack_ok, @ref mpack_error_invalid if the expression is
+ *         malformed, or @ref mpack_error_too_big if it has more than @ref
+ *         MPACK_PATH_MAX_STEPS steps.
+ */
+mpack_error_t mpack_path_compile(mpack_path_t* path, const char* expression);
+
+/**
+ * Finds the elements at the given path in the first message of the given
+ * data.
+ *
+ * Matches are stored in message order. Elements whose type does not match a
+ * step (e.g. a key step on an array) are skipped; they don't cause an error.
+ *
+ * @param path The compiled path
+ * @param data The message
+ * @param length The length of the data in bytes
+ * @param matches An array in which to store the matches
+ * @param max_matches The size of the matches array
+ * @param match_count Set to the number of matches stored
+ * @return @ref mpack_ok, @ref mpack_error_too_big if there are more than
+ *         @p max_matches matches (in which case the first @p max_matches are
+ *         stored), or the error flagged by the reader if the message is
+ *         truncated or invalid.
+ */
+mpack_error_t mpack_path_find(const mpack_path_t* path, const char* data, size_t length,
+        mpack_path_match_t* matches, size_t max_matches, size_t* match_count);
+
 /**
  * @}
  */
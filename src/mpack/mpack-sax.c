@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define MPACK_INTERNAL 1
+
+#include "mpack-sax.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+
+#if MPACK_SAX
+
+void mpack_sax_init(mpack_sax_t* sax, const mpack_sax_callbacks_t* callbacks, void* context) {
+    mpack_memset(sax, 0, sizeof(*sax));
+    sax->callbacks = *callbacks;
+    sax->context = context;
+}
+
+void mpack_sax_flag_error(mpack_sax_t* sax, mpack_error_t error) {
+    mpack_log("sax %p setting error %i: %s\n", (void*)sax, (int)error, mpack_error_to_string(error));
+    if (sax->error == mpack_ok)
+        sax->error = error;
+}
+
+mpack_error_t mpack_sax_destroy(mpack_sax_t* sax) {
+    if (mpack_sax_in_message(sax))
+        mpack_sax_flag_error(sax, mpack_error_invalid);
+    return sax->error;
+}
+
+/*
+ * Called once an element has been fully parsed, including all of its children
+ * or data. This closes any maps and arrays that the element completes.
+ */
+static void mpack_sax_element_done(mpack_sax_t* sax) {
+    while (sax->level > 0) {
+        mpack_sax_level_t* top = &sax->stack[sax->level - 1];
+        if (--top->left > 0)
+            return;
+
+        --sax->level;
+        if (sax->callbacks.finish) {
+            sax->callbacks.finish(sax, sax->level, top->type);
+            if (sax->error != mpack_ok)
+                return;
+        }
+    }
+}
+
+static void mpack_sax_element(mpack_sax_t* sax, mpack_tag_t tag) {
+    size_t depth = sax->level;
+
+    uint64_t children = 0;
+    if (tag.type == mpack_type_array)
+        children = tag.v.n;
+    else if (tag.type == mpack_type_map)
+        children = (uint64_t)tag.v.n * 2;
+
+    // the children need room on the stack before the element is reported
+    if (children > 0 && sax->level == MPACK_SAX_MAX_DEPTH) {
+        mpack_sax_flag_error(sax, mpack_error_too_big);
+        return;
+    }
+
+    if (sax->callbacks.element) {
+        sax->callbacks.element(sax, depth, tag);
+        if (sax->error != mpack_ok)
+            return;
+    }
+
+    switch (tag.type) {
+        case mpack_type_array:
+        case mpack_type_map:
+            if (children > 0) {
+                sax->stack[sax->level].left = children;
+                sax->stack[sax->level].type = tag.type;
+                ++sax->level;
+                return;
+            }
+            if (sax->callbacks.finish) {
+                sax->callbacks.finish(sax, depth, tag.type);
+                if (sax->error != mpack_ok)
+                    return;
+            }
+            break;
+
+        case mpack_type_str:
+        case mpack_type_bin:
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+        #endif
+            // the data (and the finish callback) follow in mpack_sax_parse()
+            sax->in_bytes = true;
+            sax->bytes_type = tag.type;
+            sax->bytes_left = tag.v.l;
+            return;
+
+        default:
+            break;
+    }
+
+    mpack_sax_element_done(sax);
+}
+
+static void mpack_sax_flag_tag_error(mpack_sax_t* sax, char first_byte) {
+    // reserved, or ext types with extensions disabled
+    mpack_sax_flag_error(sax, ((uint8_t)first_byte == 0xc1) ?
+            mpack_error_invalid : mpack_error_unsupported);
+}
+
+void mpack_sax_parse(mpack_sax_t* sax, const char* data, size_t length) {
+    size_t pos = 0;
+
+    while (sax->error == mpack_ok) {
+
+        // pass along as much of the current str, bin or ext data as we have
+        if (sax->in_bytes) {
+            size_t size = length - pos;
+            if (size > sax->bytes_left)
+                size = sax->bytes_left;
+            if (size > 0) {
+                if (sax->callbacks.data) {
+                    sax->callbacks.data(sax, sax->level, data + pos, size);
+                    if (sax->error != mpack_ok)
+                        return;
+                }
+                pos += size;
+                sax->bytes_left -= (uint32_t)size;
+            }
+            if (sax->bytes_left > 0)
+                return;
+
+            sax->in_bytes = false;
+            if (sax->callbacks.finish) {
+                sax->callbacks.finish(sax, sax->level, sax->bytes_type);
+                if (sax->error != mpack_ok)
+                    return;
+            }
+            mpack_sax_element_done(sax);
+            continue;
+        }
+
+        if (pos == length)
+            return;
+
+        // if a tag of any size is available we can decode it directly.
+        // otherwise it may be split across chunks, so we collect it in the
+        // parser until we have the whole thing.
+        mpack_tag_t tag = MPACK_TAG_ZERO;
+        if (sax->tag_size == 0 && length - pos >= MPACK_MAXIMUM_TAG_SIZE) {
+            size_t size = mpack_decode_tag(data + pos, &tag);
+            if (size == 0) {
+                mpack_sax_flag_tag_error(sax, data[pos]);
+                return;
+            }
+            pos += size;
+        } else {
+            char first_byte = (sax->tag_size > 0) ? sax->tag[0] : data[pos];
+            size_t size = mpack_decode_tag_size(first_byte);
+            if (size == 0) {
+                mpack_sax_flag_tag_error(sax, first_byte);
+                return;
+            }
+
+            size_t needed = size - sax->tag_size;
+            if (length - pos < needed) {
+                mpack_memcpy(sax->tag + sax->tag_size, data + pos, length - pos);
+                sax->tag_size += length - pos;
+                return;
+            }
+
+            if (sax->tag_size > 0) {
+                mpack_memcpy(sax->tag + sax->tag_size, data + pos, needed);
+                sax->tag_size = 0;
+                mpack_decode_tag(sax->tag, &tag);
+            } else {
+                mpack_decode_tag(data + pos, &tag);
+            }
+            pos += needed;
+        }
+
+        mpack_sax_element(sax, tag);
+    }
+}
+
+#endif
+
+MPACK_SILENCE_WARNINGS_END
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file
+ *
+ * Declares the MPack SAX API.
+ */
+
+#ifndef MPACK_SAX_H
+#define MPACK_SAX_H 1
+
+#include "mpack-common.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+MPACK_EXTERN_C_BEGIN
+
+#if MPACK_SAX
+
+#if MPACK_SAX_MAX_DEPTH < 1
+#error "MPACK_SAX_MAX_DEPTH must be at least 1."
+#endif
+
+/**
+ * @defgroup sax SAX API
+ *
+ * The MPack SAX API is an event-based parser. Rather than reading elements
+ * on demand (as with the Reader) or building a tree (as with the Node API), it
+ * is fed data in chunks of any size and calls a callback for each element it
+ * finds.
+ *
+ * The parser does not allocate memory and does not recurse. Its entire state
+ * is kept in the @ref mpack_sax_t, including a fixed stack of open maps and
+ * arrays (see @ref MPACK_SAX_MAX_DEPTH) and any partial tag left at the end
+ * of a chunk. Parsing simply resumes where it left off when the next chunk is
+ * given. The data of str, bin and ext elements is passed to the callbacks in
+ * place, one piece per chunk, so elements of any size are never buffered.
+ * This makes it suitable for processing streams of any length in constant
+ * memory.
+ *
+ * For example, to count the elements of every message in a file:
+ *
+ * @code{.c}
+ * static void count_element(mpack_sax_t* sax, size_t depth, mpack_tag_t tag) {
+ *     ++*(size_t*)mpack_sax_context(sax);
+ * }
+ *
+ * mpack_sax_callbacks_t callbacks = {count_element, NULL, NULL};
+ * size_t count = 0;
+ * mpack_sax_t sax;
+ * mpack_sax_init(&sax, &callbacks, &count);
+ *
+ * char buffer[4096];
+ * size_t size;
+ * while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+ *     mpack_sax_parse(&sax, buffer, size);
+ * if (mpack_sax_destroy(&sax) != mpack_ok)
+ *     fprintf(stderr, "An error occurred parsing the file!\n");
+ * @endcode
+ *
+ * A stream can contain any number of consecutive messages. Each is reported
+ * starting with an element at depth 0.
+ *
+ * @{
+ */
+
+/**
+ * @name Core SAX Functions
+ * @{
+ */
+
+struct mpack_sax_t;
+
+/**
+ * A SAX parser.
+ *
+ * The members of this structure are private. Use the functions of the SAX API
+ * to access it.
+ */
+typedef struct mpack_sax_t mpack_sax_t;
+
+/**
+ * A callback called for each element, with its depth and tag.
+ *
+ * The depth of the root element of a message is 0; the children of a map or
+ * array are one deeper than their parent. The keys and values of a map are
+ * reported in order, so keys have even indices and values have odd indices.
+ *
+ * This is followed by the children of a non-empty map or array, or by the data
+ * of a str, bin or ext element (if any). In both cases the element is then
+ * closed by a call to the finish callback.
+ *
+ * The callback can stop parsing by flagging an error with @ref
+ * mpack_sax_flag_error().
+ */
+typedef void (*mpack_sax_element_t)(mpack_sax_t* sax, size_t depth, mpack_tag_t tag);
+
+/**
+ * A callback called with a piece of the data of a str, bin or ext element.
+ *
+ * The data points into the chunk given to mpack_sax_parse(). It is not copied
+ * or null-terminated, and is only valid until the callback returns.
+ *
+ * An element's data may be split into any number of pieces depending on how
+ * the stream was divided into chunks. The pieces are never empty.
+ */
+typedef void (*mpack_sax_data_t)(mpack_sax_t* sax, size_t depth, const char* data, size_t size);
+
+/**
+ * A callback called after the last child of a map or array, or after the
+ * last piece of data of a str, bin or ext element. This is also called for
+ * empty maps, arrays, strs, bins and exts.
+ */
+typedef void (*mpack_sax_finish_t)(mpack_sax_t* sax, size_t depth, mpack_type_t type);
+
+/**
+ * The callbacks of a SAX parser. Any of them can be NULL.
+ */
+typedef struct mpack_sax_callbacks_t {
+    mpack_sax_element_t element; /**< Called for each element. */
+    mpack_sax_data_t data;       /**< Called with the data of each str, bin and ext. */
+    mpack_sax_finish_t finish;   /**< Called at the end of each map, array, str, bin and ext. */
+} mpack_sax_callbacks_t;
+
+/** @cond */
+
+typedef struct mpack_sax_level_t {
+    uint64_t left; // elements left in this map or array
+    mpack_type_t type;
+} mpack_sax_level_t;
+
+struct mpack_sax_t {
+    mpack_sax_callbacks_t callbacks;
+    void* context;
+    mpack_error_t error;
+
+    size_t level; // number of open maps and arrays
+    mpack_sax_level_t stack[MPACK_SAX_MAX_DEPTH];
+
+    bool in_bytes; // whether the data of a str, bin or ext is being parsed
+    mpack_type_t bytes_type;
+    uint32_t bytes_left;
+
+    char tag[MPACK_MAXIMUM_TAG_SIZE]; // partial tag left from the previous chunk
+    size_t tag_size;
+};
+
+/** @endcond */
+
+/**
+ * Initializes a SAX parser with the given callbacks and context.
+ *
+ * The callbacks are copied into the parser. The context can be retrieved
+ * by the callbacks with @ref mpack_sax_context().
+ *
+ * The parser does not need to be destroyed, but @ref mpack_sax_destroy() can
+ * be used to check that the stream ended on a message boundary.
+ */
+void mpack_sax_init(mpack_sax_t* sax, const mpack_sax_callbacks_t* callbacks, void* context);
+
+/**
+ * Parses the given chunk of a stream, calling the callbacks for each element.
+ *
+ * All of the data is consumed. Parsing stops at the end of the chunk, even
+ * in the middle of a tag or element; it resumes when this is called with the
+ * next chunk.
+ *
+ * If the data is invalid, or if a callback flags an error, the parser is
+ * placed in an error state and all further calls do nothing.
+ *
+ * @param sax The SAX parser
+ * @param data The next chunk of the stream
+ * @param length The length of the chunk in bytes
+ */
+void mpack_sax_parse(mpack_sax_t* sax, const char* data, size_t length);
+
+/**
+ * Returns true if the parser is in the middle of a message, i.e. if the data
+ * given so far ends with an incomplete message.
+ */
+MPACK_INLINE bool mpack_sax_in_message(mpack_sax_t* sax) {
+    return sax->level > 0 || sax->in_bytes || sax->tag_size > 0;
+}
+
+/**
+ * Finishes parsing the stream.
+ *
+ * If the stream ended in the middle of a message, @ref mpack_error_invalid is
+ * flagged.
+ *
+ * @return The final error state of the parser.
+ */
+mpack_error_t mpack_sax_destroy(mpack_sax_t* sax);
+
+/**
+ * Returns the custom context given to mpack_sax_init().
+ */
+MPACK_INLINE void* mpack_sax_context(mpack_sax_t* sax) {
+    return sax->context;
+}
+
+/**
+ * Queries the error state of the SAX parser.
+ */
+MPACK_INLINE mpack_error_t mpack_sax_error(mpack_sax_t* sax) {
+    return sax->error;
+}
+
+/**
+ * Places the SAX parser in an error state, stopping the parse. If the parser
+ * is already in an error state, this does nothing.
+ *
+ * This can be called from a callback, for example to stop parsing if the
+ * data does not match what is expected.
+ */
+void mpack_sax_flag_error(mpack_sax_t* sax, mpack_error_t error);
+
+/**
+ * @}
+ */
+
+/**
+ * @}
+ */
+
+#endif
+
+MPACK_EXTERN_C_END
+MPACK_SILENCE_WARNINGS_END
+
+#endif
+
@@ -0,0 +1,746 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define MPACK_INTERNAL 1
+
+#include "mpack-schema.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+
+#if MPACK_SCHEMA
+
+/*
+ * Compilation
+ *
+ * Keys are matched with a hash-and-displace perfect hash (shared with enum
+ * matchers in mpack-common.c), so a lookup is two table reads and a single
+ * key comparison.
+ */
+
+static size_t mpack_field_type_size(mpack_field_type_t type) {
+    switch (type) {
+        case mpack_field_bool: return sizeof(bool);
+        case mpack_field_u8:   return sizeof(uint8_t);
+        case mpack_field_u16:  return sizeof(uint16_t);
+        case mpack_field_u32:  return sizeof(uint32_t);
+        case mpack_field_u64:  return sizeof(uint64_t);
+        case mpack_field_i8:   return sizeof(int8_t);
+        case mpack_field_i16:  return sizeof(int16_t);
+        case mpack_field_i32:  return sizeof(int32_t);
+        case mpack_field_i64:  return sizeof(int64_t);
+        #if MPACK_FLOAT
+        case mpack_field_float:  return sizeof(float);
+        #endif
+        #if MPACK_DOUBLE
+        case mpack_field_double: return sizeof(double);
+        #endif
+        case mpack_field_cstr: return 0;
+        default: break;
+    }
+    return 0;
+}
+
+static bool mpack_schema_check_fields(const mpack_field_t* fields, size_t count) {
+    size_t i, j;
+    for (i = 0; i < count; ++i) {
+        const mpack_field_t* field = &fields[i];
+        if (field->key == NULL) {
+            mpack_break("field %i has no key!", (int)i);
+            return false;
+        }
+
+        if (field->type == mpack_field_str) {
+            mpack_break("field \"%s\" is a str, which is only supported in columns!", field->key);
+            return false;
+        }
+
+        if (field->type == mpack_field_cstr) {
+            if (field->size == 0) {
+                mpack_break("field \"%s\" is an empty char array!", field->key);
+                return false;
+            }
+        } else {
+            size_t size = mpack_field_type_size(field->type);
+            if (size == 0) {
+                mpack_break("field \"%s\" has invalid type %i!", field->key, (int)field->type);
+                return false;
+            }
+            if (size != field->size) {
+                mpack_break("field \"%s\" has size %i but its type has size %i!",
+                        field->key, (int)field->size, (int)size);
+                return false;
+            }
+        }
+
+        size_t length = mpack_strlen(field->key);
+        if (length > MPACK_UINT32_MAX) {
+            mpack_break("field key is too long!");
+            return false;
+        }
+        for (j = 0; j < i; ++j) {
+            if (mpack_strlen(fields[j].key) == length && mpack_memcmp(fields[j].key, field->key, length) == 0) {
+                mpack_break("duplicate field key \"%s\"!", field->key);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static size_t mpack_schema_encode_key(char* p, const char* key, size_t length) {
+    size_t header;
+    if (length <= 31) {
+        mpack_store_u8(p, (uint8_t)(0xa0 | length));
+        header = 1;
+    } else if (length <= MPACK_UINT8_MAX) {
+        mpack_store_u8(p, 0xd9);
+        mpack_store_u8(p + 1, (uint8_t)length);
+        header = 2;
+    } else if (length <= MPACK_UINT16_MAX) {
+        mpack_store_u8(p, 0xda);
+        mpack_store_u16(p + 1, (uint16_t)length);
+        header = 3;
+    } else {
+        mpack_store_u8(p, 0xdb);
+        mpack_store_u32(p + 1, (uint32_t)length);
+        header = 5;
+    }
+    mpack_memcpy(p + header, key, length);
+    return header + length;
+}
+
+static size_t mpack_schema_encoded_key_size(size_t length) {
+    if (length <= 31)
+        return 1 + length;
+    if (length <= MPACK_UINT8_MAX)
+        return 2 + length;
+    if (length <= MPACK_UINT16_MAX)
+        return 3 + length;
+    return 5 + length;
+}
+
+static const char* mpack_schema_key(const void* context, size_t index, size_t* length) {
+    const mpack_schema_t* schema = (const mpack_schema_t*)context;
+    *length = schema->keys[index].length;
+    return schema->fields[index].key;
+}
+
+mpack_error_t mpack_schema_init(mpack_schema_t* schema, const mpack_field_t* fields, size_t count) {
+    return mpack_schema_init_allocator(schema, fields, count, NULL);
+}
+
+mpack_error_t mpack_schema_init_allocator(mpack_schema_t* schema, const mpack_field_t* fields, size_t count,
+        const mpack_allocator_t* allocator)
+{
+    mpack_memset(schema, 0, sizeof(*schema));
+    if (allocator != NULL)
+        schema->allocator = *allocator;
+
+    if (count > MPACK_SCHEMA_MAX_FIELDS) {
+        mpack_break("schema has %i fields but MPACK_SCHEMA_MAX_FIELDS is %i!",
+                (int)count, (int)MPACK_SCHEMA_MAX_FIELDS);
+        return mpack_error_bug;
+    }
+    if (!mpack_schema_check_fields(fields, count))
+        return mpack_error_bug;
+
+    size_t i;
+    size_t encoded_size = 0;
+    for (i = 0; i < count; ++i)
+        encoded_size += mpack_schema_encoded_key_size(mpack_strlen(fields[i].key));
+
+    // the keys and encoded keys are stored in a single allocation
+    size_t keys_size = sizeof(mpack_schema_key_t) * count;
+    if (count > 0) {
+        char* data = (char*)mpack_allocator_alloc(&schema->allocator, keys_size + encoded_size);
+        if (data == NULL)
+            return mpack_error_memory;
+        schema->keys = (mpack_schema_key_t*)(void*)data;
+
+        char* encoded = data + keys_size;
+        for (i = 0; i < count; ++i) {
+            mpack_schema_key_t* key = &schema->keys[i];
+            key->length = mpack_strlen(fields[i].key);
+            key->encoded = encoded;
+            key->encoded_size = mpack_schema_encode_key(encoded, fields[i].key, key->length);
+            encoded += key->encoded_size;
+            if (schema->max_length < key->length)
+                schema->max_length = key->length;
+        }
+    }
+
+    schema->fields = fields;
+    schema->count = count;
+    mpack_error_t error = mpack_perfect_hash_init(&schema->hash, count,
+            &mpack_schema_key, schema, &schema->allocator);
+    if (error != mpack_ok) {
+        mpack_schema_destroy(schema);
+        return error;
+    }
+
+    mpack_log("compiled schema of %i fields\n", (int)count);
+    return mpack_ok;
+}
+
+void mpack_schema_destroy(mpack_schema_t* schema) {
+    mpack_perfect_hash_destroy(&schema->hash, &schema->allocator);
+    if (schema->keys != NULL)
+        mpack_allocator_free(&schema->allocator, schema->keys);
+    mpack_memset(schema, 0, sizeof(*schema));
+}
+
+size_t mpack_schema_find(const mpack_schema_t* schema, const char* key, size_t length) {
+    if (length > schema->max_length || schema->count == 0)
+        return schema->count;
+
+    size_t index = mpack_perfect_hash_find(&schema->hash, key, length);
+    if (index == 0)
+        return schema->count;
+    --index;
+
+    if (schema->keys[index].length != length || mpack_memcmp(schema->fields[index].key, key, length) != 0)
+        return schema->count;
+    return index;
+}
+
+
+
+/*
+ * Encoding
+ */
+
+#if MPACK_WRITER
+static size_t mpack_schema_cstr_length(const char* str, size_t size) {
+    size_t length = 0;
+    while (length < size && str[length] != '\0')
+        ++length;
+    return length;
+}
+
+static void mpack_schema_write_value(mpack_writer_t* writer, const mpack_field_t* field, const char* p) {
+    switch (field->type) {
+        case mpack_field_bool: {
+            bool value;
+            mpack_memcpy(&value, p, sizeof(value));
+            mpack_write_bool(writer, value);
+            return;
+        }
+        case mpack_field_u8: {
+            uint8_t value;
+            mpack_memcpy(&value, p, sizeof(value));
+            mpack_write_u8(writer, value);
+            return;
+        }
+        case mpack_field_u16: {
+            uint16_t value;
+            mpack_memcpy(&value, p, sizeof(value));
+            mpack_write_u16(writer, value);
+            return;
+        }
+        case mpack_field_u32: {
+            uint32_t value;
+            mpack_memcpy(&value, p, sizeof(value));
+            mpack_write_u32(writer, value);
+            return;
+        }
+        case mpack_field_u64: {
+            uint64_t value;
+            mpack_memcpy(&value, p, sizeof(value));
+            mpack_write_u64(writer, value);
+            return;
+        }
+        case mpack_field_i8: {
+            int8_t value;
+            mpack_memcpy(&value, p, sizeof(value));
+            mpack_write_i8(writer, value);
+            return;
+        }
+        case mpack_field_i16: {
+            int16_t value;
+            mpack_memcpy(&value, p, sizeof(value));
+            mpack_write_i16(writer, value);
+            return;
+        }
+        case mpack_field_i32: {
+            int32_t value;
+            mpack_memcpy(&value, p, sizeof(value));
+            mpack_write_i32(writer, value);
+            return;
+        }
+        case mpack_field_i64: {
+            int64_t value;
+            mpack_memcpy(&value, p, sizeof(value));
+            mpack_write_i64(writer, value);
+            return;
+        }
+        #if MPACK_FLOAT
+        case mpack_field_float: {
+            float value;
+            mpack_memcpy(&value, p, sizeof(value));
+            mpack_write_float(writer, value);
+            return;
+        }
+        #endif
+        #if MPACK_DOUBLE
+        case mpack_field_double: {
+            double value;
+            mpack_memcpy(&value, p, sizeof(value));
+            mpack_write_double(writer, value);
+            return;
+        }
+        #endif
+        case mpack_field_cstr:
+            mpack_write_str(writer, p, (uint32_t)mpack_schema_cstr_length(p, field->size));
+            return;
+        default:
+            break;
+    }
+    mpack_assert(0, "invalid field type %i", (int)field->type);
+}
+
+void mpack_encode_struct(mpack_writer_t* writer, const mpack_schema_t* schema, const void* object) {
+    const char* base = (const char*)object;
+    size_t i;
+
+    mpack_start_map(writer, (uint32_t)schema->count);
+    for (i = 0; i < schema->count && mpack_writer_error(writer) == mpack_ok; ++i) {
+        const mpack_field_t* field = &schema->fields[i];
+        const mpack_schema_key_t* key = &schema->keys[i];
+
+        // the pre-encoded keys use str8, so older versions re-encode theirs
+        #if MPACK_COMPATIBILITY
+        if (writer->version != mpack_version_current) {
+            mpack_write_str(writer, field->key, (uint32_t)key->length);
+        } else
+        #endif
+        {
+            mpack_write_object_bytes(writer, key->encoded, key->encoded_size);
+        }
+
+        mpack_schema_write_value(writer, field, base + field->offset);
+    }
+    mpack_finish_map(writer);
+}
+#endif
+
+
+
+/*
+ * Decoding
+ */
+
+#if MPACK_EXPECT
+static size_t mpack_schema_read_key(mpack_reader_t* reader, const mpack_schema_t* schema) {
+
+    // the key is only recognized if it is a string
+    if (mpack_peek_tag(reader).type != mpack_type_str) {
+        mpack_discard(reader);
+        return schema->count;
+    }
+
+    size_t length = mpack_expect_str(reader);
+
+    // keys that are longer than any field are skipped without reading them
+    // in-place, since they may not fit in the buffer
+    if (length > schema->max_length) {
+        mpack_skip_bytes(reader, length);
+        mpack_done_str(reader);
+        return schema->count;
+    }
+
+    const char* key = mpack_read_bytes_inplace(reader, length);
+    mpack_done_str(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return schema->count;
+    return mpack_schema_find(schema, key, length);
+}
+
+static void mpack_schema_read_value(mpack_reader_t* reader, const mpack_field_t* field, char* p) {
+    switch (field->type) {
+        case mpack_field_bool: {
+            bool value = mpack_expect_bool(reader);
+            mpack_memcpy(p, &value, sizeof(value));
+            return;
+        }
+        case mpack_field_u8: {
+            uint8_t value = mpack_expect_u8(reader);
+            mpack_memcpy(p, &value, sizeof(value));
+            return;
+        }
+        case mpack_field_u16: {
+            uint16_t value = mpack_expect_u16(reader);
+            mpack_memcpy(p, &value, sizeof(value));
+            return;
+        }
+        case mpack_field_u32: {
+            uint32_t value = mpack_expect_u32(reader);
+            mpack_memcpy(p, &value, sizeof(value));
+            return;
+        }
+        case mpack_field_u64: {
+            uint64_t value = mpack_expect_u64(reader);
+            mpack_memcpy(p, &value, sizeof(value));
+            return;
+        }
+        case mpack_field_i8: {
+            int8_t value = mpack_expect_i8(reader);
+            mpack_memcpy(p, &value, sizeof(value));
+            return;
+        }
+        case mpack_field_i16: {
+            int16_t value = mpack_expect_i16(reader);
+            mpack_memcpy(p, &value, sizeof(value));
+            return;
+        }
+        case mpack_field_i32: {
+            int32_t value = mpack_expect_i32(reader);
+            mpack_memcpy(p, &value, sizeof(value));
+            return;
+        }
+        case mpack_field_i64: {
+            int64_t value = mpack_expect_i64(reader);
+            mpack_memcpy(p, &value, sizeof(value));
+            return;
+        }
+        #if MPACK_FLOAT
+        case mpack_field_float: {
+            float value = mpack_expect_float(reader);
+            mpack_memcpy(p, &value, sizeof(value));
+            return;
+        }
+        #endif
+        #if MPACK_DOUBLE
+        case mpack_field_double: {
+            double value = mpack_expect_double(reader);
+            mpack_memcpy(p, &value, sizeof(value));
+            return;
+        }
+        #endif
+        case mpack_field_cstr:
+            mpack_expect_cstr(reader, p, field->size);
+            return;
+        default:
+            break;
+    }
+    mpack_assert(0, "invalid field type %i", (int)field->type);
+}
+
+void mpack_decode_struct(mpack_reader_t* reader, const mpack_schema_t* schema, void* object) {
+    char* base = (char*)object;
+    bool found[MPACK_SCHEMA_MAX_FIELDS];
+    size_t i;
+
+    mpack_memset(found, 0, sizeof(*found) * schema->count);
+
+    uint32_t count = mpack_expect_map(reader);
+    for (; count > 0 && mpack_reader_error(reader) == mpack_ok; --count) {
+        size_t index = mpack_schema_read_key(reader, schema);
+
+        // unrecognized keys are fine, we just skip their values
+        if (index == schema->count) {
+            mpack_discard(reader);
+            continue;
+        }
+
+        if (found[index]) {
+            mpack_reader_flag_error(reader, mpack_error_invalid);
+            return;
+        }
+        found[index] = true;
+
+        const mpack_field_t* field = &schema->fields[index];
+        mpack_schema_read_value(reader, field, base + field->offset);
+    }
+    mpack_done_map(reader);
+
+    if (mpack_reader_error(reader) != mpack_ok)
+        return;
+    for (i = 0; i < schema->count; ++i) {
+        if (!found[i] && !(schema->fields[i].flags & MPACK_FIELD_OPTIONAL)) {
+            mpack_reader_flag_error(reader, mpack_error_data);
+            return;
+        }
+    }
+}
+#endif
+
+
+
+/*
+ * Columns
+ */
+
+#if MPACK_NODE || MPACK_EXPECT
+static size_t mpack_column_value_size(mpack_field_type_t type) {
+    if (type == mpack_field_str)
+        return sizeof(mpack_str_ref_t);
+    return mpack_field_type_size(type);
+}
+
+static bool mpack_columns_check(const mpack_enum_matcher_t* keys, const mpack_column_t* columns) {
+    if (keys->count > MPACK_SCHEMA_MAX_FIELDS) {
+        mpack_break("%i columns but MPACK_SCHEMA_MAX_FIELDS is %i!",
+                (int)keys->count, (int)MPACK_SCHEMA_MAX_FIELDS);
+        return false;
+    }
+
+    size_t i;
+    for (i = 0; i < keys->count; ++i) {
+        if (mpack_column_value_size(columns[i].type) == 0) {
+            mpack_break("column \"%s\" has unsupported type %i!", keys->strings[i], (int)columns[i].type);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void mpack_columns_clear_missing(const mpack_enum_matcher_t* keys, mpack_column_t* columns, size_t rows) {
+    size_t i;
+    for (i = 0; i < keys->count; ++i)
+        if (columns[i].missing != NULL)
+            mpack_memset(columns[i].missing, 0, (rows + 7) / 8);
+}
+
+/*
+ * Marks the given row of the column as having no value, returning false if
+ * the column requires one.
+ */
+static bool mpack_column_set_missing(mpack_column_t* column, size_t row) {
+    if (column->missing == NULL)
+        return false;
+    column->missing[row / 8] = (uint8_t)(column->missing[row / 8] | (1u << (row % 8)));
+    size_t size = mpack_column_value_size(column->type);
+    mpack_memset((char*)column->values + size * row, 0, size);
+    return true;
+}
+#endif
+
+#if MPACK_NODE
+static void mpack_node_column_value(mpack_node_t node, mpack_column_t* column, size_t row) {
+    switch (column->type) {
+        case mpack_field_bool:   ((bool*)column->values)[row] = mpack_node_bool(node); return;
+        case mpack_field_u8:     ((uint8_t*)column->values)[row] = mpack_node_u8(node); return;
+        case mpack_field_u16:    ((uint16_t*)column->values)[row] = mpack_node_u16(node); return;
+        case mpack_field_u32:    ((uint32_t*)column->values)[row] = mpack_node_u32(node); return;
+        case mpack_field_u64:    ((uint64_t*)column->values)[row] = mpack_node_u64(node); return;
+        case mpack_field_i8:     ((int8_t*)column->values)[row] = mpack_node_i8(node); return;
+        case mpack_field_i16:    ((int16_t*)column->values)[row] = mpack_node_i16(node); return;
+        case mpack_field_i32:    ((int32_t*)column->values)[row] = mpack_node_i32(node); return;
+        case mpack_field_i64:    ((int64_t*)column->values)[row] = mpack_node_i64(node); return;
+        #if MPACK_FLOAT
+        case mpack_field_float:  ((float*)column->values)[row] = mpack_node_float(node); return;
+        #endif
+        #if MPACK_DOUBLE
+        case mpack_field_double: ((double*)column->values)[row] = mpack_node_double(node); return;
+        #endif
+        case mpack_field_str: {
+            mpack_str_ref_t* ref = &((mpack_str_ref_t*)column->values)[row];
+            const char* str = mpack_node_str(node);
+            ref->offset = (mpack_node_error(node) == mpack_ok) ? (size_t)(str - mpack_tree_data(node.tree)) : 0;
+            ref->length = mpack_node_strlen(node);
+            return;
+        }
+        default:
+            break;
+    }
+    mpack_assert(0, "invalid column type %i", (int)column->type);
+}
+
+size_t mpack_node_columns(mpack_node_t node, const mpack_enum_matcher_t* keys,
+        mpack_column_t* columns, size_t max_rows)
+{
+    if (mpack_node_error(node) != mpack_ok)
+        return 0;
+
+    if (!mpack_columns_check(keys, columns)) {
+        mpack_node_flag_error(node, mpack_error_bug);
+        return 0;
+    }
+
+    size_t rows = mpack_node_array_length(node);
+    if (rows > max_rows) {
+        mpack_node_flag_error(node, mpack_error_too_big);
+        return 0;
+    }
+    mpack_columns_clear_missing(keys, columns, rows);
+
+    bool found[MPACK_SCHEMA_MAX_FIELDS];
+    size_t row, i;
+    for (row = 0; row < rows && mpack_node_error(node) == mpack_ok; ++row) {
+        mpack_node_t map = mpack_node_array_at(node, row);
+        size_t count = mpack_node_map_count(map);
+        mpack_memset(found, 0, sizeof(*found) * keys->count);
+
+        for (i = 0; i < count; ++i) {
+            mpack_node_t key = mpack_node_map_key_at(map, i);
+            if (mpack_node_type(key) != mpack_type_str)
+                continue;
+            size_t index = mpack_enum_matcher_find(keys, mpack_node_str(key), mpack_node_strlen(key));
+            if (index == keys->count)
+                continue;
+
+            if (found[index]) {
+                mpack_node_flag_error(node, mpack_error_data);
+                return 0;
+            }
+            found[index] = true;
+
+            mpack_node_t value = mpack_node_map_value_at(map, i);
+            if (columns[index].missing != NULL && mpack_node_is_nil(value))
+                mpack_column_set_missing(&columns[index], row);
+            else
+                mpack_node_column_value(value, &columns[index], row);
+        }
+
+        for (i = 0; i < keys->count; ++i) {
+            if (!found[i] && !mpack_column_set_missing(&columns[i], row)) {
+                mpack_node_flag_error(node, mpack_error_data);
+                return 0;
+            }
+        }
+    }
+
+    if (mpack_node_error(node) != mpack_ok)
+        return 0;
+    return rows;
+}
+#endif
+
+#if MPACK_EXPECT
+/*
+ * Reads a str into the shared string buffer, returning its location.
+ */
+static mpack_str_ref_t mpack_decode_column_str(mpack_reader_t* reader,
+        char* strings, size_t strings_size, size_t* strings_used)
+{
+    mpack_str_ref_t ref = {0, 0};
+    size_t length = mpack_expect_str(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return ref;
+
+    if (length > strings_size - *strings_used) {
+        mpack_reader_flag_error(reader, mpack_error_too_big);
+        return ref;
+    }
+
+    mpack_read_bytes(reader, strings + *strings_used, length);
+    mpack_done_str(reader);
+    ref.offset = *strings_used;
+    ref.length = length;
+    *strings_used += length;
+    return ref;
+}
+
+static void mpack_decode_column_value(mpack_reader_t* reader, mpack_column_t* column, size_t row,
+        char* strings, size_t strings_size, size_t* strings_used)
+{
+    switch (column->type) {
+        case mpack_field_bool:   ((bool*)column->values)[row] = mpack_expect_bool(reader); return;
+        case mpack_field_u8:     ((uint8_t*)column->values)[row] = mpack_expect_u8(reader); return;
+        case mpack_field_u16:    ((uint16_t*)column->values)[row] = mpack_expect_u16(reader); return;
+        case mpack_field_u32:    ((uint32_t*)column->values)[row] = mpack_expect_u32(reader); return;
+        case mpack_field_u64:    ((uint64_t*)column->values)[row] = mpack_expect_u64(reader); return;
+        case mpack_field_i8:     ((int8_t*)column->values)[row] = mpack_expect_i8(reader); return;
+        case mpack_field_i16:    ((int16_t*)column->values)[row] = mpack_expect_i16(reader); return;
+        case mpack_field_i32:    ((int32_t*)column->values)[row] = mpack_expect_i32(reader); return;
+        case mpack_field_i64:    ((int64_t*)column->values)[row] = mpack_expect_i64(reader); return;
+        #if MPACK_FLOAT
+        case mpack_field_float:  ((float*)column->values)[row] = mpack_expect_float(reader); return;
+        #endif
+        #if MPACK_DOUBLE
+        case mpack_field_double: ((double*)column->values)[row] = mpack_expect_double(reader); return;
+        #endif
+        case mpack_field_str:
+            ((mpack_str_ref_t*)column->values)[row] =
+                    mpack_decode_column_str(reader, strings, strings_size, strings_used);
+            return;
+        default:
+            break;
+    }
+    mpack_assert(0, "invalid column type %i", (int)column->type);
+}
+
+size_t mpack_decode_columns(mpack_reader_t* reader, const mpack_enum_matcher_t* keys,
+        mpack_column_t* columns, size_t max_rows, char* strings, size_t strings_size)
+{
+    if (mpack_reader_error(reader) != mpack_ok)
+        return 0;
+
+    if (!mpack_columns_check(keys, columns)) {
+        mpack_reader_flag_error(reader, mpack_error_bug);
+        return 0;
+    }
+
+    size_t rows = mpack_expect_array(reader);
+    if (mpack_reader_error(reader) != mpack_ok)
+        return 0;
+    if (rows > max_rows) {
+        mpack_reader_flag_error(reader, mpack_error_too_big);
+        return 0;
+    }
+    mpack_columns_clear_missing(keys, columns, rows);
+
+    bool found[MPACK_SCHEMA_MAX_FIELDS];
+    size_t strings_used = 0;
+    size_t row, i;
+    for (row = 0; row < rows && mpack_reader_error(reader) == mpack_ok; ++row) {
+        uint32_t count = mpack_expect_map(reader);
+        mpack_memset(found, 0, sizeof(*found) * keys->count);
+
+        for (; count > 0 && mpack_reader_error(reader) == mpack_ok; --count) {
+            size_t index = mpack_expect_key_matcher(reader, keys, found);
+
+            // unrecognized keys are fine, we just skip their values
+            if (index == keys->count) {
+                mpack_discard(reader);
+                continue;
+            }
+
+            mpack_column_t* column = &columns[index];
+            if (column->missing != NULL && mpack_peek_tag(reader).type == mpack_type_nil) {
+                mpack_discard(reader);
+                mpack_column_set_missing(column, row);
+            } else {
+                mpack_decode_column_value(reader, column, row, strings, strings_size, &strings_used);
+            }
+        }
+        mpack_done_map(reader);
+
+        if (mpack_reader_error(reader) != mpack_ok)
+            break;
+        for (i = 0; i < keys->count; ++i) {
+            if (!found[i] && !mpack_column_set_missing(&columns[i], row)) {
+                mpack_reader_flag_error(reader, mpack_error_data);
+                return 0;
+            }
+        }
+    }
+    mpack_done_array(reader);
+
+    if (mpack_reader_error(reader) != mpack_ok)
+        return 0;
+    return rows;
+}
+#endif
+
+#endif
+
+MPACK_SILENCE_WARNINGS_END
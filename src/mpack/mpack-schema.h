@@ -0,0 +1,395 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file
+ *
+ * Declares the MPack Schema API.
+ */
+
+#ifndef MPACK_SCHEMA_H
+#define MPACK_SCHEMA_H 1
+
+#include "mpack-writer.h"
+#include "mpack-expect.h"
+#include "mpack-node.h"
+
+MPACK_SILENCE_WARNINGS_BEGIN
+MPACK_EXTERN_C_BEGIN
+
+#if MPACK_SCHEMA
+
+#ifndef MPACK_MALLOC
+#error "MPACK_SCHEMA requires MPACK_MALLOC."
+#endif
+
+#if MPACK_SCHEMA_MAX_FIELDS < 1 || MPACK_SCHEMA_MAX_FIELDS > 65535
+#error "MPACK_SCHEMA_MAX_FIELDS must be between 1 and 65535."
+#endif
+
+/**
+ * @defgroup schema Schema API
+ *
+ * The MPack Schema API encodes and decodes C structs with a fixed layout as
+ * MessagePack maps.
+ *
+ * A struct is described by a static table of @ref mpack_field_t, one per
+ * member, usually declared with @ref MPACK_FIELD(). The table is compiled
+ * once into an @ref mpack_schema_t with mpack_schema_init(). This builds a
+ * perfect hash of the keys for decoding and pre-encodes the keys for
+ * encoding, so mpack_decode_struct() and mpack_encode_struct() do a constant
+ * amount of work per field regardless of the size of the schema.
+ *
+ * For example:
+ *
+ * @code{.c}
+ * typedef struct point_t {
+ *     uint32_t id;
+ *     double x, y;
+ *     char name[16];
+ * } point_t;
+ *
+ * static const mpack_field_t point_fields[] = {
+ *     MPACK_FIELD(point_t, id, mpack_field_u32, 0),
+ *     MPACK_FIELD(point_t, x, mpack_field_double, 0),
+ *     MPACK_FIELD(point_t, y, mpack_field_double, 0),
+ *     MPACK_FIELD(point_t, name, mpack_field_cstr, MPACK_FIELD_OPTIONAL),
+ * };
+ *
+ * mpack_schema_t point_schema;
+ * mpack_schema_init(&point_schema, point_fields, sizeof(point_fields) / sizeof(*point_fields));
+ *
+ * point_t point;
+ * mpack_decode_struct(&reader, &point_schema, &point);
+ * @endcode
+ *
+ * A compiled schema is immutable so it can be shared between threads.
+ *
+ * @note This requires @ref MPACK_SCHEMA. Decoding additionally requires
+ * @ref MPACK_EXPECT and encoding requires @ref MPACK_WRITER.
+ *
+ * @{
+ */
+
+/**
+ * The type of a struct member described by an @ref mpack_field_t.
+ */
+typedef enum mpack_field_type_t {
+    mpack_field_bool,     /**< A bool. */
+    mpack_field_u8,       /**< A uint8_t. */
+    mpack_field_u16,      /**< A uint16_t. */
+    mpack_field_u32,      /**< A uint32_t. */
+    mpack_field_u64,      /**< A uint64_t. */
+    mpack_field_i8,       /**< An int8_t. */
+    mpack_field_i16,      /**< An int16_t. */
+    mpack_field_i32,      /**< An int32_t. */
+    mpack_field_i64,      /**< An int64_t. */
+    #if MPACK_FLOAT
+    mpack_field_float,    /**< A float. This requires @ref MPACK_FLOAT. */
+    #endif
+    #if MPACK_DOUBLE
+    mpack_field_double,   /**< A double. This requires @ref MPACK_DOUBLE. */
+    #endif
+
+    /**
+     * A char array holding a null-terminated string.
+     *
+     * The string is decoded with mpack_expect_cstr(), so it must fit in the
+     * array including the null-terminator or @ref mpack_error_too_big is
+     * raised.
+     */
+    mpack_field_cstr,
+
+    /**
+     * A string referenced in place as an @ref mpack_str_ref_t.
+     *
+     * This is only supported in columns. See @ref mpack_column_t.
+     */
+    mpack_field_str
+} mpack_field_type_t;
+
+/**
+ * A field flag indicating that the key may be missing when decoding.
+ *
+ * If an optional key is missing, the member is left unchanged. Otherwise a
+ * missing key raises @ref mpack_error_data.
+ */
+#define MPACK_FIELD_OPTIONAL 1u
+
+/**
+ * Describes a struct member to encode to or decode from a map.
+ *
+ * @see MPACK_FIELD()
+ */
+typedef struct mpack_field_t {
+    const char* key;         /**< The null-terminated key in the map. */
+    mpack_field_type_t type; /**< The type of the member. */
+    size_t offset;           /**< The offset of the member in the struct. */
+    size_t size;             /**< The size of the member in bytes. */
+    unsigned flags;          /**< A combination of field flags such as @ref MPACK_FIELD_OPTIONAL. */
+} mpack_field_t;
+
+/**
+ * Declares an @ref mpack_field_t initializer for the given member of the
+ * given struct type, with the name of the member as its key.
+ */
+#define MPACK_FIELD(structure, member, type, flags) \
+    MPACK_FIELD_KEY(#member, structure, member, type, flags)
+
+/**
+ * Declares an @ref mpack_field_t initializer for the given member of the
+ * given struct type with the given key.
+ */
+#define MPACK_FIELD_KEY(key, structure, member, type, flags) \
+    {key, type, offsetof(structure, member), sizeof(((structure*)NULL)->member), flags}
+
+/**
+ * A compiled schema.
+ *
+ * The contents of this struct are private. Initialize it with
+ * mpack_schema_init() and destroy it with mpack_schema_destroy().
+ */
+typedef struct mpack_schema_t mpack_schema_t;
+
+/* The encoded key of a field in a compiled schema. */
+typedef struct mpack_schema_key_t {
+    const char* encoded;
+    size_t encoded_size;
+    size_t length;
+} mpack_schema_key_t;
+
+struct mpack_schema_t {
+    const mpack_field_t* fields; /* The field table */
+    size_t count;                /* The number of fields */
+    mpack_schema_key_t* keys;    /* The encoded keys, one per field */
+    mpack_perfect_hash_t hash;   /* The perfect hash of the keys */
+    size_t max_length;           /* The length of the longest key */
+    mpack_allocator_t allocator; /* The allocator of the keys and hash */
+};
+
+/**
+ * Compiles a table of fields into a schema.
+ *
+ * The field table is referenced, not copied, so it must outlive the schema.
+ * It is expected to be a static table.
+ *
+ * If the table is invalid (for example if it contains a duplicate key or the
+ * size of a member does not match its type), @ref mpack_error_bug is
+ * returned. If memory cannot be allocated, @ref mpack_error_memory is
+ * returned. In either case the schema does not need to be destroyed.
+ *
+ * @param schema The schema to initialize.
+ * @param fields The table of fields.
+ * @param count The number of fields. This cannot exceed @ref MPACK_SCHEMA_MAX_FIELDS.
+ * @return @ref mpack_ok if the schema was compiled, or an error otherwise.
+ */
+mpack_error_t mpack_schema_init(mpack_schema_t* schema, const mpack_field_t* fields, size_t count);
+
+/**
+ * Compiles a table of fields into a schema, allocating it with the given
+ * allocator (or with MPACK_MALLOC() if it is NULL.)
+ *
+ * The allocator is copied into the schema and used again to free it in
+ * mpack_schema_destroy().
+ *
+ * @see mpack_schema_init()
+ */
+mpack_error_t mpack_schema_init_allocator(mpack_schema_t* schema, const mpack_field_t* fields, size_t count,
+        const mpack_allocator_t* allocator);
+
+/**
+ * Destroys a schema compiled with mpack_schema_init().
+ */
+void mpack_schema_destroy(mpack_schema_t* schema);
+
+/**
+ * Returns the index of the field with the given key, or the number of fields
+ * if there is no such field.
+ */
+size_t mpack_schema_find(const mpack_schema_t* schema, const char* key, size_t length);
+
+#if MPACK_WRITER
+/**
+ * Writes a struct as a map containing every field of the schema, in order.
+ *
+ * @note This requires @ref MPACK_WRITER.
+ *
+ * @param writer The writer.
+ * @param schema The compiled schema of the struct.
+ * @param object The struct to encode.
+ */
+void mpack_encode_struct(mpack_writer_t* writer, const mpack_schema_t* schema, const void* object);
+#endif
+
+#if MPACK_EXPECT
+/**
+ * Reads a map into a struct.
+ *
+ * Keys are matched with the perfect hash of the schema. Unrecognized keys and
+ * their values are skipped. A duplicate key raises @ref mpack_error_invalid,
+ * and a key that is missing raises @ref mpack_error_data unless the field is
+ * flagged @ref MPACK_FIELD_OPTIONAL. Values are read with the Expect API so
+ * they are converted in the same way, e.g. with mpack_expect_u32() for a
+ * @ref mpack_field_u32.
+ *
+ * If an error occurs, the contents of the struct are unspecified.
+ *
+ * @note This requires @ref MPACK_EXPECT.
+ *
+ * @param reader The reader.
+ * @param schema The compiled schema of the struct.
+ * @param object The struct to decode into.
+ */
+void mpack_decode_struct(mpack_reader_t* reader, const mpack_schema_t* schema, void* object);
+#endif
+
+/**
+ * The location of a string in a column of type @ref mpack_field_str.
+ */
+typedef struct mpack_str_ref_t {
+    size_t offset; /**< The offset of the string from the start of the column's string data. */
+    size_t length; /**< The length of the string in bytes. */
+} mpack_str_ref_t;
+
+/**
+ * A column of values extracted from an array of maps.
+ *
+ * Tables of records are often encoded as an array of maps with the same
+ * keys, e.g. <tt>[{"ts": ..., "id": ..., "value": ...}, ...]</tt>.
+ * mpack_node_columns() and mpack_decode_columns() transpose such an array in
+ * a single pass into one array per key, so the values of each key are
+ * contiguous and the maps don't need to be searched key by key.
+ *
+ * The keys of the columns are given as an @ref mpack_enum_matcher_t, so
+ * column @a i holds the values of the key at index @a i of the matcher.
+ *
+ * @code{.c}
+ * static const char* keys[] = {"ts", "value", "tag"};
+ * mpack_enum_matcher_t matcher;
+ * mpack_enum_matcher_init(&matcher, keys, 3);
+ *
+ * mpack_column_t columns[] = {
+ *     {mpack_field_i64, ts, NULL},
+ *     {mpack_field_double, values, values_missing},
+ *     {mpack_field_str, tags, NULL},
+ * };
+ * size_t rows = mpack_node_columns(mpack_tree_root(&tree), &matcher, columns, max_rows);
+ * @endcode
+ *
+ * Strings are extracted into columns of type @ref mpack_field_str as an
+ * @ref mpack_str_ref_t per row. mpack_node_columns() refers to the strings in
+ * place in the tree's data, while mpack_decode_columns() copies them into a
+ * buffer shared by the columns. Type @ref mpack_field_cstr is not supported.
+ */
+typedef struct mpack_column_t {
+    /**
+     * The type of the values of the column.
+     */
+    mpack_field_type_t type;
+
+    /**
+     * A buffer for one value per row, of the C type matching the column type
+     * (or @ref mpack_str_ref_t for @ref mpack_field_str.)
+     */
+    void* values;
+
+    /**
+     * A bitmap of rows with no value, or NULL if every row must have one.
+     *
+     * If not NULL, this must have room for one bit per row, i.e. <tt>(max_rows
+     * + 7) / 8</tt> bytes. The bit of row @a i is <tt>1 << (i % 8)</tt> of
+     * byte <tt>i / 8</tt>. It is set if the key is missing from the row or
+     * its value is nil, in which case the value of the row is zero.
+     *
+     * If NULL, a missing key raises @ref mpack_error_data and a nil value
+     * raises @ref mpack_error_type.
+     */
+    uint8_t* missing;
+} mpack_column_t;
+
+#if MPACK_NODE
+/**
+ * Extracts the values of an array of maps into columns, returning the number
+ * of rows.
+ *
+ * Each element of the array is a row, and must be a map. The value of each
+ * key found in @a keys is converted to the type of its column as with the
+ * corresponding Node function, e.g. mpack_node_u32() for a @ref
+ * mpack_field_u32. Keys that are not in @a keys are ignored. A key that
+ * appears more than once in a row raises @ref mpack_error_data.
+ *
+ * Strings in columns of type @ref mpack_field_str are referenced in place.
+ * Their offsets are from mpack_tree_data().
+ *
+ * If the array has more than @a max_rows elements, @ref mpack_error_too_big
+ * is raised. If an error occurs, zero is returned and the contents of the
+ * columns are unspecified.
+ *
+ * @param node The array node
+ * @param keys The keys of the columns
+ * @param columns The columns, one per key of @a keys
+ * @param max_rows The number of rows for which the columns have room
+ *
+ * @see mpack_column_t
+ */
+size_t mpack_node_columns(mpack_node_t node, const mpack_enum_matcher_t* keys,
+        mpack_column_t* columns, size_t max_rows);
+#endif
+
+#if MPACK_EXPECT
+/**
+ * Reads an array of maps into columns, returning the number of rows.
+ *
+ * This is the same as mpack_node_columns() except that values are read with
+ * the Expect API, and that a duplicate key raises @ref mpack_error_invalid
+ * as with mpack_decode_struct().
+ *
+ * Strings in columns of type @ref mpack_field_str are copied one after
+ * another into the given buffer. Their offsets are from the start of the
+ * buffer. If the buffer is too small, @ref mpack_error_too_big is raised.
+ *
+ * @note This requires @ref MPACK_EXPECT.
+ *
+ * @param reader The reader
+ * @param keys The keys of the columns
+ * @param columns The columns, one per key of @a keys
+ * @param max_rows The number of rows for which the columns have room
+ * @param strings A buffer for the strings of columns of type @ref
+ *     mpack_field_str, or NULL if there are none
+ * @param strings_size The size of the buffer in bytes
+ *
+ * @see mpack_column_t
+ */
+size_t mpack_decode_columns(mpack_reader_t* reader, const mpack_enum_matcher_t* keys,
+        mpack_column_t* columns, size_t max_rows, char* strings, size_t strings_size);
+#endif
+
+/**
+ * @}
+ */
+
+#endif
+
+MPACK_EXTERN_C_END
+MPACK_SILENCE_WARNINGS_END
+
+#endif
+
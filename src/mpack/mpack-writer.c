@@ -96,31 +96,84 @@ static void mpack_writer_clear(mpack_writer_t* writer) {
     #if MPACK_COMPATIBILITY
     writer->version = mpack_version_current;
     #endif
+    #if MPACK_DOUBLE
+    writer->compact_floats = false;
+    #endif
     writer->flush = NULL;
     writer->error_fn = NULL;
     writer->teardown = NULL;
     writer->context = NULL;
 
+    writer->flush_iov = NULL;
+    writer->iov = NULL;
+    writer->iov_count = 0;
+    writer->iov_capacity = 0;
+    writer->iov_start = NULL;
+
     writer->buffer = NULL;
     writer->position = NULL;
     writer->end = NULL;
     writer->error = mpack_ok;
 
+    writer->frame_open = false;
+    writer->frame_start = 0;
+
     #if MPACK_WRITE_TRACKING
     mpack_memset(&writer->track, 0, sizeof(writer->track));
     #endif
 
+    #ifdef MPACK_MALLOC
+    mpack_memset(&writer->allocator, 0, sizeof(writer->allocator));
+    #endif
+
+    #if MPACK_STATS
+    mpack_memset(&writer->stats, 0, sizeof(writer->stats));
+    #endif
+
     #if MPACK_BUILDER
     writer->builder.current_build = NULL;
     writer->builder.latest_build = NULL;
     writer->builder.current_page = NULL;
     writer->builder.pages = NULL;
+    writer->builder.spare = NULL;
     writer->builder.stash_buffer = NULL;
     writer->builder.stash_position = NULL;
     writer->builder.stash_end = NULL;
+    writer->builder.mode = mpack_build_mode_paged;
+    writer->builder.in_place = false;
+    writer->builder.canonical = false;
+    #endif
+}
+
+#if MPACK_BUILDER
+// Pages are not freed until the writer is destroyed. They are kept in a spare
+// list so that later builds don't need to allocate.
+static inline void mpack_builder_free_page(mpack_writer_t* writer, mpack_builder_page_t* page) {
+    mpack_log("releasing page %p\n", (void*)page);
+    #if MPACK_BUILDER_INTERNAL_STORAGE
+    if ((char*)page == writer->builder.internal)
+        return;
     #endif
+    page->next = writer->builder.spare;
+    writer->builder.spare = page;
 }
 
+// Frees a list of builder pages, skipping the internal storage.
+static void mpack_builder_free_list(mpack_writer_t* writer, const mpack_allocator_t* allocator,
+        mpack_builder_page_t* page)
+{
+    while (page != NULL) {
+        mpack_builder_page_t* next = page->next;
+        #if MPACK_BUILDER_INTERNAL_STORAGE
+        if ((char*)page != writer->builder.internal)
+        #endif
+            mpack_allocator_free(allocator, page);
+        page = next;
+    }
+    MPACK_UNUSED(writer);
+}
+#endif
+
 void mpack_writer_init(mpack_writer_t* writer, char* buffer, size_t size) {
     mpack_assert(buffer != NULL, "cannot initialize writer with empty buffer");
     mpack_writer_clear(writer);
@@ -144,6 +197,52 @@ void mpack_writer_init_error(mpack_writer_t* writer, mpack_error_t error) {
     mpack_log("initializing writer in error state %i\n", (int)error);
 }
 
+void mpack_writer_reset(mpack_writer_t* writer) {
+    // A writer without a buffer was initialized in an error state (or lost its
+    // buffer to an error) so there is nothing to write into.
+    if (writer->buffer == NULL)
+        return;
+
+    #if MPACK_BUILDER
+    // Drop any open builds, keeping their pages. A paged build has diverted
+    // the writer to its page so we restore the real buffer.
+    mpack_builder_t* builder = &writer->builder;
+    if (builder->current_build != NULL && !builder->in_place) {
+        writer->buffer = builder->stash_buffer;
+        writer->position = builder->stash_position;
+        writer->end = builder->stash_end;
+    }
+    mpack_builder_page_t* page = builder->pages;
+    while (page != NULL) {
+        mpack_builder_page_t* next = page->next;
+        mpack_builder_free_page(writer, page);
+        page = next;
+    }
+    builder->current_build = NULL;
+    builder->latest_build = NULL;
+    builder->current_page = NULL;
+    builder->pages = NULL;
+    builder->in_place = false;
+    #endif
+
+    writer->error = mpack_ok;
+    writer->position = writer->buffer;
+    writer->frame_open = false;
+    writer->iov_count = 0;
+    writer->iov_start = writer->buffer;
+
+    #if MPACK_WRITE_TRACKING
+    writer->track.count = 0;
+    #if !MPACK_TRACKING_DEPTH_ONLY
+    if (writer->track.capacity == 0)
+        mpack_writer_flag_if_error(writer, mpack_track_init(&writer->track));
+    #endif
+    #endif
+
+    mpack_log("===========================\n");
+    mpack_log("resetting writer\n");
+}
+
 void mpack_writer_set_flush(mpack_writer_t* writer, mpack_writer_flush_t flush) {
     MPACK_STATIC_ASSERT(MPACK_WRITER_MINIMUM_BUFFER_SIZE >= MPACK_MAXIMUM_TAG_SIZE,
             "minimum buffer size must fit any tag!");
@@ -160,6 +259,53 @@ void mpack_writer_set_flush(mpack_writer_t* writer, mpack_writer_flush_t flush)
     writer->flush = flush;
 }
 
+static void mpack_iov_writer_flush(mpack_writer_t* writer, const char* data, size_t count) {
+    // The buffer is flushed with data pointing to the start of the buffer.
+    // Anything else is extra data that doesn't fit in the (just emptied)
+    // buffer.
+    if (data == writer->buffer) {
+        const char* end = data + count;
+        if (end != writer->iov_start) {
+            writer->iov[writer->iov_count].base = writer->iov_start;
+            writer->iov[writer->iov_count].len = (size_t)(end - writer->iov_start);
+            ++writer->iov_count;
+        }
+    } else {
+        mpack_assert(writer->iov_count == 0, "extra data flushed with pending segments!");
+        writer->iov[writer->iov_count].base = data;
+        writer->iov[writer->iov_count].len = count;
+        ++writer->iov_count;
+    }
+
+    size_t iov_count = writer->iov_count;
+    writer->iov_count = 0;
+    writer->iov_start = writer->buffer;
+    if (iov_count > 0)
+        writer->flush_iov(writer, writer->iov, iov_count);
+}
+
+void mpack_writer_set_flush_iov(mpack_writer_t* writer, mpack_writer_flush_iov_t flush_iov,
+        mpack_iovec_t* iov, size_t iov_capacity)
+{
+    // we need room for the buffered bytes before a payload, the payload
+    // itself, and the buffered bytes after it.
+    if (iov_capacity < 3) {
+        mpack_break("iovec capacity is %i, but minimum capacity is 3", (int)iov_capacity);
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+
+    mpack_writer_set_flush(writer, mpack_iov_writer_flush);
+    if (writer->flush != mpack_iov_writer_flush)
+        return;
+
+    writer->flush_iov = flush_iov;
+    writer->iov = iov;
+    writer->iov_count = 0;
+    writer->iov_capacity = iov_capacity;
+    writer->iov_start = writer->buffer;
+}
+
 #ifdef MPACK_MALLOC
 typedef struct mpack_growable_writer_t {
     char** target_data;
@@ -209,16 +355,31 @@ static void mpack_growable_writer_flush(mpack_writer_t* writer, const char* data
             "extra flush for %i but there is %i space left in the buffer! (%i/%i)",
             (int)count, (int)mpack_writer_buffer_left(writer), (int)used, (int)size);
 
-    // grow to fit the data
-    // TODO: this really needs to correctly test for overflow
-    size_t new_size = size * 2;
-    while (new_size < used + count)
+    // grow to fit the data, by at least double. if doubling would overflow
+    // we grow to exactly what's needed instead.
+    if (count > SIZE_MAX - used) {
+        mpack_writer_flag_error(writer, mpack_error_memory);
+        return;
+    }
+    size_t needed = used + count;
+    size_t new_size = size;
+    do {
+        if (new_size > SIZE_MAX / 2) {
+            new_size = (needed > size) ? needed : SIZE_MAX;
+            break;
+        }
         new_size *= 2;
+    } while (new_size < needed);
+    if (new_size == size) {
+        mpack_writer_flag_error(writer, mpack_error_memory);
+        return;
+    }
 
     mpack_log("flush growing buffer size from %i to %i\n", (int)size, (int)new_size);
+    MPACK_STATS_ADD(writer->stats, grows, 1);
 
     // grow the buffer
-    char* new_buffer = (char*)mpack_realloc(writer->buffer, used, new_size);
+    char* new_buffer = (char*)mpack_allocator_realloc(&writer->allocator, writer->buffer, used, new_size);
     if (new_buffer == NULL) {
         mpack_writer_flag_error(writer, mpack_error_memory);
         return;
@@ -251,9 +412,9 @@ static void mpack_growable_writer_teardown(mpack_writer_t* writer) {
             // do this so we enforce it ourselves.
             size_t size = (used != 0) ? used : 1;
 
-            char* buffer = (char*)mpack_realloc(writer->buffer, used, size);
+            char* buffer = (char*)mpack_allocator_realloc(&writer->allocator, writer->buffer, used, size);
             if (!buffer) {
-                MPACK_FREE(writer->buffer);
+                mpack_allocator_free(&writer->allocator, writer->buffer);
                 mpack_writer_flag_error(writer, mpack_error_memory);
                 return;
             }
@@ -266,7 +427,7 @@ static void mpack_growable_writer_teardown(mpack_writer_t* writer) {
         writer->buffer = NULL;
 
     } else if (writer->buffer) {
-        MPACK_FREE(writer->buffer);
+        mpack_allocator_free(&writer->allocator, writer->buffer);
         writer->buffer = NULL;
     }
 
@@ -274,6 +435,12 @@ static void mpack_growable_writer_teardown(mpack_writer_t* writer) {
 }
 
 void mpack_writer_init_growable(mpack_writer_t* writer, char** target_data, size_t* target_size) {
+    mpack_writer_init_growable_reserve(writer, target_data, target_size, MPACK_BUFFER_SIZE);
+}
+
+void mpack_writer_init_growable_reserve(mpack_writer_t* writer, char** target_data, size_t* target_size,
+        size_t capacity)
+{
     mpack_assert(target_data != NULL, "cannot initialize writer without a destination for the data");
     mpack_assert(target_size != NULL, "cannot initialize writer without a destination for the size");
 
@@ -287,7 +454,8 @@ void mpack_writer_init_growable(mpack_writer_t* writer, char** target_data, size
     growable_writer->target_data = target_data;
     growable_writer->target_size = target_size;
 
-    size_t capacity = MPACK_BUFFER_SIZE;
+    if (capacity < MPACK_WRITER_MINIMUM_BUFFER_SIZE)
+        capacity = MPACK_WRITER_MINIMUM_BUFFER_SIZE;
     char* buffer = (char*)MPACK_MALLOC(capacity);
     if (buffer == NULL) {
         mpack_writer_init_error(writer, mpack_error_memory);
@@ -298,6 +466,67 @@ void mpack_writer_init_growable(mpack_writer_t* writer, char** target_data, size
     mpack_writer_set_flush(writer, mpack_growable_writer_flush);
     mpack_writer_set_teardown(writer, mpack_growable_writer_teardown);
 }
+
+void mpack_writer_reset_growable(mpack_writer_t* writer) {
+    mpack_growable_writer_t* growable_writer = (mpack_growable_writer_t*)mpack_writer_get_reserved(writer);
+
+    if (writer->flush != mpack_growable_writer_flush || writer->teardown != mpack_growable_writer_teardown) {
+        mpack_break("writer is not a growable writer!");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+
+    #if MPACK_WRITE_TRACKING
+    // You cannot reset while there are elements open.
+    mpack_writer_flag_if_error(writer, mpack_track_check_empty(&writer->track));
+    #endif
+
+    #if MPACK_BUILDER
+    if (writer->builder.current_build != NULL) {
+        mpack_break("cannot call mpack_writer_reset_growable() while there are elements open!");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+    }
+    #endif
+
+    if (mpack_writer_error(writer) != mpack_ok) {
+        *growable_writer->target_data = NULL;
+        *growable_writer->target_size = 0;
+        return;
+    }
+
+    *growable_writer->target_data = writer->buffer;
+    *growable_writer->target_size = mpack_writer_buffer_used(writer);
+    writer->position = writer->buffer;
+}
+
+void mpack_writer_set_allocator(mpack_writer_t* writer, const mpack_allocator_t* allocator) {
+    mpack_assert(writer->position == writer->buffer, "the allocator must be set before writing!");
+    #if MPACK_BUILDER
+    mpack_assert(writer->builder.pages == NULL, "the allocator must be set before building!");
+    #endif
+
+    mpack_allocator_t old_allocator = writer->allocator;
+    #if MPACK_BUILDER
+    // pages kept from previous messages belong to the old allocator
+    mpack_builder_free_list(writer, &old_allocator, writer->builder.spare);
+    writer->builder.spare = NULL;
+    #endif
+    if (allocator == NULL)
+        mpack_memset(&writer->allocator, 0, sizeof(writer->allocator));
+    else
+        writer->allocator = *allocator;
+
+    // move the buffer of a growable writer to the new allocator
+    if (writer->flush != mpack_growable_writer_flush || writer->buffer == NULL)
+        return;
+    size_t capacity = mpack_writer_buffer_size(writer);
+    mpack_allocator_free(&old_allocator, writer->buffer);
+    writer->buffer = (char*)mpack_allocator_alloc(&writer->allocator, capacity);
+    writer->position = writer->buffer;
+    writer->end = (writer->buffer == NULL) ? NULL : writer->buffer + capacity;
+    if (writer->buffer == NULL)
+        mpack_writer_flag_error(writer, mpack_error_memory);
+}
 #endif
 
 #if MPACK_STDIO
@@ -360,6 +589,12 @@ void mpack_writer_init_filename(mpack_writer_t* writer, const char* filename) {
 }
 #endif
 
+#if MPACK_STATS
+void mpack_writer_reset_stats(mpack_writer_t* writer) {
+    mpack_memset(&writer->stats, 0, sizeof(writer->stats));
+}
+#endif
+
 void mpack_writer_flag_error(mpack_writer_t* writer, mpack_error_t error) {
     mpack_log("writer %p setting error %i: %s\n", (void*)writer, (int)error, mpack_error_to_string(error));
 
@@ -370,12 +605,34 @@ void mpack_writer_flag_error(mpack_writer_t* writer, mpack_error_t error) {
     }
 }
 
+// Returns true if everything written stays in the writer's buffer, i.e. the
+// writer has no flush function or is a growable writer (although its buffer
+// may move.)
+static bool mpack_writer_keeps_output(mpack_writer_t* writer) {
+    if (writer->flush == NULL)
+        return true;
+    #ifdef MPACK_MALLOC
+    if (writer->flush == mpack_growable_writer_flush)
+        return true;
+    #endif
+    return false;
+}
+
 MPACK_STATIC_INLINE void mpack_writer_flush_unchecked(mpack_writer_t* writer) {
+    // The header of an open frame hasn't been written yet so we can't let it
+    // go out.
+    if (writer->frame_open && !mpack_writer_keeps_output(writer)) {
+        mpack_writer_flag_error(writer, mpack_error_too_big);
+        return;
+    }
+
     // This is a bit ugly; we reset used before calling flush so that
     // a flush function can distinguish between flushing the buffer
     // versus flushing external data. see mpack_growable_writer_flush()
     size_t used = mpack_writer_buffer_used(writer);
     writer->position = writer->buffer;
+    MPACK_STATS_ADD(writer->stats, flushes, 1);
+    MPACK_STATS_ADD(writer->stats, flush_bytes, used);
     writer->flush(writer, writer->buffer, used);
 }
 
@@ -398,13 +655,20 @@ void mpack_writer_flush_message(mpack_writer_t* writer) {
     }
     #endif
 
+    if (writer->frame_open) {
+        mpack_break("cannot call mpack_writer_flush_message() while a frame is open!");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+
     if (writer->flush == NULL) {
         mpack_break("cannot call mpack_writer_flush_message() without a flush function!");
         mpack_writer_flag_error(writer, mpack_error_bug);
         return;
     }
 
-    if (mpack_writer_buffer_used(writer) > 0)
+    // an iovec writer may have pending segments even if its buffer is empty
+    if (mpack_writer_buffer_used(writer) > 0 || writer->iov_count > 0)
         mpack_writer_flush_unchecked(writer);
 }
 
@@ -426,9 +690,11 @@ MPACK_NOINLINE static bool mpack_writer_ensure(mpack_writer_t* writer, size_t co
         return false;
 
     #if MPACK_BUILDER
-    // if we have a build in progress, we just ask the builder for a page.
-    // either it will have space for a tag, or it will flag a memory error.
-    if (writer->builder.current_build != NULL) {
+    // if we have a paged build in progress, we just ask the builder for a
+    // page. either it will have space for a tag, or it will flag a memory
+    // error. in-place builds use the writer's buffer (and flush function)
+    // directly.
+    if (writer->builder.current_build != NULL && !writer->builder.in_place) {
         mpack_builder_flush(writer);
         return mpack_writer_error(writer) == mpack_ok;
     }
@@ -454,7 +720,7 @@ MPACK_NOINLINE static bool mpack_writer_ensure(mpack_writer_t* writer, size_t co
 // does not fit in the buffer (i.e. it straddles the edge of the
 // buffer.) If there is a flush function, it is guaranteed to be
 // called; otherwise mpack_error_too_big is raised.
-MPACK_NOINLINE static void mpack_write_native_straddle(mpack_writer_t* writer, const char* p, size_t count) {
+MPACK_NOINLINE void mpack_write_native_straddle(mpack_writer_t* writer, const char* p, size_t count) {
     mpack_assert(count == 0 || p != NULL, "data pointer for %i bytes is NULL", (int)count);
 
     if (mpack_writer_error(writer) != mpack_ok)
@@ -467,9 +733,9 @@ MPACK_NOINLINE static void mpack_write_native_straddle(mpack_writer_t* writer, c
             (int)count, (int)(mpack_writer_buffer_left(writer)));
 
     #if MPACK_BUILDER
-    // if we have a build in progress, we can't flush. we need to copy all
-    // bytes into as many build buffer pages as it takes.
-    if (writer->builder.current_build != NULL) {
+    // if we have a paged build in progress, we can't flush. we need to copy
+    // all bytes into as many build buffer pages as it takes.
+    if (writer->builder.current_build != NULL && !writer->builder.in_place) {
         while (true) {
             size_t step = (size_t)(writer->end - writer->position);
             if (step > count)
@@ -507,6 +773,8 @@ MPACK_NOINLINE static void mpack_write_native_straddle(mpack_writer_t* writer, c
 
     // flush the extra data directly if it doesn't fit in the buffer
     if (count > mpack_writer_buffer_left(writer)) {
+        MPACK_STATS_ADD(writer->stats, flushes, 1);
+        MPACK_STATS_ADD(writer->stats, flush_bytes, count);
         writer->flush(writer, p, count);
         if (mpack_writer_error(writer) != mpack_ok)
             return;
@@ -516,16 +784,43 @@ MPACK_NOINLINE static void mpack_write_native_straddle(mpack_writer_t* writer, c
     }
 }
 
-// Writes encoded bytes to the buffer, flushing if necessary.
-MPACK_STATIC_INLINE void mpack_write_native(mpack_writer_t* writer, const char* p, size_t count) {
-    mpack_assert(count == 0 || p != NULL, "data pointer for %i bytes is NULL", (int)count);
+// Records a payload as a pending segment of an iovec writer instead of
+// copying it.
+MPACK_NOINLINE static void mpack_write_native_iov(mpack_writer_t* writer, const char* p, size_t count) {
+    if (mpack_writer_error(writer) != mpack_ok)
+        return;
 
-    if (mpack_writer_buffer_left(writer) < count) {
-        mpack_write_native_straddle(writer, p, count);
-    } else {
-        mpack_memcpy(writer->position, p, count);
-        writer->position += count;
+    if (writer->iov_capacity - writer->iov_count < 3) {
+        mpack_writer_flush_unchecked(writer);
+        if (mpack_writer_error(writer) != mpack_ok)
+            return;
+    }
+
+    mpack_log("referencing %i bytes from %p\n", (int)count, p);
+    if (writer->position != writer->iov_start) {
+        writer->iov[writer->iov_count].base = writer->iov_start;
+        writer->iov[writer->iov_count].len = (size_t)(writer->position - writer->iov_start);
+        ++writer->iov_count;
+    }
+    writer->iov[writer->iov_count].base = p;
+    writer->iov[writer->iov_count].len = count;
+    ++writer->iov_count;
+    writer->iov_start = writer->position;
+}
+
+// Writes the payload of a str, bin or ext, referencing it instead if the
+// writer has an iovec flush function and the payload is large.
+MPACK_STATIC_INLINE void mpack_write_payload(mpack_writer_t* writer, const char* p, size_t count) {
+    if (count >= MPACK_WRITER_IOV_MIN_SIZE && writer->flush_iov != NULL && !writer->frame_open
+            #if MPACK_BUILDER
+            && writer->builder.current_build == NULL
+            #endif
+            )
+    {
+        mpack_write_native_iov(writer, p, count);
+        return;
     }
+    mpack_write_native(writer, p, count);
 }
 
 mpack_error_t mpack_writer_destroy(mpack_writer_t* writer) {
@@ -549,23 +844,14 @@ mpack_error_t mpack_writer_destroy(mpack_writer_t* writer) {
             mpack_writer_flag_error(writer, mpack_error_bug);
         }
 
-        // Free any remaining builder pages
-        mpack_builder_page_t* page = builder->pages;
-        #if MPACK_BUILDER_INTERNAL_STORAGE
-        mpack_assert(page == (mpack_builder_page_t*)builder->internal);
-        page = page->next;
-        #endif
-        while (page != NULL) {
-            mpack_builder_page_t* next = page->next;
-            MPACK_FREE(page);
-            page = next;
-        }
-
         // Restore the stashed pointers. The teardown function may need to free
-        // them (e.g. mpack_growable_writer_teardown().)
-        writer->buffer = builder->stash_buffer;
-        writer->position = builder->stash_position;
-        writer->end = builder->stash_end;
+        // them (e.g. mpack_growable_writer_teardown().) In-place builds don't
+        // divert the writer so there is nothing to restore.
+        if (!builder->in_place) {
+            writer->buffer = builder->stash_buffer;
+            writer->position = builder->stash_position;
+            writer->end = builder->stash_end;
+        }
 
         // Note: It's not necessary to clean up the current_build or other
         // pointers at this point because we're guaranteed to be in an error
@@ -573,10 +859,26 @@ mpack_error_t mpack_writer_destroy(mpack_writer_t* writer) {
         // destroy function will complete no matter what so it doesn't matter
         // what junk is left in the writer.
     }
+
+    // Free any remaining builder pages. These may be left over from an
+    // incomplete build, or kept for reuse between builds.
+    mpack_builder_free_list(writer, &writer->allocator, builder->pages);
+    mpack_builder_free_list(writer, &writer->allocator, builder->spare);
+    builder->pages = NULL;
+    builder->spare = NULL;
     #endif
 
+    if (writer->frame_open && mpack_writer_error(writer) == mpack_ok) {
+        mpack_break("writer cannot be destroyed with an open frame unless an error was flagged!");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+    }
+
     // flush any outstanding data
-    if (mpack_writer_error(writer) == mpack_ok && mpack_writer_buffer_used(writer) != 0 && writer->flush != NULL) {
+    if (mpack_writer_error(writer) == mpack_ok && writer->flush != NULL &&
+            (mpack_writer_buffer_used(writer) != 0 || writer->iov_count != 0))
+    {
+        MPACK_STATS_ADD(writer->stats, flushes, 1);
+        MPACK_STATS_ADD(writer->stats, flush_bytes, mpack_writer_buffer_used(writer));
         writer->flush(writer, writer->buffer, mpack_writer_buffer_used(writer));
         writer->flush = NULL;
     }
@@ -590,12 +892,43 @@ mpack_error_t mpack_writer_destroy(mpack_writer_t* writer) {
 }
 
 void mpack_write_tag(mpack_writer_t* writer, mpack_tag_t value) {
+    #if MPACK_DOUBLE
+    if (value.type == mpack_type_double && writer->compact_floats) {
+        mpack_write_double(writer, value.v.d);
+        return;
+    }
+    #endif
+
     switch (value.type) {
         case mpack_type_missing:
             mpack_break("cannot write a missing value!");
             mpack_writer_flag_error(writer, mpack_error_bug);
             return;
 
+        // scalars are encoded directly when there is room for a tag of
+        // any size. otherwise we fall back to the typed writers below, which
+        // ensure only the space they need.
+        case mpack_type_nil:
+        case mpack_type_bool:
+        case mpack_type_int:
+        case mpack_type_uint:
+        case mpack_type_float:
+        case mpack_type_double:
+            if (MPACK_LIKELY(mpack_writer_buffer_left(writer) >= MPACK_MAXIMUM_TAG_SIZE)) {
+                mpack_writer_track_element(writer);
+                writer->position += mpack_encode_tag(writer->position, value);
+                return;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    switch (value.type) {
+        case mpack_type_missing:
+            break;
+
         case mpack_type_nil:    mpack_write_nil   (writer);            return;
         case mpack_type_bool:   mpack_write_bool  (writer, value.v.b); return;
         case mpack_type_int:    mpack_write_int   (writer, value.v.i); return;
@@ -892,6 +1225,84 @@ MPACK_STATIC_INLINE void mpack_encode_timestamp_12(char* p, int64_t seconds, uin
 }
 #endif
 
+MPACK_STATIC_INLINE size_t mpack_encode_u64_smallest(char* p, uint64_t value) {
+    if (value <= 127) {
+        mpack_encode_fixuint(p, (uint8_t)value);
+        return MPACK_TAG_SIZE_FIXUINT;
+    } else if (value <= MPACK_UINT8_MAX) {
+        mpack_encode_u8(p, (uint8_t)value);
+        return MPACK_TAG_SIZE_U8;
+    } else if (value <= MPACK_UINT16_MAX) {
+        mpack_encode_u16(p, (uint16_t)value);
+        return MPACK_TAG_SIZE_U16;
+    } else if (value <= MPACK_UINT32_MAX) {
+        mpack_encode_u32(p, (uint32_t)value);
+        return MPACK_TAG_SIZE_U32;
+    }
+    mpack_encode_u64(p, value);
+    return MPACK_TAG_SIZE_U64;
+}
+
+MPACK_STATIC_INLINE size_t mpack_encode_i64_smallest(char* p, int64_t value) {
+    if (value >= -32) {
+        if (value <= 127) {
+            mpack_encode_fixint(p, (int8_t)value);
+            return MPACK_TAG_SIZE_FIXINT;
+        }
+        return mpack_encode_u64_smallest(p, (uint64_t)value);
+    } else if (value >= MPACK_INT8_MIN) {
+        mpack_encode_i8(p, (int8_t)value);
+        return MPACK_TAG_SIZE_I8;
+    } else if (value >= MPACK_INT16_MIN) {
+        mpack_encode_i16(p, (int16_t)value);
+        return MPACK_TAG_SIZE_I16;
+    } else if (value >= MPACK_INT32_MIN) {
+        mpack_encode_i32(p, (int32_t)value);
+        return MPACK_TAG_SIZE_I32;
+    }
+    mpack_encode_i64(p, value);
+    return MPACK_TAG_SIZE_I64;
+}
+
+#if MPACK_DOUBLE
+// Encodes a double in the smallest form that reads back as exactly the same
+// value. Integers are preferred when they are no larger than a float. The
+// exponent checks keep the integer conversions in range.
+MPACK_STATIC_INLINE size_t mpack_encode_double_compact(char* p, double value) {
+    union {
+        double d;
+        uint64_t u;
+    } v;
+    v.d = value;
+    int exponent = (int)((v.u >> 52) & 0x7ff) - 1023;
+
+    // negative zero is not an integer since it would lose its sign
+    size_t size = 0;
+    if ((v.u >> 63) == 0 && exponent < 64) {
+        uint64_t u = (uint64_t)value;
+        if ((double)u == value)
+            size = mpack_encode_u64_smallest(p, u);
+    } else if (value < 0 && exponent < 63) {
+        int64_t i = (int64_t)value;
+        if ((double)i == value)
+            size = mpack_encode_i64_smallest(p, i);
+    }
+    if (size != 0 && size <= MPACK_TAG_SIZE_FLOAT)
+        return size;
+
+    #if MPACK_FLOAT
+    float f;
+    if (mpack_narrow_double_to_float(value, &f)) {
+        mpack_encode_float(p, f);
+        return MPACK_TAG_SIZE_FLOAT;
+    }
+    #endif
+
+    mpack_encode_double(p, value);
+    return MPACK_TAG_SIZE_DOUBLE;
+}
+#endif
+
 
 
 /*
@@ -1081,8 +1492,18 @@ void mpack_write_raw_float(mpack_writer_t* writer, uint32_t value) {
 #endif
 
 #if MPACK_DOUBLE
+MPACK_NOINLINE static void mpack_write_double_compact(mpack_writer_t* writer, double value) {
+    if (MPACK_LIKELY(mpack_writer_buffer_left(writer) >= MPACK_TAG_SIZE_DOUBLE) ||
+            mpack_writer_ensure(writer, MPACK_TAG_SIZE_DOUBLE))
+        writer->position += mpack_encode_double_compact(writer->position, value);
+}
+
 void mpack_write_double(mpack_writer_t* writer, double value) {
     mpack_writer_track_element(writer);
+    if (writer->compact_floats) {
+        mpack_write_double_compact(writer, value);
+        return;
+    }
     MPACK_WRITE_ENCODED(mpack_encode_double, MPACK_TAG_SIZE_DOUBLE, value);
 }
 #else
@@ -1154,6 +1575,240 @@ void mpack_start_map(mpack_writer_t* writer, uint32_t count) {
     mpack_builder_compound_push(writer);
 }
 
+/*
+ * Typed array functions
+ */
+
+// Returns the number of elements of at most size bytes each (up to the given
+// remaining count) that can be encoded directly into the buffer, flushing if
+// there isn't room for even one. Returns 0 if an error occurred.
+MPACK_STATIC_INLINE size_t mpack_write_array_reserve(mpack_writer_t* writer, size_t remaining, size_t size) {
+    size_t count = mpack_writer_buffer_left(writer) / size;
+    if (count == 0) {
+        if (!mpack_writer_ensure(writer, size))
+            return 0;
+        count = mpack_writer_buffer_left(writer) / size;
+    }
+    return (count < remaining) ? count : remaining;
+}
+
+// Tracks array elements that were encoded directly into the buffer. These
+// are always within an array so the builder doesn't need to count them.
+MPACK_STATIC_INLINE void mpack_writer_track_elements(mpack_writer_t* writer, uint32_t count) {
+    #if MPACK_WRITE_TRACKING
+    for (; count > 0; --count)
+        if (writer->error == mpack_ok)
+            mpack_writer_flag_if_error(writer, mpack_track_element(&writer->track, false));
+    #else
+    MPACK_UNUSED(writer);
+    MPACK_UNUSED(count);
+    #endif
+}
+
+// Writes a typed array. encode is a statement that encodes values[i] at p
+// and advances p by at most size bytes. The fixed width arrays store tags
+// directly since the encode functions assert the smallest encoding.
+#define MPACK_WRITE_TYPED_ARRAY(size, encode) do {                                  \
+    mpack_start_array(writer, count);                                               \
+    size_t i = 0;                                                                   \
+    while (i < count && mpack_writer_error(writer) == mpack_ok) {                   \
+        size_t end = i + mpack_write_array_reserve(writer, count - i, size);        \
+        char* p = writer->position;                                                 \
+        for (; i < end; ++i) {                                                      \
+            encode;                                                                 \
+        }                                                                           \
+        writer->position = p;                                                       \
+    }                                                                               \
+    mpack_writer_track_elements(writer, count);                                     \
+    mpack_finish_array(writer);                                                     \
+} while (0)
+
+void mpack_write_u32_array(mpack_writer_t* writer, const uint32_t* values, uint32_t count) {
+    MPACK_WRITE_TYPED_ARRAY(MPACK_TAG_SIZE_U32,
+            p += mpack_encode_u64_smallest(p, values[i]));
+}
+
+void mpack_write_u32_array_fixed(mpack_writer_t* writer, const uint32_t* values, uint32_t count) {
+    MPACK_WRITE_TYPED_ARRAY(MPACK_TAG_SIZE_U32,
+            mpack_store_u8(p, 0xce); mpack_store_u32(p + 1, values[i]); p += MPACK_TAG_SIZE_U32);
+}
+
+void mpack_write_i64_array(mpack_writer_t* writer, const int64_t* values, uint32_t count) {
+    MPACK_WRITE_TYPED_ARRAY(MPACK_TAG_SIZE_I64,
+            p += mpack_encode_i64_smallest(p, values[i]));
+}
+
+void mpack_write_i64_array_fixed(mpack_writer_t* writer, const int64_t* values, uint32_t count) {
+    MPACK_WRITE_TYPED_ARRAY(MPACK_TAG_SIZE_I64,
+            mpack_store_u8(p, 0xd3); mpack_store_i64(p + 1, values[i]); p += MPACK_TAG_SIZE_I64);
+}
+
+#if MPACK_FLOAT
+void mpack_write_float_array(mpack_writer_t* writer, const float* values, uint32_t count) {
+    MPACK_WRITE_TYPED_ARRAY(MPACK_TAG_SIZE_FLOAT,
+            mpack_encode_float(p, values[i]); p += MPACK_TAG_SIZE_FLOAT);
+}
+#endif
+
+#if MPACK_DOUBLE
+void mpack_write_double_array(mpack_writer_t* writer, const double* values, uint32_t count) {
+    if (writer->compact_floats) {
+        MPACK_WRITE_TYPED_ARRAY(MPACK_TAG_SIZE_DOUBLE,
+                p += mpack_encode_double_compact(p, values[i]));
+        return;
+    }
+    MPACK_WRITE_TYPED_ARRAY(MPACK_TAG_SIZE_DOUBLE,
+            mpack_encode_double(p, values[i]); p += MPACK_TAG_SIZE_DOUBLE);
+}
+#endif
+
+// Frames contain only complete elements, so nothing can be open when one is
+// begun or ended.
+static bool mpack_writer_check_frame_boundary(mpack_writer_t* writer) {
+    MPACK_UNUSED(writer);
+
+    #if MPACK_WRITE_TRACKING
+    mpack_writer_flag_if_error(writer, mpack_track_check_empty(&writer->track));
+    if (mpack_writer_error(writer) != mpack_ok)
+        return false;
+    #endif
+
+    #if MPACK_BUILDER
+    if (writer->builder.current_build != NULL) {
+        mpack_break("cannot begin or end a frame while there are elements open!");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return false;
+    }
+    #endif
+
+    return true;
+}
+
+void mpack_writer_begin_frame(mpack_writer_t* writer) {
+    if (mpack_writer_error(writer) != mpack_ok)
+        return;
+
+    if (writer->frame_open) {
+        mpack_break("frames cannot be nested!");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+    if (!mpack_writer_check_frame_boundary(writer))
+        return;
+
+    // A writer that flushes can't flush within the frame, so we give the
+    // frame the whole buffer.
+    if (!mpack_writer_keeps_output(writer) &&
+            (mpack_writer_buffer_used(writer) > 0 || writer->iov_count > 0))
+    {
+        mpack_writer_flush_unchecked(writer);
+        if (mpack_writer_error(writer) != mpack_ok)
+            return;
+    }
+
+    // The header is stored as an offset since a growable writer's buffer can
+    // move.
+    if (mpack_writer_buffer_left(writer) < MPACK_FRAME_HEADER_SIZE &&
+            !mpack_writer_ensure(writer, MPACK_FRAME_HEADER_SIZE))
+        return;
+    writer->frame_start = mpack_writer_buffer_used(writer);
+    writer->position += MPACK_FRAME_HEADER_SIZE;
+    writer->frame_open = true;
+    mpack_log("began frame at offset %i\n", (int)writer->frame_start);
+}
+
+void mpack_writer_end_frame(mpack_writer_t* writer) {
+    if (mpack_writer_error(writer) != mpack_ok)
+        return;
+
+    if (!writer->frame_open) {
+        mpack_break("no frame is open!");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+    if (!mpack_writer_check_frame_boundary(writer))
+        return;
+
+    size_t length = mpack_writer_buffer_used(writer) - writer->frame_start - MPACK_FRAME_HEADER_SIZE;
+    if (length > MPACK_UINT32_MAX) {
+        mpack_writer_flag_error(writer, mpack_error_too_big);
+        return;
+    }
+    mpack_log("ended frame of %i bytes\n", (int)length);
+    mpack_store_u32(writer->buffer + writer->frame_start, (uint32_t)length);
+    writer->frame_open = false;
+}
+
+#ifdef MPACK_MALLOC
+typedef struct mpack_fork_writer_t {
+    uint32_t count; // the number of elements the child writes
+} mpack_fork_writer_t;
+
+static void mpack_fork_writer_teardown(mpack_writer_t* writer) {
+    if (writer->buffer != NULL) {
+        mpack_allocator_free(&writer->allocator, writer->buffer);
+        writer->buffer = NULL;
+    }
+}
+
+void mpack_writer_fork(mpack_writer_t* parent, mpack_writer_t* child, uint32_t count) {
+    char* buffer = (char*)mpack_allocator_alloc(&parent->allocator, MPACK_BUFFER_SIZE);
+    if (buffer == NULL) {
+        mpack_writer_init_error(child, mpack_error_memory);
+        return;
+    }
+
+    mpack_writer_init(child, buffer, MPACK_BUFFER_SIZE);
+    child->allocator = parent->allocator;
+    #if MPACK_COMPATIBILITY
+    child->version = parent->version;
+    #endif
+    #if MPACK_DOUBLE
+    child->compact_floats = parent->compact_floats;
+    #endif
+    mpack_writer_set_flush(child, mpack_growable_writer_flush);
+    mpack_writer_set_teardown(child, mpack_fork_writer_teardown);
+
+    MPACK_STATIC_ASSERT(sizeof(mpack_fork_writer_t) <= sizeof(child->reserved),
+            "not enough reserved space for fork writer!");
+    ((mpack_fork_writer_t*)mpack_writer_get_reserved(child))->count = count;
+
+    // the child's elements are tracked as an array so that joining can check
+    // that exactly count were written
+    mpack_writer_track_push(child, mpack_type_array, count);
+    mpack_log("forked writer %p for %i elements\n", (void*)child, (int)count);
+}
+
+void mpack_writer_join(mpack_writer_t* parent, mpack_writer_t* child) {
+    if (child->teardown != mpack_fork_writer_teardown && mpack_writer_error(child) == mpack_ok) {
+        mpack_break("writer was not forked!");
+        mpack_writer_flag_error(child, mpack_error_bug);
+    }
+    mpack_writer_track_pop(child, mpack_type_array);
+
+    #if MPACK_BUILDER
+    if (child->builder.current_build != NULL && mpack_writer_error(child) == mpack_ok) {
+        mpack_break("cannot join a writer while it has a build open!");
+        mpack_writer_flag_error(child, mpack_error_bug);
+    }
+    #endif
+
+    mpack_error_t error = mpack_writer_error(child);
+    if (error != mpack_ok) {
+        mpack_writer_flag_error(parent, error);
+    } else if (mpack_writer_error(parent) == mpack_ok) {
+        mpack_log("joining %i bytes from writer %p\n", (int)mpack_writer_buffer_used(child), (void*)child);
+        uint32_t count = ((mpack_fork_writer_t*)mpack_writer_get_reserved(child))->count;
+        uint32_t i;
+        for (i = 0; i < count; ++i)
+            mpack_writer_track_element(parent);
+        mpack_write_native(parent, child->buffer, mpack_writer_buffer_used(child));
+    }
+
+    mpack_writer_destroy(child);
+}
+#endif
+
 static void mpack_start_str_notrack(mpack_writer_t* writer, uint32_t count) {
     if (count <= 31) {
         MPACK_WRITE_ENCODED(mpack_encode_fixstr, MPACK_TAG_SIZE_FIXSTR, (uint8_t)count);
@@ -1251,7 +1906,7 @@ void mpack_write_str(mpack_writer_t* writer, const char* data, uint32_t count) {
     #if MPACK_OPTIMIZE_FOR_SIZE
     mpack_writer_track_element(writer);
     mpack_start_str_notrack(writer, count);
-    mpack_write_native(writer, data, count);
+    mpack_write_payload(writer, data, count);
     #else
 
     mpack_writer_track_element(writer);
@@ -1281,7 +1936,7 @@ void mpack_write_str(mpack_writer_t* writer, const char* data, uint32_t count) {
             writer->position += count + MPACK_TAG_SIZE_STR8;
         } else {
             MPACK_WRITE_ENCODED(mpack_encode_str8, MPACK_TAG_SIZE_STR8, (uint8_t)count);
-            mpack_write_native(writer, data, count);
+            mpack_write_payload(writer, data, count);
         }
         return;
     }
@@ -1291,10 +1946,10 @@ void mpack_write_str(mpack_writer_t* writer, const char* data, uint32_t count) {
     // minimize code size.
     if (count <= MPACK_UINT16_MAX) {
         MPACK_WRITE_ENCODED(mpack_encode_str16, MPACK_TAG_SIZE_STR16, (uint16_t)count);
-        mpack_write_native(writer, data, count);
+        mpack_write_payload(writer, data, count);
     } else {
         MPACK_WRITE_ENCODED(mpack_encode_str32, MPACK_TAG_SIZE_STR32, (uint32_t)count);
-        mpack_write_native(writer, data, count);
+        mpack_write_payload(writer, data, count);
     }
 
     #endif
@@ -1319,7 +1974,7 @@ void mpack_write_ext(mpack_writer_t* writer, int8_t exttype, const char* data, u
 void mpack_write_bytes(mpack_writer_t* writer, const char* data, size_t count) {
     mpack_assert(count == 0 || data != NULL, "data pointer for %i bytes is NULL", (int)count);
     mpack_writer_track_bytes(writer, count);
-    mpack_write_native(writer, data, count);
+    mpack_write_payload(writer, data, count);
 }
 
 void mpack_write_cstr(mpack_writer_t* writer, const char* cstr) {
@@ -1458,15 +2113,24 @@ static inline size_t mpack_builder_align_build(size_t bytes_used) {
     return offset;
 }
 
-static inline void mpack_builder_free_page(mpack_writer_t* writer, mpack_builder_page_t* page) {
-    mpack_log("freeing page %p\n", (void*)page);
-    #if MPACK_BUILDER_INTERNAL_STORAGE
-    if ((char*)page == writer->builder.internal)
-        return;
-    #else
-    (void)writer;
-    #endif
-    MPACK_FREE(page);
+// Takes a page from the spare list, or allocates one if there are none.
+static mpack_builder_page_t* mpack_builder_alloc_page(mpack_writer_t* writer) {
+    mpack_builder_t* builder = &writer->builder;
+    mpack_builder_page_t* page = builder->spare;
+    if (page != NULL) {
+        builder->spare = page->next;
+    } else {
+        page = (mpack_builder_page_t*)mpack_allocator_alloc(&writer->allocator, MPACK_BUILDER_PAGE_SIZE);
+        if (page == NULL) {
+            mpack_writer_flag_error(writer, mpack_error_memory);
+            return NULL;
+        }
+        MPACK_STATS_ADD(writer->stats, builder_pages, 1);
+    }
+
+    page->next = NULL;
+    page->bytes_used = sizeof(mpack_builder_page_t);
+    return page;
 }
 
 static inline size_t mpack_builder_page_remaining(mpack_writer_t* writer, mpack_builder_page_t* page) {
@@ -1494,14 +2158,10 @@ static void mpack_builder_add_page(mpack_writer_t* writer) {
     mpack_assert(writer->error == mpack_ok);
 
     mpack_log("adding a page.\n");
-    mpack_builder_page_t* page = (mpack_builder_page_t*)MPACK_MALLOC(MPACK_BUILDER_PAGE_SIZE);
-    if (page == NULL) {
-        mpack_writer_flag_error(writer, mpack_error_memory);
+    mpack_builder_page_t* page = mpack_builder_alloc_page(writer);
+    if (page == NULL)
         return;
-    }
 
-    page->next = NULL;
-    page->bytes_used = sizeof(mpack_builder_page_t);
     builder->current_page->next = page;
     builder->current_page = page;
 }
@@ -1538,13 +2198,14 @@ MPACK_NOINLINE static void mpack_builder_begin(mpack_writer_t* writer) {
     mpack_assert(writer->error == mpack_ok);
     mpack_assert(builder->current_build == NULL);
     mpack_assert(builder->latest_build == NULL);
-    mpack_assert(builder->pages == NULL);
 
     // If this is the first build, we need to stash the real buffer backing our
     // writer. We'll be diverting the writer to our build buffer.
-    builder->stash_buffer = writer->buffer;
-    builder->stash_position = writer->position;
-    builder->stash_end = writer->end;
+    if (!builder->in_place) {
+        builder->stash_buffer = writer->buffer;
+        builder->stash_position = writer->position;
+        builder->stash_end = writer->end;
+    }
 
     mpack_builder_page_t* page;
 
@@ -1553,12 +2214,10 @@ MPACK_NOINLINE static void mpack_builder_begin(mpack_writer_t* writer) {
     page = (mpack_builder_page_t*)builder->internal;
     mpack_log("beginning builder with internal storage %p\n", (void*)page);
     #else
-    page = (mpack_builder_page_t*)MPACK_MALLOC(MPACK_BUILDER_PAGE_SIZE);
-    if (page == NULL) {
-        mpack_writer_flag_error(writer, mpack_error_memory);
+    page = mpack_builder_alloc_page(writer);
+    if (page == NULL)
         return;
-    }
-    mpack_log("beginning builder with allocated page %p\n", (void*)page);
+    mpack_log("beginning builder with page %p\n", (void*)page);
     #endif
 
     page->next = NULL;
@@ -1567,6 +2226,97 @@ MPACK_NOINLINE static void mpack_builder_begin(mpack_writer_t* writer) {
     builder->current_page = page;
 }
 
+static bool mpack_builder_can_build_in_place(mpack_writer_t* writer) {
+    // The contents of in-place builds must stay in the writer's buffer until
+    // they are completed.
+    return mpack_writer_keeps_output(writer);
+}
+
+// Reserves space for the largest header of an in-place build. Its position is
+// stored as an offset since a growable writer's buffer can move.
+static void mpack_builder_reserve_header(mpack_writer_t* writer, mpack_build_t* build) {
+    MPACK_STATIC_ASSERT(MPACK_TAG_SIZE_MAP32 == MPACK_TAG_SIZE_ARRAY32, "map32 and array32 differ in size?");
+    if (mpack_writer_buffer_left(writer) < MPACK_TAG_SIZE_MAP32 &&
+            !mpack_writer_ensure(writer, MPACK_TAG_SIZE_MAP32))
+        return;
+    build->bytes = mpack_writer_buffer_used(writer);
+    writer->position += MPACK_TAG_SIZE_MAP32;
+    mpack_log("reserved header for build %p at offset %zi\n", (void*)build, build->bytes);
+}
+
+// Writes the header of a completed in-place build, moving its contents down
+// over any unused reserved space, and pops it.
+static void mpack_builder_complete_in_place(mpack_writer_t* writer) {
+    mpack_builder_t* builder = &writer->builder;
+    mpack_build_t* build = builder->current_build;
+    char* header = writer->buffer + build->bytes;
+    char* contents = header + MPACK_TAG_SIZE_MAP32;
+    uint32_t count = build->count;
+    bool map = build->type == mpack_type_map;
+
+    size_t size = MPACK_TAG_SIZE_MAP32;
+    if (builder->mode == mpack_build_mode_in_place_fixed) {
+        // keep the full reserved header
+    } else if (count <= 15) {
+        size = MPACK_TAG_SIZE_FIXMAP;
+    } else if (count <= MPACK_UINT16_MAX) {
+        size = MPACK_TAG_SIZE_MAP16;
+    }
+
+    if (size != MPACK_TAG_SIZE_MAP32) {
+        size_t bytes = (size_t)(writer->position - contents);
+        mpack_log("moving %zi bytes of build %p down by %zi\n", bytes, (void*)build,
+                (size_t)MPACK_TAG_SIZE_MAP32 - size);
+        mpack_memmove(header + size, contents, bytes);
+        writer->position -= MPACK_TAG_SIZE_MAP32 - size;
+    }
+
+    switch (size) {
+        case MPACK_TAG_SIZE_FIXMAP:
+            if (map)
+                mpack_encode_fixmap(header, (uint8_t)count);
+            else
+                mpack_encode_fixarray(header, (uint8_t)count);
+            break;
+        case MPACK_TAG_SIZE_MAP16:
+            if (map)
+                mpack_encode_map16(header, (uint16_t)count);
+            else
+                mpack_encode_array16(header, (uint16_t)count);
+            break;
+        default:
+            // the encoders assert on non-canonical sizes, so we store the
+            // full header directly.
+            mpack_store_u8(header, map ? 0xdf : 0xdd);
+            mpack_store_u32(header + 1, count);
+            break;
+    }
+
+    // Builds are completed in reverse order so we can usually give back the
+    // build's space in its page. (If a child build started a new page, the
+    // space stays used until the outermost build is completed.)
+    mpack_builder_page_t* page = builder->current_page;
+    if ((char*)build + sizeof(mpack_build_t) == (char*)page + page->bytes_used)
+        page->bytes_used = (size_t)((char*)build - (char*)page);
+
+    builder->current_build = build->parent;
+    builder->latest_build = build->parent;
+    if (builder->current_build != NULL)
+        return;
+
+    // This was the outermost build. Its pages are kept for the next one.
+    mpack_log("done in-place build.\n");
+    page = builder->pages;
+    while (page != NULL) {
+        mpack_builder_page_t* next = page->next;
+        mpack_builder_free_page(writer, page);
+        page = next;
+    }
+    builder->pages = NULL;
+    builder->current_page = NULL;
+    builder->in_place = false;
+}
+
 static void mpack_builder_build(mpack_writer_t* writer, mpack_type_t type) {
     mpack_builder_check_sizes(writer);
     if (mpack_writer_error(writer) != mpack_ok)
@@ -1578,8 +2328,10 @@ static void mpack_builder_build(mpack_writer_t* writer, mpack_type_t type) {
     mpack_builder_t* builder = &writer->builder;
 
     if (builder->current_build == NULL) {
+        builder->in_place = builder->mode != mpack_build_mode_paged &&
+                !builder->canonical && mpack_builder_can_build_in_place(writer);
         mpack_builder_begin(writer);
-    } else {
+    } else if (!builder->in_place) {
         mpack_builder_apply_writes(writer);
     }
     if (mpack_writer_error(writer) != mpack_ok)
@@ -1620,6 +2372,11 @@ static void mpack_builder_build(mpack_writer_t* writer, mpack_type_t type) {
     builder->current_build = build;
     builder->latest_build = build;
 
+    if (builder->in_place) {
+        mpack_builder_reserve_header(writer, build);
+        return;
+    }
+
     // we always need to provide a buffer that meets the minimum buffer size.
     // if there isn't enough space, we discard the remaining space in the
     // current page and allocate a new one.
@@ -1634,6 +2391,343 @@ static void mpack_builder_build(mpack_writer_t* writer, mpack_type_t type) {
     mpack_builder_configure_buffer(writer);
 }
 
+/*
+ * Canonical builds are first resolved into a contiguous buffer, which is then
+ * re-encoded element by element into a second buffer. Each map is
+ * canonicalized in place at the end of the output: its entries are encoded
+ * one after another, sorted by their key bytes, and then copied past the end
+ * of the buffer in sorted order before being moved back down.
+ */
+
+typedef struct mpack_canonical_buffer_t {
+    char* data;
+    size_t used;
+    size_t capacity;
+} mpack_canonical_buffer_t;
+
+// The offsets of the key, the value and the end of a map entry in the output
+typedef struct mpack_canonical_entry_t {
+    size_t key;
+    size_t value;
+    size_t end;
+} mpack_canonical_entry_t;
+
+static bool mpack_canonical_reserve(mpack_writer_t* writer, mpack_canonical_buffer_t* buffer, size_t count) {
+    if (mpack_writer_error(writer) != mpack_ok)
+        return false;
+    if (buffer->capacity - buffer->used >= count)
+        return true;
+
+    size_t capacity = (buffer->capacity == 0) ? MPACK_BUFFER_SIZE : buffer->capacity;
+    while (capacity - buffer->used < count) {
+        if (capacity > SIZE_MAX / 2) {
+            mpack_writer_flag_error(writer, mpack_error_memory);
+            return false;
+        }
+        capacity *= 2;
+    }
+
+    char* data;
+    if (buffer->data == NULL)
+        data = (char*)mpack_allocator_alloc(&writer->allocator, capacity);
+    else
+        data = (char*)mpack_allocator_realloc(&writer->allocator, buffer->data, buffer->used, capacity);
+    if (data == NULL) {
+        mpack_writer_flag_error(writer, mpack_error_memory);
+        return false;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return true;
+}
+
+static void mpack_canonical_append(mpack_writer_t* writer, mpack_canonical_buffer_t* buffer,
+        const char* data, size_t count)
+{
+    if (!mpack_canonical_reserve(writer, buffer, count))
+        return;
+    mpack_memcpy(buffer->data + buffer->used, data, count);
+    buffer->used += count;
+}
+
+static void mpack_canonical_append_tag(mpack_writer_t* writer, mpack_canonical_buffer_t* buffer, mpack_tag_t tag) {
+    if (!mpack_canonical_reserve(writer, buffer, MPACK_MAXIMUM_TAG_SIZE))
+        return;
+
+    #if MPACK_COMPATIBILITY
+    // v4 has neither bin nor str8, so as in mpack_start_bin_notrack() and
+    // mpack_start_str_notrack(), bins become raws and str8 becomes str16.
+    if (writer->version <= mpack_version_v4) {
+        if (tag.type == mpack_type_bin)
+            tag.type = mpack_type_str;
+        if (tag.type == mpack_type_str && tag.v.l > 31 && tag.v.l <= MPACK_UINT8_MAX) {
+            mpack_encode_str16(buffer->data + buffer->used, (uint16_t)tag.v.l);
+            buffer->used += MPACK_TAG_SIZE_STR16;
+            return;
+        }
+    }
+    #endif
+
+    buffer->used += mpack_encode_tag(buffer->data + buffer->used, tag);
+}
+
+// Orders map entries by their key bytes. Encoded elements are self-delimiting
+// so distinct keys never compare equal.
+static int mpack_canonical_compare(const char* data, const mpack_canonical_entry_t* left,
+        const mpack_canonical_entry_t* right)
+{
+    size_t left_size = left->value - left->key;
+    size_t right_size = right->value - right->key;
+    int cmp = mpack_memcmp(data + left->key, data + right->key,
+            (left_size < right_size) ? left_size : right_size);
+    if (cmp != 0)
+        return cmp;
+    return (left_size < right_size) ? -1 : (left_size > right_size) ? 1 : 0;
+}
+
+static void mpack_canonical_sift_down(const char* data, mpack_canonical_entry_t* entries,
+        size_t root, size_t count)
+{
+    while (root * 2 + 1 < count) {
+        size_t child = root * 2 + 1;
+        if (child + 1 < count && mpack_canonical_compare(data, &entries[child], &entries[child + 1]) < 0)
+            ++child;
+        if (mpack_canonical_compare(data, &entries[root], &entries[child]) >= 0)
+            return;
+        mpack_canonical_entry_t swap = entries[root];
+        entries[root] = entries[child];
+        entries[child] = swap;
+        root = child;
+    }
+}
+
+// A heapsort, since it needs neither recursion nor extra memory.
+static void mpack_canonical_sort(const char* data, mpack_canonical_entry_t* entries, size_t count) {
+    size_t i;
+    for (i = count / 2; i > 0; --i)
+        mpack_canonical_sift_down(data, entries, i - 1, count);
+    for (i = count; i > 1; --i) {
+        mpack_canonical_entry_t swap = entries[0];
+        entries[0] = entries[i - 1];
+        entries[i - 1] = swap;
+        mpack_canonical_sift_down(data, entries, 0, i - 1);
+    }
+}
+
+// Sorts the encoded entries of a map, which run from start to the end of the
+// output.
+static void mpack_canonical_reorder(mpack_writer_t* writer, mpack_canonical_buffer_t* out,
+        mpack_canonical_entry_t* entries, size_t count, size_t start)
+{
+    mpack_canonical_sort(out->data, entries, count);
+    size_t i;
+    for (i = 1; i < count; ++i) {
+        if (mpack_canonical_compare(out->data, &entries[i - 1], &entries[i]) == 0) {
+            mpack_log("duplicate key in canonical map\n");
+            mpack_writer_flag_error(writer, mpack_error_invalid);
+            return;
+        }
+    }
+
+    // the entries are copied in order past the end of the output and then
+    // moved back down over the originals
+    size_t size = out->used - start;
+    if (!mpack_canonical_reserve(writer, out, size))
+        return;
+    char* sorted = out->data + out->used;
+    for (i = 0; i < count; ++i) {
+        size_t entry_size = entries[i].end - entries[i].key;
+        mpack_memcpy(sorted, out->data + entries[i].key, entry_size);
+        sorted += entry_size;
+    }
+    mpack_memcpy(out->data + start, out->data + out->used, size);
+}
+
+// An open array or map while re-encoding. Maps keep the offsets of their
+// entries so that they can be sorted once they are complete.
+typedef struct mpack_canonical_level_t {
+    size_t left;                      // elements left, counting keys and values separately
+    size_t total;                     // total elements
+    mpack_canonical_entry_t* entries; // the entries of a map, or NULL for an array
+    size_t start;                     // the offset of the first entry of a map
+    bool sorted;                      // whether the entries so far are in order
+} mpack_canonical_level_t;
+
+// Records the end of a map entry, noting whether it follows the previous one.
+static void mpack_canonical_end_entry(mpack_canonical_buffer_t* out, mpack_canonical_level_t* level, size_t i) {
+    level->entries[i].end = out->used;
+    if (i > 0 && mpack_canonical_compare(out->data, &level->entries[i - 1], &level->entries[i]) >= 0)
+        level->sorted = false;
+}
+
+// Reads one tag from the resolved data and appends it to the output, along
+// with the contents of a str, bin or ext. Returns false if an error was
+// flagged.
+static bool mpack_canonical_tag(mpack_writer_t* writer, mpack_canonical_buffer_t* out,
+        const char** p, const char* end, mpack_tag_t* tag)
+{
+    if (*p == end) {
+        mpack_writer_flag_error(writer, mpack_error_invalid);
+        return false;
+    }
+    size_t size = mpack_decode_tag_size(**p);
+    if (size == 0) {
+        // reserved, or ext types with extensions disabled
+        mpack_writer_flag_error(writer, ((uint8_t)**p == 0xc1) ?
+                mpack_error_invalid : mpack_error_unsupported);
+        return false;
+    }
+    if ((size_t)(end - *p) < size) {
+        mpack_writer_flag_error(writer, mpack_error_invalid);
+        return false;
+    }
+    mpack_memset(tag, 0, sizeof(*tag));
+    mpack_decode_tag(*p, tag);
+    *p += size;
+
+    #if MPACK_FLOAT && MPACK_DOUBLE
+    float f;
+    if (tag->type == mpack_type_double && mpack_narrow_double_to_float(tag->v.d, &f))
+        *tag = mpack_tag_make_float(f);
+    #endif
+    mpack_canonical_append_tag(writer, out, *tag);
+
+    switch (tag->type) {
+        case mpack_type_str:
+        case mpack_type_bin:
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+        #endif
+            if ((size_t)(end - *p) < tag->v.l) {
+                mpack_writer_flag_error(writer, mpack_error_invalid);
+                return false;
+            }
+            mpack_canonical_append(writer, out, *p, tag->v.l);
+            *p += tag->v.l;
+            break;
+        default:
+            break;
+    }
+    return mpack_writer_error(writer) == mpack_ok;
+}
+
+// Re-encodes one element. Nested arrays and maps are walked with an explicit
+// stack rather than by recursion so that a deeply nested build can't
+// overflow the C stack.
+static void mpack_canonical_element(mpack_writer_t* writer, mpack_canonical_buffer_t* out,
+        const char** p, const char* end)
+{
+    mpack_canonical_level_t local[8];
+    mpack_canonical_level_t* levels = local;
+    size_t capacity = sizeof(local) / sizeof(*local);
+    size_t depth = 1;
+
+    // the root is treated as an array of one element
+    levels[0].left = 1;
+    levels[0].total = 1;
+    levels[0].entries = NULL;
+
+    while (depth > 0 && mpack_writer_error(writer) == mpack_ok) {
+        mpack_canonical_level_t* level = &levels[depth - 1];
+
+        if (level->left == 0) {
+            if (level->entries != NULL) {
+                mpack_canonical_end_entry(out, level, level->total / 2 - 1);
+                if (!level->sorted)
+                    mpack_canonical_reorder(writer, out, level->entries, level->total / 2, level->start);
+                mpack_allocator_free(&writer->allocator, level->entries);
+            }
+            --depth;
+            continue;
+        }
+
+        if (level->entries != NULL) {
+            size_t element = level->total - level->left;
+            if (element % 2 == 1) {
+                level->entries[element / 2].value = out->used;
+            } else {
+                if (element > 0)
+                    mpack_canonical_end_entry(out, level, element / 2 - 1);
+                level->entries[element / 2].key = out->used;
+            }
+        }
+        --level->left;
+
+        mpack_tag_t tag;
+        if (!mpack_canonical_tag(writer, out, p, end, &tag))
+            break;
+        if ((tag.type != mpack_type_array && tag.type != mpack_type_map) || tag.v.n == 0)
+            continue;
+
+        mpack_canonical_level_t child;
+        child.left = tag.v.n;
+        child.entries = NULL;
+        child.start = out->used;
+        child.sorted = true;
+        if (tag.type == mpack_type_map) {
+            // every entry takes at least two bytes. this keeps a corrupt
+            // count from allocating more than the data could hold.
+            if (tag.v.n > (size_t)(end - *p) / 2) {
+                mpack_writer_flag_error(writer, mpack_error_invalid);
+                break;
+            }
+            child.left *= 2;
+            size_t bytes = (size_t)tag.v.n * sizeof(mpack_canonical_entry_t);
+            if (bytes / sizeof(mpack_canonical_entry_t) == tag.v.n)
+                child.entries = (mpack_canonical_entry_t*)mpack_allocator_alloc(&writer->allocator, bytes);
+            if (child.entries == NULL) {
+                mpack_writer_flag_error(writer, mpack_error_memory);
+                break;
+            }
+        }
+        child.total = child.left;
+
+        if (depth == capacity) {
+            mpack_canonical_level_t* new_levels;
+            if (levels == local) {
+                new_levels = (mpack_canonical_level_t*)mpack_allocator_alloc(&writer->allocator,
+                        sizeof(*levels) * capacity * 2);
+                if (new_levels != NULL)
+                    mpack_memcpy(new_levels, local, sizeof(local));
+            } else {
+                new_levels = (mpack_canonical_level_t*)mpack_allocator_realloc(&writer->allocator, levels,
+                        sizeof(*levels) * capacity, sizeof(*levels) * capacity * 2);
+            }
+            if (new_levels == NULL) {
+                if (child.entries != NULL)
+                    mpack_allocator_free(&writer->allocator, child.entries);
+                mpack_writer_flag_error(writer, mpack_error_memory);
+                break;
+            }
+            levels = new_levels;
+            capacity *= 2;
+        }
+        levels[depth++] = child;
+    }
+
+    // on error, the maps that are still open own their entries
+    while (depth > 0) {
+        --depth;
+        if (levels[depth].entries != NULL)
+            mpack_allocator_free(&writer->allocator, levels[depth].entries);
+    }
+    if (levels != local)
+        mpack_allocator_free(&writer->allocator, levels);
+}
+
+// Writes the resolved contents of a canonical build to the writer.
+static void mpack_builder_write_canonical(mpack_writer_t* writer, const char* data, size_t size) {
+    mpack_canonical_buffer_t out = {NULL, 0, 0};
+    const char* p = data;
+    mpack_canonical_element(writer, &out, &p, data + size);
+    if (mpack_writer_error(writer) == mpack_ok) {
+        mpack_assert(p == data + size, "resolved build has trailing data?");
+        mpack_write_native(writer, out.data, out.used);
+    }
+    if (out.data != NULL)
+        mpack_allocator_free(&writer->allocator, out.data);
+}
+
 MPACK_NOINLINE
 static void mpack_builder_resolve(mpack_writer_t* writer) {
     mpack_builder_t* builder = &writer->builder;
@@ -1664,6 +2758,11 @@ static void mpack_builder_resolve(mpack_writer_t* writer) {
     writer->position = builder->stash_position;
     writer->end = builder->stash_end;
 
+    // A canonical build is gathered into a temporary buffer and canonicalized
+    // once it has been resolved.
+    bool canonical = builder->canonical;
+    mpack_canonical_buffer_t resolved = {NULL, 0, 0};
+
     // We can also close out the build now.
     builder->current_build = NULL;
     builder->latest_build = NULL;
@@ -1690,10 +2789,16 @@ static void mpack_builder_resolve(mpack_writer_t* writer) {
                 mpack_type_to_string(build->type), build->count, build->bytes);
         switch (build->type) {
             case mpack_type_map:
-                mpack_write_map_notrack(writer, build->count);
+                if (canonical)
+                    mpack_canonical_append_tag(writer, &resolved, mpack_tag_make_map(build->count));
+                else
+                    mpack_write_map_notrack(writer, build->count);
                 break;
             case mpack_type_array:
-                mpack_write_array_notrack(writer, build->count);
+                if (canonical)
+                    mpack_canonical_append_tag(writer, &resolved, mpack_tag_make_array(build->count));
+                else
+                    mpack_write_array_notrack(writer, build->count);
                 break;
             default:
                 mpack_break("invalid type in builder?");
@@ -1715,7 +2820,10 @@ static void mpack_builder_resolve(mpack_writer_t* writer) {
                     step = left;
                 mpack_log("writing out %zi bytes starting at %p in page %p\n",
                         step, (void*)((char*)page + offset), (void*)page);
-                mpack_write_native(writer, (char*)page + offset, step);
+                if (canonical)
+                    mpack_canonical_append(writer, &resolved, (char*)page + offset, step);
+                else
+                    mpack_write_native(writer, (char*)page + offset, step);
                 offset += step;
                 left -= step;
             }
@@ -1763,6 +2871,13 @@ static void mpack_builder_resolve(mpack_writer_t* writer) {
 
     mpack_log("done resolve.\n");
 
+    if (canonical) {
+        if (mpack_writer_error(writer) == mpack_ok)
+            mpack_builder_write_canonical(writer, resolved.data, resolved.used);
+        if (resolved.data != NULL)
+            mpack_allocator_free(&writer->allocator, resolved.data);
+    }
+
     // We can now restore the error handler and call it if an error occurred.
     writer->error_fn = error_fn;
     if (writer->error_fn && mpack_writer_error(writer) != mpack_ok)
@@ -1792,6 +2907,11 @@ static void mpack_builder_complete(mpack_writer_t* writer, mpack_type_t type) {
         return;
     }
 
+    if (builder->in_place) {
+        mpack_builder_complete_in_place(writer);
+        return;
+    }
+
     // We need to apply whatever writes have been made to the current build
     // before popping it.
     mpack_builder_apply_writes(writer);
@@ -1808,6 +2928,24 @@ static void mpack_builder_complete(mpack_writer_t* writer, mpack_type_t type) {
     }
 }
 
+void mpack_writer_set_build_mode(mpack_writer_t* writer, mpack_build_mode_t mode) {
+    if (writer->builder.current_build != NULL) {
+        mpack_break("cannot change the build mode while there are builds open!");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+    writer->builder.mode = mode;
+}
+
+void mpack_writer_set_canonical(mpack_writer_t* writer, bool canonical) {
+    if (writer->builder.current_build != NULL) {
+        mpack_break("cannot change canonical builds while there are builds open!");
+        mpack_writer_flag_error(writer, mpack_error_bug);
+        return;
+    }
+    writer->builder.canonical = canonical;
+}
+
 void mpack_build_map(mpack_writer_t* writer) {
     mpack_builder_build(writer, mpack_type_map);
 }
@@ -74,6 +74,31 @@ typedef struct mpack_writer_t mpack_writer_t;
  */
 typedef void (*mpack_writer_flush_t)(mpack_writer_t* writer, const char* buffer, size_t count);
 
+/**
+ * A segment of output for an iovec flush function. This has the same layout as
+ * the POSIX struct iovec.
+ *
+ * @see mpack_writer_flush_iov_t
+ */
+typedef struct mpack_iovec_t {
+    const void* base; /**< The start of the segment. */
+    size_t len;       /**< The number of bytes in the segment. */
+} mpack_iovec_t;
+
+/**
+ * The MPack writer's iovec flush function to write a list of segments to the
+ * output stream, in order. This is suitable for writev() or sendmsg().
+ *
+ * The segments point either into the writer's buffer or to large payloads
+ * passed to mpack_write_bin(), mpack_write_str() and friends which the writer
+ * did not copy. They are only valid until the function returns.
+ *
+ * It should flag an appropriate error on the writer if flushing fails.
+ *
+ * @see mpack_writer_set_flush_iov()
+ */
+typedef void (*mpack_writer_flush_iov_t)(mpack_writer_t* writer, const mpack_iovec_t* iov, size_t count);
+
 /**
  * An error handler function to be called when an error is flagged on
  * the writer.
@@ -105,6 +130,39 @@ typedef void (*mpack_writer_error_t)(mpack_writer_t* writer, mpack_error_t error
  */
 typedef void (*mpack_writer_teardown_t)(mpack_writer_t* writer);
 
+#if MPACK_BUILDER
+/**
+ * The strategy a writer uses to compute the sizes of maps and arrays started
+ * with mpack_build_map() and mpack_build_array().
+ *
+ * @see mpack_writer_set_build_mode()
+ */
+typedef enum mpack_build_mode_t {
+
+    /**
+     * Writes are diverted to paged builder buffers and composed into the
+     * writer once the outermost build is completed. This works with any
+     * writer. This is the default.
+     */
+    mpack_build_mode_paged,
+
+    /**
+     * Writes go directly to the writer's buffer after a reserved 32-bit
+     * header. When a build is completed, the smallest header is written and
+     * the contents are moved down over the rest of the reserved space.
+     */
+    mpack_build_mode_in_place,
+
+    /**
+     * Like mpack_build_mode_in_place, but the reserved 32-bit header is
+     * back-patched without moving the contents. This avoids the move at the
+     * expense of up to four extra bytes per build; the message is still valid
+     * MessagePack but is not in its smallest encoding.
+     */
+    mpack_build_mode_in_place_fixed,
+} mpack_build_mode_t;
+#endif
+
 /* Hide internals from documentation */
 /** @cond */
 
@@ -130,7 +188,10 @@ typedef struct mpack_build_t {
     struct mpack_build_t* parent;
     //struct mpack_build_t* next;
 
-    size_t bytes; // number of bytes between this build and the next one
+    // number of bytes between this build and the next one. for in-place
+    // builds, this is instead the offset of the reserved header from the start
+    // of the writer's buffer.
+    size_t bytes;
     uint32_t count; // number of elements (or key/value pairs) in this map/array
     mpack_type_t type;
 
@@ -152,29 +213,60 @@ typedef struct mpack_builder_t {
     mpack_build_t* latest_build; // build which is accumulating bytes
     mpack_builder_page_t* current_page;
     mpack_builder_page_t* pages;
+    mpack_builder_page_t* spare; // freed pages kept for the next build
     char* stash_buffer;
     char* stash_position;
     char* stash_end;
+    mpack_build_mode_t mode; // mode for the next outermost build
+    bool in_place; // whether the open builds are being written in place
+    bool canonical; // whether outermost builds are written in canonical form
     #if MPACK_BUILDER_INTERNAL_STORAGE
     char internal[MPACK_BUILDER_INTERNAL_STORAGE_SIZE];
     #endif
 } mpack_builder_t;
 #endif
 
+#if MPACK_STATS
+/**
+ * Instrumentation counters for a writer.
+ *
+ * @see MPACK_STATS
+ * @see mpack_writer_stats()
+ */
+typedef struct mpack_writer_stats_t {
+    size_t flushes;       /**< Calls to the flush function */
+    size_t flush_bytes;   /**< Bytes passed to the flush function */
+    size_t grows;         /**< Reallocations of a growable buffer */
+    size_t builder_pages; /**< Pages allocated by the builder */
+} mpack_writer_stats_t;
+#endif
+
 struct mpack_writer_t {
     #if MPACK_COMPATIBILITY
     mpack_version_t version;          /* Version of the MessagePack spec to write */
     #endif
+    #if MPACK_DOUBLE
+    bool compact_floats;              /* Whether doubles are written in their smallest lossless form */
+    #endif
     mpack_writer_flush_t flush;       /* Function to write bytes to the output stream */
     mpack_writer_error_t error_fn;    /* Function to call on error */
     mpack_writer_teardown_t teardown; /* Function to teardown the context on destroy */
     void* context;                    /* Context for writer callbacks */
 
+    mpack_writer_flush_iov_t flush_iov; /* Function to write segments to the output stream */
+    mpack_iovec_t* iov;                 /* Pending segments to flush */
+    size_t iov_count;                   /* Number of pending segments */
+    size_t iov_capacity;                /* Maximum number of pending segments */
+    char* iov_start;                    /* Start of buffered bytes not in a pending segment */
+
     char* buffer;         /* Byte buffer */
     char* position;       /* Current position within the buffer */
     char* end;            /* The end of the buffer */
     mpack_error_t error;  /* Error state */
 
+    bool frame_open;      /* Whether a frame has been begun */
+    size_t frame_start;   /* Offset of the open frame's header in the buffer */
+
     #if MPACK_WRITE_TRACKING
     mpack_track_t track; /* Stack of map/array/str/bin/ext writes */
     #endif
@@ -183,11 +275,17 @@ struct mpack_writer_t {
     /* Reserved. You can use this space to allocate a custom
      * context in order to reduce heap allocations. */
     void* reserved[2];
+
+    mpack_allocator_t allocator; /* Allocator for growable buffers and builder pages */
     #endif
 
     #if MPACK_BUILDER
     mpack_builder_t builder;
     #endif
+
+    #if MPACK_STATS
+    mpack_writer_stats_t stats; /* Instrumentation counters */
+    #endif
 };
 
 
@@ -252,7 +350,8 @@ void mpack_writer_init(mpack_writer_t* writer, char* buffer, size_t size);
  * and will remain NULL if an error occurs.
  *
  * The allocated data must be freed with MPACK_FREE() (or simply free()
- * if MPack's allocator hasn't been customized.)
+ * if MPack's allocator hasn't been customized), or with the writer's
+ * allocator if one was set with mpack_writer_set_allocator().
  *
  * @throws mpack_error_memory if the buffer fails to grow when
  * flushing.
@@ -262,8 +361,63 @@ void mpack_writer_init(mpack_writer_t* writer, char* buffer, size_t size);
  * @param size Where to write the size of the data.
  */
 void mpack_writer_init_growable(mpack_writer_t* writer, char** data, size_t* size);
+
+/**
+ * Initializes an MPack writer using a growable buffer with the given initial
+ * capacity.
+ *
+ * This is the same as mpack_writer_init_growable() except for the capacity.
+ * If the size of the output is known or can be estimated, reserving it up
+ * front avoids growing (and copying) the buffer while writing.
+ *
+ * @param writer The MPack writer.
+ * @param data Where to place the allocated data.
+ * @param size Where to write the size of the data.
+ * @param capacity The initial capacity of the buffer in bytes.
+ */
+void mpack_writer_init_growable_reserve(mpack_writer_t* writer, char** data, size_t* size,
+        size_t capacity);
+
+/**
+ * Completes the current message of a growable writer and starts the next one
+ * at the start of the same buffer.
+ *
+ * The message written since the writer was initialized or last reset is
+ * placed in the writer's data and size pointers, but unlike on destroy the
+ * buffer remains owned by the writer: the data is only valid until something
+ * else is written. Since the buffer keeps its capacity, a writer that is
+ * reset after each message stops growing once it fits the largest message.
+ *
+ * You cannot reset while there are elements open. If the writer is in an
+ * error state, the data pointer is set to NULL and the size to zero.
+ *
+ * @param writer The growable MPack writer.
+ */
+void mpack_writer_reset_growable(mpack_writer_t* writer);
 #endif
 
+/**
+ * Discards everything written since the writer was initialized or last reset
+ * and starts a new message at the start of the writer's buffer.
+ *
+ * Any error the writer is in is cleared, and any open elements or builds are
+ * dropped. The buffer, the pages of the builder and the allocations of write
+ * tracking are all kept, so a writer that is reset between messages no longer
+ * touches the allocator once it has written its largest message.
+ *
+ * Bytes that have not yet been flushed are discarded along with the rest of
+ * the message, so with a flush function you should call mpack_writer_flush_message()
+ * before resetting (unless you are abandoning the message.) A writer that was
+ * initialized with mpack_writer_init_error() has no buffer and stays in its
+ * error state.
+ *
+ * To hand out the message of a growable writer before starting the next one,
+ * use mpack_writer_reset_growable() instead.
+ *
+ * @param writer The MPack writer.
+ */
+void mpack_writer_reset(mpack_writer_t* writer);
+
 /**
  * Initializes an MPack writer directly into an error state. Use this if you
  * are writing a wrapper to mpack_writer_init() which can fail its setup.
@@ -378,6 +532,29 @@ MPACK_INLINE void mpack_writer_set_version(mpack_writer_t* writer, mpack_version
 }
 #endif
 
+#if MPACK_DOUBLE
+/**
+ * Sets whether doubles are written in the smallest form that reads back as
+ * exactly the same value.
+ *
+ * When enabled, mpack_write_double() writes a double that holds an integer
+ * as an int if that is no larger than a float, or otherwise as a float if
+ * the float has exactly the same value. Everything else is still written as
+ * a double. Negative zero, infinities and NaNs keep their sign and bits.
+ *
+ * This applies to all doubles written by the writer, including those in
+ * mpack_write_double_array() and mpack_write_tag(). Such data is read back
+ * unchanged by mpack_expect_double() and mpack_node_double(), which widen
+ * ints and floats to double, but not by mpack_expect_double_strict() or
+ * mpack_node_double_strict(), which reject ints.
+ *
+ * This is disabled by default.
+ */
+MPACK_INLINE void mpack_writer_set_compact_floats(mpack_writer_t* writer, bool compact_floats) {
+    writer->compact_floats = compact_floats;
+}
+#endif
+
 /**
  * Sets the custom pointer to pass to the writer callbacks, such as flush
  * or teardown.
@@ -417,6 +594,31 @@ MPACK_INLINE void* mpack_writer_context(mpack_writer_t* writer) {
  */
 void mpack_writer_set_flush(mpack_writer_t* writer, mpack_writer_flush_t flush);
 
+/**
+ * Sets an iovec flush function to write out the data, referencing large
+ * payloads instead of copying them into the buffer.
+ *
+ * Payloads of str, bin and ext of at least @ref MPACK_WRITER_IOV_MIN_SIZE bytes
+ * are recorded by reference in the given iovec array, along with the
+ * encoded bytes in the buffer between them. The array is flushed together
+ * when the buffer or the array is full, when mpack_writer_flush_message() is
+ * called and when the writer is destroyed. Such payloads must therefore
+ * remain valid and unchanged until the next flush.
+ *
+ * Payloads written within a Builder are always copied.
+ *
+ * This replaces any flush function set with mpack_writer_set_flush().
+ *
+ * @param writer The MPack writer.
+ * @param flush_iov The function to write out segments.
+ * @param iov Storage for pending segments. It must outlive the writer.
+ * @param iov_capacity The number of segments in @p iov, at least 3.
+ *
+ * @see mpack_writer_context()
+ */
+void mpack_writer_set_flush_iov(mpack_writer_t* writer, mpack_writer_flush_iov_t flush_iov,
+        mpack_iovec_t* iov, size_t iov_capacity);
+
 /**
  * Sets the error function to call when an error is flagged on the writer.
  *
@@ -447,6 +649,31 @@ MPACK_INLINE void mpack_writer_set_teardown(mpack_writer_t* writer, mpack_writer
     writer->teardown = teardown;
 }
 
+#ifdef MPACK_MALLOC
+/**
+ * Sets the allocator for the writer's dynamic memory.
+ *
+ * This is used for the pages of the Builder API and for the buffer of a
+ * growable writer (see mpack_writer_init_growable()), which is moved to the
+ * new allocator. The data of a growable writer must then be freed with this
+ * allocator. The buffers of other writers (e.g. of
+ * mpack_writer_init_filename()) are not affected.
+ *
+ * The allocator is copied into the writer. This must be called before
+ * anything is written.
+ *
+ * This requires @ref MPACK_MALLOC.
+ *
+ * @throws mpack_error_memory if the buffer of a growable writer cannot be
+ * allocated.
+ *
+ * @param writer The MPack writer.
+ * @param allocator The allocator, or NULL to use MPACK_MALLOC() and
+ *        MPACK_FREE()
+ */
+void mpack_writer_set_allocator(mpack_writer_t* writer, const mpack_allocator_t* allocator);
+#endif
+
 /**
  * @}
  */
@@ -529,6 +756,23 @@ MPACK_INLINE mpack_error_t mpack_writer_error(mpack_writer_t* writer) {
     return writer->error;
 }
 
+#if MPACK_STATS
+/**
+ * Returns the instrumentation counters of the writer since it was
+ * initialized or since they were last reset.
+ *
+ * @see MPACK_STATS
+ */
+MPACK_INLINE mpack_writer_stats_t mpack_writer_stats(const mpack_writer_t* writer) {
+    return writer->stats;
+}
+
+/**
+ * Resets the instrumentation counters of the writer to zero.
+ */
+void mpack_writer_reset_stats(mpack_writer_t* writer);
+#endif
+
 /**
  * Writes a MessagePack object header (an MPack Tag.)
  *
@@ -760,6 +1004,59 @@ MPACK_INLINE void mpack_finish_map(mpack_writer_t* writer) {
     mpack_builder_compound_pop(writer);
 }
 
+#if MPACK_BUILDER
+/**
+ * Sets the strategy the writer uses for maps and arrays being built.
+ *
+ * The in-place modes write build contents directly into the writer's buffer,
+ * avoiding the extra copy of the paged builder. This requires the output to
+ * stay in the buffer until builds are completed, so they are only used by
+ * writers without a flush function (see mpack_writer_init()) and by growable
+ * writers (see mpack_writer_init_growable()). Other writers always use
+ * mpack_build_mode_paged regardless of this setting.
+ *
+ * A writer building in place still uses a small amount of builder memory to
+ * keep track of open builds, but this is kept between messages.
+ *
+ * This cannot be called while a build is in progress.
+ *
+ * @see mpack_build_mode_t
+ * @see mpack_build_map()
+ */
+void mpack_writer_set_build_mode(mpack_writer_t* writer, mpack_build_mode_t mode);
+
+/**
+ * Enables or disables canonical builds.
+ *
+ * When enabled, the contents of each outermost build (see mpack_build_map()
+ * and mpack_build_array()) are written in a canonical form, so that equal
+ * data always produces identical bytes regardless of the order or encoding in
+ * which it was written. Everything within the build is canonicalized,
+ * including maps and arrays started with mpack_start_map(), elements written
+ * with mpack_write_object_bytes() and nested builds:
+ *
+ * - The entries of every map are sorted by the bytes of their encoded keys;
+ * - All integers, lengths and counts use their smallest encoding, and
+ *   non-negative signed integers are written as unsigned;
+ * - Doubles that are exactly representable as floats are written as floats.
+ *
+ * A map with two entries whose keys are equal flags @ref mpack_error_invalid,
+ * since it has no canonical form. Elements written outside of any build are
+ * written as-is.
+ *
+ * Canonical builds always use mpack_build_mode_paged regardless of the build
+ * mode. They are composed into a temporary buffer when the outermost build is
+ * completed, which costs an extra copy and an allocation for each map of the
+ * build. The result can be compared or hashed in a tree with
+ * mpack_node_equal() and mpack_node_hash().
+ *
+ * This cannot be called while a build is in progress.
+ *
+ * @see mpack_writer_set_build_mode()
+ */
+void mpack_writer_set_canonical(mpack_writer_t* writer, bool canonical);
+#endif
+
 /**
  * Starts building an array.
  *
@@ -802,7 +1099,9 @@ void mpack_build_array(struct mpack_writer_t* writer);
  *
  * This indirect encoding is costly, as it incurs at least an extra copy of all
  * data written within a builder (but not additional copies for nested
- * builders.) Expect a speed penalty of half or more.
+ * builders.) Expect a speed penalty of half or more. Writers with a fixed or
+ * growable buffer can avoid this copy by building in place instead (see
+ * mpack_writer_set_build_mode().)
  *
  * A good strategy is to use this during early development when your messages
  * are constantly changing, and then closer to release when your message
@@ -838,6 +1137,194 @@ void mpack_complete_map(struct mpack_writer_t* writer);
  * @}
  */
 
+/**
+ * @name Typed Array Functions
+ * @{
+ */
+
+/**
+ * Writes an array of unsigned integers in the most efficient packing
+ * available.
+ *
+ * This is equivalent to calling mpack_start_array(), mpack_write_u32() for
+ * each value, and mpack_finish_array(), but space in the buffer is reserved
+ * for as many elements as fit at once rather than checked per element.
+ *
+ * @see mpack_write_u32_array_fixed() to encode every value with the same width
+ */
+void mpack_write_u32_array(mpack_writer_t* writer, const uint32_t* values, uint32_t count);
+
+/**
+ * Writes an array of unsigned integers, encoding every element as a 32-bit
+ * uint (type byte 0xce followed by four big-endian bytes.)
+ *
+ * The output is larger than that of mpack_write_u32_array() for small
+ * values, but every element has the same width so its position in the
+ * output is known ahead of time and the encoding loop is a plain byte swap.
+ */
+void mpack_write_u32_array_fixed(mpack_writer_t* writer, const uint32_t* values, uint32_t count);
+
+/**
+ * Writes an array of signed integers in the most efficient packing
+ * available.
+ *
+ * This is equivalent to calling mpack_start_array(), mpack_write_i64() for
+ * each value, and mpack_finish_array(), but space in the buffer is reserved
+ * for as many elements as fit at once rather than checked per element.
+ *
+ * @see mpack_write_i64_array_fixed() to encode every value with the same width
+ */
+void mpack_write_i64_array(mpack_writer_t* writer, const int64_t* values, uint32_t count);
+
+/**
+ * Writes an array of signed integers, encoding every element as a 64-bit
+ * int (type byte 0xd3 followed by eight big-endian bytes.)
+ *
+ * This is not the smallest encoding, but it is valid MessagePack and every
+ * element has the same width.
+ */
+void mpack_write_i64_array_fixed(mpack_writer_t* writer, const int64_t* values, uint32_t count);
+
+#if MPACK_FLOAT
+/**
+ * Writes an array of floats.
+ *
+ * This is equivalent to calling mpack_start_array(), mpack_write_float() for
+ * each value, and mpack_finish_array(). Floats are always fixed width.
+ */
+void mpack_write_float_array(mpack_writer_t* writer, const float* values, uint32_t count);
+#endif
+
+#if MPACK_DOUBLE
+/**
+ * Writes an array of doubles.
+ *
+ * This is equivalent to calling mpack_start_array(), mpack_write_double() for
+ * each value, and mpack_finish_array(). Doubles are fixed width unless
+ * compact floats are enabled with mpack_writer_set_compact_floats().
+ */
+void mpack_write_double_array(mpack_writer_t* writer, const double* values, uint32_t count);
+#endif
+
+/**
+ * @}
+ */
+
+/**
+ * @name Frame Functions
+ * @{
+ */
+
+/**
+ * Begins a frame.
+ *
+ * A frame is a header of @ref MPACK_FRAME_HEADER_SIZE bytes holding the
+ * length of the data that follows it. Framing a stream of messages lets the
+ * receiver read each message into a buffer of exactly its size, and split
+ * the stream into messages without parsing them, for example to dispatch
+ * them to other threads. See mpack_read_frame().
+ *
+ * The header is reserved in the writer's buffer and back-patched by
+ * mpack_writer_end_frame(), so the frame must stay in the buffer until it
+ * is ended. A writer without a flush function or a growable writer can
+ * write frames of any size that fits its buffer. A writer with any other
+ * flush function flushes what it has buffered when the frame begins, and
+ * flags @ref mpack_error_too_big if the frame then does not fit in its
+ * buffer. Large payloads are not referenced by an iovec writer within a
+ * frame (see mpack_writer_set_flush_iov().)
+ *
+ * Frames cannot be nested, and cannot be begun or ended while any map,
+ * array or other compound type is open. Any number of complete elements
+ * may be written within a frame, although a frame that is to be parsed with
+ * mpack_tree_init_data() should contain exactly one message.
+ *
+ * @see mpack_writer_end_frame()
+ */
+void mpack_writer_begin_frame(mpack_writer_t* writer);
+
+/**
+ * Ends the frame begun with mpack_writer_begin_frame(), writing its length
+ * into its header.
+ *
+ * @throws mpack_error_too_big if the frame is larger than 4 GiB.
+ */
+void mpack_writer_end_frame(mpack_writer_t* writer);
+
+/**
+ * @}
+ */
+
+#ifdef MPACK_MALLOC
+/**
+ * @name Fork and Join Functions
+ * @{
+ */
+
+/**
+ * Initializes a child writer that writes the given number of elements on
+ * behalf of the parent writer.
+ *
+ * This lets the elements of a large array or map be encoded by several
+ * threads into one message. The parent opens the container, forks a child
+ * for each range of its elements, and joins the children in order once they
+ * are done:
+ *
+ * @code{.c}
+ * mpack_start_array(&writer, count);
+ *
+ * mpack_writer_t children[THREADS];
+ * for (i = 0; i < THREADS; ++i)
+ *     mpack_writer_fork(&writer, &children[i], range_count(i));
+ *
+ * // on each thread: write range_count(i) elements to children[i]
+ *
+ * for (i = 0; i < THREADS; ++i)
+ *     mpack_writer_join(&writer, &children[i]);
+ * mpack_finish_array(&writer);
+ * @endcode
+ *
+ * The child is a growable writer with its own buffer, tracking and builder,
+ * so it can be used on a different thread than the parent. It allocates with
+ * the parent's allocator, which must therefore be thread-safe if the child
+ * is used on another thread (the default allocator is.) It writes the same
+ * version of MessagePack as the parent.
+ *
+ * The child must be joined with mpack_writer_join() rather than destroyed.
+ * If its buffer cannot be allocated, it is initialized in the @ref
+ * mpack_error_memory state, which is flagged on the parent when it is
+ * joined.
+ *
+ * @param parent The writer on whose behalf the child writes.
+ * @param child The writer to initialize.
+ * @param count The number of elements the child will write. For a map, the
+ *     keys and values are each an element.
+ */
+void mpack_writer_fork(mpack_writer_t* parent, mpack_writer_t* child, uint32_t count);
+
+/**
+ * Writes the elements written by a child writer to its parent, and destroys
+ * the child.
+ *
+ * The child's data is written to the parent as with mpack_write_object_bytes(),
+ * so a large child is flushed straight from its buffer if the parent has a
+ * flush function. The child's elements count towards the open array or map
+ * (or build) of the parent.
+ *
+ * If the child is in an error state, its error is flagged on the parent. The
+ * child must have written exactly the number of elements it was forked for,
+ * with nothing left open; this is checked if @ref MPACK_WRITE_TRACKING is
+ * enabled.
+ *
+ * @param parent The writer the child was forked from.
+ * @param child The child writer.
+ */
+void mpack_writer_join(mpack_writer_t* parent, mpack_writer_t* child);
+
+/**
+ * @}
+ */
+#endif
+
 /**
  * @name Data Helpers
  * @{
@@ -1087,6 +1574,25 @@ MPACK_INLINE void mpack_finish_type(mpack_writer_t* writer, mpack_type_t type) {
  * @}
  */
 
+#if MPACK_INTERNAL
+
+void mpack_write_native_straddle(mpack_writer_t* writer, const char* p, size_t count);
+
+// Writes encoded bytes to the buffer, flushing if necessary. This does not
+// track writes, so it can also be used for non-MessagePack output (e.g. JSON.)
+MPACK_INLINE void mpack_write_native(mpack_writer_t* writer, const char* p, size_t count) {
+    mpack_assert(count == 0 || p != NULL, "data pointer for %i bytes is NULL", (int)count);
+
+    if (mpack_writer_buffer_left(writer) < count) {
+        mpack_write_native_straddle(writer, p, count);
+    } else {
+        mpack_memcpy(writer->position, p, count);
+        writer->position += count;
+    }
+}
+
+#endif
+
 #if MPACK_HAS_GENERIC && !defined(__cplusplus)
 
 /**
@@ -34,6 +34,10 @@
 #include "mpack-reader.h"
 #include "mpack-expect.h"
 #include "mpack-node.h"
+#include "mpack-sax.h"
+#include "mpack-schema.h"
+#include "mpack-json.h"
+#include "mpack-compress.h"
 
 #endif
 
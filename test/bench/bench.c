@@ -0,0 +1,526 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// This is a benchmark of the MPack hot paths. It generates a corpus of
+// representative message shapes and measures the throughput of parsing,
+// decoding, discarding and writing them.
+//
+// Run it with tools/bench.sh. Arguments are either "-t <seconds>" to set the
+// minimum time spent on each benchmark or substrings to filter the benchmarks
+// to run by name or corpus (e.g. "tree" or "numeric").
+
+#include "mpack/mpack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static size_t bench_allocations;
+
+void* bench_malloc(size_t size) {
+    ++bench_allocations;
+    return malloc(size);
+}
+
+void* bench_realloc(void* p, size_t size) {
+    ++bench_allocations;
+    return realloc(p, size);
+}
+
+void bench_free(void* p) {
+    free(p);
+}
+
+static void bench_fail(const char* what, mpack_error_t error) {
+    fprintf(stderr, "%s failed: %s\n", what, mpack_error_to_string(error));
+    exit(EXIT_FAILURE);
+}
+
+
+
+/*
+ * Corpus
+ */
+
+#define BENCH_WIDE_MAP_COUNT 1000
+#define BENCH_DEEP_COUNT 64
+#define BENCH_DEEP_DEPTH 100
+#define BENCH_NUMERIC_COUNT 100000
+#define BENCH_BIN_COUNT 16
+#define BENCH_BIN_SIZE (64 * 1024)
+#define BENCH_STRING_COUNT 2000
+#define BENCH_STRING_MAX 1024
+
+typedef enum bench_shape_t {
+    bench_shape_wide_map,
+    bench_shape_deep,
+    bench_shape_numeric,
+    bench_shape_bins,
+    bench_shape_strings,
+    bench_shape_count
+} bench_shape_t;
+
+typedef struct bench_corpus_t {
+    const char* name;
+    char* data;
+    size_t size;
+} bench_corpus_t;
+
+static bench_corpus_t bench_corpus[bench_shape_count];
+
+static double bench_doubles[BENCH_NUMERIC_COUNT];
+static int64_t bench_ints[BENCH_NUMERIC_COUNT];
+static char bench_bin[BENCH_BIN_SIZE];
+static char bench_string[BENCH_STRING_MAX];
+static char bench_keys[BENCH_WIDE_MAP_COUNT][16];
+
+// A mix of multi-byte UTF-8 sequences: "héllo wörld ✓ 日本 "
+static const char bench_utf8_word[] =
+        "h\xc3\xa9llo w\xc3\xb6rld \xe2\x9c\x93 \xe6\x97\xa5\xe6\x9c\xac ";
+
+static size_t bench_string_length(size_t i) {
+    return ((i * 37) % (BENCH_STRING_MAX / (sizeof(bench_utf8_word) - 1))) * (sizeof(bench_utf8_word) - 1);
+}
+
+// Writes a map of string keys to unsigned ints of varying widths.
+static void bench_write_wide_map(mpack_writer_t* writer, bool build) {
+    uint32_t i;
+    if (build)
+        mpack_build_map(writer);
+    else
+        mpack_start_map(writer, BENCH_WIDE_MAP_COUNT);
+    for (i = 0; i < BENCH_WIDE_MAP_COUNT; ++i) {
+        mpack_write_cstr(writer, bench_keys[i]);
+        mpack_write_u64(writer, (uint64_t)i * i * i * 37u);
+    }
+    if (build)
+        mpack_complete_map(writer);
+    else
+        mpack_finish_map(writer);
+}
+
+static void bench_write_deep(mpack_writer_t* writer) {
+    int i, j;
+    mpack_start_array(writer, BENCH_DEEP_COUNT);
+    for (i = 0; i < BENCH_DEEP_COUNT; ++i) {
+        for (j = 0; j < BENCH_DEEP_DEPTH; ++j)
+            mpack_start_array(writer, 1);
+        mpack_write_nil(writer);
+        for (j = 0; j < BENCH_DEEP_DEPTH; ++j)
+            mpack_finish_array(writer);
+    }
+    mpack_finish_array(writer);
+}
+
+static void bench_write_numeric(mpack_writer_t* writer, bool bulk) {
+    uint32_t i;
+    mpack_start_array(writer, 2);
+    if (bulk) {
+        mpack_write_double_array(writer, bench_doubles, BENCH_NUMERIC_COUNT);
+        mpack_write_i64_array(writer, bench_ints, BENCH_NUMERIC_COUNT);
+    } else {
+        mpack_start_array(writer, BENCH_NUMERIC_COUNT);
+        for (i = 0; i < BENCH_NUMERIC_COUNT; ++i)
+            mpack_write_double(writer, bench_doubles[i]);
+        mpack_finish_array(writer);
+        mpack_start_array(writer, BENCH_NUMERIC_COUNT);
+        for (i = 0; i < BENCH_NUMERIC_COUNT; ++i)
+            mpack_write_i64(writer, bench_ints[i]);
+        mpack_finish_array(writer);
+    }
+    mpack_finish_array(writer);
+}
+
+static void bench_write_bins(mpack_writer_t* writer) {
+    int i;
+    mpack_start_array(writer, BENCH_BIN_COUNT);
+    for (i = 0; i < BENCH_BIN_COUNT; ++i)
+        mpack_write_bin(writer, bench_bin, BENCH_BIN_SIZE);
+    mpack_finish_array(writer);
+}
+
+static void bench_write_strings(mpack_writer_t* writer) {
+    size_t i;
+    mpack_start_array(writer, BENCH_STRING_COUNT);
+    for (i = 0; i < BENCH_STRING_COUNT; ++i)
+        mpack_write_str(writer, bench_string, (uint32_t)bench_string_length(i));
+    mpack_finish_array(writer);
+}
+
+static void bench_write_shape(mpack_writer_t* writer, bench_shape_t shape) {
+    switch (shape) {
+        case bench_shape_wide_map: bench_write_wide_map(writer, false); break;
+        case bench_shape_deep:     bench_write_deep(writer);            break;
+        case bench_shape_numeric:  bench_write_numeric(writer, false);  break;
+        case bench_shape_bins:     bench_write_bins(writer);            break;
+        case bench_shape_strings:  bench_write_strings(writer);         break;
+        default: break;
+    }
+}
+
+static void bench_corpus_init(void) {
+    static const char* names[bench_shape_count] = {
+        "wide-map", "deep", "numeric", "bins", "strings",
+    };
+    size_t i;
+
+    for (i = 0; i < BENCH_NUMERIC_COUNT; ++i) {
+        int64_t v = (int64_t)i;
+        bench_doubles[i] = (double)v * 0.25 - 1000.0;
+        bench_ints[i] = (i % 3 == 0) ? -(v * v * v) : v * v;
+    }
+    for (i = 0; i < BENCH_WIDE_MAP_COUNT; ++i)
+        snprintf(bench_keys[i], sizeof(bench_keys[i]), "field%04u", (unsigned)i);
+    for (i = 0; i < BENCH_BIN_SIZE; ++i)
+        bench_bin[i] = (char)(i * 31);
+    for (i = 0; i + sizeof(bench_utf8_word) - 1 <= BENCH_STRING_MAX; i += sizeof(bench_utf8_word) - 1)
+        memcpy(bench_string + i, bench_utf8_word, sizeof(bench_utf8_word) - 1);
+
+    for (i = 0; i < bench_shape_count; ++i) {
+        bench_corpus_t* corpus = &bench_corpus[i];
+        mpack_writer_t writer;
+        corpus->name = names[i];
+        mpack_writer_init_growable(&writer, &corpus->data, &corpus->size);
+        bench_write_shape(&writer, (bench_shape_t)i);
+        mpack_error_t error = mpack_writer_destroy(&writer);
+        if (error != mpack_ok)
+            bench_fail("corpus generation", error);
+    }
+}
+
+static void bench_corpus_destroy(void) {
+    size_t i;
+    for (i = 0; i < bench_shape_count; ++i)
+        MPACK_FREE(bench_corpus[i].data);
+}
+
+
+
+/*
+ * Benchmarks
+ *
+ * Each benchmark processes one message and returns the number of bytes of
+ * MessagePack it read or wrote.
+ */
+
+typedef size_t (*bench_fn_t)(const bench_corpus_t* corpus);
+
+static size_t bench_tree_parse(const bench_corpus_t* corpus) {
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, corpus->data, corpus->size);
+    mpack_tree_parse(&tree);
+    mpack_error_t error = mpack_tree_destroy(&tree);
+    if (error != mpack_ok)
+        bench_fail("tree parse", error);
+    return corpus->size;
+}
+
+// A long-lived tree that is reset for each message.
+static mpack_tree_t bench_reset_tree;
+static bool bench_reset_tree_ready = false;
+
+static size_t bench_tree_reset(const bench_corpus_t* corpus) {
+    if (!bench_reset_tree_ready) {
+        mpack_tree_init_data(&bench_reset_tree, corpus->data, corpus->size);
+        bench_reset_tree_ready = true;
+    } else {
+        mpack_tree_reset(&bench_reset_tree, corpus->data, corpus->size);
+    }
+    mpack_tree_parse(&bench_reset_tree);
+    mpack_error_t error = mpack_tree_error(&bench_reset_tree);
+    if (error != mpack_ok)
+        bench_fail("tree reset", error);
+    return corpus->size;
+}
+
+static size_t bench_discard(const bench_corpus_t* corpus) {
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, corpus->data, corpus->size);
+    mpack_discard(&reader);
+    mpack_error_t error = mpack_reader_destroy(&reader);
+    if (error != mpack_ok)
+        bench_fail("discard", error);
+    return corpus->size;
+}
+
+static void bench_expect_deep(mpack_reader_t* reader, int depth) {
+    if (depth == 0) {
+        mpack_expect_nil(reader);
+        return;
+    }
+    mpack_expect_array_match(reader, 1);
+    bench_expect_deep(reader, depth - 1);
+    mpack_done_array(reader);
+}
+
+static void bench_expect_shape(mpack_reader_t* reader, const bench_corpus_t* corpus) {
+    char key[16];
+    uint32_t i;
+    double sum = 0;
+
+    switch ((bench_shape_t)(corpus - bench_corpus)) {
+        case bench_shape_wide_map:
+            mpack_expect_map_match(reader, BENCH_WIDE_MAP_COUNT);
+            for (i = 0; i < BENCH_WIDE_MAP_COUNT; ++i) {
+                mpack_expect_cstr(reader, key, sizeof(key));
+                sum += (double)mpack_expect_u64(reader);
+            }
+            mpack_done_map(reader);
+            break;
+
+        case bench_shape_deep:
+            mpack_expect_array_match(reader, BENCH_DEEP_COUNT);
+            for (i = 0; i < BENCH_DEEP_COUNT; ++i)
+                bench_expect_deep(reader, BENCH_DEEP_DEPTH);
+            mpack_done_array(reader);
+            break;
+
+        case bench_shape_numeric:
+            mpack_expect_array_match(reader, 2);
+            mpack_expect_array_match(reader, BENCH_NUMERIC_COUNT);
+            for (i = 0; i < BENCH_NUMERIC_COUNT; ++i)
+                sum += mpack_expect_double(reader);
+            mpack_done_array(reader);
+            mpack_expect_array_match(reader, BENCH_NUMERIC_COUNT);
+            for (i = 0; i < BENCH_NUMERIC_COUNT; ++i)
+                sum += (double)mpack_expect_i64(reader);
+            mpack_done_array(reader);
+            mpack_done_array(reader);
+            break;
+
+        case bench_shape_bins:
+            mpack_expect_array_match(reader, BENCH_BIN_COUNT);
+            for (i = 0; i < BENCH_BIN_COUNT; ++i)
+                sum += (double)mpack_expect_bin_buf(reader, bench_bin, sizeof(bench_bin));
+            mpack_done_array(reader);
+            break;
+
+        case bench_shape_strings:
+            mpack_expect_array_match(reader, BENCH_STRING_COUNT);
+            for (i = 0; i < BENCH_STRING_COUNT; ++i)
+                sum += (double)mpack_expect_utf8(reader, bench_string, sizeof(bench_string));
+            mpack_done_array(reader);
+            break;
+
+        default:
+            break;
+    }
+
+    // keep the decoded values alive
+    if (sum == -1.0)
+        printf("\n");
+}
+
+static size_t bench_expect(const bench_corpus_t* corpus) {
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, corpus->data, corpus->size);
+    bench_expect_shape(&reader, corpus);
+    mpack_error_t error = mpack_reader_destroy(&reader);
+    if (error != mpack_ok)
+        bench_fail("expect", error);
+    return corpus->size;
+}
+
+static size_t bench_expect_bulk(const bench_corpus_t* corpus) {
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, corpus->data, corpus->size);
+    mpack_expect_array_match(&reader, 2);
+    mpack_expect_double_array(&reader, bench_doubles, BENCH_NUMERIC_COUNT);
+    mpack_expect_i64_array(&reader, bench_ints, BENCH_NUMERIC_COUNT);
+    mpack_done_array(&reader);
+    mpack_error_t error = mpack_reader_destroy(&reader);
+    if (error != mpack_ok)
+        bench_fail("expect bulk", error);
+    return corpus->size;
+}
+
+static size_t bench_node_utf8(const bench_corpus_t* corpus) {
+    mpack_tree_t tree;
+    size_t i;
+    mpack_tree_init_data(&tree, corpus->data, corpus->size);
+    mpack_tree_parse(&tree);
+    mpack_node_t root = mpack_tree_root(&tree);
+    for (i = 0; i < BENCH_STRING_COUNT; ++i)
+        mpack_node_check_utf8(mpack_node_array_at(root, i));
+    mpack_error_t error = mpack_tree_destroy(&tree);
+    if (error != mpack_ok)
+        bench_fail("node utf8", error);
+    return corpus->size;
+}
+
+// Writes the corpus shape to a new growable writer and returns the size.
+static size_t bench_growable_write(const bench_corpus_t* corpus, bool build, bool in_place, bool bulk) {
+    bench_shape_t shape = (bench_shape_t)(corpus - bench_corpus);
+    mpack_writer_t writer;
+    char* data;
+    size_t size;
+
+    mpack_writer_init_growable(&writer, &data, &size);
+    if (in_place)
+        mpack_writer_set_build_mode(&writer, mpack_build_mode_in_place);
+    if (shape == bench_shape_wide_map)
+        bench_write_wide_map(&writer, build);
+    else if (shape == bench_shape_numeric)
+        bench_write_numeric(&writer, bulk);
+    else
+        bench_write_shape(&writer, shape);
+    mpack_error_t error = mpack_writer_destroy(&writer);
+    if (error != mpack_ok)
+        bench_fail("write", error);
+    MPACK_FREE(data);
+    return size;
+}
+
+static size_t bench_write(const bench_corpus_t* corpus) {
+    return bench_growable_write(corpus, false, false, false);
+}
+
+static size_t bench_build_map(const bench_corpus_t* corpus) {
+    return bench_growable_write(corpus, true, false, false);
+}
+
+static size_t bench_build_map_in_place(const bench_corpus_t* corpus) {
+    return bench_growable_write(corpus, true, true, false);
+}
+
+static size_t bench_write_bulk(const bench_corpus_t* corpus) {
+    return bench_growable_write(corpus, false, false, true);
+}
+
+// A long-lived growable writer that is reset for each message.
+static mpack_writer_t bench_reset_writer;
+static char* bench_reset_data;
+static size_t bench_reset_size;
+static bool bench_reset_writer_ready = false;
+
+static size_t bench_write_reset(const bench_corpus_t* corpus) {
+    bench_shape_t shape = (bench_shape_t)(corpus - bench_corpus);
+    if (!bench_reset_writer_ready) {
+        mpack_writer_init_growable(&bench_reset_writer, &bench_reset_data, &bench_reset_size);
+        bench_reset_writer_ready = true;
+    } else {
+        mpack_writer_reset(&bench_reset_writer);
+    }
+    if (shape == bench_shape_wide_map)
+        bench_write_wide_map(&bench_reset_writer, true);
+    else
+        bench_write_shape(&bench_reset_writer, shape);
+    mpack_error_t error = mpack_writer_error(&bench_reset_writer);
+    if (error != mpack_ok)
+        bench_fail("write reset", error);
+    return mpack_writer_buffer_used(&bench_reset_writer);
+}
+
+
+
+/*
+ * Runner
+ */
+
+static double bench_min_seconds = 0.25;
+static int bench_filter_count;
+static char** bench_filters;
+
+static bool bench_selected(const char* name, const char* corpus) {
+    int i;
+    if (bench_filter_count == 0)
+        return true;
+    for (i = 0; i < bench_filter_count; ++i)
+        if (strstr(name, bench_filters[i]) || strstr(corpus, bench_filters[i]))
+            return true;
+    return false;
+}
+
+static void bench_run(const char* name, bench_fn_t fn, bench_shape_t shape) {
+    const bench_corpus_t* corpus = &bench_corpus[shape];
+    if (!bench_selected(name, corpus->name))
+        return;
+
+    // warm up caches and allocators before measuring
+    fn(corpus);
+
+    size_t allocations = bench_allocations;
+    double bytes = 0;
+    double messages = 0;
+    double seconds;
+    clock_t start = clock();
+    do {
+        bytes += (double)fn(corpus);
+        messages += 1;
+        seconds = (double)(clock() - start) / (double)CLOCKS_PER_SEC;
+    } while (seconds < bench_min_seconds);
+
+    if (seconds <= 0)
+        seconds = 1.0 / (double)CLOCKS_PER_SEC;
+    printf("%-18s %-9s %10.1f MB/s %12.1f msg/s %8.1f allocs/msg\n",
+            name, corpus->name,
+            bytes / seconds / (1024.0 * 1024.0),
+            messages / seconds,
+            (double)(bench_allocations - allocations) / messages);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    int i;
+
+    bench_filters = (char**)malloc(sizeof(char*) * (size_t)argc);
+    for (i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            bench_min_seconds = atof(argv[++i]);
+        } else {
+            bench_filters[bench_filter_count++] = argv[i];
+        }
+    }
+
+    bench_corpus_init();
+    for (i = 0; i < bench_shape_count; ++i)
+        printf("corpus %-9s %9u bytes\n", bench_corpus[i].name, (unsigned)bench_corpus[i].size);
+    printf("\n");
+
+    for (i = 0; i < bench_shape_count; ++i)
+        bench_run("tree-parse", bench_tree_parse, (bench_shape_t)i);
+    for (i = 0; i < bench_shape_count; ++i)
+        bench_run("tree-reset", bench_tree_reset, (bench_shape_t)i);
+    for (i = 0; i < bench_shape_count; ++i)
+        bench_run("expect", bench_expect, (bench_shape_t)i);
+    bench_run("expect-bulk", bench_expect_bulk, bench_shape_numeric);
+    for (i = 0; i < bench_shape_count; ++i)
+        bench_run("discard", bench_discard, (bench_shape_t)i);
+    bench_run("node-utf8", bench_node_utf8, bench_shape_strings);
+    for (i = 0; i < bench_shape_count; ++i)
+        bench_run("write", bench_write, (bench_shape_t)i);
+    bench_run("write-bulk", bench_write_bulk, bench_shape_numeric);
+    for (i = 0; i < bench_shape_count; ++i)
+        bench_run("write-reset", bench_write_reset, (bench_shape_t)i);
+    bench_run("build-map", bench_build_map, bench_shape_wide_map);
+    bench_run("build-map-in-place", bench_build_map_in_place, bench_shape_wide_map);
+
+    if (bench_reset_tree_ready)
+        mpack_tree_destroy(&bench_reset_tree);
+    if (bench_reset_writer_ready) {
+        mpack_writer_destroy(&bench_reset_writer);
+        MPACK_FREE(bench_reset_data);
+    }
+    bench_corpus_destroy();
+    free(bench_filters);
+    return EXIT_SUCCESS;
+}
@@ -200,11 +200,20 @@ else:
     ]
 
 global_cppflags += [
-    "-Isrc", "-Itest/unit/src",
-    "-DMPACK_VARIANT_BUILDS=1",
+    "-Isrc",
     "-DMPACK_HAS_CONFIG=1",
 ]
 
+# The unit tests use the configuration in test/unit/src/mpack-config.h. The
+# benchmarks use their own configuration in test/bench/mpack-config.h.
+unitflags = [
+    "-Itest/unit/src",
+    "-DMPACK_VARIANT_BUILDS=1",
+]
+benchflags = [
+    "-Itest/bench",
+]
+
 defaultfeatures = [
     "-DMPACK_READER=1",
     "-DMPACK_WRITER=1",
@@ -215,6 +224,7 @@ defaultfeatures = [
 allfeatures = defaultfeatures + [
     "-DMPACK_COMPATIBILITY=1",
     "-DMPACK_EXTENSIONS=1",
+    "-DMPACK_STATS=1",
 ]
 
 noioconfigs = [
@@ -225,6 +235,8 @@ noioconfigs = [
 
 allconfigs = noioconfigs + [
     "-DMPACK_STDIO=1",
+    "-DMPACK_MMAP=1",
+    "-DMPACK_COMPRESS=1",
 ]
 
 # optimization
@@ -303,18 +315,31 @@ ltoflags = []
 # Build configuration
 ###################################################
 
+def findSources(folders):
+    srcs = []
+    for folder in folders:
+        for root, dirs, files in os.walk(folder):
+            for name in files:
+                if name.endswith(".c"):
+                    srcs.append(os.path.join(root, name))
+    return srcs
+
+unitsrcs = findSources([path.join("src", "mpack"), path.join("test", "unit", "src")])
+benchsrcs = findSources([path.join("src", "mpack"), path.join("test", "bench")])
+
 builds = {}
 
 class Build:
-    def __init__(self, name, cppflags, ldflags):
+    def __init__(self, name, cppflags, ldflags, srcs):
         self.name = name
         self.cppflags = cppflags
         self.ldflags = ldflags
+        self.srcs = srcs
         self.run_wrapper = None
         self.exclude = False
 
 def addBuild(name, cppflags, ldflags=[]):
-    builds[name] = Build(name, cppflags[:], ldflags[:])
+    builds[name] = Build(name, unitflags + cppflags, ldflags[:], unitsrcs)
 
 def addDebugReleaseBuilds(name, cppflags, ldflags = []):
     addBuild(name + "-debug", cppflags + debugflags, ldflags)
@@ -330,6 +355,7 @@ addDebugReleaseBuilds('compatibility', defaultfeatures + ["-DMPACK_COMPATIBILITY
 addDebugReleaseBuilds('extensions', defaultfeatures + ["-DMPACK_EXTENSIONS=1"] + allconfigs + cflags)
 addDebugReleaseBuilds('no-float', allfeatures + allconfigs + cflags + ["-DMPACK_FLOAT=0"])
 addDebugReleaseBuilds('no-double', allfeatures + allconfigs + cflags + ["-DMPACK_DOUBLE=0"])
+addDebugReleaseBuilds('node-compact', allfeatures + allconfigs + cflags + ["-DMPACK_NODE_COMPACT=1"])
 
 # writer builds
 addDebugReleaseBuilds('writer-only',
@@ -437,6 +463,7 @@ addBuild('optimize-size-release', allfeatures + allconfigs + cflags + sizeOptimi
 
 # miscellaneous special builds
 addBuild('notrack', allfeatures + allconfigs + cflags + debugflags + ["-DMPACK_NO_TRACKING=1"])
+addBuild('depthtrack', allfeatures + allconfigs + cflags + debugflags + ["-DMPACK_TRACKING_DEPTH_ONLY=1"])
 addDebugReleaseBuilds('realloc', allfeatures + allconfigs + cflags + ["-DMPACK_REALLOC=test_realloc"])
 if not msvc and compiler != "TinyCC":
     addBuild('O3', allfeatures + allconfigs + cflags + ["-O3"])
@@ -468,20 +495,22 @@ elif compiler != "TinyCC":
     # not technically a sanitizer, but close enough:
     addSanitizerBuilds('sanitize-stack-protector', ["-Wstack-protector", "-fstack-protector-all"])
 
+# benchmarks (always optimized, and not run as part of "all")
+if msvc:
+    benchOptimize = ["/O2", "/MD"]
+elif compiler != "TinyCC":
+    benchOptimize = ["-O3"]
+else:
+    benchOptimize = ["-O2"]
+builds["bench"] = Build("bench", benchflags + cflags + benchOptimize + ["-DNDEBUG"], [], benchsrcs)
+builds["bench"].exclude = True
+
 
 
 ###################################################
 # Ninja generation
 ###################################################
 
-srcs = []
-
-for paths in [path.join("src", "mpack"), path.join("test", "unit", "src")]:
-    for root, dirs, files in os.walk(paths):
-        for name in files:
-            if name.endswith(".c"):
-                srcs.append(os.path.join(root, name))
-
 ninja = path.join(globalbuild, "build.ninja")
 with open(ninja, "w") as out:
     out.write("# This file is auto-generated.\n")
@@ -538,7 +567,7 @@ with open(ninja, "w") as out:
             cppflags.append("/Fd" + buildfolder)
             ldflags.append("/DEBUG")
 
-        for src in srcs:
+        for src in build.srcs:
             obj = path.join(buildfolder, "objs", src[:-2] + obj_extension)
             objs.append(obj)
             out.write("build " + obj + ": compile " + src + "\n")
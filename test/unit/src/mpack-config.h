@@ -72,6 +72,12 @@
     #define MPACK_STDLIB 1
     #define MPACK_STDIO 1
 
+    // We test parsing memory-mapped files.
+    #define MPACK_MMAP 1
+
+    // We test the compression adapters with a simple test codec.
+    #define MPACK_COMPRESS 1
+
 #endif
 
 // We've disabled the unit test for single inline under tcc.
@@ -262,6 +262,15 @@ static void test_expect_buffer(void) {
 
         // read and destroy, ensuring no errors
         test_expect_buffer_values(&reader);
+        #if MPACK_STATS
+        mpack_reader_stats_t stats = mpack_reader_stats(&reader);
+        TEST_TRUE(stats.fill_bytes == sizeof(test_numbers) - 1);
+        TEST_TRUE(stats.fills >= (sizeof(test_numbers) - 1 + size - 1) / size);
+        TEST_TRUE(stats.straddles > 0);
+        TEST_TRUE(stats.segments == 0);
+        mpack_reader_reset_stats(&reader);
+        TEST_TRUE(mpack_reader_stats(&reader).fills == 0);
+        #endif
         TEST_READER_DESTROY_NOERROR(&reader);
         free(buffer);
 
@@ -296,6 +305,12 @@ static void test_write_buffer(void) {
         test_write_buffer_values(&writer);
         TEST_WRITER_DESTROY_NOERROR(&writer);
         free(buffer);
+        #if MPACK_STATS
+        mpack_writer_stats_t stats = mpack_writer_stats(&writer);
+        TEST_TRUE(stats.flush_bytes == sizeof(test_numbers) - 1);
+        TEST_TRUE(stats.flushes >= (sizeof(test_numbers) - 1 + size - 1) / size);
+        TEST_TRUE(stats.grows == 0);
+        #endif
 
         // check output
         TEST_TRUE(output_size - state.remaining == sizeof(test_numbers) - 1,
@@ -419,6 +419,285 @@ static void test_builder_resolve_error(void) {
     TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_too_big);
 }
 
+static void test_builder_in_place_message(mpack_writer_t* writer) {
+    mpack_build_map(writer);
+    mpack_write_cstr(writer, "nums");
+    mpack_build_array(writer);
+    int i;
+    for (i = 0; i < 20; ++i)
+        mpack_write_int(writer, i * 1000);
+    mpack_complete_array(writer);
+    mpack_write_cstr(writer, "known");
+    mpack_start_array(writer, 2);
+    mpack_build_map(writer);
+    mpack_complete_map(writer);
+    mpack_build_array(writer);
+    mpack_write_cstr(writer, "a string that is long enough to need a grow");
+    mpack_complete_array(writer);
+    mpack_finish_array(writer);
+    mpack_write_cstr(writer, "wide");
+    mpack_build_array(writer);
+    for (i = 0; i < 70000; ++i)
+        mpack_write_nil(writer);
+    mpack_complete_array(writer);
+    mpack_complete_map(writer);
+}
+
+static void test_builder_in_place(void) {
+    static char paged[160*1024];
+    static char buf[160*1024];
+    mpack_writer_t writer;
+
+    mpack_writer_init(&writer, paged, sizeof(paged));
+    test_builder_in_place_message(&writer);
+    size_t size = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    // in place in a fixed buffer, twice to reuse its pages
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_set_build_mode(&writer, mpack_build_mode_in_place);
+    test_builder_in_place_message(&writer);
+    TEST_TRUE(mpack_writer_buffer_used(&writer) == size);
+    test_builder_in_place_message(&writer);
+    TEST_TRUE(mpack_writer_buffer_used(&writer) == size * 2);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(0 == memcmp(buf, paged, size));
+    TEST_TRUE(0 == memcmp(buf + size, paged, size));
+
+    // in place in a growable buffer that starts small
+    #ifdef MPACK_MALLOC
+    char* grown;
+    size_t grown_size;
+    mpack_writer_init_growable_reserve(&writer, &grown, &grown_size, 32);
+    mpack_writer_set_build_mode(&writer, mpack_build_mode_in_place);
+    test_builder_in_place_message(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(grown_size == size);
+    TEST_TRUE(grown != NULL && 0 == memcmp(grown, paged, size));
+    MPACK_FREE(grown);
+    #endif
+
+    // fixed headers are back-patched without moving the contents
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_set_build_mode(&writer, mpack_build_mode_in_place_fixed);
+    mpack_build_array(&writer);
+    mpack_write_u8(&writer, 2);
+    mpack_build_map(&writer);
+    mpack_complete_map(&writer);
+    mpack_complete_array(&writer);
+    TEST_DESTROY_MATCH_IMPL(buf, "\xdd\x00\x00\x00\x02\x02\xdf\x00\x00\x00\x00");
+
+    // the mode can't change during a build
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_build_array(&writer);
+    TEST_BREAK((mpack_writer_set_build_mode(&writer, mpack_build_mode_in_place), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+
+    // an in-place build that doesn't fit is too big
+    mpack_writer_init(&writer, buf, 8);
+    mpack_writer_set_build_mode(&writer, mpack_build_mode_in_place);
+    mpack_build_array(&writer);
+    mpack_write_cstr(&writer, "Hello world!");
+    mpack_complete_array(&writer);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_too_big);
+}
+
+static void test_builder_reset(void) {
+    static char paged[160*1024];
+    static char buf[160*1024];
+    mpack_writer_t writer;
+
+    mpack_writer_init(&writer, paged, sizeof(paged));
+    test_builder_in_place_message(&writer);
+    size_t size = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    // open builds are dropped, in both modes
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_build_map(&writer);
+    mpack_write_cstr(&writer, "dropped");
+    mpack_build_array(&writer);
+    mpack_writer_reset(&writer);
+    mpack_writer_set_build_mode(&writer, mpack_build_mode_in_place);
+    mpack_build_array(&writer);
+    mpack_write_nil(&writer);
+    mpack_writer_reset(&writer);
+    TEST_TRUE(mpack_writer_buffer_used(&writer) == 0);
+
+    // later messages reuse the pages of the first
+    test_builder_in_place_message(&writer);
+    mpack_writer_reset(&writer);
+    mpack_writer_set_build_mode(&writer, mpack_build_mode_paged);
+    test_builder_in_place_message(&writer);
+    mpack_writer_reset(&writer);
+    #ifdef MPACK_MALLOC
+    size_t allocations = test_malloc_total_count();
+    #endif
+    int i;
+    for (i = 0; i < 3; ++i) {
+        mpack_writer_reset(&writer);
+        mpack_writer_set_build_mode(&writer, (i % 2) ? mpack_build_mode_in_place : mpack_build_mode_paged);
+        test_builder_in_place_message(&writer);
+        TEST_TRUE(mpack_writer_buffer_used(&writer) == size);
+        TEST_TRUE(0 == memcmp(buf, paged, size));
+    }
+    #ifdef MPACK_MALLOC
+    TEST_TRUE(test_malloc_total_count() == allocations);
+    #endif
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+}
+
+static void test_builder_canonical(void) {
+    static char buf[4096];
+    mpack_writer_t writer;
+
+    // keys are sorted and non-minimal encodings are shrunk, even within known
+    // maps and nested builds. this is the same in any build mode.
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_set_canonical(&writer, true);
+    mpack_writer_set_build_mode(&writer, mpack_build_mode_in_place);
+    mpack_write_object_bytes(&writer, "\xd0\x05", 2);
+    mpack_build_map(&writer);
+    mpack_write_cstr(&writer, "c");
+    mpack_start_map(&writer, 2);
+    mpack_write_cstr(&writer, "z");
+    mpack_write_nil(&writer);
+    mpack_write_cstr(&writer, "yy");
+    mpack_write_true(&writer);
+    mpack_finish_map(&writer);
+    mpack_write_cstr(&writer, "b");
+    mpack_build_map(&writer);
+    mpack_complete_map(&writer);
+    mpack_write_cstr(&writer, "a");
+    mpack_build_array(&writer);
+    mpack_write_object_bytes(&writer, "\xd0\x05", 2);
+    mpack_write_object_bytes(&writer, "\xd1\xff\xff", 3);
+    mpack_write_object_bytes(&writer, "\xdc\x00\x00", 3);
+    mpack_complete_array(&writer);
+    mpack_complete_map(&writer);
+    TEST_DESTROY_MATCH_IMPL(buf,
+            "\xd0\x05\x83\xa1""a\x93\x05\xff\x90\xa1""b\x80"
+            "\xa1""c\x82\xa1""z\xc0\xa2yy\xc3");
+
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_set_canonical(&writer, true);
+    mpack_build_map(&writer);
+    mpack_write_cstr(&writer, "a");
+    mpack_build_array(&writer);
+    mpack_write_u8(&writer, 5);
+    mpack_write_i8(&writer, -1);
+    mpack_start_array(&writer, 0);
+    mpack_finish_array(&writer);
+    mpack_complete_array(&writer);
+    mpack_write_cstr(&writer, "b");
+    mpack_start_map(&writer, 0);
+    mpack_finish_map(&writer);
+    mpack_write_cstr(&writer, "c");
+    mpack_build_map(&writer);
+    mpack_write_cstr(&writer, "yy");
+    mpack_write_true(&writer);
+    mpack_write_cstr(&writer, "z");
+    mpack_write_nil(&writer);
+    mpack_complete_map(&writer);
+    mpack_complete_map(&writer);
+    TEST_DESTROY_MATCH_IMPL(buf,
+            "\x83\xa1""a\x93\x05\xff\x90\xa1""b\x80"
+            "\xa1""c\x82\xa1""z\xc0\xa2yy\xc3");
+
+    #if MPACK_FLOAT && MPACK_DOUBLE
+    // doubles are narrowed to floats when exact
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_set_canonical(&writer, true);
+    mpack_build_array(&writer);
+    mpack_write_double(&writer, 1.5);
+    mpack_write_double(&writer, 0.1);
+    mpack_write_float(&writer, 0.1f);
+    mpack_complete_array(&writer);
+    TEST_DESTROY_MATCH_IMPL(buf, "\x93\xca\x3f\xc0\x00\x00"
+            "\xcb\x3f\xb9\x99\x99\x99\x99\x99\x9a\xca\x3d\xcc\xcc\xcd");
+    #endif
+
+    // a large map written in reverse order spans pages and needs sorting
+    static char sorted[16384];
+    mpack_writer_init(&writer, sorted, sizeof(sorted));
+    mpack_start_map(&writer, 300);
+    int i;
+    for (i = 0; i < 300; ++i) {
+        mpack_write_int(&writer, i);
+        mpack_write_cstr(&writer, "a value of some length");
+    }
+    mpack_finish_map(&writer);
+    size_t size = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    static char large[16384];
+    mpack_writer_init(&writer, large, sizeof(large));
+    mpack_writer_set_canonical(&writer, true);
+    mpack_build_map(&writer);
+    for (i = 299; i >= 0; --i) {
+        mpack_write_int(&writer, i);
+        mpack_write_cstr(&writer, "a value of some length");
+    }
+    mpack_complete_map(&writer);
+    TEST_TRUE(mpack_writer_buffer_used(&writer) == size);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(0 == memcmp(large, sorted, size));
+
+    // deeply nested contents are re-encoded without recursion
+    #define TEST_CANONICAL_DEPTH 20000
+    static char deep[TEST_CANONICAL_DEPTH * 2 + 16];
+    mpack_writer_init(&writer, deep, sizeof(deep));
+    mpack_writer_set_canonical(&writer, true);
+    mpack_build_map(&writer);
+    mpack_write_u8(&writer, 1);
+    mpack_write_nil(&writer);
+    mpack_write_u8(&writer, 0);
+    for (i = 0; i < TEST_CANONICAL_DEPTH; ++i) {
+        mpack_start_map(&writer, 1);
+        mpack_write_u8(&writer, 0);
+    }
+    mpack_write_nil(&writer);
+    for (i = 0; i < TEST_CANONICAL_DEPTH; ++i)
+        mpack_finish_map(&writer);
+    mpack_complete_map(&writer);
+    size = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(size == TEST_CANONICAL_DEPTH * 2 + 5);
+    TEST_TRUE(0 == memcmp(deep, "\x82\x00\x81\x00", 4));
+    TEST_TRUE(0 == memcmp(deep + size - 4, "\x00\xc0\x01\xc0", 4));
+    #undef TEST_CANONICAL_DEPTH
+
+    #if MPACK_COMPATIBILITY
+    // v4 has no str8 or bin, so canonical builds avoid them as well
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_set_version(&writer, mpack_version_v4);
+    mpack_writer_set_canonical(&writer, true);
+    mpack_build_array(&writer);
+    mpack_write_str(&writer, "0123456789012345678901234567890123456789", 40);
+    mpack_write_bin(&writer, "abc", 3);
+    mpack_complete_array(&writer);
+    TEST_DESTROY_MATCH_IMPL(buf, "\x92\xda\x00\x28"
+            "0123456789012345678901234567890123456789\xa3""abc");
+    #endif
+
+    // keys that are equal once canonicalized are duplicates
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_set_canonical(&writer, true);
+    mpack_build_map(&writer);
+    mpack_write_u8(&writer, 1);
+    mpack_write_nil(&writer);
+    mpack_write_object_bytes(&writer, "\xd0\x01", 2);
+    mpack_write_nil(&writer);
+    mpack_complete_map(&writer);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_invalid);
+
+    // canonical builds can't be toggled during a build
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_build_array(&writer);
+    TEST_BREAK((mpack_writer_set_canonical(&writer, true), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+}
+
 void test_builder(void) {
     test_builder_basic();
     test_builder_repeat();
@@ -428,5 +707,8 @@ void test_builder(void) {
     test_builder_content();
     test_builder_strings();
     test_builder_resolve_error();
+    test_builder_in_place();
+    test_builder_reset();
+    test_builder_canonical();
 }
 #endif
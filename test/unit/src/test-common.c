@@ -444,6 +444,45 @@ static void test_utf8_check(void) {
     TEST_TRUE(false == mpack_utf8_check(EXPAND_STR_ARGS("test\xFF""testtesttest")));
 }
 
+static void test_utf8_check_long(void) {
+    // long strings are checked several bytes at a time. we place invalid
+    // bytes and NUL at every offset to test word boundaries.
+    char str[40];
+    mpack_memset(str, 'a', sizeof(str));
+
+    TEST_TRUE(true == mpack_utf8_check(str, sizeof(str)));
+    TEST_TRUE(true == mpack_utf8_check_no_null(str, sizeof(str)));
+    TEST_TRUE(true == mpack_str_check_no_null(str, sizeof(str)));
+
+    size_t i;
+    for (i = 0; i < sizeof(str); ++i) {
+        str[i] = '\0';
+        TEST_TRUE(true == mpack_utf8_check(str, sizeof(str)));
+        TEST_TRUE(false == mpack_utf8_check_no_null(str, sizeof(str)));
+        TEST_TRUE(false == mpack_str_check_no_null(str, sizeof(str)));
+        TEST_TRUE(true == mpack_str_check_no_null(str, i));
+
+        str[i] = (char)0x80;
+        TEST_TRUE(false == mpack_utf8_check(str, sizeof(str)));
+        TEST_TRUE(false == mpack_utf8_check_no_null(str, sizeof(str)));
+        TEST_TRUE(true == mpack_str_check_no_null(str, sizeof(str)));
+        TEST_TRUE(true == mpack_utf8_check(str, i));
+
+        str[i] = 'a';
+    }
+
+    // multibyte sequences straddling word boundaries
+    for (i = 0; i + 4 <= sizeof(str); ++i) {
+        str[i] = (char)0xF0;
+        str[i + 1] = (char)0x9F;
+        str[i + 2] = (char)0x98;
+        str[i + 3] = (char)0x80;
+        TEST_TRUE(true == mpack_utf8_check_no_null(str, sizeof(str)));
+        TEST_TRUE(false == mpack_utf8_check(str, i + 3)); // truncated
+        mpack_memset(str + i, 'a', 4);
+    }
+}
+
 static void test_shorten_raw_double_to_float(void) {
     #if MPACK_FLOAT && !MPACK_DOUBLE && !defined(__AVR__)
     TEST_DOUBLE doubles[] = {
@@ -491,6 +530,357 @@ static void test_shorten_raw_double_to_float(void) {
     #endif
 }
 
+static void test_scan_elements(void) {
+    #define TEST_SCAN(data, count, size) do { \
+        mpack_error_t error = mpack_ok; \
+        TEST_TRUE((size) == mpack_scan_elements(data, sizeof(data) - 1, count, &error)); \
+        TEST_TRUE(error == mpack_ok); \
+    } while (0)
+    #define TEST_SCAN_ERROR(data, count) do { \
+        mpack_error_t error = mpack_ok; \
+        TEST_TRUE(0 == mpack_scan_elements(data, sizeof(data) - 1, count, &error)); \
+        TEST_TRUE(error == mpack_error_invalid); \
+    } while (0)
+
+    TEST_SCAN("", 0, 0);
+    TEST_SCAN("\x01\x02", 0, 0);
+    TEST_SCAN("\x01\x02", 1, 1);
+    TEST_SCAN("\x01\x02", 2, 2);
+    TEST_SCAN("\xc0\xc2\xc3\xe0\x7f", 5, 5);
+    TEST_SCAN("\xcc\x01\xcd\x00\x01\xce\x00\x00\x00\x01", 3, 10);
+    TEST_SCAN("\xd3\x00\x00\x00\x00\x00\x00\x00\x01", 1, 9);
+    TEST_SCAN("\xca\x00\x00\x00\x00\xcb\x00\x00\x00\x00\x00\x00\x00\x00", 2, 14);
+    TEST_SCAN("\xa3""abc\xd9\x01""a\xda\x00\x01""a\xdb\x00\x00\x00\x01""a", 4, 17);
+    TEST_SCAN("\xc4\x01""a\xc5\x00\x01""a\xc6\x00\x00\x00\x01""a", 3, 13);
+    #if MPACK_EXTENSIONS
+    TEST_SCAN("\xd4\x01\x00\xd5\x01\x00\x00\xc7\x01\x01\x00", 3, 11);
+    TEST_SCAN("\xd7\xff\x00\x00\x00\x00\x00\x00\x00\x00", 1, 10);
+    #else
+    do {
+        mpack_error_t error = mpack_ok;
+        TEST_TRUE(0 == mpack_scan_elements("\xd4\x01\x00", 3, 1, &error));
+        TEST_TRUE(error == mpack_error_unsupported);
+    } while (0);
+    #endif
+
+    // compound types are skipped with all their children
+    TEST_SCAN("\x90\x80", 2, 2);
+    TEST_SCAN("\x92\x01\x91\x02\x03", 1, 4);
+    TEST_SCAN("\x82\x01\x92\x02\x03\xa1""a\x81\x04\x05\x06", 1, 10);
+    TEST_SCAN("\xdc\x00\x02\x01\x02\xde\x00\x01\x03\x04", 2, 10);
+    TEST_SCAN("\x91\x91\x91\x91\x91\x91\x91\x91\xc0", 1, 9);
+
+    // truncated or invalid data
+    TEST_SCAN_ERROR("", 1);
+    TEST_SCAN_ERROR("\x01", 2);
+    TEST_SCAN_ERROR("\xc1", 1);
+    TEST_SCAN_ERROR("\xcd\x00", 1);
+    TEST_SCAN_ERROR("\xa3""ab", 1);
+    #if MPACK_EXTENSIONS
+    TEST_SCAN_ERROR("\xd6\x01\x00\x00", 1);
+    #endif
+    TEST_SCAN_ERROR("\x92\x01", 1);
+    TEST_SCAN_ERROR("\x81\x01", 1);
+    TEST_SCAN_ERROR("\xdd\xff\xff\xff\xff\x00", 1);
+    TEST_SCAN_ERROR("\xdb\xff\xff\xff\xff\x00", 1);
+
+    #undef TEST_SCAN
+    #undef TEST_SCAN_ERROR
+}
+
+static void test_tag_encoding(void) {
+    // every first byte decodes to the size in the table
+    char data[MPACK_MAXIMUM_TAG_SIZE];
+    mpack_memset(data, 0, sizeof(data));
+    int i;
+    for (i = 0; i < 256; ++i) {
+        data[0] = (char)i;
+        mpack_tag_t tag = mpack_tag_nil();
+        size_t size = mpack_decode_tag_size(data[0]);
+        TEST_TRUE(size <= MPACK_MAXIMUM_TAG_SIZE);
+        TEST_TRUE(mpack_decode_tag(data, &tag) == size);
+    }
+    TEST_TRUE(mpack_decode_tag_size((char)0xc1) == 0);
+    #if !MPACK_EXTENSIONS
+    TEST_TRUE(mpack_decode_tag_size((char)0xc7) == 0);
+    TEST_TRUE(mpack_decode_tag_size((char)0xd4) == 0);
+    #endif
+
+    // tags round-trip in their smallest encoding
+    #define TEST_TAG_ROUND_TRIP(value, expected_size) do { \
+        mpack_tag_t tag = (value), decoded = mpack_tag_nil(); \
+        char buffer[MPACK_MAXIMUM_TAG_SIZE]; \
+        size_t size = mpack_encode_tag(buffer, tag); \
+        TEST_TRUE(size == (expected_size), "%i", (int)size); \
+        TEST_TRUE(mpack_decode_tag_size(buffer[0]) == size); \
+        TEST_TRUE(mpack_decode_tag(buffer, &decoded) == size); \
+        TEST_TRUE(mpack_tag_equal(tag, decoded)); \
+    } while (0)
+
+    TEST_TAG_ROUND_TRIP(mpack_tag_nil(), 1);
+    TEST_TAG_ROUND_TRIP(mpack_tag_true(), 1);
+    TEST_TAG_ROUND_TRIP(mpack_tag_false(), 1);
+    TEST_TAG_ROUND_TRIP(mpack_tag_uint(127), 1);
+    TEST_TAG_ROUND_TRIP(mpack_tag_uint(128), 2);
+    TEST_TAG_ROUND_TRIP(mpack_tag_uint(MPACK_UINT16_MAX), 3);
+    TEST_TAG_ROUND_TRIP(mpack_tag_uint(MPACK_UINT32_MAX), 5);
+    TEST_TAG_ROUND_TRIP(mpack_tag_uint(MPACK_UINT64_MAX), 9);
+    TEST_TAG_ROUND_TRIP(mpack_tag_int(-32), 1);
+    TEST_TAG_ROUND_TRIP(mpack_tag_int(-33), 2);
+    TEST_TAG_ROUND_TRIP(mpack_tag_int(MPACK_INT16_MIN), 3);
+    TEST_TAG_ROUND_TRIP(mpack_tag_int(MPACK_INT32_MIN), 5);
+    TEST_TAG_ROUND_TRIP(mpack_tag_int(MPACK_INT64_MIN), 9);
+    #if MPACK_FLOAT
+    TEST_TAG_ROUND_TRIP(mpack_tag_float(1.5f), 5);
+    #endif
+    #if MPACK_DOUBLE
+    TEST_TAG_ROUND_TRIP(mpack_tag_double(-2.25), 9);
+    #endif
+    TEST_TAG_ROUND_TRIP(mpack_tag_make_str(31), 1);
+    TEST_TAG_ROUND_TRIP(mpack_tag_make_str(32), 2);
+    TEST_TAG_ROUND_TRIP(mpack_tag_make_str(MPACK_UINT16_MAX), 3);
+    TEST_TAG_ROUND_TRIP(mpack_tag_make_str(MPACK_UINT32_MAX), 5);
+    TEST_TAG_ROUND_TRIP(mpack_tag_make_bin(0), 2);
+    TEST_TAG_ROUND_TRIP(mpack_tag_make_bin(256), 3);
+    TEST_TAG_ROUND_TRIP(mpack_tag_make_bin(MPACK_UINT16_MAX + 1), 5);
+    TEST_TAG_ROUND_TRIP(mpack_tag_make_array(15), 1);
+    TEST_TAG_ROUND_TRIP(mpack_tag_make_array(16), 3);
+    TEST_TAG_ROUND_TRIP(mpack_tag_make_array(MPACK_UINT16_MAX + 1), 5);
+    TEST_TAG_ROUND_TRIP(mpack_tag_make_map(0), 1);
+    TEST_TAG_ROUND_TRIP(mpack_tag_make_map(MPACK_UINT16_MAX), 3);
+    TEST_TAG_ROUND_TRIP(mpack_tag_make_map(MPACK_UINT32_MAX), 5);
+    #if MPACK_EXTENSIONS
+    TEST_TAG_ROUND_TRIP(mpack_tag_make_ext(1, 1), 2);
+    TEST_TAG_ROUND_TRIP(mpack_tag_make_ext(-1, 16), 2);
+    TEST_TAG_ROUND_TRIP(mpack_tag_make_ext(2, 0), 3);
+    TEST_TAG_ROUND_TRIP(mpack_tag_make_ext(3, 3), 3);
+    TEST_TAG_ROUND_TRIP(mpack_tag_make_ext(4, 256), 4);
+    TEST_TAG_ROUND_TRIP(mpack_tag_make_ext(-128, MPACK_UINT16_MAX + 1), 6);
+    #endif
+
+    #undef TEST_TAG_ROUND_TRIP
+
+    TEST_TRUE(mpack_encode_tag(data, mpack_tag_make_nil()) == 1);
+    mpack_tag_t missing = MPACK_TAG_ZERO;
+    TEST_TRUE(mpack_encode_tag(data, missing) == 0);
+}
+
+#ifdef MPACK_MALLOC
+static void test_arena(void) {
+    mpack_arena_t arena;
+    mpack_arena_init(&arena);
+
+    // allocations are aligned and carved out of one chunk
+    char* a = (char*)mpack_arena_alloc(&arena, 1);
+    char* b = (char*)mpack_arena_alloc(&arena, 3);
+    TEST_TRUE(a != NULL && b != NULL && a != b);
+    TEST_TRUE((uintptr_t)b % sizeof(uint64_t) == 0);
+    size_t total = test_malloc_total_count();
+    char* c = (char*)mpack_arena_alloc(&arena, 100);
+    TEST_TRUE(c != NULL && test_malloc_total_count() == total);
+
+    // rewinding releases only the allocations after the mark
+    mpack_arena_mark_t mark = mpack_arena_mark(&arena);
+    char* d = (char*)mpack_arena_alloc(&arena, MPACK_ARENA_CHUNK_SIZE / 2);
+    char* e = (char*)mpack_arena_alloc(&arena, MPACK_ARENA_CHUNK_SIZE / 2);
+    TEST_TRUE(d != NULL && e != NULL);
+    mpack_arena_rewind(&arena, mark);
+    TEST_TRUE(d == (char*)mpack_arena_alloc(&arena, MPACK_ARENA_CHUNK_SIZE / 2));
+
+    // an oversized allocation gets its own chunk
+    char* big = (char*)mpack_arena_alloc(&arena, MPACK_ARENA_CHUNK_SIZE * 2);
+    TEST_TRUE(big != NULL);
+    mpack_memset(big, 0, MPACK_ARENA_CHUNK_SIZE * 2);
+
+    // after a reset, chunks are reused without allocating
+    mpack_arena_reset(&arena);
+    total = test_malloc_total_count();
+    TEST_TRUE(a == (char*)mpack_arena_alloc(&arena, 1));
+    TEST_TRUE(NULL != mpack_arena_alloc(&arena, MPACK_ARENA_CHUNK_SIZE / 2));
+    TEST_TRUE(NULL != mpack_arena_alloc(&arena, MPACK_ARENA_CHUNK_SIZE / 2));
+    TEST_TRUE(test_malloc_total_count() == total);
+
+    // the allocator resizes and frees the most recent allocation in place
+    mpack_arena_reset(&arena);
+    mpack_allocator_t allocator = mpack_arena_allocator(&arena);
+    char* p = (char*)allocator.allocate(allocator.context, 4);
+    TEST_TRUE(p != NULL);
+    mpack_memcpy(p, "abcd", 4);
+    TEST_TRUE(p == (char*)allocator.reallocate(allocator.context, p, 4, 64));
+    char* q = (char*)allocator.allocate(allocator.context, 4);
+    TEST_TRUE(q != NULL && q != p);
+    char* r = (char*)allocator.reallocate(allocator.context, p, 4, 128);
+    TEST_TRUE(r != NULL && r != p && mpack_memcmp(r, "abcd", 4) == 0);
+    allocator.release(allocator.context, r);
+    TEST_TRUE(r == (char*)allocator.allocate(allocator.context, 4));
+    allocator.release(allocator.context, q);
+    TEST_TRUE(r != (char*)allocator.allocate(allocator.context, 4));
+
+    mpack_arena_destroy(&arena);
+    TEST_TRUE(test_malloc_active_count() == 0);
+}
+
+static void test_enum_matcher(void) {
+    // many strings of the same length that differ only in their last chars
+    #define TEST_ENUM_COUNT 150
+    static char names[TEST_ENUM_COUNT][10];
+    static const char* strings[TEST_ENUM_COUNT + 1];
+    size_t i;
+    for (i = 0; i < TEST_ENUM_COUNT; ++i) {
+        mpack_memcpy(names[i], "event_", 6);
+        names[i][6] = (char)('0' + i / 100);
+        names[i][7] = (char)('0' + (i / 10) % 10);
+        names[i][8] = (char)('0' + i % 10);
+        names[i][9] = '\0';
+        strings[i] = names[i];
+    }
+    strings[TEST_ENUM_COUNT] = names[7]; // duplicate
+
+    mpack_enum_matcher_t matcher;
+    TEST_TRUE(mpack_enum_matcher_init(&matcher, strings, TEST_ENUM_COUNT + 1) == mpack_ok);
+    for (i = 0; i < TEST_ENUM_COUNT; ++i)
+        TEST_TRUE(mpack_enum_matcher_find(&matcher, names[i], 9) == i);
+    TEST_TRUE(mpack_enum_matcher_find(&matcher, "event_150", 9) == TEST_ENUM_COUNT + 1);
+    TEST_TRUE(mpack_enum_matcher_find(&matcher, "event_00", 8) == TEST_ENUM_COUNT + 1);
+    TEST_TRUE(mpack_enum_matcher_find(&matcher, "event_0000", 10) == TEST_ENUM_COUNT + 1);
+    TEST_TRUE(mpack_enum_matcher_find(&matcher, "", 0) == TEST_ENUM_COUNT + 1);
+    mpack_enum_matcher_destroy(&matcher);
+    #undef TEST_ENUM_COUNT
+
+    // an empty string and an empty table
+    static const char* empty[] = {"a", ""};
+    TEST_TRUE(mpack_enum_matcher_init(&matcher, empty, 2) == mpack_ok);
+    TEST_TRUE(mpack_enum_matcher_find(&matcher, "", 0) == 1);
+    mpack_enum_matcher_destroy(&matcher);
+    TEST_TRUE(mpack_enum_matcher_init(&matcher, empty, 0) == mpack_ok);
+    TEST_TRUE(mpack_enum_matcher_find(&matcher, "a", 1) == 0);
+    mpack_enum_matcher_destroy(&matcher);
+
+    TEST_BREAK(mpack_enum_matcher_init(&matcher, empty, (size_t)MPACK_UINT16_MAX + 1) == mpack_error_bug);
+    TEST_TRUE(test_malloc_active_count() == 0);
+}
+
+static bool test_enum_matcher_memory(void) {
+    // a large table with a custom allocator. every allocation goes through
+    // the allocator and is freed on error and on destroy.
+    #define TEST_ENUM_COUNT 3000
+    static char names[TEST_ENUM_COUNT][8];
+    static const char* strings[TEST_ENUM_COUNT];
+    size_t i;
+    for (i = 0; i < TEST_ENUM_COUNT; ++i) {
+        names[i][0] = 'e';
+        names[i][1] = (char)('0' + i / 1000);
+        names[i][2] = (char)('0' + (i / 100) % 10);
+        names[i][3] = (char)('0' + (i / 10) % 10);
+        names[i][4] = (char)('0' + i % 10);
+        names[i][5] = '\0';
+        strings[i] = names[i];
+    }
+
+    mpack_allocator_t allocator;
+    size_t active;
+    test_allocator_init(&allocator, &active);
+    size_t base = test_malloc_active_count();
+
+    mpack_enum_matcher_t matcher;
+    mpack_error_t error = mpack_enum_matcher_init_allocator(&matcher, strings, TEST_ENUM_COUNT, &allocator);
+    TEST_TRUE(test_malloc_active_count() == base + active);
+    if (error == mpack_error_memory) {
+        TEST_TRUE(active == 0);
+        return false;
+    }
+    TEST_TRUE(error == mpack_ok);
+    TEST_TRUE(active > 0);
+    for (i = 0; i < TEST_ENUM_COUNT; ++i)
+        TEST_TRUE(mpack_enum_matcher_find(&matcher, names[i], 5) == i);
+    TEST_TRUE(mpack_enum_matcher_find(&matcher, "e3000", 5) == TEST_ENUM_COUNT);
+    mpack_enum_matcher_destroy(&matcher);
+    TEST_TRUE(active == 0);
+    #undef TEST_ENUM_COUNT
+    return true;
+}
+
+typedef struct test_frame_stream_t {
+    const char* data;
+    size_t length;
+    size_t pos;
+    size_t step;
+} test_frame_stream_t;
+
+static size_t test_frame_read(void* context, char* buffer, size_t count) {
+    test_frame_stream_t* stream = (test_frame_stream_t*)context;
+    size_t left = stream->length - stream->pos;
+    if (count > left)
+        count = left;
+    if (count > stream->step)
+        count = stream->step;
+    mpack_memcpy(buffer, stream->data + stream->pos, count);
+    stream->pos += count;
+    return count;
+}
+
+static void* test_frame_allocate_fail(void* context, size_t size) {
+    MPACK_UNUSED(context);
+    MPACK_UNUSED(size);
+    return NULL;
+}
+
+static void test_read_frame_step(size_t step) {
+    static const char frames[] = "\x00\x00\x00\x03\x92\x01\x02" "\x00\x00\x00\x01\xc0";
+    test_frame_stream_t stream = {frames, sizeof(frames) - 1, 0, step};
+    char* data;
+    size_t size;
+
+    // each frame is read into a buffer of exactly its size
+    TEST_TRUE(mpack_read_frame(&test_frame_read, &stream, 100, NULL, &data, &size) == mpack_ok);
+    TEST_TRUE(size == 3 && mpack_memcmp(data, "\x92\x01\x02", 3) == 0);
+    TEST_TRUE(stream.pos == 7);
+    MPACK_FREE(data);
+
+    mpack_arena_t arena;
+    mpack_arena_init(&arena);
+    mpack_allocator_t allocator = mpack_arena_allocator(&arena);
+    TEST_TRUE(mpack_read_frame(&test_frame_read, &stream, 100, &allocator, &data, &size) == mpack_ok);
+    TEST_TRUE(size == 1 && data[0] == '\xc0');
+    mpack_arena_destroy(&arena);
+
+    // the end of the stream between frames
+    TEST_TRUE(mpack_read_frame(&test_frame_read, &stream, 100, NULL, &data, &size) == mpack_error_eof);
+    TEST_TRUE(data == NULL && size == 0);
+}
+
+static void test_read_frame(void) {
+    test_read_frame_step(1);
+    test_read_frame_step(3);
+    test_read_frame_step(4096);
+
+    char* data;
+    size_t size;
+    #define TEST_READ_FRAME_ERROR(bytes, error) do { \
+        test_frame_stream_t stream = {bytes, sizeof(bytes) - 1, 0, 4096}; \
+        TEST_TRUE(mpack_read_frame(&test_frame_read, &stream, 100, NULL, &data, &size) == error); \
+        TEST_TRUE(data == NULL && size == 0); \
+    } while (0)
+
+    // truncated header or contents
+    TEST_READ_FRAME_ERROR("\x00\x00", mpack_error_io);
+    TEST_READ_FRAME_ERROR("\x00\x00\x00\x02\xc0", mpack_error_io);
+
+    // empty and oversized frames
+    TEST_READ_FRAME_ERROR("\x00\x00\x00\x00\xc0", mpack_error_invalid);
+    TEST_READ_FRAME_ERROR("\x00\x00\x00\x65", mpack_error_too_big);
+    TEST_READ_FRAME_ERROR("\xff\xff\xff\xff", mpack_error_too_big);
+    #undef TEST_READ_FRAME_ERROR
+
+    // out of memory
+    test_frame_stream_t stream = {"\x00\x00\x00\x01\xc0", 5, 0, 4096};
+    mpack_allocator_t allocator = {&test_frame_allocate_fail, NULL, NULL, NULL};
+    TEST_TRUE(mpack_read_frame(&test_frame_read, &stream, 100, &allocator, &data, &size) == mpack_error_memory);
+    TEST_TRUE(data == NULL && size == 0);
+    TEST_TRUE(test_malloc_active_count() == 0);
+}
+#endif
+
 void test_common() {
     test_tags_special();
     test_tags_simple();
@@ -499,6 +889,15 @@ void test_common() {
 
     test_strings();
     test_utf8_check();
+    test_utf8_check_long();
+    test_scan_elements();
+    test_tag_encoding();
     test_shorten_raw_double_to_float();
+    #ifdef MPACK_MALLOC
+    test_arena();
+    test_enum_matcher();
+    test_system_fail_until_ok(&test_enum_matcher_memory);
+    test_read_frame();
+    #endif
 }
 
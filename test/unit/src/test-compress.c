@@ -0,0 +1,394 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test-compress.h"
+#include "test-reader.h"
+#include "test-write.h"
+#include "test-node.h"
+
+#if MPACK_COMPRESS
+
+// the tests compress with a writer and decompress with a reader or tree
+#if MPACK_WRITER && (MPACK_READER || MPACK_NODE)
+
+/*
+ * A simple block codec for testing. Each block is a length byte followed by
+ * that many bytes of data, and a frame ends with a zero length byte. A length
+ * of 0xff is invalid.
+ */
+
+static mpack_codec_status_t test_block_compress(void* context, mpack_codec_io_t* io, bool end) {
+    MPACK_UNUSED(context);
+    while (io->in != io->in_end && io->out_end - io->out >= 2) {
+        size_t count = (size_t)(io->in_end - io->in);
+        size_t space = (size_t)(io->out_end - io->out) - 1;
+        if (count > space)
+            count = space;
+        if (count > 0xfe)
+            count = 0xfe;
+        *io->out++ = (char)count;
+        mpack_memcpy(io->out, io->in, count);
+        io->out += count;
+        io->in += count;
+    }
+
+    if (!end || io->in != io->in_end || io->out == io->out_end)
+        return mpack_codec_more;
+    *io->out++ = 0;
+    return mpack_codec_frame_end;
+}
+
+static mpack_codec_status_t test_block_decompress(void* context, mpack_codec_io_t* io, bool end) {
+    size_t* left = (size_t*)context; // bytes left in the current block
+    MPACK_UNUSED(end);
+
+    while (io->in != io->in_end) {
+        if (*left == 0) {
+            uint8_t length = (uint8_t)*io->in++;
+            if (length == 0xff)
+                return mpack_codec_failed;
+            if (length == 0)
+                return mpack_codec_frame_end;
+            *left = length;
+            continue;
+        }
+
+        if (io->out == io->out_end)
+            break;
+        size_t count = *left;
+        if (count > (size_t)(io->in_end - io->in))
+            count = (size_t)(io->in_end - io->in);
+        if (count > (size_t)(io->out_end - io->out))
+            count = (size_t)(io->out_end - io->out);
+        mpack_memcpy(io->out, io->in, count);
+        io->out += count;
+        io->in += count;
+        *left -= count;
+    }
+
+    return mpack_codec_more;
+}
+
+typedef struct test_compress_sink_t {
+    char data[2048];
+    size_t used;
+    bool fail;
+} test_compress_sink_t;
+
+static bool test_compress_output(void* context, const char* data, size_t size) {
+    test_compress_sink_t* sink = (test_compress_sink_t*)context;
+    if (sink->fail || size > sizeof(sink->data) - sink->used)
+        return false;
+    mpack_memcpy(sink->data + sink->used, data, size);
+    sink->used += size;
+    return true;
+}
+
+typedef struct test_compress_source_t {
+    const char* data;
+    size_t length;
+    size_t pos;
+    size_t step;
+} test_compress_source_t;
+
+static size_t test_compress_input(void* context, char* buffer, size_t count) {
+    test_compress_source_t* source = (test_compress_source_t*)context;
+    size_t left = source->length - source->pos;
+    if (count > left)
+        count = left;
+    if (count > source->step)
+        count = source->step;
+    mpack_memcpy(buffer, source->data + source->pos, count);
+    source->pos += count;
+    return count;
+}
+
+#define TEST_COMPRESS_MESSAGES 3
+#define TEST_COMPRESS_BIN_SIZE 200
+
+// Writes a test message. Its bin is larger than the writer's buffer so that
+// it is flushed directly to the compressor.
+static void test_compress_write_message(mpack_writer_t* writer, int index) {
+    char bin[TEST_COMPRESS_BIN_SIZE];
+    size_t i;
+    for (i = 0; i < sizeof(bin); ++i)
+        bin[i] = (char)(i * 7 + (size_t)index);
+
+    mpack_start_map(writer, 3);
+    mpack_write_cstr(writer, "index");
+    mpack_write_int(writer, index);
+    mpack_write_cstr(writer, "name");
+    mpack_write_cstr(writer, "compressed");
+    mpack_write_cstr(writer, "data");
+    mpack_write_bin(writer, bin, (uint32_t)sizeof(bin));
+    mpack_finish_map(writer);
+}
+
+// Writes the test messages without compression for comparison.
+static size_t test_compress_plain(char* data, size_t size, int first, int count) {
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, data, size);
+    int i;
+    for (i = first; i < first + count; ++i)
+        test_compress_write_message(&writer, i);
+    size_t used = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    return used;
+}
+
+// Compresses the test messages into the sink, ending a frame after each
+// message in framed mode.
+static mpack_error_t test_compress_messages(test_compress_sink_t* sink, bool framed, size_t size) {
+    char compressed[512];
+    char buffer[64];
+    mpack_assert(size <= sizeof(compressed));
+
+    mpack_compressor_t compressor;
+    mpack_compressor_init(&compressor, test_block_compress, NULL, compressed, size,
+            test_compress_output, sink);
+    mpack_compressor_set_framed(&compressor, framed);
+
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_writer_set_compressor(&writer, &compressor);
+
+    int i;
+    for (i = 0; i < TEST_COMPRESS_MESSAGES; ++i) {
+        test_compress_write_message(&writer, i);
+        if (framed) {
+            mpack_writer_end_compressed_frame(&writer);
+            // this does nothing since the frame is empty
+            mpack_writer_end_compressed_frame(&writer);
+        }
+    }
+    return mpack_writer_destroy(&writer);
+}
+
+static void test_compress_stream(void) {
+    char expected[1024];
+    size_t expected_size = test_compress_plain(expected, sizeof(expected), 0, TEST_COMPRESS_MESSAGES);
+
+    // a compressed buffer smaller than a message is written out many times
+    test_compress_sink_t sink;
+    sink.used = 0;
+    sink.fail = false;
+    TEST_TRUE(test_compress_messages(&sink, false, 16) == mpack_ok);
+    TEST_TRUE(sink.used > expected_size);
+
+    test_compress_source_t source = {sink.data, sink.used, 0, 3};
+    char buffer[8];
+    size_t left = 0;
+    mpack_decompressor_t decompressor;
+    mpack_decompressor_init(&decompressor, test_block_decompress, &left, buffer, sizeof(buffer),
+            test_compress_input, &source);
+
+    char output[1024];
+    size_t used = 0;
+    size_t count;
+    while ((count = mpack_decompressor_read(&decompressor, output + used, 5)) > 0)
+        used += count;
+    TEST_TRUE(mpack_decompressor_error(&decompressor) == mpack_ok);
+    TEST_TRUE(used == expected_size && memcmp(output, expected, used) == 0);
+}
+
+#if MPACK_READER
+static void test_compress_reader(void) {
+    test_compress_sink_t sink;
+    sink.used = 0;
+    sink.fail = false;
+    TEST_TRUE(test_compress_messages(&sink, false, 16) == mpack_ok);
+
+    test_compress_source_t source = {sink.data, sink.used, 0, 5};
+    char compressed[16];
+    size_t left = 0;
+    mpack_decompressor_t decompressor;
+    mpack_decompressor_init(&decompressor, test_block_decompress, &left, compressed, sizeof(compressed),
+            test_compress_input, &source);
+
+    char buffer[MPACK_READER_MINIMUM_BUFFER_SIZE];
+    mpack_reader_t reader;
+    mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+    mpack_reader_set_decompressor(&reader, &decompressor);
+
+    // the bins are larger than the reader's buffer so they are skipped by
+    // decompressing through it
+    int i;
+    for (i = 0; i < TEST_COMPRESS_MESSAGES; ++i) {
+        TEST_TRUE(mpack_tag_equal(mpack_read_tag(&reader), mpack_tag_make_map(3)));
+        mpack_discard(&reader);
+        TEST_TRUE(mpack_tag_equal(mpack_read_tag(&reader), mpack_tag_make_uint((uint64_t)i)));
+        mpack_discard(&reader);
+        mpack_discard(&reader);
+        mpack_discard(&reader);
+        mpack_discard(&reader);
+        mpack_done_map(&reader);
+    }
+    TEST_READER_DESTROY_NOERROR(&reader);
+
+    // corrupt data is flagged on the reader
+    mpack_decompressor_init_data(&decompressor, test_block_decompress, &left, "\x01\x90\xff", 3);
+    mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+    mpack_reader_set_decompressor(&reader, &decompressor);
+    mpack_read_tag(&reader);
+    TEST_TRUE(mpack_reader_destroy(&reader) == mpack_error_invalid);
+}
+#endif
+
+#if MPACK_NODE && defined(MPACK_MALLOC)
+static void test_compress_check_tree(mpack_tree_t* tree) {
+    int i;
+    for (i = 0; i < TEST_COMPRESS_MESSAGES; ++i) {
+        mpack_tree_parse(tree);
+        mpack_node_t root = mpack_tree_root(tree);
+        TEST_TRUE(mpack_node_int(mpack_node_map_cstr(root, "index")) == i);
+        TEST_TRUE(mpack_node_bin_size(mpack_node_map_cstr(root, "data")) == TEST_COMPRESS_BIN_SIZE);
+    }
+    TEST_TREE_DESTROY_NOERROR(tree);
+}
+
+static void test_compress_tree(void) {
+    test_compress_sink_t sink;
+    sink.used = 0;
+    sink.fail = false;
+    TEST_TRUE(test_compress_messages(&sink, false, 16) == mpack_ok);
+
+    test_compress_source_t source = {sink.data, sink.used, 0, 7};
+    char compressed[16];
+    size_t left = 0;
+    mpack_decompressor_t decompressor;
+    mpack_decompressor_init(&decompressor, test_block_decompress, &left, compressed, sizeof(compressed),
+            test_compress_input, &source);
+
+    mpack_tree_t tree;
+    mpack_tree_init_decompressor(&tree, &decompressor, 1024, 16);
+    test_compress_check_tree(&tree);
+}
+#endif
+
+static void test_compress_frames(void) {
+    test_compress_sink_t sink;
+    sink.used = 0;
+    sink.fail = false;
+    TEST_TRUE(test_compress_messages(&sink, true, 512) == mpack_ok);
+
+    #ifdef MPACK_MALLOC
+    // the frames can be split without decompressing them, and each can be
+    // decompressed independently
+    test_compress_source_t source = {sink.data, sink.used, 0, 11};
+    char* data;
+    size_t size;
+    int i;
+    for (i = 0; i < TEST_COMPRESS_MESSAGES; ++i) {
+        TEST_TRUE(mpack_read_frame(test_compress_input, &source, 1024, NULL, &data, &size) == mpack_ok);
+        if (data == NULL)
+            break;
+
+        size_t left = 0;
+        mpack_decompressor_t decompressor;
+        mpack_decompressor_init_data(&decompressor, test_block_decompress, &left, data, size);
+        char output[512];
+        size_t used = 0;
+        size_t count;
+        while ((count = mpack_decompressor_read(&decompressor, output + used, sizeof(output) - used)) > 0)
+            used += count;
+        TEST_TRUE(mpack_decompressor_error(&decompressor) == mpack_ok);
+        MPACK_FREE(data);
+
+        char expected[512];
+        size_t expected_size = test_compress_plain(expected, sizeof(expected), i, 1);
+        TEST_TRUE(used == expected_size && memcmp(output, expected, used) == 0);
+    }
+    TEST_TRUE(mpack_read_frame(test_compress_input, &source, 1024, NULL, &data, &size) == mpack_error_eof);
+    #endif
+
+    #if MPACK_NODE && defined(MPACK_MALLOC)
+    // the whole framed stream can also be decompressed at once
+    test_compress_source_t stream = {sink.data, sink.used, 0, 3};
+    char compressed[16];
+    size_t stream_left = 0;
+    mpack_decompressor_t stream_decompressor;
+    mpack_decompressor_init(&stream_decompressor, test_block_decompress, &stream_left,
+            compressed, sizeof(compressed), test_compress_input, &stream);
+    mpack_decompressor_set_framed(&stream_decompressor, true);
+
+    mpack_tree_t tree;
+    mpack_tree_init_decompressor(&tree, &stream_decompressor, 1024, 16);
+    test_compress_check_tree(&tree);
+    #endif
+}
+
+static mpack_error_t test_compress_read_framed(const char* data, size_t length) {
+    size_t left = 0;
+    mpack_decompressor_t decompressor;
+    mpack_decompressor_init_data(&decompressor, test_block_decompress, &left, data, length);
+    mpack_decompressor_set_framed(&decompressor, true);
+    char output[64];
+    while (mpack_decompressor_read(&decompressor, output, sizeof(output)) > 0)
+        ;
+    return mpack_decompressor_error(&decompressor);
+}
+
+static void test_compress_errors(void) {
+    test_compress_sink_t sink;
+    sink.used = 0;
+    sink.fail = false;
+
+    // a frame must fit in the compressed buffer
+    TEST_TRUE(test_compress_messages(&sink, true, 64) == mpack_error_too_big);
+
+    // a failed output is an io error
+    sink.fail = true;
+    TEST_TRUE(test_compress_messages(&sink, false, 16) == mpack_error_io);
+
+    // framed data must contain whole frames
+    TEST_TRUE(test_compress_read_framed("\x00\x00\x00\x03\x01\xc0\x00", 7) == mpack_ok);
+    TEST_TRUE(test_compress_read_framed("\x00\x00\x00\x03\x01\xc0", 6) == mpack_error_invalid);
+    TEST_TRUE(test_compress_read_framed("\x00\x00\x00\x02\x01\xc0", 6) == mpack_error_invalid);
+    TEST_TRUE(test_compress_read_framed("\x00\x00\x00\x04\x01\xc0\x00\x00", 8) == mpack_error_invalid);
+    TEST_TRUE(test_compress_read_framed("\x00\x00\x00\x03\x01\xc0\x00\x00", 8) == mpack_error_invalid);
+    TEST_TRUE(test_compress_read_framed("\x00\x00\x00\x00", 4) == mpack_error_invalid);
+
+    // ending a compressed frame requires a compressor
+    char buffer[64];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    TEST_BREAK((mpack_writer_end_compressed_frame(&writer), true));
+    TEST_TRUE(mpack_writer_destroy(&writer) == mpack_error_bug);
+}
+
+#endif
+
+void test_compress(void) {
+    #if MPACK_WRITER && (MPACK_READER || MPACK_NODE)
+    test_compress_stream();
+    #if MPACK_READER
+    test_compress_reader();
+    #endif
+    #if MPACK_NODE && defined(MPACK_MALLOC)
+    test_compress_tree();
+    #endif
+    test_compress_frames();
+    test_compress_errors();
+    #endif
+}
+
+#endif
+
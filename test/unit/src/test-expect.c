@@ -463,7 +463,6 @@ static void test_expect_misc(void) {
 
 #if MPACK_READ_TRACKING
 static void test_expect_tracking(void) {
-    char buf[4];
     mpack_reader_t reader;
 
     // tracking depth growth
@@ -495,6 +494,27 @@ static void test_expect_tracking(void) {
     TEST_BREAK((mpack_done_map(&reader), true));
     TEST_READER_DESTROY_ERROR(&reader, mpack_error_bug);
 
+    // done type once everything nested past the initial capacity is closed
+    TEST_READER_INIT_STR(&reader, "\x91\x91\x91\x91\x90");
+    int i;
+    for (i = 0; i < 5; ++i)
+        mpack_expect_array(&reader);
+    for (i = 0; i < 5; ++i)
+        mpack_done_array(&reader);
+    TEST_BREAK((mpack_done_array(&reader), true));
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_bug);
+
+    // destroying with a type left open
+    TEST_READER_INIT_STR(&reader, "\x91\x90");
+    mpack_expect_array(&reader);
+    mpack_expect_array(&reader);
+    mpack_done_array(&reader);
+    TEST_BREAK(mpack_reader_destroy(&reader) == mpack_error_bug);
+
+    // depth-only tracking doesn't check types, element counts or bytes
+    #if !MPACK_TRACKING_DEPTH_ONLY
+    char buf[4];
+
     // closing incomplete type
     TEST_READER_INIT_STR(&reader, "\x91\xc0");
     mpack_expect_array(&reader);
@@ -535,6 +555,7 @@ static void test_expect_tracking(void) {
     mpack_expect_str(&reader);
     TEST_BREAK((mpack_reader_remaining(&reader, NULL), true));
     TEST_READER_DESTROY_ERROR(&reader, mpack_error_bug);
+    #endif
 }
 #endif
 
@@ -597,6 +618,33 @@ static void test_expect_reals(void) {
     #endif
 }
 
+#if MPACK_DOUBLE && MPACK_WRITER
+// doubles written in compact form are read back exactly
+static void test_expect_compact_floats(void) {
+    static const double values[] = {0.0, -0.0, 1.0, -33.0, 65536.0, 0.5, 4294967296.0, 3.14159265, 1e300, 1e-320};
+    const uint32_t count = (uint32_t)(sizeof(values) / sizeof(*values));
+    char data[128];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, data, sizeof(data));
+    mpack_writer_set_compact_floats(&writer, true);
+    mpack_write_double_array(&writer, values, count);
+    size_t size = mpack_writer_buffer_used(&writer);
+    TEST_TRUE(mpack_writer_destroy(&writer) == mpack_ok);
+    TEST_TRUE(size < 1 + count * MPACK_TAG_SIZE_DOUBLE);
+
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, data, size);
+    TEST_TRUE(mpack_expect_array(&reader) == count);
+    uint32_t i;
+    for (i = 0; i < count; ++i) {
+        double value = mpack_expect_double(&reader);
+        TEST_TRUE(memcmp(&value, &values[i], sizeof(value)) == 0);
+    }
+    mpack_done_array(&reader);
+    TEST_READER_DESTROY_NOERROR(&reader);
+}
+#endif
+
 static void test_expect_reals_range(void) {
     mpack_reader_t reader;
     (void)reader;
@@ -729,6 +777,22 @@ static void test_expect_str(void) {
     }
     TEST_SIMPLE_READ_ERROR("\xa5he\00lo", NULL == mpack_expect_cstr_alloc(&reader, 256), mpack_error_type);
     TEST_SIMPLE_READ_ERROR("\x01", NULL == mpack_expect_cstr_alloc(&reader, 3), mpack_error_type);
+
+    // cstr alloc with a custom allocator
+    mpack_allocator_t allocator;
+    size_t active;
+    test_allocator_init(&allocator, &active);
+    TEST_READER_INIT_STR(&reader, "\xa4test\xa5he\x00lo");
+    mpack_reader_set_allocator(&reader, &allocator);
+    test = mpack_expect_cstr_alloc(&reader, 5);
+    TEST_TRUE(test != NULL && active == 1);
+    if (test) {
+        TEST_TRUE(memcmp(test, "test", 5) == 0);
+        allocator.release(allocator.context, test);
+    }
+    TEST_TRUE(NULL == mpack_expect_cstr_alloc(&reader, 256));
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_type);
+    TEST_TRUE(active == 0);
     #endif
 
     // cstr match
@@ -1271,6 +1335,119 @@ static size_t test_expect_stream_fill(mpack_reader_t* reader, char* buffer, size
     return count;
 }
 
+#ifdef MPACK_MALLOC
+static void test_expect_enum_matcher(void) {
+    mpack_reader_t reader;
+
+    typedef enum           { APPLE ,  BANANA ,  ORANGE , COUNT} fruit_t;
+    static const char* fruits[] = {"apple", "banana", "orange"};
+    mpack_enum_matcher_t matcher;
+    TEST_TRUE(mpack_enum_matcher_init(&matcher, fruits, COUNT) == mpack_ok);
+
+    TEST_SIMPLE_READ("\xa5""apple", APPLE == (fruit_t)mpack_expect_enum_matcher(&reader, &matcher));
+    TEST_SIMPLE_READ("\xa6""orange", ORANGE == (fruit_t)mpack_expect_enum_matcher(&reader, &matcher));
+    TEST_SIMPLE_READ_ERROR("\xa4""kiwi", COUNT == (fruit_t)mpack_expect_enum_matcher(&reader, &matcher), mpack_error_type);
+    TEST_SIMPLE_READ_ERROR("\x01", COUNT == (fruit_t)mpack_expect_enum_matcher(&reader, &matcher), mpack_error_type);
+
+    TEST_SIMPLE_READ("\xa6""banana", BANANA == (fruit_t)mpack_expect_enum_matcher_optional(&reader, &matcher));
+    TEST_SIMPLE_READ("\xa4""kiwi", COUNT == (fruit_t)mpack_expect_enum_matcher_optional(&reader, &matcher));
+    TEST_SIMPLE_READ("\x92\x01\x02", COUNT == (fruit_t)mpack_expect_enum_matcher_optional(&reader, &matcher));
+
+    // strings longer than any in the table are skipped, even if they don't
+    // fit in the buffer
+    char data[] = "\xd9\x28""a string longer than the reader's buffer\xa6""banana";
+    char buffer[MPACK_READER_MINIMUM_BUFFER_SIZE];
+    test_expect_stream_t context = {data, sizeof(data) - 1, 7};
+    mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+    mpack_reader_set_context(&reader, &context);
+    mpack_reader_set_fill(&reader, &test_expect_stream_fill);
+    TEST_TRUE(COUNT == (fruit_t)mpack_expect_enum_matcher_optional(&reader, &matcher));
+    TEST_TRUE(BANANA == (fruit_t)mpack_expect_enum_matcher(&reader, &matcher));
+    TEST_READER_DESTROY_NOERROR(&reader);
+
+    // keys
+    static const char keys[] = "\x84\xa5""apple\xc0\x01\xc0\xa6""orange\xc0\xa5""apple\xc0";
+    bool found[COUNT];
+    memset(found, 0, sizeof(found));
+    mpack_reader_init_data(&reader, keys, sizeof(keys) - 1);
+    TEST_TRUE(4 == mpack_expect_map(&reader));
+    TEST_TRUE(APPLE == (fruit_t)mpack_expect_key_matcher(&reader, &matcher, found));
+    mpack_expect_nil(&reader);
+    TEST_TRUE(COUNT == (fruit_t)mpack_expect_key_matcher(&reader, &matcher, found)); // unknown
+    mpack_discard(&reader);
+    TEST_TRUE(ORANGE == (fruit_t)mpack_expect_key_matcher(&reader, &matcher, found));
+    mpack_expect_nil(&reader);
+    TEST_TRUE(COUNT == (fruit_t)mpack_expect_key_matcher(&reader, &matcher, found)); // duplicate
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+    TEST_TRUE(found[APPLE] && !found[BANANA] && found[ORANGE]);
+
+    mpack_enum_matcher_destroy(&matcher);
+}
+#endif
+
+static void test_expect_typed_arrays(void) {
+    mpack_reader_t reader;
+
+    // unsigned, with each integer encoding
+    static const char u32_data[] = "\x96\x01\xcc\xff\xcd\x01\x00\xce\x00\x01\x00\x00\xd0\x05"
+            "\xcf\x00\x00\x00\x00\xff\xff\xff\xff";
+    uint32_t u32[8];
+    mpack_reader_init_data(&reader, u32_data, sizeof(u32_data) - 1);
+    TEST_TRUE(6 == mpack_expect_u32_array(&reader, u32, 8));
+    TEST_READER_DESTROY_NOERROR(&reader);
+    TEST_TRUE(u32[0] == 1 && u32[1] == 255 && u32[2] == 256 && u32[3] == 65536 && u32[4] == 5 &&
+            u32[5] == MPACK_UINT32_MAX);
+
+    // from a stream, elements straddle the buffer
+    char buffer[MPACK_READER_MINIMUM_BUFFER_SIZE];
+    char stream_data[sizeof(u32_data)];
+    memcpy(stream_data, u32_data, sizeof(u32_data));
+    test_expect_stream_t context = {stream_data, sizeof(stream_data) - 1, 3};
+    mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+    mpack_reader_set_context(&reader, &context);
+    mpack_reader_set_fill(&reader, &test_expect_stream_fill);
+    memset(u32, 0, sizeof(u32));
+    TEST_TRUE(6 == mpack_expect_u32_array(&reader, u32, 6));
+    TEST_READER_DESTROY_NOERROR(&reader);
+    TEST_TRUE(u32[0] == 1 && u32[3] == 65536 && u32[5] == MPACK_UINT32_MAX);
+
+    // errors
+    TEST_SIMPLE_READ_ERROR("\x93\x01\x02\x03", 0 == mpack_expect_u32_array(&reader, u32, 2), mpack_error_too_big);
+    TEST_SIMPLE_READ_ERROR("\x92\x01\xff", 0 == mpack_expect_u32_array(&reader, u32, 2), mpack_error_type);
+    TEST_SIMPLE_READ_ERROR("\x91\xcf\x00\x00\x00\x01\x00\x00\x00\x00", 0 == mpack_expect_u32_array(&reader, u32, 2), mpack_error_type);
+    TEST_SIMPLE_READ_ERROR("\x01", 0 == mpack_expect_u32_array(&reader, u32, 2), mpack_error_type);
+    TEST_SIMPLE_READ("\x90", 0 == mpack_expect_u32_array(&reader, u32, 0));
+
+    // signed
+    static const char i64_data[] = "\x97\x7f\xe0\xd0\x80\xd1\x80\x00\xd2\x80\x00\x00\x00"
+            "\xd3\x80\x00\x00\x00\x00\x00\x00\x00\xcf\x00\x00\x00\x00\x00\x00\x00\x02";
+    int64_t i64[7];
+    mpack_reader_init_data(&reader, i64_data, sizeof(i64_data) - 1);
+    TEST_TRUE(7 == mpack_expect_i64_array(&reader, i64, 7));
+    TEST_READER_DESTROY_NOERROR(&reader);
+    TEST_TRUE(i64[0] == 127 && i64[1] == -32 && i64[2] == -128 && i64[3] == -32768 &&
+            i64[4] == MPACK_INT32_MIN && i64[5] == MPACK_INT64_MIN && i64[6] == 2);
+    TEST_SIMPLE_READ_ERROR("\x91\xcf\xff\xff\xff\xff\xff\xff\xff\xff", 0 == mpack_expect_i64_array(&reader, i64, 1), mpack_error_type);
+
+    #if MPACK_FLOAT
+    float f[3];
+    TEST_SIMPLE_READ("\x92\xca\x3f\xc0\x00\x00\xca\xc0\x10\x00\x00",
+            2 == mpack_expect_float_array(&reader, f, 3) && f[0] == 1.5f && f[1] == -2.25f);
+    TEST_SIMPLE_READ("\x93\xca\x3f\xc0\x00\x00\x01\xca\xc0\x10\x00\x00",
+            3 == mpack_expect_float_array(&reader, f, 3) && f[0] == 1.5f && f[1] == 1.0f && f[2] == -2.25f);
+    TEST_SIMPLE_READ_ERROR("\x92\xca\x3f\xc0\x00\x00\xc0", 0 == mpack_expect_float_array(&reader, f, 3), mpack_error_type);
+    #endif
+
+    #if MPACK_DOUBLE
+    double d[3];
+    TEST_SIMPLE_READ("\x92\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00\xcb\xc0\x02\x00\x00\x00\x00\x00\x00",
+            2 == mpack_expect_double_array(&reader, d, 3) && d[0] == 1.5 && d[1] == -2.25);
+    TEST_SIMPLE_READ("\x93\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00\x01\xca\xc0\x10\x00\x00",
+            3 == mpack_expect_double_array(&reader, d, 3) && d[0] == 1.5 && d[1] == 1.0 && d[2] == -2.25);
+    TEST_SIMPLE_READ_ERROR("\x92\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00\xa0", 0 == mpack_expect_double_array(&reader, d, 3), mpack_error_type);
+    #endif
+}
+
 static void test_expect_streaming(void) {
     // We test reading from a stream of messages using a function
     // that returns a small number of bytes each time (as though
@@ -1393,6 +1570,10 @@ void test_expect() {
     test_expect_key_cstr_mixed();
     test_expect_key_cstr_duplicate();
     test_expect_key_uint();
+    #ifdef MPACK_MALLOC
+    test_expect_enum_matcher();
+    #endif
+    test_expect_typed_arrays();
 
     // other
     test_expect_misc();
@@ -1401,6 +1582,9 @@ void test_expect() {
     #endif
     test_expect_reals();
     test_expect_reals_range();
+    #if MPACK_DOUBLE && MPACK_WRITER
+    test_expect_compact_floats();
+    #endif
     test_expect_bad_type();
     test_expect_pre_error();
     test_expect_streaming();
@@ -813,6 +813,28 @@ static void test_file_node(void) {
     test_fclose(file);
 }
 
+#if MPACK_MMAP
+static void test_file_node_mmap(void) {
+    mpack_tree_t tree;
+
+    // test maximum size
+    mpack_tree_init_mmap(&tree, test_filename, 100);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_too_big);
+
+    // test blank file
+    mpack_tree_init_mmap(&tree, test_blank_filename, 0);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_invalid);
+
+    // test missing file
+    mpack_tree_init_mmap(&tree, "invalid-filename", 0);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_io);
+
+    // test successful parse
+    mpack_tree_init_mmap(&tree, test_filename, 0);
+    test_file_tree_successful_parse(&tree);
+}
+#endif
+
 typedef struct test_file_stream_t {
     size_t length;
     char* data;
@@ -1002,6 +1024,9 @@ void test_file(void) {
     #endif
     #if MPACK_NODE
     test_file_node();
+    #if MPACK_MMAP
+    test_file_node_mmap();
+    #endif
     test_file_node_stream();
     #endif
 
@@ -0,0 +1,368 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test-json.h"
+#include "test-reader.h"
+#include "test-write.h"
+
+#include <locale.h>
+
+#if MPACK_JSON
+
+static bool test_json_matches(const char* data, size_t size, const char* expected, size_t expected_size) {
+    return size == expected_size && memcmp(data, expected, size) == 0;
+}
+
+#if MPACK_READER || MPACK_NODE
+// Transcodes the given MessagePack with both a reader and a tree, checking
+// that the given error occurs and that the JSON matches (if given.)
+static void test_json_transcode(const char* data, size_t size, const char* expected, mpack_error_t expected_error) {
+    char buffer[256];
+    mpack_writer_t writer;
+    size_t used;
+
+    #if MPACK_READER
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, data, size);
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_transcode_json(&reader, &writer);
+    used = mpack_writer_buffer_used(&writer);
+    TEST_TRUE(mpack_reader_destroy(&reader) == expected_error);
+    TEST_TRUE(mpack_writer_destroy(&writer) == expected_error);
+    if (expected != NULL)
+        TEST_TRUE(test_json_matches(buffer, used, expected, strlen(expected)));
+    #endif
+
+    #if MPACK_NODE
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, data, size);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_node_transcode_json(mpack_tree_root(&tree), &writer);
+    used = mpack_writer_buffer_used(&writer);
+    TEST_TRUE(mpack_tree_destroy(&tree) == expected_error);
+    TEST_TRUE(mpack_writer_destroy(&writer) == expected_error);
+    if (expected != NULL)
+        TEST_TRUE(test_json_matches(buffer, used, expected, strlen(expected)));
+    #endif
+}
+
+#define TEST_JSON_TRANSCODE(data, json) \
+    test_json_transcode(data, sizeof(data) - 1, json, mpack_ok)
+
+#define TEST_JSON_TRANSCODE_ERROR(data, error) \
+    test_json_transcode(data, sizeof(data) - 1, NULL, error)
+
+static void test_json_transcode_scalars(void) {
+    TEST_JSON_TRANSCODE("\xc0", "null");
+    TEST_JSON_TRANSCODE("\xc3", "true");
+    TEST_JSON_TRANSCODE("\xc2", "false");
+
+    TEST_JSON_TRANSCODE("\x00", "0");
+    TEST_JSON_TRANSCODE("\x07", "7");
+    TEST_JSON_TRANSCODE("\x7f", "127");
+    TEST_JSON_TRANSCODE("\xff", "-1");
+    TEST_JSON_TRANSCODE("\xcd\x30\x39", "12345");
+    TEST_JSON_TRANSCODE("\xd1\xfc\x18", "-1000");
+    TEST_JSON_TRANSCODE("\xcf\xff\xff\xff\xff\xff\xff\xff\xff", "18446744073709551615");
+    TEST_JSON_TRANSCODE("\xd3\x80\x00\x00\x00\x00\x00\x00\x00", "-9223372036854775808");
+
+    TEST_JSON_TRANSCODE("\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00", "1.5");
+    TEST_JSON_TRANSCODE("\xcb\x3f\xb9\x99\x99\x99\x99\x99\x9a", "0.1");
+    TEST_JSON_TRANSCODE("\xcb\x40\x59\x00\x00\x00\x00\x00\x00", "100.0");
+    TEST_JSON_TRANSCODE("\xcb\x7e\x37\xe4\x3c\x88\x00\x75\x9c", "1e+300");
+    TEST_JSON_TRANSCODE("\xcb\x43\x50\x00\x00\x00\x00\x00\x00", "18014398509481984.0");
+    #if !MPACK_FINITE_MATH
+    TEST_JSON_TRANSCODE("\xcb\x7f\xf8\x00\x00\x00\x00\x00\x00", "null"); // NaN
+    TEST_JSON_TRANSCODE("\xcb\xff\xf0\x00\x00\x00\x00\x00\x00", "null"); // -infinity
+    #endif
+    TEST_JSON_TRANSCODE("\xca\xc0\x00\x00\x00", "-2.0");
+    TEST_JSON_TRANSCODE("\xca\x3d\xcc\xcc\xcd", "0.1");
+}
+
+static void test_json_transcode_strings(void) {
+    TEST_JSON_TRANSCODE("\xa0", "\"\"");
+    TEST_JSON_TRANSCODE("\xa5" "hello", "\"hello\"");
+    TEST_JSON_TRANSCODE("\xa7" "a\"b\\\n\t\x01", "\"a\\\"b\\\\\\n\\t\\u0001\"");
+    TEST_JSON_TRANSCODE("\xa2" "\x1f\x7f", "\"\\u001f\x7f\"");
+    TEST_JSON_TRANSCODE("\xa3" "\xc3\xa9/", "\"\xc3\xa9/\"");
+    TEST_JSON_TRANSCODE_ERROR("\xa1" "\xff", mpack_error_type);
+    TEST_JSON_TRANSCODE_ERROR("\xa2" "\xc3\x28", mpack_error_type);
+
+    // bin is base64-encoded
+    TEST_JSON_TRANSCODE("\xc4\x00", "\"\"");
+    TEST_JSON_TRANSCODE("\xc4\x01" "a", "\"YQ==\"");
+    TEST_JSON_TRANSCODE("\xc4\x02" "ab", "\"YWI=\"");
+    TEST_JSON_TRANSCODE("\xc4\x03" "abc", "\"YWJj\"");
+    TEST_JSON_TRANSCODE("\xc4\x04" "\xff\xfe\x00\x01", "\"//4AAQ==\"");
+
+    #if MPACK_EXTENSIONS
+    TEST_JSON_TRANSCODE_ERROR("\xd4\x01\x00", mpack_error_type);
+    #endif
+}
+
+static void test_json_transcode_compound(void) {
+    TEST_JSON_TRANSCODE("\x90", "[]");
+    TEST_JSON_TRANSCODE("\x80", "{}");
+    TEST_JSON_TRANSCODE("\x93\x01\xc0\x91\xa1" "x", "[1,null,[\"x\"]]");
+    TEST_JSON_TRANSCODE("\x82\xa1" "a\x01\x02\xc3", "{\"a\":1,\"2\":true}");
+    TEST_JSON_TRANSCODE("\x81\xff\x92\x80\x90", "{\"-1\":[{},[]]}");
+
+    // keys must be strs or integers
+    TEST_JSON_TRANSCODE_ERROR("\x81\xc3\x00", mpack_error_type);
+    TEST_JSON_TRANSCODE_ERROR("\x81\x90\x00", mpack_error_type);
+    TEST_JSON_TRANSCODE_ERROR("\x81\xc4\x00\x00", mpack_error_type);
+
+    // nesting is limited
+    char data[MPACK_JSON_MAX_DEPTH + 2];
+    mpack_memset(data, (char)0x91, MPACK_JSON_MAX_DEPTH + 1);
+    data[MPACK_JSON_MAX_DEPTH] = (char)0xc0;
+    test_json_transcode(data, MPACK_JSON_MAX_DEPTH + 1, NULL, mpack_ok);
+    data[MPACK_JSON_MAX_DEPTH] = (char)0x91;
+    data[MPACK_JSON_MAX_DEPTH + 1] = (char)0xc0;
+    test_json_transcode(data, MPACK_JSON_MAX_DEPTH + 2, NULL, mpack_error_too_big);
+}
+#endif
+
+#if MPACK_READER
+static void test_json_transcode_writer_error(void) {
+    // an error on the writer is flagged on the reader as well
+    static const char data[] = "\x92\xa5" "hello\xa5" "world";
+    char buffer[8];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, data, sizeof(data) - 1);
+    mpack_transcode_json(&reader, &writer);
+    TEST_TRUE(mpack_reader_destroy(&reader) == mpack_error_too_big);
+    TEST_TRUE(mpack_writer_destroy(&writer) == mpack_error_too_big);
+}
+
+typedef struct test_json_stream_t {
+    const char* data;
+    size_t left;
+} test_json_stream_t;
+
+static size_t test_json_stream_fill(mpack_reader_t* reader, char* buffer, size_t count) {
+    test_json_stream_t* stream = (test_json_stream_t*)mpack_reader_context(reader);
+    if (count > 7)
+        count = 7;
+    if (count > stream->left)
+        count = stream->left;
+    memcpy(buffer, stream->data, count);
+    stream->data += count;
+    stream->left -= count;
+    return count;
+}
+
+static void test_json_transcode_stream(void) {
+    // a str and a bin too big to read in place, so they are copied out of
+    // the reader in chunks. the str is made of two-byte characters, some of
+    // which are split between chunks.
+    char data[3 + 300 + 3 + 300];
+    char expected[1 + 300 + 2 + 400 + 1];
+    size_t i;
+
+    data[0] = (char)0xda;
+    data[1] = (char)0x01;
+    data[2] = (char)0x2c;
+    for (i = 0; i < 300; i += 2) {
+        data[3 + i] = (char)0xc3;
+        data[4 + i] = (char)0xa9;
+    }
+    data[303] = (char)0xc5;
+    data[304] = (char)0x01;
+    data[305] = (char)0x2c;
+    mpack_memset(data + 306, 0, 300);
+
+    expected[0] = '"';
+    mpack_memcpy(expected + 1, data + 3, 300);
+    expected[301] = '"';
+    expected[302] = '"';
+    mpack_memset(expected + 303, 'A', 400);
+    expected[703] = '"';
+
+    char buffer[MPACK_READER_MINIMUM_BUFFER_SIZE];
+    test_json_stream_t stream = {data, sizeof(data)};
+    mpack_reader_t reader;
+    mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+    mpack_reader_set_context(&reader, &stream);
+    mpack_reader_set_fill(&reader, &test_json_stream_fill);
+
+    char output[sizeof(expected)];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, output, sizeof(output));
+    mpack_transcode_json(&reader, &writer);
+    mpack_transcode_json(&reader, &writer);
+    size_t used = mpack_writer_buffer_used(&writer);
+    TEST_READER_DESTROY_NOERROR(&reader);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(test_json_matches(output, used, expected, sizeof(expected)));
+}
+#endif
+
+static void test_json_write(const char* json, const char* expected, size_t expected_size, mpack_error_t expected_error) {
+    char buffer[256];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_write_json(&writer, json, strlen(json));
+    size_t used = mpack_writer_buffer_used(&writer);
+    TEST_TRUE(mpack_writer_destroy(&writer) == expected_error);
+    if (expected != NULL)
+        TEST_TRUE(test_json_matches(buffer, used, expected, expected_size));
+}
+
+#define TEST_JSON_WRITE(json, data) \
+    test_json_write(json, data, sizeof(data) - 1, mpack_ok)
+
+#define TEST_JSON_WRITE_ERROR(json, error) \
+    test_json_write(json, NULL, 0, error)
+
+static void test_json_write_values(void) {
+    TEST_JSON_WRITE("null", "\xc0");
+    TEST_JSON_WRITE(" true ", "\xc3");
+    TEST_JSON_WRITE("\n\tfalse\r\n", "\xc2");
+
+    TEST_JSON_WRITE("0", "\x00");
+    TEST_JSON_WRITE("-0", "\x00");
+    TEST_JSON_WRITE("-1", "\xff");
+    TEST_JSON_WRITE("300", "\xcd\x01\x2c");
+    TEST_JSON_WRITE("18446744073709551615", "\xcf\xff\xff\xff\xff\xff\xff\xff\xff");
+    TEST_JSON_WRITE("-9223372036854775808", "\xd3\x80\x00\x00\x00\x00\x00\x00\x00");
+    TEST_JSON_WRITE("18446744073709551616", "\xcb\x43\xf0\x00\x00\x00\x00\x00\x00");
+    TEST_JSON_WRITE("1.5", "\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00");
+    TEST_JSON_WRITE("100.0", "\xcb\x40\x59\x00\x00\x00\x00\x00\x00");
+    TEST_JSON_WRITE("-2E0", "\xcb\xc0\x00\x00\x00\x00\x00\x00\x00");
+    TEST_JSON_WRITE("1e+300", "\xcb\x7e\x37\xe4\x3c\x88\x00\x75\x9c");
+    TEST_JSON_WRITE("0.100000000000000000000000000000000000000000000000000000000000000000000",
+            "\xcb\x3f\xb9\x99\x99\x99\x99\x99\x9a");
+
+    TEST_JSON_WRITE("\"\"", "\xa0");
+    TEST_JSON_WRITE("\"hi\"", "\xa2" "hi");
+    TEST_JSON_WRITE("\"a\\nb\\u00e9\\ud83d\\ude00\"", "\xa9" "a\nb\xc3\xa9\xf0\x9f\x98\x80");
+    TEST_JSON_WRITE("\"\\\"\\\\\\/\\b\\f\\r\\t\"", "\xa7" "\"\\/\b\f\r\t");
+
+    TEST_JSON_WRITE("[]", "\x90");
+    TEST_JSON_WRITE("{}", "\x80");
+    TEST_JSON_WRITE("[1, [ ], { }]", "\x93\x01\x90\x80");
+    TEST_JSON_WRITE("{\"a\": [true], \"b\" : null}", "\x82\xa1" "a\x91\xc3\xa1" "b\xc0");
+}
+
+// Numbers must be parsed and written the same way under a locale with a
+// comma for a decimal point. This is skipped if no such locale is installed.
+static void test_json_locale(void) {
+    static const char* locales[] = {"de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "fr_FR.utf8", "de_DE", "fr_FR"};
+    size_t i;
+    for (i = 0; i < sizeof(locales) / sizeof(*locales); ++i)
+        if (setlocale(LC_NUMERIC, locales[i]) != NULL)
+            break;
+    if (i == sizeof(locales) / sizeof(*locales))
+        return;
+
+    TEST_JSON_WRITE("1.5", "\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00");
+    TEST_JSON_WRITE("-2.25e1", "\xcb\xc0\x36\x80\x00\x00\x00\x00\x00");
+    TEST_JSON_WRITE_ERROR("1,5", mpack_error_invalid);
+    #if MPACK_READER || MPACK_NODE
+    TEST_JSON_TRANSCODE("\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00", "1.5");
+    #endif
+
+    setlocale(LC_NUMERIC, "C");
+}
+
+static void test_json_write_errors(void) {
+    static const char* invalid[] = {
+        "", " ", "nul", "nulll", "True", "[1,]", "[1 2]", "[", "]", "{\"a\" 1}",
+        "{\"a\":}", "{1:2}", "{\"a\":1,}", "01", "1.", ".5", "-", "1e", "+1",
+        "\"abc", "\"\\x\"", "\"\\u12\"", "\"\\ud800\"", "\"\\udc00\"",
+        "\"\\ud800\\u0041\"", "\"\x01\"", "\"\xff\"", "1 2", "null,",
+    };
+    size_t i;
+    for (i = 0; i < sizeof(invalid) / sizeof(*invalid); ++i)
+        TEST_JSON_WRITE_ERROR(invalid[i], mpack_error_invalid);
+
+    // nesting is limited
+    char json[(MPACK_JSON_MAX_DEPTH + 1) * 2 + 1];
+    mpack_memset(json, '[', MPACK_JSON_MAX_DEPTH);
+    mpack_memset(json + MPACK_JSON_MAX_DEPTH, ']', MPACK_JSON_MAX_DEPTH);
+    json[MPACK_JSON_MAX_DEPTH * 2] = '\0';
+    TEST_JSON_WRITE_ERROR(json, mpack_ok);
+    mpack_memset(json, '[', MPACK_JSON_MAX_DEPTH + 1);
+    mpack_memset(json + MPACK_JSON_MAX_DEPTH + 1, ']', MPACK_JSON_MAX_DEPTH + 1);
+    json[(MPACK_JSON_MAX_DEPTH + 1) * 2] = '\0';
+    TEST_JSON_WRITE_ERROR(json, mpack_error_too_big);
+}
+
+#if MPACK_READER
+static bool test_json_round_trip(void) {
+    static const char json[] =
+        "{\"id\":12345,\"name\":\"caf\xc3\xa9 \\\"du\\\" coin\",\"tags\":[\"a\",\"b\"],"
+        "\"pos\":[-1.25,0.1,1e+100],\"ok\":true,\"next\":null}";
+
+    char* data;
+    size_t size;
+    mpack_writer_t writer;
+    mpack_writer_init_growable(&writer, &data, &size);
+    mpack_write_json(&writer, json, sizeof(json) - 1);
+    mpack_error_t error = mpack_writer_destroy(&writer);
+    if (error == mpack_error_memory)
+        return false;
+    TEST_TRUE(error == mpack_ok);
+
+    char* out;
+    size_t out_size;
+    mpack_writer_init_growable(&writer, &out, &out_size);
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, data, size);
+    mpack_transcode_json(&reader, &writer);
+    TEST_TRUE(mpack_reader_destroy(&reader) == mpack_ok || mpack_reader_error(&reader) == mpack_error_memory);
+    error = mpack_writer_destroy(&writer);
+    MPACK_FREE(data);
+    if (error == mpack_error_memory)
+        return false;
+    TEST_TRUE(error == mpack_ok);
+
+    TEST_TRUE(test_json_matches(out, out_size, json, sizeof(json) - 1));
+    MPACK_FREE(out);
+    return true;
+}
+#endif
+
+void test_json(void) {
+    #if MPACK_READER || MPACK_NODE
+    test_json_transcode_scalars();
+    test_json_transcode_strings();
+    test_json_transcode_compound();
+    #endif
+    #if MPACK_READER
+    test_json_transcode_writer_error();
+    test_json_transcode_stream();
+    #endif
+
+    test_json_write_values();
+    test_json_write_errors();
+    test_json_locale();
+    #if MPACK_READER
+    test_system_fail_until_ok(&test_json_round_trip);
+    #endif
+}
+
+#endif
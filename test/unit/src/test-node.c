@@ -20,6 +20,7 @@
  */
 
 #include "test-node.h"
+#include "test-write.h"
 
 #if MPACK_NODE
 
@@ -538,6 +539,40 @@ static void test_node_read_bad_type(void) {
     #endif
 }
 
+static void test_node_read_wide_values(void) {
+    // 64-bit values are read from the data in the compact node layout
+    static const char test[] =
+            "\x96\xcf\x00\x00\x00\x01\x00\x00\x00\x00\xd3\xff\xff\xff\xff\x7f\xff\xff\xff"
+            "\xcf\x00\x00\x00\x00\xff\xff\xff\xff\xd3\xff\xff\xff\xff\x80\x00\x00\x00"
+            "\xcb\x40\x09\x21\xfb\x54\x44\x2d\x18\x81\xcf\x00\x00\x00\x00\x00\x00\x00\x07\xc0";
+    mpack_tree_t tree;
+
+    #if MPACK_NODE_COMPACT
+    TEST_TRUE(sizeof(mpack_node_data_t) == 12);
+    #endif
+
+    TEST_MPACK_SILENCE_SHADOW_BEGIN
+    mpack_node_data_t pool[10];
+    TEST_MPACK_SILENCE_SHADOW_END
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    mpack_node_t root = mpack_tree_root(&tree);
+
+    TEST_TRUE(UINT64_C(0x100000000) == mpack_node_u64(mpack_node_array_at(root, 0)));
+    TEST_TRUE(INT64_C(-0x80000001) == mpack_node_i64(mpack_node_array_at(root, 1)));
+    TEST_TRUE(MPACK_UINT32_MAX == mpack_node_u32(mpack_node_array_at(root, 2)));
+    TEST_TRUE(MPACK_INT32_MIN == mpack_node_i32(mpack_node_array_at(root, 3)));
+    #if MPACK_DOUBLE
+    TEST_TRUE(3.141592653589793 == mpack_node_double(mpack_node_array_at(root, 4)));
+    #endif
+
+    // lookups also use the wide value
+    mpack_node_t map = mpack_node_array_at(root, 5);
+    TEST_TRUE(mpack_node_is_nil(mpack_node_map_uint(map, 7)));
+    TEST_TRUE(false == mpack_node_map_contains_int(map, 8));
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+
 static void test_node_read_possible(void) {
     // test early exit for data that contains impossible node numbers
 
@@ -792,6 +827,41 @@ static void test_node_read_strings(void) {
     #endif
 }
 
+static void test_node_read_typed_arrays(void) {
+    mpack_tree_t tree;
+
+    uint32_t u32[8];
+    TEST_SIMPLE_TREE_READ("\x96\x01\xcc\xff\xcd\x01\x00\xce\x00\x01\x00\x00\xd0\x05"
+            "\xcf\x00\x00\x00\x00\xff\xff\xff\xff",
+            6 == mpack_node_array_u32(node, u32, 8));
+    TEST_TRUE(u32[0] == 1 && u32[1] == 255 && u32[2] == 256 && u32[3] == 65536 && u32[4] == 5 &&
+            u32[5] == MPACK_UINT32_MAX);
+    TEST_SIMPLE_TREE_READ("\x90", 0 == mpack_node_array_u32(node, u32, 0));
+    TEST_SIMPLE_TREE_READ_ERROR("\x93\x01\x02\x03", 0 == mpack_node_array_u32(node, u32, 2), mpack_error_too_big);
+    TEST_SIMPLE_TREE_READ_ERROR("\x92\x01\xff", 0 == mpack_node_array_u32(node, u32, 2), mpack_error_type);
+    TEST_SIMPLE_TREE_READ_ERROR("\x01", 0 == mpack_node_array_u32(node, u32, 2), mpack_error_type);
+
+    int64_t i64[4];
+    TEST_SIMPLE_TREE_READ("\x94\x7f\xe0\xd3\x80\x00\x00\x00\x00\x00\x00\x00\xcf\x00\x00\x00\x00\x00\x00\x00\x02",
+            4 == mpack_node_array_i64(node, i64, 4));
+    TEST_TRUE(i64[0] == 127 && i64[1] == -32 && i64[2] == MPACK_INT64_MIN && i64[3] == 2);
+    TEST_SIMPLE_TREE_READ_ERROR("\x91\xcf\xff\xff\xff\xff\xff\xff\xff\xff", 0 == mpack_node_array_i64(node, i64, 4), mpack_error_type);
+
+    #if MPACK_FLOAT
+    float f[3];
+    TEST_SIMPLE_TREE_READ("\x93\xca\x3f\xc0\x00\x00\x01\xca\xc0\x10\x00\x00",
+            3 == mpack_node_array_float(node, f, 3) && f[0] == 1.5f && f[1] == 1.0f && f[2] == -2.25f);
+    TEST_SIMPLE_TREE_READ_ERROR("\x91\xc0", 0 == mpack_node_array_float(node, f, 3), mpack_error_type);
+    #endif
+
+    #if MPACK_DOUBLE
+    double d[3];
+    TEST_SIMPLE_TREE_READ("\x93\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00\x01\xca\xc0\x10\x00\x00",
+            3 == mpack_node_array_double(node, d, 3) && d[0] == 1.5 && d[1] == 1.0 && d[2] == -2.25);
+    TEST_SIMPLE_TREE_READ_ERROR("\x91\xa0", 0 == mpack_node_array_double(node, d, 3), mpack_error_type);
+    #endif
+}
+
 static void test_node_read_enum(void) {
     mpack_tree_t tree;
 
@@ -812,6 +882,20 @@ static void test_node_read_enum(void) {
 
     // test pre-existing error
     TEST_SIMPLE_TREE_READ_ERROR("\x01", (mpack_node_nil(node), COUNT == (fruit_t)mpack_node_enum(node, fruits, COUNT)), mpack_error_type);
+
+    #ifdef MPACK_MALLOC
+    mpack_enum_matcher_t matcher;
+    TEST_TRUE(mpack_enum_matcher_init(&matcher, fruits, COUNT) == mpack_ok);
+    TEST_SIMPLE_TREE_READ("\xa5""apple", APPLE == (fruit_t)mpack_node_enum_matcher(node, &matcher));
+    TEST_SIMPLE_TREE_READ("\xa6""orange", ORANGE == (fruit_t)mpack_node_enum_matcher(node, &matcher));
+    TEST_SIMPLE_TREE_READ_ERROR("\xa4""kiwi", COUNT == (fruit_t)mpack_node_enum_matcher(node, &matcher), mpack_error_type);
+    TEST_SIMPLE_TREE_READ_ERROR("\x01", COUNT == (fruit_t)mpack_node_enum_matcher(node, &matcher), mpack_error_type);
+    TEST_SIMPLE_TREE_READ("\xa6""banana", BANANA == (fruit_t)mpack_node_enum_matcher_optional(node, &matcher));
+    TEST_SIMPLE_TREE_READ("\xa4""kiwi", COUNT == (fruit_t)mpack_node_enum_matcher_optional(node, &matcher));
+    TEST_SIMPLE_TREE_READ("\x01", COUNT == (fruit_t)mpack_node_enum_matcher_optional(node, &matcher));
+    TEST_SIMPLE_TREE_READ_ERROR("\x01", (mpack_node_nil(node), COUNT == (fruit_t)mpack_node_enum_matcher(node, &matcher)), mpack_error_type);
+    mpack_enum_matcher_destroy(&matcher);
+    #endif
 }
 
 #if MPACK_EXTENSIONS
@@ -983,6 +1067,512 @@ static void test_node_read_map_search(void) {
     TEST_SIMPLE_TREE_READ_ERROR(test, false == mpack_node_map_contains_cstr(node, "carl"), mpack_error_data);
 }
 
+#ifdef MPACK_MALLOC
+// A map of 40 pairs: str keys "k00" to "k29", uint keys 100 to 107, int key
+// -128 and a duplicate of "k05". Each value is the index of its pair.
+static size_t test_node_map_index_data(char* buf) {
+    char* p = buf;
+    *p++ = (char)0xde;
+    *p++ = 0;
+    *p++ = 40;
+
+    int i;
+    for (i = 0; i < 30; ++i) {
+        *p++ = (char)0xa3;
+        *p++ = 'k';
+        *p++ = (char)('0' + i / 10);
+        *p++ = (char)('0' + i % 10);
+        *p++ = (char)i;
+    }
+    for (i = 30; i < 38; ++i) {
+        *p++ = (char)(100 + i - 30);
+        *p++ = (char)i;
+    }
+    *p++ = (char)0xd0;
+    *p++ = (char)0x80;
+    *p++ = 38;
+    mpack_memcpy(p, "\xa3""k05\x27", 5);
+    p += 5;
+
+    return (size_t)(p - buf);
+}
+
+static void test_node_read_map_index_threshold(size_t min_count) {
+    char buf[256];
+    size_t size = test_node_map_index_data(buf);
+    mpack_tree_t tree;
+    mpack_node_t node;
+    int i;
+
+    mpack_tree_init(&tree, buf, size);
+    mpack_tree_set_map_index(&tree, min_count);
+    mpack_tree_parse(&tree);
+    node = mpack_tree_root(&tree);
+
+    for (i = 0; i < 30; ++i) {
+        char key[4] = {'k', (char)('0' + i / 10), (char)('0' + i % 10), 0};
+        if (i != 5)
+            TEST_TRUE(i == mpack_node_i32(mpack_node_map_cstr(node, key)));
+    }
+    for (i = 30; i < 38; ++i) {
+        TEST_TRUE(i == mpack_node_i32(mpack_node_map_uint(node, (uint64_t)(100 + i - 30))));
+        TEST_TRUE(i == mpack_node_i32(mpack_node_map_int(node, 100 + i - 30)));
+    }
+    TEST_TRUE(38 == mpack_node_i32(mpack_node_map_int(node, -128)));
+
+    TEST_TRUE(mpack_node_map_contains_str(node, "k29", 3));
+    TEST_TRUE(false == mpack_node_map_contains_str(node, "k30", 3));
+    TEST_TRUE(false == mpack_node_map_contains_cstr(node, "k"));
+    TEST_TRUE(false == mpack_node_map_contains_int(node, -1));
+    TEST_TRUE(false == mpack_node_map_contains_int(node, 99));
+    TEST_TRUE(false == mpack_node_map_contains_uint(node, 108));
+    TEST_TRUE(false == mpack_node_map_contains_uint(node, (uint64_t)-128));
+    TEST_TRUE(mpack_node_is_missing(mpack_node_map_cstr_optional(node, "eve")));
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // looking up a duplicate key is an error
+    mpack_tree_init(&tree, buf, size);
+    mpack_tree_set_map_index(&tree, min_count);
+    mpack_tree_parse(&tree);
+    node = mpack_tree_root(&tree);
+    TEST_TRUE(0 == mpack_node_i32(mpack_node_map_cstr(node, "k00")));
+    TEST_TRUE(false == mpack_node_map_contains_cstr(node, "k05"));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_data);
+}
+
+static void test_node_read_map_index(void) {
+    test_node_read_map_index_threshold(0);
+    test_node_read_map_index_threshold(1);
+    test_node_read_map_index_threshold(16);
+    test_node_read_map_index_threshold(41); // larger than the map
+}
+
+static bool test_node_map_index_allocs(void) {
+    // allocating an index can fail; lookups should fall back to a linear
+    // search in this case.
+    char buf[256];
+    size_t size = test_node_map_index_data(buf);
+    mpack_tree_t tree;
+    mpack_tree_init(&tree, buf, size);
+    mpack_tree_set_map_index(&tree, 1);
+    mpack_tree_parse(&tree);
+    if (mpack_tree_error(&tree) == mpack_error_memory) {
+        mpack_tree_destroy(&tree);
+        return false;
+    }
+
+    mpack_node_t node = mpack_tree_root(&tree);
+    TEST_TRUE(21 == mpack_node_i32(mpack_node_map_cstr(node, "k21")));
+    TEST_TRUE(33 == mpack_node_i32(mpack_node_map_int(node, 103)));
+    TEST_TRUE(mpack_node_is_missing(mpack_node_map_uint_optional(node, 5)));
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    return true;
+}
+
+// {"a": 1, "b": {"a": 2, "c": 3}, 5: "a", "toolongkey": 4}
+static const char test_node_key_table_data[] =
+        "\x84\xa1""a\x01\xa1""b\x82\xa1""a\x02\xa1""c\x03\x05\xa1""a\xaa""toolongkey\x04";
+
+static void test_node_key_table_message(mpack_key_table_t* table, bool lazy) {
+    mpack_tree_t tree;
+    mpack_tree_init(&tree, test_node_key_table_data, sizeof(test_node_key_table_data) - 1);
+    mpack_tree_set_key_table(&tree, table);
+    mpack_tree_set_lazy(&tree, lazy);
+    mpack_tree_parse(&tree);
+    mpack_node_t root = mpack_tree_root(&tree);
+
+    // the keys were interned while parsing (or earlier, if the tree is lazy)
+    size_t count = table->count;
+    TEST_TRUE(0 != mpack_key_table_find(table, "c", 1));
+    uint16_t a = mpack_key_table_intern(table, "a", 1);
+    uint16_t b = mpack_key_table_intern(table, "b", 1);
+    uint16_t c = mpack_key_table_intern(table, "c", 1);
+
+    TEST_TRUE(1 == mpack_node_int(mpack_node_map_key_id(root, a)));
+    TEST_TRUE(3 == mpack_node_int(mpack_node_map_key_id(mpack_node_map_key_id(root, b), c)));
+    TEST_TRUE(mpack_node_is_missing(mpack_node_map_key_id_optional(root, c)));
+    TEST_TRUE(a == mpack_node_key_id(mpack_node_map_key_at(root, 0)));
+    TEST_TRUE(c == mpack_node_key_id(mpack_node_map_key_at(mpack_node_map_value_at(root, 1), 1)));
+
+    // only str keys no longer than the maximum length are interned
+    TEST_TRUE(0 == mpack_node_key_id(mpack_node_map_uint(root, 5)));
+    TEST_TRUE(0 == mpack_node_key_id(mpack_node_map_key_at(root, 2)));
+    TEST_TRUE(0 == mpack_node_key_id(mpack_node_map_key_at(root, 3)));
+    TEST_TRUE(0 == mpack_key_table_find(table, "toolongkey", 10));
+    TEST_TRUE(count == table->count);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+
+// Writes the key "k<i>", returning its length.
+static size_t test_node_key_name(char* str, int i) {
+    size_t len = 1;
+    int digits = 1;
+    while (digits * 10 <= i)
+        digits *= 10;
+    str[0] = 'k';
+    for (; digits > 0; digits /= 10)
+        str[len++] = (char)('0' + i / digits % 10);
+    return len;
+}
+
+static void test_node_key_table(void) {
+    mpack_key_table_t table;
+    mpack_key_table_init(&table, 8);
+    TEST_TRUE(0 == mpack_key_table_find(&table, "a", 1));
+
+    // keys interned up front keep their IDs
+    TEST_TRUE(1 == mpack_key_table_intern(&table, "b", 1));
+    TEST_TRUE(0 == mpack_key_table_intern(&table, "toolongkey", 10));
+    test_node_key_table_message(&table, false);
+    TEST_TRUE(1 == mpack_key_table_find(&table, "b", 1));
+    TEST_TRUE(2 == mpack_key_table_find(&table, "a", 1));
+
+    // the table is shared by later messages and lazy trees
+    size_t length;
+    const char* key = mpack_key_table_key(&table, 2, &length);
+    TEST_TRUE(1 == length && 0 == strcmp(key, "a"));
+    test_node_key_table_message(&table, false);
+    test_node_key_table_message(&table, true);
+    TEST_TRUE(key == mpack_key_table_key(&table, 2, NULL));
+    TEST_BREAK(NULL == mpack_key_table_key(&table, 4, NULL));
+
+    // growing the table keeps existing IDs
+    int i;
+    for (i = 0; i < 1000; ++i) {
+        char str[8];
+        size_t len = test_node_key_name(str, i);
+        TEST_TRUE((uint16_t)(4 + i) == mpack_key_table_intern(&table, str, len));
+    }
+    TEST_TRUE(key == mpack_key_table_key(&table, 2, NULL));
+    TEST_TRUE(504 == mpack_key_table_find(&table, "k500", 4));
+    test_node_key_table_message(&table, false);
+
+    // lookup errors
+    mpack_tree_t tree;
+    mpack_tree_init(&tree, "\x82\xa1""a\x01\xa1""a\x02", 7);
+    mpack_tree_set_key_table(&tree, &table);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_node_is_nil(mpack_node_map_key_id_optional(mpack_tree_root(&tree), 2)));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_data);
+
+    mpack_tree_init(&tree, "\x91\xa1""a", 3);
+    mpack_tree_set_key_table(&tree, &table);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(0 == mpack_node_key_id(mpack_node_array_at(mpack_tree_root(&tree), 0)));
+    TEST_TRUE(mpack_node_is_nil(mpack_node_map_key_id(mpack_tree_root(&tree), 2)));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_type);
+
+    mpack_tree_init(&tree, "\x80", 1);
+    mpack_tree_parse(&tree);
+    TEST_BREAK(mpack_node_is_nil(mpack_node_map_key_id(mpack_tree_root(&tree), 2)));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_bug);
+
+    mpack_key_table_destroy(&table);
+}
+
+static bool test_node_key_table_allocs(void) {
+    // a table that fails to grow is left usable
+    mpack_key_table_t table;
+    mpack_key_table_init(&table, 8);
+    int i;
+    for (i = 0; i < 100; ++i) {
+        char str[8];
+        size_t len = test_node_key_name(str, i);
+        if (0 == mpack_key_table_intern(&table, str, len)) {
+            TEST_TRUE((size_t)i == table.count);
+            TEST_TRUE(0 == mpack_key_table_find(&table, str, len));
+            if (i > 0)
+                TEST_TRUE(1 == mpack_key_table_find(&table, "k0", 2));
+            mpack_key_table_destroy(&table);
+            return false;
+        }
+    }
+
+    mpack_tree_t tree;
+    mpack_tree_init(&tree, test_node_key_table_data, sizeof(test_node_key_table_data) - 1);
+    mpack_tree_set_key_table(&tree, &table);
+    mpack_tree_parse(&tree);
+    if (mpack_tree_error(&tree) == mpack_error_memory) {
+        mpack_tree_destroy(&tree);
+        mpack_key_table_destroy(&table);
+        return false;
+    }
+    TEST_TRUE(3 == mpack_node_int(mpack_node_map_key_id(
+                    mpack_node_map_cstr(mpack_tree_root(&tree), "b"), mpack_key_table_find(&table, "c", 1))));
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    mpack_key_table_destroy(&table);
+    return true;
+}
+#endif
+
+static void test_node_lazy_pool(void) {
+    static const char test[] =
+            "\x83\xa1""a\x93\x01\x92\x02\x03\xa1""x"
+            "\xa1""b\x81\xa1""c\xc0\xa1""e\x90"
+            "\x91\x05";
+    mpack_tree_t tree;
+    mpack_node_t root;
+
+    TEST_MPACK_SILENCE_SHADOW_BEGIN
+    mpack_node_data_t pool[12];
+    TEST_MPACK_SILENCE_SHADOW_END
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_lazy(&tree, true);
+
+    // only the root is parsed
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    TEST_TRUE(sizeof(test) - 3 == mpack_tree_size(&tree));
+    TEST_TRUE(1 == tree.node_count);
+    root = mpack_tree_root(&tree);
+    TEST_TRUE(3 == mpack_node_map_count(root));
+    TEST_TRUE(1 == tree.node_count);
+
+    // the first lookup parses the keys and values of the root
+    mpack_node_t a = mpack_node_map_cstr(root, "a");
+    TEST_TRUE(7 == tree.node_count);
+    TEST_TRUE(3 == mpack_node_array_length(a));
+    TEST_TRUE(1 == mpack_node_int(mpack_node_array_at(a, 0)));
+    TEST_TRUE(10 == tree.node_count);
+    TEST_TRUE(3 == mpack_node_int(mpack_node_array_at(mpack_node_array_at(a, 1), 1)));
+    TEST_TRUE(12 == tree.node_count);
+    TEST_TRUE(0 == mpack_memcmp("x", mpack_node_str(mpack_node_array_at(a, 2)), 1));
+    TEST_TRUE(0 == mpack_node_array_length(mpack_node_map_cstr(root, "e")));
+    TEST_TRUE(0 == mpack_memcmp("b", mpack_node_str(mpack_node_map_key_at(root, 1)), 1));
+
+    // nodes that were already materialized don't change
+    TEST_TRUE(a.data == mpack_node_map_value_at(root, 0).data);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+
+    // the pool is full, so the next container can't be materialized
+    TEST_TRUE(mpack_node_is_nil(mpack_node_map_cstr(mpack_node_map_cstr(root, "b"), "c")));
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_error_too_big);
+    mpack_tree_destroy(&tree);
+
+    // the second message starts with a fresh pool
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_lazy(&tree, true);
+    mpack_tree_parse(&tree);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(5 == mpack_node_int(mpack_node_array_at(mpack_tree_root(&tree), 0)));
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // invalid and truncated data are still detected during parsing
+    static const char* const errors[] = {
+        "\x92\x01\xc1", "\x92\x01\x91", "\x81\xa1""a\xda\x00\xff",
+    };
+    size_t i;
+    for (i = 0; i < sizeof(errors) / sizeof(*errors); ++i) {
+        mpack_tree_init_pool(&tree, errors[i], strlen(errors[i]), pool, sizeof(pool) / sizeof(*pool));
+        mpack_tree_set_lazy(&tree, true);
+        mpack_tree_parse(&tree);
+        TEST_TREE_DESTROY_ERROR(&tree, mpack_error_invalid);
+    }
+}
+
+// Compares the roots of two messages, checking that equal nodes hash equally
+static bool test_node_equal_messages(const char* left, size_t left_size,
+        const char* right, size_t right_size)
+{
+    static mpack_node_data_t right_pool[64];
+    mpack_tree_t left_tree;
+    mpack_tree_t right_tree;
+    mpack_tree_init_pool(&left_tree, left, left_size, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_init_pool(&right_tree, right, right_size, right_pool, sizeof(right_pool) / sizeof(*right_pool));
+    mpack_tree_parse(&left_tree);
+    mpack_tree_parse(&right_tree);
+
+    mpack_node_t left_root = mpack_tree_root(&left_tree);
+    mpack_node_t right_root = mpack_tree_root(&right_tree);
+    bool equal = mpack_node_equal(left_root, right_root);
+    TEST_TRUE(equal == mpack_node_equal(right_root, left_root));
+    if (equal)
+        TEST_TRUE(mpack_node_hash(left_root) == mpack_node_hash(right_root));
+
+    TEST_TREE_DESTROY_NOERROR(&left_tree);
+    TEST_TREE_DESTROY_NOERROR(&right_tree);
+    return equal;
+}
+
+#define TEST_NODE_EQUAL(left, right) \
+    test_node_equal_messages(left, sizeof(left) - 1, right, sizeof(right) - 1)
+
+static void test_node_equal(void) {
+    // maps are compared regardless of order, and ints regardless of encoding
+    TEST_TRUE(TEST_NODE_EQUAL(
+            "\x83\xa1""a\x92\xd0\x01\xd1\xff\xff\xa1""b\xc0\xa1""c\xd9\x01x",
+            "\x83\xa1""c\xa1x\xa1""a\x92\x01\xff\xa1""b\xc0"));
+    TEST_TRUE(TEST_NODE_EQUAL("\x81\x01\x02", "\xdf\x00\x00\x00\x01\xd3\x00\x00\x00\x00\x00\x00\x00\x01\x02"));
+
+    TEST_TRUE(!TEST_NODE_EQUAL("\x82\xa1""a\x01\xa1""b\x02", "\x82\xa1""a\x02\xa1""b\x01"));
+    TEST_TRUE(!TEST_NODE_EQUAL("\x82\xa1""a\x01\xa1""b\x02", "\x82\xa1""a\x01\xa1""c\x02"));
+    TEST_TRUE(!TEST_NODE_EQUAL("\x81\xa1""a\x01", "\x82\xa1""a\x01\xa1""b\x02"));
+    TEST_TRUE(!TEST_NODE_EQUAL("\x92\x01\x02", "\x92\x02\x01"));
+    TEST_TRUE(!TEST_NODE_EQUAL("\xa1x", "\xc4\x01x"));
+    TEST_TRUE(!TEST_NODE_EQUAL("\xa1x", "\xa1y"));
+    TEST_TRUE(!TEST_NODE_EQUAL("\x01", "\xca\x3f\x80\x00\x00"));
+    TEST_TRUE(!TEST_NODE_EQUAL("\xc0", "\xc2"));
+
+    // reals compare by bits after narrowing doubles, so NaNs equal themselves
+    // and zeroes differ by sign
+    TEST_TRUE(TEST_NODE_EQUAL("\xca\x7f\xc0\x00\x00", "\xca\x7f\xc0\x00\x00"));
+    TEST_TRUE(!TEST_NODE_EQUAL("\xca\x00\x00\x00\x00", "\xca\x80\x00\x00\x00"));
+    #if MPACK_FLOAT && MPACK_DOUBLE
+    TEST_TRUE(TEST_NODE_EQUAL("\xca\x3f\xc0\x00\x00", "\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00"));
+    TEST_TRUE(!TEST_NODE_EQUAL("\xca\x3d\xcc\xcc\xcd", "\xcb\x3f\xb9\x99\x99\x99\x99\x99\x9a"));
+
+    // the largest floats equal their doubles
+    TEST_TRUE(TEST_NODE_EQUAL("\xca\x7f\x00\x00\x00", "\xcb\x47\xe0\x00\x00\x00\x00\x00\x00"));
+    TEST_TRUE(TEST_NODE_EQUAL("\xca\x7f\x7f\xff\xff", "\xcb\x47\xef\xff\xff\xe0\x00\x00\x00"));
+    TEST_TRUE(!TEST_NODE_EQUAL("\xca\x7f\x80\x00\x00", "\xcb\x47\xf0\x00\x00\x00\x00\x00\x00"));
+    #endif
+
+    // hashes don't depend on the order of map entries
+    mpack_tree_t tree;
+    mpack_tree_init_pool(&tree, "\x92\x82\x01\x02\x03\x04\x82\x03\x04\x01\x02", 11,
+            pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    mpack_node_t root = mpack_tree_root(&tree);
+    TEST_TRUE(mpack_node_hash(mpack_node_array_at(root, 0)) == mpack_node_hash(mpack_node_array_at(root, 1)));
+    TEST_TRUE(mpack_node_hash(mpack_node_array_at(root, 0)) != mpack_node_hash(root));
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // nodes of trees in error never compare equal
+    mpack_tree_init_pool(&tree, "\xc1", 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    root = mpack_tree_root(&tree);
+    TEST_TRUE(mpack_node_hash(root) == 0);
+    TEST_TRUE(!mpack_node_equal(root, root));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_invalid);
+}
+
+#if MPACK_WRITER
+static void test_node_write_message(const char* message, size_t size,
+        bool spans, bool lazy, const char* result, size_t result_size)
+{
+    TEST_MPACK_SILENCE_SHADOW_BEGIN
+    mpack_node_data_t pool[16];
+    TEST_MPACK_SILENCE_SHADOW_END
+    mpack_tree_t tree;
+    mpack_tree_init_pool(&tree, message, size, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_spans(&tree, spans);
+    mpack_tree_set_lazy(&tree, lazy);
+    mpack_tree_parse(&tree);
+
+    char buf[64];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_write_node(&writer, mpack_tree_root(&tree));
+    size_t written = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    TEST_TRUE(written == result_size && 0 == memcmp(buf, result, written));
+}
+
+#if MPACK_DOUBLE
+// doubles written in compact form are read back exactly
+static void test_node_compact_floats(void) {
+    static const double values[] = {0.0, -0.0, 1.0, -33.0, 65536.0, 0.5, 4294967296.0, 3.14159265, 1e300, 1e-320};
+    const uint32_t count = (uint32_t)(sizeof(values) / sizeof(*values));
+    char data[128];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, data, sizeof(data));
+    mpack_writer_set_compact_floats(&writer, true);
+    mpack_write_double_array(&writer, values, count);
+    size_t size = mpack_writer_buffer_used(&writer);
+    TEST_TRUE(mpack_writer_destroy(&writer) == mpack_ok);
+    TEST_TRUE(size < 1 + count * MPACK_TAG_SIZE_DOUBLE);
+
+    mpack_tree_t tree;
+    mpack_tree_init_pool(&tree, data, size, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_parse(&tree);
+    mpack_node_t root = mpack_tree_root(&tree);
+    TEST_TRUE(mpack_node_array_length(root) == count);
+    uint32_t i;
+    for (i = 0; i < count; ++i) {
+        double value = mpack_node_double(mpack_node_array_at(root, i));
+        TEST_TRUE(memcmp(&value, &values[i], sizeof(value)) == 0);
+    }
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+#endif
+
+static void test_node_write(void) {
+    // the containers and the int are not in their smallest encoding
+    static const char message[] =
+            "\x82\xa1""a\xdc\x00\x02\x01\xcc\x05"
+            "\xa1""b\xdf\x00\x00\x00\x01\xa1""c\xc0";
+    static const char canonical[] =
+            "\x82\xa1""a\x92\x01\x05\xa1""b\x81\xa1""c\xc0";
+
+    // recorded spans are copied verbatim; everything else is re-encoded
+    test_node_write_message(message, sizeof(message) - 1, true, false, message, sizeof(message) - 1);
+    test_node_write_message(message, sizeof(message) - 1, false, false, canonical, sizeof(canonical) - 1);
+    test_node_write_message(message, sizeof(message) - 1, true, true, canonical, sizeof(canonical) - 1);
+
+    mpack_tree_t tree;
+    mpack_tree_init_pool(&tree, message, sizeof(message) - 1, pool, sizeof(pool) / sizeof(*pool));
+    mpack_tree_set_spans(&tree, true);
+    mpack_tree_parse(&tree);
+    mpack_node_t root = mpack_tree_root(&tree);
+
+    size_t size;
+    TEST_TRUE(message == mpack_node_span(root, &size));
+    TEST_TRUE(size == sizeof(message) - 1);
+    TEST_TRUE(message + 3 == mpack_node_span(mpack_node_map_cstr(root, "a"), &size));
+    TEST_TRUE(size == 6);
+    TEST_TRUE(NULL == mpack_node_span(mpack_node_map_key_at(root, 0), &size));
+    TEST_TRUE(size == 0);
+
+    // splice the untouched entry into a modified map
+    char buf[64];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_start_map(&writer, 2);
+    mpack_write_cstr(&writer, "a");
+    mpack_write_nil(&writer);
+    mpack_write_node(&writer, mpack_node_map_key_at(root, 1));
+    mpack_write_node(&writer, mpack_node_map_value_at(root, 1));
+    mpack_finish_map(&writer);
+    TEST_DESTROY_MATCH_IMPL(buf, "\x82\xa1""a\xc0\xa1""b\xdf\x00\x00\x00\x01\xa1""c\xc0");
+
+    // the tree's error is flagged on the writer
+    mpack_node_flag_error(root, mpack_error_data);
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_write_node(&writer, root);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_data);
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_data);
+}
+#endif
+
+#ifdef MPACK_MALLOC
+static bool test_node_lazy_allocs(void) {
+    char buf[256];
+    size_t size = test_node_map_index_data(buf);
+    mpack_tree_t tree;
+    mpack_tree_init(&tree, buf, size);
+    mpack_tree_set_lazy(&tree, true);
+    mpack_tree_set_map_index(&tree, 8);
+    mpack_tree_parse(&tree);
+    if (mpack_tree_error(&tree) == mpack_error_memory) {
+        mpack_tree_destroy(&tree);
+        return false;
+    }
+
+    mpack_node_t node = mpack_tree_root(&tree);
+    mpack_node_t value = mpack_node_map_cstr(node, "k21");
+    if (mpack_tree_error(&tree) == mpack_error_memory) {
+        mpack_tree_destroy(&tree);
+        return false;
+    }
+
+    TEST_TRUE(21 == mpack_node_i32(value));
+    TEST_TRUE(33 == mpack_node_i32(mpack_node_map_int(node, 103)));
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    return true;
+}
+#endif
+
 static void test_node_read_compound_errors(void) {
     mpack_tree_t tree;
 
@@ -1235,6 +1825,25 @@ static bool test_node_multiple_allocs(bool stream, size_t stream_read_size) {
     TEST_TRUE(-3 == mpack_node_int(mpack_node_array_at(mpack_tree_root(&tree), 2)));
     TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
 
+    #if MPACK_STATS
+    mpack_tree_stats_t stats = mpack_tree_stats(&tree);
+    TEST_TRUE(stats.messages == 3);
+    TEST_TRUE(stats.bytes == sizeof(test) - 1);
+    TEST_TRUE(stats.nodes == 5 + 11 + 4);
+    // pages are reused between messages, so the first page is the only one
+    // needed (plus the separate page for the large array)
+    TEST_TRUE(stats.pages >= 1 && stats.pages <= 2);
+    if (stream) {
+        TEST_TRUE(stats.fill_bytes == sizeof(test) - 1);
+        TEST_TRUE(stats.fills >= (sizeof(test) - 1 + stream_read_size - 1) / stream_read_size);
+        TEST_TRUE(stats.buffer_grows >= 1);
+    } else {
+        TEST_TRUE(stats.fills == 0 && stats.fill_bytes == 0 && stats.buffer_grows == 0);
+    }
+    mpack_tree_reset_stats(&tree);
+    TEST_TRUE(mpack_tree_stats(&tree).messages == 0);
+    #endif
+
     // success!
     mpack_tree_destroy(&tree);
     return true;
@@ -1261,6 +1870,493 @@ static bool test_node_multiple_allocs_stream4096(void) {
 }
 #endif
 
+static void test_node_batch_pool(void) {
+    static const char test[] = "\x00\xa5""hello\x92\x01\xa3""bob\xc0";
+    mpack_tree_t tree;
+    mpack_node_t roots[3];
+
+    TEST_MPACK_SILENCE_SHADOW_BEGIN
+    mpack_node_data_t pool[6];
+    TEST_MPACK_SILENCE_SHADOW_END
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+
+    // first batch is limited by the number of roots
+    TEST_TRUE(3 == mpack_tree_parse_batch(&tree, roots, 3));
+    TEST_TRUE(0u == mpack_node_uint(roots[0]));
+    TEST_TRUE(5 == mpack_node_strlen(roots[1]));
+    TEST_TRUE(0 == mpack_memcmp("hello", mpack_node_str(roots[1]), 5));
+    TEST_TRUE(2 == mpack_node_array_length(roots[2]));
+    TEST_TRUE(1 == mpack_node_int(mpack_node_array_at(roots[2], 0)));
+    TEST_TRUE(0 == mpack_memcmp("bob", mpack_node_str(mpack_node_array_at(roots[2], 1)), 3));
+    TEST_TRUE(roots[0].data == mpack_tree_root(&tree).data);
+    TEST_TRUE(sizeof(test) - 2 == mpack_tree_size(&tree));
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+
+    // second batch is limited by the data
+    TEST_TRUE(1 == mpack_tree_parse_batch(&tree, roots, 3));
+    mpack_node_nil(roots[0]);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // an exact tree has no pool, so it allocates pages for later messages
+    #ifdef MPACK_MALLOC
+    mpack_tree_init_exact(&tree, test, sizeof(test) - 1);
+    TEST_TRUE(3 == mpack_tree_parse_batch(&tree, roots, 3));
+    TEST_TRUE(0u == mpack_node_uint(roots[0]));
+    TEST_TRUE(0 == mpack_memcmp("hello", mpack_node_str(roots[1]), 5));
+    TEST_TRUE(1 == mpack_node_int(mpack_node_array_at(roots[2], 0)));
+    TEST_TRUE(0 == mpack_memcmp("bob", mpack_node_str(mpack_node_array_at(roots[2], 1)), 3));
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    #endif
+
+    // the pool is too small to hold all messages
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, 4);
+    TEST_TRUE(0 == mpack_tree_parse_batch(&tree, roots, 3));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_too_big);
+
+    // a truncated message fails the batch
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 3, pool, sizeof(pool) / sizeof(*pool));
+    TEST_TRUE(0 == mpack_tree_parse_batch(&tree, roots, 3));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_invalid);
+
+    // the batch must have room for a root
+    mpack_tree_init_pool(&tree, test, sizeof(test) - 1, pool, sizeof(pool) / sizeof(*pool));
+    TEST_BREAK(0 == mpack_tree_parse_batch(&tree, roots, 0));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_bug);
+}
+
+static void test_node_split(void) {
+    // a root array of seven records, split into chunks that are each parsed
+    // as a batch
+    static const char array[] = "\x97\x00\x91\x01\xa1""2\x92\x03\x03\x04\x81\x05\x05\x06";
+    mpack_tree_chunk_t chunks[3];
+    size_t count;
+
+    TEST_TRUE(mpack_ok == mpack_tree_split_data(array, sizeof(array) - 1, chunks, 3, &count));
+    TEST_TRUE(3 == count);
+    TEST_TRUE(3 == chunks[0].count);
+    TEST_TRUE(2 == chunks[1].count);
+    TEST_TRUE(2 == chunks[2].count);
+    TEST_TRUE(array + 1 == chunks[0].data);
+    TEST_TRUE(chunks[0].data + chunks[0].size == chunks[1].data);
+    TEST_TRUE(chunks[1].data + chunks[1].size == chunks[2].data);
+    TEST_TRUE(array + sizeof(array) - 1 == chunks[2].data + chunks[2].size);
+
+    TEST_MPACK_SILENCE_SHADOW_BEGIN
+    mpack_node_data_t pool[8];
+    TEST_MPACK_SILENCE_SHADOW_END
+    mpack_tree_t tree;
+    mpack_node_t roots[3];
+
+    mpack_tree_init_pool(&tree, chunks[1].data, chunks[1].size, pool, sizeof(pool) / sizeof(*pool));
+    TEST_TRUE(2 == mpack_tree_parse_batch(&tree, roots, chunks[1].count));
+    TEST_TRUE(3 == mpack_node_int(mpack_node_array_at(roots[0], 1)));
+    TEST_TRUE(4 == mpack_node_int(roots[1]));
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    mpack_tree_init_pool(&tree, chunks[2].data, chunks[2].size, pool, sizeof(pool) / sizeof(*pool));
+    TEST_TRUE(2 == mpack_tree_parse_batch(&tree, roots, chunks[2].count));
+    TEST_TRUE(5 == mpack_node_int(mpack_node_map_int(roots[0], 5)));
+    TEST_TRUE(6 == mpack_node_int(roots[1]));
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // more chunks than elements
+    TEST_TRUE(mpack_ok == mpack_tree_split_data("\x92\x01\x02", 3, chunks, 3, &count));
+    TEST_TRUE(2 == count);
+    TEST_TRUE(1 == chunks[1].count && 1 == chunks[1].size);
+
+    // map pairs are not split
+    static const char map[] = "\x83\x01\x02\x03\x04\x05\x06";
+    TEST_TRUE(mpack_ok == mpack_tree_split_data(map, sizeof(map) - 1, chunks, 2, &count));
+    TEST_TRUE(2 == count);
+    TEST_TRUE(4 == chunks[0].count && 4 == chunks[0].size);
+    TEST_TRUE(2 == chunks[1].count && 2 == chunks[1].size);
+
+    // empty, truncated and invalid roots
+    TEST_TRUE(mpack_ok == mpack_tree_split_data("\x90", 1, chunks, 3, &count));
+    TEST_TRUE(0 == count);
+    TEST_TRUE(mpack_error_type == mpack_tree_split_data("\x01", 1, chunks, 3, &count));
+    TEST_TRUE(mpack_error_invalid == mpack_tree_split_data("\x93\x01\x02", 3, chunks, 3, &count));
+    TEST_TRUE(mpack_error_invalid == mpack_tree_split_data("\x92\x01\xa2""a", 4, chunks, 1, &count));
+    TEST_TRUE(mpack_error_invalid == mpack_tree_split_data("", 0, chunks, 1, &count));
+    TEST_TRUE(0 == count);
+    TEST_BREAK(mpack_error_bug == mpack_tree_split_data("\x90", 1, chunks, 0, &count));
+}
+
+static void test_node_count_nodes(void) {
+    size_t count;
+    size_t depth;
+
+    TEST_TRUE(mpack_ok == mpack_tree_count_nodes("\x01", 1, &count, &depth));
+    TEST_TRUE(1 == count && 1 == depth);
+    TEST_TRUE(mpack_ok == mpack_tree_count_nodes("\x90", 1, &count, &depth));
+    TEST_TRUE(1 == count && 1 == depth);
+    TEST_TRUE(mpack_ok == mpack_tree_count_nodes("\x92\x01\x91\x02", 4, &count, &depth));
+    TEST_TRUE(4 == count && 3 == depth);
+    TEST_TRUE(mpack_ok == mpack_tree_count_nodes("\x82\xa1""a\x91\xc0\xc4\x02""bc\x80", 10, &count, &depth));
+    TEST_TRUE(6 == count && 3 == depth);
+
+    // only the first message is counted
+    TEST_TRUE(mpack_ok == mpack_tree_count_nodes("\x91\x01\x92\x01\x02", 5, &count, &depth));
+    TEST_TRUE(2 == count && 2 == depth);
+
+    // truncated and invalid messages
+    TEST_TRUE(mpack_error_invalid == mpack_tree_count_nodes("\x92\x01", 2, &count, &depth));
+    TEST_TRUE(0 == count && 0 == depth);
+    TEST_TRUE(mpack_error_invalid == mpack_tree_count_nodes("\x91\xa2""a", 3, &count, &depth));
+    TEST_TRUE(mpack_error_invalid == mpack_tree_count_nodes("\xc1", 1, &count, &depth));
+    TEST_TRUE(mpack_error_invalid == mpack_tree_count_nodes("", 0, &count, &depth));
+
+    // the depth is limited without malloc()
+    char deep[101];
+    mpack_memset(deep, (int)0x91, sizeof(deep) - 1);
+    deep[sizeof(deep) - 1] = (char)0xc0;
+    #ifdef MPACK_MALLOC
+    TEST_TRUE(mpack_ok == mpack_tree_count_nodes(deep, sizeof(deep), &count, &depth));
+    TEST_TRUE(101 == count && 101 == depth);
+    #else
+    TEST_TRUE(mpack_error_too_big == mpack_tree_count_nodes(deep, sizeof(deep), &count, &depth));
+    #endif
+}
+
+#ifdef MPACK_MALLOC
+static bool test_node_exact_allocs(void) {
+    // forty nested arrays around {"a": [1, 2, 3]}
+    char data[47];
+    mpack_memset(data, (int)0x91, 40);
+    mpack_memcpy(data + 40, "\x81\xa1""a\x93\x01\x02\x03", 7);
+    size_t length = 47;
+
+    // scanning deeper than MPACK_NODE_INITIAL_DEPTH allocates
+    size_t count;
+    size_t depth;
+    mpack_error_t scanned = mpack_tree_count_nodes(data, length, &count, &depth);
+    if (scanned == mpack_error_memory)
+        return false;
+    TEST_TRUE(mpack_ok == scanned);
+    TEST_TRUE(46 == count && 43 == depth);
+
+    mpack_tree_t tree;
+    mpack_tree_init_exact(&tree, data, length);
+    mpack_tree_set_spans(&tree, true);
+
+    int i;
+    for (i = 0; i < 2; ++i) {
+        mpack_tree_parse(&tree);
+        if (mpack_tree_error(&tree) == mpack_error_memory) {
+            mpack_tree_destroy(&tree);
+            return false;
+        }
+
+        mpack_node_t node = mpack_tree_root(&tree);
+        size_t j;
+        for (j = 0; j < 40; ++j)
+            node = mpack_node_array_at(node, 0);
+        size_t span_size;
+        TEST_TRUE(data + 40 == mpack_node_span(node, &span_size));
+        TEST_TRUE(length - 40 == span_size);
+        node = mpack_node_map_cstr(node, "a");
+        TEST_TRUE(3 == mpack_node_u8(mpack_node_array_at(node, 2)));
+
+        // all nodes (and the spans of all 41 containers) are in one block
+        mpack_node_data_t* last = mpack_node_array_at(node, 2).data;
+        TEST_TRUE(last > mpack_tree_root(&tree).data);
+        TEST_TRUE((size_t)(last - mpack_tree_root(&tree).data) < 46 + 41);
+        TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+
+        // parse the same data again, reusing the block and parse stack
+        mpack_tree_reset(&tree, data, length);
+    }
+
+    #if MPACK_STATS
+    TEST_TRUE(1 == mpack_tree_stats(&tree).pages);
+    TEST_TRUE(1 == mpack_tree_stats(&tree).stack_grows);
+    #endif
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // a truncated message falls back to pages and flags the usual error
+    mpack_tree_init_exact(&tree, data, length - 1);
+    mpack_tree_parse(&tree);
+    if (mpack_tree_error(&tree) == mpack_error_memory) {
+        mpack_tree_destroy(&tree);
+        return false;
+    }
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_invalid);
+    return true;
+}
+#endif
+
+#ifdef MPACK_MALLOC
+static bool test_node_batch_allocs(void) {
+    // many small messages so that roots span several pages
+    char data[200];
+    size_t i;
+    for (i = 0; i < sizeof(data) / 2; ++i) {
+        data[i * 2] = (char)0x91;
+        data[i * 2 + 1] = (char)(i & 0x7f);
+    }
+
+    mpack_tree_t tree;
+    mpack_node_t roots[sizeof(data) / 2];
+    mpack_tree_init(&tree, data, sizeof(data));
+    size_t count = mpack_tree_parse_batch(&tree, roots, sizeof(roots) / sizeof(*roots));
+    if (mpack_tree_error(&tree) == mpack_error_memory) {
+        mpack_tree_destroy(&tree);
+        return false;
+    }
+
+    TEST_TRUE(count == sizeof(roots) / sizeof(*roots));
+    for (i = 0; i < count; ++i)
+        TEST_TRUE((i & 0x7f) == mpack_node_uint(mpack_node_array_at(roots[i], 0)));
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    return true;
+}
+
+static void test_node_batch_stream(void) {
+    mpack_tree_t tree;
+    mpack_node_t root;
+    mpack_tree_init_stream(&tree, &test_node_stream_read, NULL, 1000, 1000);
+    TEST_BREAK(0 == mpack_tree_parse_batch(&tree, &root, 1));
+    TEST_TREE_DESTROY_ERROR(&tree, mpack_error_bug);
+}
+#endif
+
+#ifdef MPACK_MALLOC
+// writes a deep array followed by a map that gets indexed
+static size_t test_node_deep_map_data(char* buf) {
+    char* p = buf;
+    int i;
+    for (i = 0; i < 100; ++i)
+        *p++ = (char)0x91;
+    *p++ = 0x07;
+    p += test_node_map_index_data(p);
+    return (size_t)(p - buf);
+}
+
+static void test_node_reset(void) {
+    static char buf[4096];
+    size_t length = test_node_deep_map_data(buf);
+
+    // once the tree has parsed a deep message, parsing it again after a reset
+    // allocates nothing
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, buf, length);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+    size_t total = test_malloc_total_count();
+    int round;
+    for (round = 0; round < 3; ++round) {
+        mpack_tree_reset(&tree, buf, length);
+        mpack_tree_parse(&tree);
+        TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+        TEST_TRUE(101 == mpack_tree_size(&tree));
+    }
+    TEST_TRUE(test_malloc_total_count() == total);
+
+    // a reset clears the error
+    mpack_tree_reset(&tree, "\xc1", 1);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_error_invalid);
+    mpack_tree_reset(&tree, buf, length);
+    mpack_tree_parse(&tree);
+    TEST_TRUE(mpack_tree_error(&tree) == mpack_ok);
+
+    // without a reuse limit, the pages and stack are allocated again
+    mpack_tree_set_reuse_limit(&tree, 0);
+    mpack_tree_reset(&tree, buf, length);
+    total = test_malloc_total_count();
+    mpack_tree_parse(&tree);
+    TEST_TRUE(test_malloc_total_count() > total);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+
+    // a stream tree discards buffered data and keeps its buffer
+    test_node_stream_t stream_context;
+    stream_context.data = buf;
+    stream_context.length = length;
+    stream_context.pos = 0;
+    stream_context.step = 64;
+    mpack_tree_init_stream(&tree, &test_node_stream_read, &stream_context, 4096, 4096);
+    total = 0;
+    for (round = 0; round < 3; ++round) {
+        if (round == 2)
+            total = test_malloc_total_count();
+        mpack_tree_reset(&tree, NULL, 0);
+        stream_context.pos = 0;
+        mpack_tree_parse(&tree);
+        TEST_TRUE(101 == mpack_tree_size(&tree));
+        mpack_tree_parse(&tree);
+        TEST_TRUE(21 == mpack_node_i32(mpack_node_map_cstr(mpack_tree_root(&tree), "k21")));
+    }
+    TEST_TRUE(test_malloc_total_count() == total);
+    TEST_TREE_DESTROY_NOERROR(&tree);
+}
+
+static void test_node_pipeline_step(size_t step) {
+    static const char test[] = "\xa5hello\x92\x01\xa3""abc\x93\x01\x02\x03\xc0";
+    test_node_stream_t stream_context;
+    stream_context.data = test;
+    stream_context.length = sizeof(test) - 1;
+    stream_context.pos = 0;
+    stream_context.step = step;
+
+    mpack_tree_t trees[2];
+    mpack_tree_init_stream(&trees[0], &test_node_stream_read, &stream_context, 1000, 1000);
+    mpack_tree_init_stream(&trees[1], &test_node_stream_read, &stream_context, 1000, 1000);
+
+    // each message stays valid while the next is parsed into the other tree
+    mpack_tree_parse(&trees[0]);
+    mpack_tree_pipeline(&trees[0], &trees[1]);
+    mpack_tree_parse(&trees[1]);
+    TEST_TRUE(mpack_node_strlen(mpack_tree_root(&trees[0])) == 5);
+    TEST_TRUE(0 == memcmp(mpack_node_str(mpack_tree_root(&trees[0])), "hello", 5));
+    mpack_tree_pipeline(&trees[1], &trees[0]);
+    mpack_tree_parse(&trees[0]);
+    mpack_node_t root = mpack_tree_root(&trees[1]);
+    TEST_TRUE(1 == mpack_node_int(mpack_node_array_at(root, 0)));
+    TEST_TRUE(0 == memcmp(mpack_node_str(mpack_node_array_at(root, 1)), "abc", 3));
+    mpack_tree_pipeline(&trees[0], &trees[1]);
+    mpack_tree_parse(&trees[1]);
+    TEST_TRUE(3 == mpack_node_array_length(mpack_tree_root(&trees[0])));
+    TEST_TRUE(3 == mpack_node_int(mpack_node_array_at(mpack_tree_root(&trees[0]), 2)));
+    mpack_node_nil(mpack_tree_root(&trees[1]));
+    TEST_TRUE(stream_context.pos == stream_context.length);
+
+    // the end of the stream is reached in the other tree
+    mpack_tree_pipeline(&trees[1], &trees[0]);
+    TEST_TRUE(!mpack_tree_try_parse(&trees[0]));
+    TEST_TREE_DESTROY_NOERROR(&trees[0]);
+    TEST_TREE_DESTROY_NOERROR(&trees[1]);
+}
+
+static void test_node_pipeline(void) {
+    test_node_pipeline_step(1);
+    test_node_pipeline_step(3);
+    test_node_pipeline_step(4096);
+
+    test_node_stream_t stream_context;
+    stream_context.data = "\xc0";
+    stream_context.length = 1;
+    stream_context.pos = 0;
+    stream_context.step = 1;
+    mpack_tree_t trees[2];
+
+    // the tree must have parsed a message
+    mpack_tree_init_stream(&trees[0], &test_node_stream_read, &stream_context, 1000, 1000);
+    mpack_tree_init_stream(&trees[1], &test_node_stream_read, &stream_context, 1000, 1000);
+    TEST_BREAK((mpack_tree_pipeline(&trees[0], &trees[1]), true));
+    TEST_TREE_DESTROY_NOERROR(&trees[0]);
+    TEST_TREE_DESTROY_ERROR(&trees[1], mpack_error_bug);
+
+    // errors are passed along
+    mpack_tree_init_stream(&trees[0], &test_node_stream_read, &stream_context, 1000, 1000);
+    mpack_tree_init_stream(&trees[1], &test_node_stream_read, &stream_context, 1000, 1000);
+    mpack_tree_flag_error(&trees[0], mpack_error_io);
+    mpack_tree_pipeline(&trees[0], &trees[1]);
+    TEST_TREE_DESTROY_ERROR(&trees[0], mpack_error_io);
+    TEST_TREE_DESTROY_ERROR(&trees[1], mpack_error_io);
+
+    // both trees must be streams
+    mpack_tree_init_data(&trees[0], "\xc0\xc0", 2);
+    mpack_tree_init_stream(&trees[1], &test_node_stream_read, &stream_context, 1000, 1000);
+    mpack_tree_parse(&trees[0]);
+    TEST_BREAK((mpack_tree_pipeline(&trees[0], &trees[1]), true));
+    TEST_TREE_DESTROY_NOERROR(&trees[0]);
+    TEST_TREE_DESTROY_ERROR(&trees[1], mpack_error_bug);
+}
+
+static bool test_node_allocator(void) {
+    // a deep message from a stream uses the allocator for the buffer, pages,
+    // parse stack and map indices
+    static char buf[4096];
+    test_node_stream_t stream_context;
+    stream_context.data = buf;
+    stream_context.length = test_node_deep_map_data(buf);
+    stream_context.pos = 0;
+    stream_context.step = 64;
+
+    mpack_allocator_t allocator;
+    size_t active;
+    test_allocator_init(&allocator, &active);
+
+    mpack_tree_t tree;
+    mpack_tree_init_stream(&tree, &test_node_stream_read, &stream_context, 4096, 4096);
+    mpack_tree_set_allocator(&tree, &allocator);
+    mpack_tree_set_map_index(&tree, 1);
+    mpack_tree_parse(&tree);
+    mpack_tree_parse(&tree);
+    char* str = mpack_node_cstr_alloc(mpack_node_map_key_at(mpack_tree_root(&tree), 5), 4);
+    if (mpack_tree_error(&tree) == mpack_error_memory) {
+        mpack_tree_destroy(&tree);
+        TEST_TRUE(active == 0);
+        return false;
+    }
+
+    TEST_TRUE(active > 2);
+    TEST_TRUE(0 == strcmp(str, "k05"));
+    TEST_TRUE(21 == mpack_node_i32(mpack_node_map_cstr(mpack_tree_root(&tree), "k21")));
+    TEST_TREE_DESTROY_NOERROR(&tree);
+    TEST_TRUE(active == 1);
+    allocator.release(allocator.context, str);
+    return true;
+}
+
+static bool test_node_arena(void) {
+    // once the arena has grown to fit a message, parsing it again after a
+    // reset allocates nothing
+    static char buf[4096];
+    buf[0] = (char)0x92;
+    size_t length = 1 + test_node_deep_map_data(buf + 1);
+
+    // an exact tree scans nested arrays deeper than its initial scan stack
+    char nested[MPACK_NODE_INITIAL_DEPTH * 3];
+    memset(nested, 0x91, sizeof(nested) - 1);
+    nested[sizeof(nested) - 1] = (char)0xc0;
+
+    mpack_arena_t arena;
+    mpack_arena_init(&arena);
+    mpack_allocator_t allocator = mpack_arena_allocator(&arena);
+    size_t total = 0;
+
+    int round;
+    for (round = 0; round < 2; ++round) {
+        if (round == 1)
+            total = test_malloc_total_count();
+
+        mpack_tree_t tree;
+        mpack_tree_init_data(&tree, buf, length);
+        mpack_tree_set_allocator(&tree, &allocator);
+        mpack_tree_set_map_index(&tree, 1);
+        mpack_tree_parse(&tree);
+        mpack_node_t map = mpack_node_array_at(mpack_tree_root(&tree), 1);
+        char* str = mpack_node_cstr_alloc(mpack_node_map_key_at(map, 5), 4);
+        if (mpack_tree_error(&tree) == mpack_error_memory) {
+            mpack_tree_destroy(&tree);
+            mpack_arena_destroy(&arena);
+            return false;
+        }
+
+        TEST_TRUE(0 == strcmp(str, "k05"));
+        TEST_TRUE(21 == mpack_node_i32(mpack_node_map_cstr(map, "k21")));
+        TEST_TREE_DESTROY_NOERROR(&tree);
+
+        mpack_tree_init_exact(&tree, nested, sizeof(nested));
+        mpack_tree_set_allocator(&tree, &allocator);
+        mpack_tree_parse(&tree);
+        if (mpack_tree_error(&tree) == mpack_error_memory) {
+            mpack_tree_destroy(&tree);
+            mpack_arena_destroy(&arena);
+            return false;
+        }
+        TEST_TRUE(mpack_node_array_length(mpack_tree_root(&tree)) == 1);
+        TEST_TREE_DESTROY_NOERROR(&tree);
+        mpack_arena_reset(&arena);
+    }
+
+    TEST_TRUE(test_malloc_total_count() == total);
+    mpack_arena_destroy(&arena);
+    return true;
+}
+#endif
+
 #if MPACK_DEBUG && MPACK_STDIO
 static void test_node_print_buffer(void) {
     static const char test[] = "\x82\xA7""compact\xC3\xA6""schema\x00";
@@ -1326,11 +2422,13 @@ void test_node(void) {
     // other
     test_node_read_misc();
     test_node_read_floats();
+    test_node_read_wide_values();
     test_node_read_bad_type();
     test_node_read_possible();
     test_node_read_pre_error();
     test_node_read_strings();
     test_node_read_enum();
+    test_node_read_typed_arrays();
     #if MPACK_EXTENSIONS
     test_node_read_timestamp();
     #endif
@@ -1339,18 +2437,45 @@ void test_node(void) {
     test_node_read_array();
     test_node_read_map();
     test_node_read_map_search();
+    #ifdef MPACK_MALLOC
+    test_node_read_map_index();
+    test_system_fail_until_ok(&test_node_map_index_allocs);
+    test_node_key_table();
+    test_system_fail_until_ok(&test_node_key_table_allocs);
+    #endif
+    test_node_lazy_pool();
+    #ifdef MPACK_MALLOC
+    test_system_fail_until_ok(&test_node_lazy_allocs);
+    #endif
+    test_node_equal();
+    #if MPACK_WRITER
+    test_node_write();
+    #if MPACK_DOUBLE
+    test_node_compact_floats();
+    #endif
+    #endif
     test_node_read_compound_errors();
     test_node_read_data();
     test_node_read_deep_stack();
 
     // message streams
     test_node_multiple_simple();
+    test_node_batch_pool();
+    test_node_split();
+    test_node_count_nodes();
     #ifdef MPACK_MALLOC
+    test_system_fail_until_ok(&test_node_exact_allocs);
     test_system_fail_until_ok(&test_node_multiple_allocs_memory);
     test_system_fail_until_ok(&test_node_multiple_allocs_stream1);
     test_system_fail_until_ok(&test_node_multiple_allocs_stream2);
     test_system_fail_until_ok(&test_node_multiple_allocs_stream3);
     test_system_fail_until_ok(&test_node_multiple_allocs_stream4096);
+    test_system_fail_until_ok(&test_node_batch_allocs);
+    test_node_batch_stream();
+    test_node_reset();
+    test_node_pipeline();
+    test_system_fail_until_ok(&test_node_allocator);
+    test_system_fail_until_ok(&test_node_arena);
     #endif
 }
 
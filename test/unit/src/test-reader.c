@@ -159,6 +159,315 @@ static void test_count_messages(void) {
     TEST_TRUE(!count_messages(test2, sizeof(test2)-1, &message_count));
 }
 
+static size_t test_reader_discard_fill(mpack_reader_t* reader, char* buffer, size_t count) {
+    // provides the data one byte at a time so that elements straddle the buffer
+    const char** data = (const char**)reader->context;
+    MPACK_UNUSED(count);
+    buffer[0] = **data;
+    ++*data;
+    return 1;
+}
+
+static void test_reader_discard(void) {
+    static const char test[] = "\x93\x92\xa3""abc\x81\x01\x90\xc4\x02xy\xdc\x00\x01\xc3\x2a";
+    mpack_reader_t reader;
+
+    // in a buffer, the whole element is skipped at once
+    mpack_reader_init_data(&reader, test, sizeof(test) - 1);
+    mpack_discard(&reader);
+    TEST_TRUE(mpack_tag_equal(mpack_tag_make_uint(42), mpack_read_tag(&reader)));
+    TEST_READER_DESTROY_NOERROR(&reader);
+
+    // in a stream, the element is read tag by tag
+    const char* data = test;
+    char buffer[MPACK_READER_MINIMUM_BUFFER_SIZE];
+    mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+    mpack_reader_set_context(&reader, &data);
+    mpack_reader_set_fill(&reader, test_reader_discard_fill);
+    mpack_discard(&reader);
+    TEST_TRUE(mpack_tag_equal(mpack_tag_make_uint(42), mpack_read_tag(&reader)));
+    TEST_READER_DESTROY_NOERROR(&reader);
+
+    // invalid data within a buffered element is still an error
+    TEST_SIMPLE_READ_ERROR("\x92\x01\xc1", (mpack_discard(&reader), true), mpack_error_invalid);
+}
+
+typedef struct test_reader_segments_t {
+    const char* const* segments;
+    size_t count;
+    size_t index;
+} test_reader_segments_t;
+
+static const char* test_reader_segment(mpack_reader_t* reader, size_t* size) {
+    test_reader_segments_t* segments = (test_reader_segments_t*)reader->context;
+    if (segments->index == segments->count)
+        return NULL;
+    const char* segment = segments->segments[segments->index++];
+    *size = strlen(segment);
+    return segment;
+}
+
+static void test_reader_segments(void) {
+    static const char* const test[] = {
+        "\x97\xcd\x01",
+        "\x02\xa5hel",
+        "lo\xc4\x04w",
+        "xyz",
+        "\xa3""abc",
+        "\xc4\x0a""abcd",
+        "efgh",
+        "ij\x2a",
+        "\xc3",
+    };
+    test_reader_segments_t segments = {test, sizeof(test) / sizeof(*test), 0};
+    char buffer[MPACK_READER_MINIMUM_BUFFER_SIZE];
+    char bytes[4];
+
+    mpack_reader_t reader;
+    mpack_reader_init_segments(&reader, buffer, sizeof(buffer), test_reader_segment);
+    mpack_reader_set_context(&reader, &segments);
+    TEST_TRUE(mpack_tag_equal(mpack_tag_make_array(7), mpack_read_tag(&reader)));
+
+    // a tag and an in-place read straddling segments are reassembled
+    TEST_TRUE(mpack_tag_equal(mpack_tag_make_uint(0x102), mpack_read_tag(&reader)));
+    TEST_TRUE(mpack_tag_equal(mpack_tag_make_str(5), mpack_read_tag(&reader)));
+    TEST_TRUE(0 == memcmp("hello", mpack_read_bytes_inplace(&reader, 5), 5));
+    mpack_done_str(&reader);
+
+    // a copying read straddling segments is copied directly
+    TEST_TRUE(mpack_tag_equal(mpack_tag_make_bin(4), mpack_read_tag(&reader)));
+    mpack_read_bytes(&reader, bytes, sizeof(bytes));
+    TEST_TRUE(0 == memcmp("wxyz", bytes, sizeof(bytes)));
+    mpack_done_bin(&reader);
+
+    // an in-place read within a segment references it
+    TEST_TRUE(mpack_tag_equal(mpack_tag_make_str(3), mpack_read_tag(&reader)));
+    TEST_TRUE(test[4] + 1 == mpack_read_bytes_inplace(&reader, 3));
+    mpack_done_str(&reader);
+
+    // skipping across segments
+    mpack_discard(&reader);
+    TEST_TRUE(mpack_tag_equal(mpack_tag_make_uint(42), mpack_read_tag(&reader)));
+    TEST_TRUE(mpack_tag_equal(mpack_tag_make_true(), mpack_read_tag(&reader)));
+    mpack_done_array(&reader);
+    TEST_TRUE(segments.index == segments.count);
+
+    // the end of the input is an io error
+    mpack_read_tag(&reader);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_io);
+
+    // an in-place read straddling segments must fit in the buffer
+    static const char* const big[] = {"\xc4\x40", "ab", "c"};
+    test_reader_segments_t big_segments = {big, sizeof(big) / sizeof(*big), 0};
+    mpack_reader_init_segments(&reader, buffer, sizeof(buffer), test_reader_segment);
+    mpack_reader_set_context(&reader, &big_segments);
+    TEST_TRUE(mpack_tag_equal(mpack_tag_make_bin(64), mpack_read_tag(&reader)));
+    TEST_TRUE(NULL == mpack_read_bytes_inplace(&reader, 64));
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_too_big);
+}
+
+#if MPACK_EXPECT
+typedef struct test_reader_nonblocking_t {
+    const char* data;
+    size_t length;
+    size_t pos;
+    size_t available; // the number of bytes that can be read without blocking
+} test_reader_nonblocking_t;
+
+static size_t test_reader_nonblocking_fill(mpack_reader_t* reader, char* buffer, size_t count) {
+    test_reader_nonblocking_t* source = (test_reader_nonblocking_t*)reader->context;
+    if (source->pos == source->available) {
+        mpack_reader_flag_error(reader, mpack_error_would_block);
+        return 0;
+    }
+    if (count > source->available - source->pos)
+        count = source->available - source->pos;
+    memcpy(buffer, source->data + source->pos, count);
+    source->pos += count;
+    return count;
+}
+
+static void test_reader_nonblocking(void) {
+    static const char test[] =
+        "\x94\xa5hello\xcd\x03\xe8\x92\xc3\xc0"
+        "\xd9\x28""abcdefghijklmnopqrstuvwxyz0123456789ABCD";
+    test_reader_nonblocking_t source = {test, sizeof(test) - 1, 0, 0};
+    char buffer[64];
+    char str[64];
+    int resumes = 0;
+
+    mpack_reader_t reader;
+    mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+    mpack_reader_set_context(&reader, &source);
+    mpack_reader_set_fill(&reader, test_reader_nonblocking_fill);
+
+    // each step is retried from its checkpoint until the data is available,
+    // three bytes at a time
+    int step = 0;
+    while (step < 5) {
+        mpack_reader_checkpoint(&reader);
+        switch (step) {
+            case 0:
+                mpack_expect_array_match(&reader, 4);
+                break;
+            case 1:
+                mpack_expect_cstr(&reader, str, sizeof(str));
+                break;
+            case 2:
+                TEST_TRUE(1000 == mpack_expect_u16(&reader) || mpack_reader_error(&reader) != mpack_ok);
+                break;
+            case 3:
+                mpack_expect_array_match(&reader, 2);
+                mpack_expect_true(&reader);
+                mpack_expect_nil(&reader);
+                mpack_done_array(&reader);
+                break;
+            default:
+                mpack_expect_cstr(&reader, str, sizeof(str));
+                break;
+        }
+
+        if (mpack_reader_resume(&reader)) {
+            ++resumes;
+            source.available += 3;
+            if (source.available > source.length)
+                source.available = source.length;
+            continue;
+        }
+        TEST_TRUE(mpack_reader_error(&reader) == mpack_ok);
+        if (step == 1)
+            TEST_TRUE(0 == strcmp(str, "hello"));
+        ++step;
+    }
+    mpack_done_array(&reader);
+    TEST_TRUE(0 == strcmp(str, "abcdefghijklmnopqrstuvwxyz0123456789ABCD"));
+    TEST_TRUE(resumes > 5);
+    TEST_READER_DESTROY_NOERROR(&reader);
+
+    // everything since the checkpoint must fit in the buffer
+    source.pos = 0;
+    source.available = source.length;
+    mpack_reader_init(&reader, buffer, MPACK_READER_MINIMUM_BUFFER_SIZE, 0);
+    mpack_reader_set_context(&reader, &source);
+    mpack_reader_set_fill(&reader, test_reader_nonblocking_fill);
+    mpack_reader_checkpoint(&reader);
+    mpack_discard(&reader);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_too_big);
+
+    // without a checkpoint, would-block is an io error
+    source.pos = 0;
+    source.available = 2;
+    mpack_reader_init(&reader, buffer, sizeof(buffer), 0);
+    mpack_reader_set_context(&reader, &source);
+    mpack_reader_set_fill(&reader, test_reader_nonblocking_fill);
+    mpack_discard(&reader);
+    TEST_TRUE(!mpack_reader_resume(&reader));
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_io);
+}
+#endif
+
+static void test_reader_path_compile(void) {
+    mpack_path_t path;
+
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, ""));
+    TEST_TRUE(0 == path.count);
+
+    static const char expression[] = "events[*].user[12].*.id";
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, expression));
+    TEST_TRUE(6 == path.count);
+    TEST_TRUE(mpack_path_step_key == path.steps[0].type);
+    TEST_TRUE(expression == path.steps[0].key && 6 == path.steps[0].length);
+    TEST_TRUE(mpack_path_step_wildcard == path.steps[1].type);
+    TEST_TRUE(mpack_path_step_key == path.steps[2].type);
+    TEST_TRUE(mpack_path_step_index == path.steps[3].type && 12 == path.steps[3].length);
+    TEST_TRUE(mpack_path_step_wildcard == path.steps[4].type);
+    TEST_TRUE(mpack_path_step_key == path.steps[5].type && 2 == path.steps[5].length);
+
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "[0][1]"));
+    TEST_TRUE(2 == path.count);
+
+    // malformed expressions
+    TEST_TRUE(mpack_error_invalid == mpack_path_compile(&path, ".a"));
+    TEST_TRUE(mpack_error_invalid == mpack_path_compile(&path, "a..b"));
+    TEST_TRUE(mpack_error_invalid == mpack_path_compile(&path, "a."));
+    TEST_TRUE(mpack_error_invalid == mpack_path_compile(&path, "a[0]b"));
+    TEST_TRUE(mpack_error_invalid == mpack_path_compile(&path, "a[]"));
+    TEST_TRUE(mpack_error_invalid == mpack_path_compile(&path, "a[x]"));
+    TEST_TRUE(mpack_error_invalid == mpack_path_compile(&path, "a[0"));
+    TEST_TRUE(mpack_error_invalid == mpack_path_compile(&path, "a]"));
+    TEST_TRUE(mpack_error_invalid == mpack_path_compile(&path, "[4294967296]"));
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "[4294967295]"));
+
+    // too many steps
+    char deep[MPACK_PATH_MAX_STEPS * 3 + 4];
+    size_t i;
+    for (i = 0; i <= MPACK_PATH_MAX_STEPS; ++i)
+        mpack_memcpy(deep + i * 3, "[0]", 3);
+    deep[(MPACK_PATH_MAX_STEPS + 1) * 3] = '\0';
+    TEST_TRUE(mpack_error_too_big == mpack_path_compile(&path, deep));
+    deep[MPACK_PATH_MAX_STEPS * 3] = '\0';
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, deep));
+}
+
+static void test_reader_path_find(void) {
+    // {"events": [{"user": {"id": 1}}, 5, {"user": {"name": "x"}},
+    //     {"user": {"id": "two"}, "id": 3}], "user": {"id": 4}}
+    static const char data[] =
+        "\x82"
+        "\xa6" "events" "\x94"
+            "\x81" "\xa4" "user" "\x81" "\xa2" "id" "\x01"
+            "\x05"
+            "\x81" "\xa4" "user" "\x81" "\xa4" "name" "\xa1" "x"
+            "\x82" "\xa4" "user" "\x81" "\xa2" "id" "\xa3" "two" "\xa2" "id" "\x03"
+        "\xa4" "user" "\x81" "\xa2" "id" "\x04";
+    size_t length = sizeof(data) - 1;
+
+    mpack_path_t path;
+    mpack_path_match_t matches[4];
+    size_t count;
+
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "events[*].user.id"));
+    TEST_TRUE(mpack_ok == mpack_path_find(&path, data, length, matches, 4, &count));
+    TEST_TRUE(2 == count);
+    TEST_TRUE(mpack_tag_equal(mpack_tag_uint(1), matches[0].tag));
+    TEST_TRUE(1 == matches[0].size && 1 == *matches[0].data);
+    TEST_TRUE(mpack_type_str == matches[1].tag.type && 4 == matches[1].size);
+    TEST_TRUE(0 == memcmp(matches[1].data, "\xa3" "two", 4));
+
+    // wildcards match map values
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "*.id"));
+    TEST_TRUE(mpack_ok == mpack_path_find(&path, data, length, matches, 4, &count));
+    TEST_TRUE(1 == count);
+    TEST_TRUE(mpack_tag_equal(mpack_tag_uint(4), matches[0].tag));
+
+    // containers are matched with their contents
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "events[2]"));
+    TEST_TRUE(mpack_ok == mpack_path_find(&path, data, length, matches, 4, &count));
+    TEST_TRUE(1 == count);
+    TEST_TRUE(mpack_type_map == matches[0].tag.type && 1 == matches[0].tag.v.n);
+    TEST_TRUE(14 == matches[0].size);
+
+    // the root, and paths that don't exist
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, ""));
+    TEST_TRUE(mpack_ok == mpack_path_find(&path, data, length, matches, 4, &count));
+    TEST_TRUE(1 == count && data == matches[0].data && length == matches[0].size);
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "events[9]"));
+    TEST_TRUE(mpack_ok == mpack_path_find(&path, data, length, matches, 4, &count));
+    TEST_TRUE(0 == count);
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "events.user"));
+    TEST_TRUE(mpack_ok == mpack_path_find(&path, data, length, matches, 4, &count));
+    TEST_TRUE(0 == count);
+
+    // too many matches
+    TEST_TRUE(mpack_ok == mpack_path_compile(&path, "events[*]"));
+    TEST_TRUE(mpack_error_too_big == mpack_path_find(&path, data, length, matches, 3, &count));
+    TEST_TRUE(3 == count);
+    TEST_TRUE(mpack_tag_equal(mpack_tag_uint(5), matches[1].tag));
+
+    // truncated
+    TEST_TRUE(mpack_error_invalid == mpack_path_find(&path, data, length - 1, matches, 4, &count));
+}
+
 void test_reader() {
     #if MPACK_DEBUG && MPACK_STDIO
     test_print_buffer();
@@ -169,6 +478,13 @@ void test_reader() {
     test_reader_should_inplace();
     test_reader_miscellaneous();
     test_count_messages();
+    test_reader_discard();
+    test_reader_segments();
+    test_reader_path_compile();
+    test_reader_path_find();
+    #if MPACK_EXPECT
+    test_reader_nonblocking();
+    #endif
 }
 
 #endif
@@ -0,0 +1,304 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test-sax.h"
+
+#if MPACK_SAX
+
+// Events are logged as text. Each element is logged as its depth and a
+// letter for its type, and str, bin and ext data is logged in quotes. Maps
+// and arrays are closed with their depth and a closing bracket.
+typedef struct test_sax_log_t {
+    char text[512];
+    size_t length;
+    int64_t sum; // the sum of all int and uint values
+    size_t pieces; // the number of data callbacks
+    bool stop_at_nil; // whether to flag an error at a nil element
+} test_sax_log_t;
+
+static void test_sax_append(test_sax_log_t* log, char c) {
+    TEST_TRUE(log->length < sizeof(log->text) - 1);
+    if (log->length < sizeof(log->text) - 1)
+        log->text[log->length++] = c;
+}
+
+static void test_sax_element(mpack_sax_t* sax, size_t depth, mpack_tag_t tag) {
+    test_sax_log_t* log = (test_sax_log_t*)mpack_sax_context(sax);
+    test_sax_append(log, (char)('0' + depth));
+
+    switch (tag.type) {
+        case mpack_type_nil:
+            test_sax_append(log, 'n');
+            if (log->stop_at_nil)
+                mpack_sax_flag_error(sax, mpack_error_data);
+            break;
+        case mpack_type_bool:
+            test_sax_append(log, tag.v.b ? 't' : 'f');
+            break;
+        case mpack_type_int:
+            test_sax_append(log, 'i');
+            log->sum += tag.v.i;
+            break;
+        case mpack_type_uint:
+            test_sax_append(log, 'u');
+            log->sum += (int64_t)tag.v.u;
+            break;
+        case mpack_type_str:
+            test_sax_append(log, 's');
+            test_sax_append(log, '"');
+            break;
+        case mpack_type_bin:
+            test_sax_append(log, 'b');
+            test_sax_append(log, '"');
+            break;
+        #if MPACK_EXTENSIONS
+        case mpack_type_ext:
+            test_sax_append(log, 'e');
+            test_sax_append(log, '"');
+            break;
+        #endif
+        case mpack_type_array:
+            test_sax_append(log, '[');
+            break;
+        case mpack_type_map:
+            test_sax_append(log, '{');
+            break;
+        default:
+            test_sax_append(log, '?');
+            break;
+    }
+}
+
+static void test_sax_data(mpack_sax_t* sax, size_t depth, const char* data, size_t size) {
+    MPACK_UNUSED(depth);
+    test_sax_log_t* log = (test_sax_log_t*)mpack_sax_context(sax);
+    TEST_TRUE(size > 0);
+    ++log->pieces;
+    size_t i;
+    for (i = 0; i < size; ++i)
+        test_sax_append(log, data[i]);
+}
+
+static void test_sax_finish(mpack_sax_t* sax, size_t depth, mpack_type_t type) {
+    test_sax_log_t* log = (test_sax_log_t*)mpack_sax_context(sax);
+    if (type == mpack_type_array || type == mpack_type_map) {
+        test_sax_append(log, (char)('0' + depth));
+        test_sax_append(log, type == mpack_type_array ? ']' : '}');
+    } else {
+        test_sax_append(log, '"');
+    }
+}
+
+static const mpack_sax_callbacks_t test_sax_callbacks = {
+    test_sax_element,
+    test_sax_data,
+    test_sax_finish,
+};
+
+static void test_sax_log_init(test_sax_log_t* log) {
+    mpack_memset(log, 0, sizeof(*log));
+}
+
+static bool test_sax_log_matches(test_sax_log_t* log, const char* expected) {
+    return log->length == strlen(expected) && memcmp(log->text, expected, log->length) == 0;
+}
+
+// an array of every kind of element that doesn't depend on configuration
+static const char test_sax_data_message[] =
+    "\x99"
+    "\x01"
+    "\xff"
+    "\xa2" "ab"
+    "\x82" "\xa1" "k" "\xc0" "\xa0" "\xc3"
+    "\xc4\x02" "xy"
+    "\x90"
+    "\xcf\x00\x00\x01\x00\x00\x00\x00\x00"
+    "\xde\x00\x01" "\x01" "\xc2"
+    "\xd9\x03" "xyz";
+
+static const char test_sax_data_log[] =
+    "0[" "1u" "1i" "1s\"ab\""
+    "1{" "2s\"k\"" "2n" "2s\"\"" "2t" "1}"
+    "1b\"xy\"" "1[1]" "1u" "1{2u2f1}" "1s\"xyz\"" "0]";
+
+static void test_sax_chunks(void) {
+    size_t length = sizeof(test_sax_data_message) - 1;
+    test_sax_log_t log;
+    mpack_sax_t sax;
+
+    // the whole message at once
+    test_sax_log_init(&log);
+    mpack_sax_init(&sax, &test_sax_callbacks, &log);
+    mpack_sax_parse(&sax, test_sax_data_message, length);
+    TEST_TRUE(!mpack_sax_in_message(&sax));
+    TEST_TRUE(mpack_sax_destroy(&sax) == mpack_ok);
+    TEST_TRUE(test_sax_log_matches(&log, test_sax_data_log));
+    TEST_TRUE(log.sum == ((int64_t)1 << 40) + 1);
+
+    // split in two at every possible position, including inside tags
+    size_t i;
+    for (i = 0; i <= length; ++i) {
+        test_sax_log_init(&log);
+        mpack_sax_init(&sax, &test_sax_callbacks, &log);
+        mpack_sax_parse(&sax, test_sax_data_message, i);
+        TEST_TRUE(mpack_sax_in_message(&sax) == (i > 0 && i < length));
+        mpack_sax_parse(&sax, test_sax_data_message + i, length - i);
+        TEST_TRUE(mpack_sax_destroy(&sax) == mpack_ok);
+        TEST_TRUE(test_sax_log_matches(&log, test_sax_data_log));
+        TEST_TRUE(log.sum == ((int64_t)1 << 40) + 1);
+    }
+
+    // one byte at a time
+    test_sax_log_init(&log);
+    mpack_sax_init(&sax, &test_sax_callbacks, &log);
+    for (i = 0; i < length; ++i)
+        mpack_sax_parse(&sax, test_sax_data_message + i, 1);
+    TEST_TRUE(mpack_sax_destroy(&sax) == mpack_ok);
+    TEST_TRUE(test_sax_log_matches(&log, test_sax_data_log));
+}
+
+static void test_sax_large_str(void) {
+    char data[3 + 300];
+    data[0] = (char)0xda;
+    data[1] = (char)0x01;
+    data[2] = (char)0x2c;
+    mpack_memset(data + 3, 'x', 300);
+
+    // the str data is passed in place, in one piece per chunk
+    test_sax_log_t log;
+    mpack_sax_t sax;
+    test_sax_log_init(&log);
+    mpack_sax_init(&sax, &test_sax_callbacks, &log);
+    size_t pos;
+    for (pos = 0; pos < sizeof(data); pos += 64) {
+        size_t size = sizeof(data) - pos < 64 ? sizeof(data) - pos : 64;
+        mpack_sax_parse(&sax, data + pos, size);
+    }
+    TEST_TRUE(mpack_sax_destroy(&sax) == mpack_ok);
+    TEST_TRUE(log.pieces == 5);
+    TEST_TRUE(log.length == 3 + 300 + 1);
+}
+
+static void test_sax_messages(void) {
+    test_sax_log_t log;
+    mpack_sax_t sax;
+    test_sax_log_init(&log);
+    mpack_sax_init(&sax, &test_sax_callbacks, &log);
+
+    // consecutive messages each start at depth 0
+    mpack_sax_parse(&sax, "\x01\x91\x02\xa0", 4);
+    TEST_TRUE(!mpack_sax_in_message(&sax));
+    mpack_sax_parse(&sax, "\x80\x92", 2);
+    TEST_TRUE(mpack_sax_in_message(&sax));
+    mpack_sax_parse(&sax, "\xc0\xc0", 2);
+    TEST_TRUE(!mpack_sax_in_message(&sax));
+    TEST_TRUE(mpack_sax_destroy(&sax) == mpack_ok);
+    TEST_TRUE(test_sax_log_matches(&log, "0u0[1u0]0s\"\"0{0}0[1n1n0]"));
+
+    // NULL callbacks are skipped
+    mpack_sax_callbacks_t callbacks = {NULL, NULL, NULL};
+    mpack_sax_init(&sax, &callbacks, NULL);
+    mpack_sax_parse(&sax, test_sax_data_message, sizeof(test_sax_data_message) - 1);
+    TEST_TRUE(mpack_sax_destroy(&sax) == mpack_ok);
+}
+
+static void test_sax_errors(void) {
+    test_sax_log_t log;
+    mpack_sax_t sax;
+
+    // truncated
+    test_sax_log_init(&log);
+    mpack_sax_init(&sax, &test_sax_callbacks, &log);
+    mpack_sax_parse(&sax, "\x92\x01", 2);
+    TEST_TRUE(mpack_sax_error(&sax) == mpack_ok);
+    TEST_TRUE(mpack_sax_destroy(&sax) == mpack_error_invalid);
+
+    // truncated inside a tag
+    mpack_sax_init(&sax, &test_sax_callbacks, &log);
+    mpack_sax_parse(&sax, "\xcd\x01", 2);
+    TEST_TRUE(mpack_sax_destroy(&sax) == mpack_error_invalid);
+
+    // reserved byte
+    test_sax_log_init(&log);
+    mpack_sax_init(&sax, &test_sax_callbacks, &log);
+    mpack_sax_parse(&sax, "\x92\x01\xc1\x02", 4);
+    TEST_TRUE(mpack_sax_error(&sax) == mpack_error_invalid);
+    TEST_TRUE(test_sax_log_matches(&log, "0[1u"));
+
+    // further data is ignored
+    mpack_sax_parse(&sax, "\x01", 1);
+    TEST_TRUE(test_sax_log_matches(&log, "0[1u"));
+    TEST_TRUE(mpack_sax_destroy(&sax) == mpack_error_invalid);
+
+    // a callback can stop parsing
+    test_sax_log_init(&log);
+    log.stop_at_nil = true;
+    mpack_sax_init(&sax, &test_sax_callbacks, &log);
+    mpack_sax_parse(&sax, test_sax_data_message, sizeof(test_sax_data_message) - 1);
+    TEST_TRUE(mpack_sax_destroy(&sax) == mpack_error_data);
+    TEST_TRUE(test_sax_log_matches(&log, "0[1u1i1s\"ab\"1{2s\"k\"2n"));
+
+    // the depth is limited
+    mpack_sax_callbacks_t callbacks = {NULL, NULL, NULL};
+    char deep[MPACK_SAX_MAX_DEPTH + 2];
+    mpack_memset(deep, (int)0x91, sizeof(deep));
+    deep[MPACK_SAX_MAX_DEPTH] = (char)0xc0;
+    mpack_sax_init(&sax, &callbacks, NULL);
+    mpack_sax_parse(&sax, deep, MPACK_SAX_MAX_DEPTH + 1);
+    TEST_TRUE(mpack_sax_destroy(&sax) == mpack_ok);
+    deep[MPACK_SAX_MAX_DEPTH] = (char)0x91;
+    deep[MPACK_SAX_MAX_DEPTH + 1] = (char)0xc0;
+    mpack_sax_init(&sax, &callbacks, NULL);
+    mpack_sax_parse(&sax, deep, sizeof(deep));
+    TEST_TRUE(mpack_sax_destroy(&sax) == mpack_error_too_big);
+}
+
+#if MPACK_EXTENSIONS
+static void test_sax_ext(void) {
+    test_sax_log_t log;
+    mpack_sax_t sax;
+    test_sax_log_init(&log);
+    mpack_sax_init(&sax, &test_sax_callbacks, &log);
+    mpack_sax_parse(&sax, "\x92\xd4\x05\x07\xc7\x00\x01", 7);
+    TEST_TRUE(mpack_sax_destroy(&sax) == mpack_ok);
+    TEST_TRUE(test_sax_log_matches(&log, "0[1e\"\x07\"1e\"\"0]"));
+}
+#endif
+
+void test_sax(void) {
+    test_sax_chunks();
+    test_sax_large_str();
+    test_sax_messages();
+    test_sax_errors();
+    #if MPACK_EXTENSIONS
+    test_sax_ext();
+    #else
+    test_sax_log_t log;
+    mpack_sax_t sax;
+    test_sax_log_init(&log);
+    mpack_sax_init(&sax, &test_sax_callbacks, &log);
+    mpack_sax_parse(&sax, "\x91\xd4\x05\x07", 4);
+    TEST_TRUE(mpack_sax_destroy(&sax) == mpack_error_unsupported);
+    TEST_TRUE(test_sax_log_matches(&log, "0["));
+    #endif
+}
+
+#endif
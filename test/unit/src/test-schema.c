@@ -0,0 +1,486 @@
+/*
+ * Copyright (c) 2015-2021 Nicholas Fraser and the MPack authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test-schema.h"
+#include "test-write.h"
+#include "test-reader.h"
+#include "test-node.h"
+
+#if MPACK_SCHEMA
+
+typedef struct test_schema_point_t {
+    uint32_t id;
+    int16_t dx;
+    bool visible;
+    char name[8];
+} test_schema_point_t;
+
+static const mpack_field_t test_schema_point_fields[] = {
+    MPACK_FIELD(test_schema_point_t, id, mpack_field_u32, 0),
+    MPACK_FIELD(test_schema_point_t, dx, mpack_field_i16, 0),
+    MPACK_FIELD(test_schema_point_t, visible, mpack_field_bool, MPACK_FIELD_OPTIONAL),
+    MPACK_FIELD_KEY("a long key that needs a str8 tag", test_schema_point_t, name,
+            mpack_field_cstr, MPACK_FIELD_OPTIONAL),
+};
+
+#define TEST_SCHEMA_POINT_COUNT (sizeof(test_schema_point_fields) / sizeof(*test_schema_point_fields))
+
+#define TEST_SCHEMA_POINT_DATA \
+    "\x84" \
+    "\xa2" "id" "\xcd\x01\x2c" \
+    "\xa2" "dx" "\xfb" \
+    "\xa7" "visible" "\xc3" \
+    "\xd9\x20" "a long key that needs a str8 tag" "\xa3" "abc"
+
+static void test_schema_init_errors(void) {
+    mpack_schema_t schema;
+
+    static const mpack_field_t duplicate[] = {
+        MPACK_FIELD(test_schema_point_t, id, mpack_field_u32, 0),
+        MPACK_FIELD_KEY("id", test_schema_point_t, dx, mpack_field_i16, 0),
+    };
+    TEST_BREAK(mpack_schema_init(&schema, duplicate, 2) == mpack_error_bug);
+
+    static const mpack_field_t wrong_size[] = {
+        MPACK_FIELD(test_schema_point_t, id, mpack_field_u16, 0),
+    };
+    TEST_BREAK(mpack_schema_init(&schema, wrong_size, 1) == mpack_error_bug);
+
+    static const mpack_field_t str[] = {
+        MPACK_FIELD(test_schema_point_t, name, mpack_field_str, 0),
+    };
+    TEST_BREAK(mpack_schema_init(&schema, str, 1) == mpack_error_bug);
+
+    TEST_BREAK(mpack_schema_init(&schema, test_schema_point_fields, MPACK_SCHEMA_MAX_FIELDS + 1) == mpack_error_bug);
+
+    // an empty schema is fine
+    TEST_TRUE(mpack_schema_init(&schema, NULL, 0) == mpack_ok);
+    TEST_TRUE(mpack_schema_find(&schema, "", 0) == 0);
+    #if MPACK_EXPECT
+    mpack_reader_t reader;
+    TEST_READER_INIT_STR(&reader, "\x81\xa2" "id" "\x01");
+    mpack_decode_struct(&reader, &schema, NULL);
+    TEST_READER_DESTROY_NOERROR(&reader);
+    #endif
+    mpack_schema_destroy(&schema);
+}
+
+static bool test_schema_init_memory(void) {
+    mpack_schema_t schema;
+    mpack_error_t error = mpack_schema_init(&schema, test_schema_point_fields, TEST_SCHEMA_POINT_COUNT);
+    if (error == mpack_error_memory)
+        return false;
+    TEST_TRUE(error == mpack_ok);
+    mpack_schema_destroy(&schema);
+    return true;
+}
+
+static bool test_schema_init_allocator(void) {
+    mpack_allocator_t allocator;
+    size_t active;
+    test_allocator_init(&allocator, &active);
+    size_t base = test_malloc_active_count();
+
+    mpack_schema_t schema;
+    mpack_error_t error = mpack_schema_init_allocator(&schema, test_schema_point_fields,
+            TEST_SCHEMA_POINT_COUNT, &allocator);
+    TEST_TRUE(test_malloc_active_count() == base + active);
+    if (error == mpack_error_memory) {
+        TEST_TRUE(active == 0);
+        return false;
+    }
+    TEST_TRUE(error == mpack_ok);
+    TEST_TRUE(active > 0);
+    TEST_TRUE(mpack_schema_find(&schema, "dx", 2) == 1);
+    mpack_schema_destroy(&schema);
+    TEST_TRUE(active == 0);
+    return true;
+}
+
+typedef struct test_schema_values_t {
+    uint8_t values[MPACK_SCHEMA_MAX_FIELDS];
+} test_schema_values_t;
+
+static void test_schema_perfect_hash(void) {
+    // lots of similar keys all hash to separate slots
+    static char keys[MPACK_SCHEMA_MAX_FIELDS][4];
+    static mpack_field_t fields[MPACK_SCHEMA_MAX_FIELDS];
+    size_t i;
+    for (i = 0; i < MPACK_SCHEMA_MAX_FIELDS; ++i) {
+        keys[i][0] = 'k';
+        keys[i][1] = (char)('a' + i / 16);
+        keys[i][2] = (char)('a' + i % 16);
+        keys[i][3] = '\0';
+        fields[i].key = keys[i];
+        fields[i].type = mpack_field_u8;
+        fields[i].offset = offsetof(test_schema_values_t, values) + i;
+        fields[i].size = sizeof(uint8_t);
+        fields[i].flags = 0;
+    }
+
+    mpack_schema_t schema;
+    TEST_TRUE(mpack_schema_init(&schema, fields, MPACK_SCHEMA_MAX_FIELDS) == mpack_ok);
+    for (i = 0; i < MPACK_SCHEMA_MAX_FIELDS; ++i)
+        TEST_TRUE(mpack_schema_find(&schema, keys[i], 3) == i);
+    TEST_TRUE(mpack_schema_find(&schema, "kzz", 3) == MPACK_SCHEMA_MAX_FIELDS);
+    TEST_TRUE(mpack_schema_find(&schema, "ka", 2) == MPACK_SCHEMA_MAX_FIELDS);
+    TEST_TRUE(mpack_schema_find(&schema, "kaaa", 4) == MPACK_SCHEMA_MAX_FIELDS);
+
+    #if MPACK_WRITER && MPACK_EXPECT
+    test_schema_values_t in, out;
+    for (i = 0; i < MPACK_SCHEMA_MAX_FIELDS; ++i)
+        in.values[i] = (uint8_t)(i * 3);
+    char buf[1024];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_encode_struct(&writer, &schema, &in);
+    size_t used = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, buf, used);
+    mpack_decode_struct(&reader, &schema, &out);
+    TEST_READER_DESTROY_NOERROR(&reader);
+    TEST_TRUE(memcmp(&in, &out, sizeof(in)) == 0);
+    #endif
+
+    mpack_schema_destroy(&schema);
+}
+
+#if MPACK_WRITER
+static void test_schema_encode(const mpack_schema_t* schema) {
+    test_schema_point_t point = {300, -5, true, "abc"};
+    char buf[128];
+    mpack_writer_t writer;
+
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_encode_struct(&writer, schema, &point);
+    TEST_DESTROY_MATCH_IMPL(buf, TEST_SCHEMA_POINT_DATA);
+
+    // a name that fills its array is not null-terminated
+    memcpy(point.name, "abcdefgh", sizeof(point.name));
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_start_array(&writer, 1);
+    mpack_encode_struct(&writer, schema, &point);
+    mpack_finish_array(&writer);
+    size_t written = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(written == sizeof(TEST_SCHEMA_POINT_DATA) - 1 + 1 + 5);
+    TEST_TRUE(memcmp(buf + written - 9, "\xa8" "abcdefgh", 9) == 0);
+
+    #if MPACK_COMPATIBILITY
+    // v4 has no str8 so the key is written as str16
+    point.name[0] = '\0';
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_set_version(&writer, mpack_version_v4);
+    mpack_encode_struct(&writer, schema, &point);
+    TEST_DESTROY_MATCH_IMPL(buf,
+        "\x84"
+        "\xa2" "id" "\xcd\x01\x2c"
+        "\xa2" "dx" "\xfb"
+        "\xa7" "visible" "\xc3"
+        "\xda\x00\x20" "a long key that needs a str8 tag" "\xa0");
+    #endif
+}
+#endif
+
+#if MPACK_EXPECT
+static void test_schema_decode(const mpack_schema_t* schema) {
+    test_schema_point_t point;
+    mpack_reader_t reader;
+
+    memset(&point, 0, sizeof(point));
+    TEST_READER_INIT_STR(&reader, TEST_SCHEMA_POINT_DATA);
+    mpack_decode_struct(&reader, schema, &point);
+    TEST_READER_DESTROY_NOERROR(&reader);
+    TEST_TRUE(point.id == 300 && point.dx == -5 && point.visible && strcmp(point.name, "abc") == 0);
+
+    // keys in any order, unknown keys skipped, optional keys missing
+    memcpy(point.name, "keep", 5);
+    TEST_READER_INIT_STR(&reader,
+            "\x86"
+            "\xa7" "visible" "\xc2"
+            "\xa2" "dx" "\x05"
+            "\x01" "\xc0"
+            "\xa5" "other" "\x92\x01\x02"
+            "\xa2" "id" "\xcc\x07"
+            "\xd9\x29" "a key that is longer than any of the keys" "\xc0");
+    mpack_decode_struct(&reader, schema, &point);
+    TEST_READER_DESTROY_NOERROR(&reader);
+    TEST_TRUE(point.id == 7 && point.dx == 5 && !point.visible && strcmp(point.name, "keep") == 0);
+
+    // missing required key
+    TEST_READER_INIT_STR(&reader, "\x81\xa2" "id" "\x01");
+    mpack_decode_struct(&reader, schema, &point);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_data);
+
+    // duplicate key
+    TEST_READER_INIT_STR(&reader, "\x83\xa2" "id" "\x01\xa2" "dx" "\x01\xa2" "id" "\x02");
+    mpack_decode_struct(&reader, schema, &point);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_invalid);
+
+    // wrong type
+    TEST_READER_INIT_STR(&reader, "\x82\xa2" "id" "\xff\xa2" "dx" "\x01");
+    mpack_decode_struct(&reader, schema, &point);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_type);
+
+    // string that doesn't fit
+    TEST_READER_INIT_STR(&reader, "\x83\xa2" "id" "\x01\xa2" "dx" "\x01"
+            "\xd9\x20" "a long key that needs a str8 tag" "\xa8" "abcdefgh");
+    mpack_decode_struct(&reader, schema, &point);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_too_big);
+
+    // not a map
+    TEST_READER_INIT_STR(&reader, "\x90");
+    mpack_decode_struct(&reader, schema, &point);
+    TEST_READER_DESTROY_ERROR(&reader, mpack_error_type);
+}
+#endif
+
+#if MPACK_WRITER && MPACK_EXPECT && MPACK_FLOAT && MPACK_DOUBLE
+typedef struct test_schema_floats_t {
+    float f;
+    double d;
+    uint64_t u;
+    int64_t i;
+} test_schema_floats_t;
+
+static void test_schema_floats(void) {
+    static const mpack_field_t fields[] = {
+        MPACK_FIELD(test_schema_floats_t, f, mpack_field_float, 0),
+        MPACK_FIELD(test_schema_floats_t, d, mpack_field_double, 0),
+        MPACK_FIELD(test_schema_floats_t, u, mpack_field_u64, 0),
+        MPACK_FIELD(test_schema_floats_t, i, mpack_field_i64, 0),
+    };
+
+    mpack_schema_t schema;
+    TEST_TRUE(mpack_schema_init(&schema, fields, sizeof(fields) / sizeof(*fields)) == mpack_ok);
+
+    test_schema_floats_t in = {1.5f, -2.25, MPACK_UINT64_C(0x123456789), -MPACK_INT64_C(0x123456789)};
+    test_schema_floats_t out;
+    char buf[128];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_encode_struct(&writer, &schema, &in);
+    size_t used = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, buf, used);
+    mpack_decode_struct(&reader, &schema, &out);
+    TEST_READER_DESTROY_NOERROR(&reader);
+    TEST_TRUE(out.f == in.f && out.d == in.d && out.u == in.u && out.i == in.i);
+
+    mpack_schema_destroy(&schema);
+}
+#endif
+
+#if MPACK_NODE || MPACK_EXPECT
+static const char* test_schema_column_keys[] = {"ts", "id", "tag", "value"};
+
+// rows with missing, nil and unknown keys
+#define TEST_SCHEMA_COLUMNS_DATA \
+    "\x93" \
+    "\x84" "\xa2" "ts" "\x01" "\xa2" "id" "\x0a" "\xa3" "tag" "\xa1" "a" "\xa5" "value" "\xc0" \
+    "\x85" "\xa2" "id" "\x0b" "\xa3" "tag" "\xa2" "bc" "\xa2" "ts" "\x02" "\xa1" "x" "\x92\x01\x02" "\x05" "\x00" \
+    "\x82" "\xa2" "ts" "\x03" "\xa5" "value" "\xd0\x80"
+
+typedef struct test_schema_columns_t {
+    int64_t ts[4];
+    uint16_t id[4];
+    mpack_str_ref_t tag[4];
+    int32_t value[4];
+    uint8_t id_missing[1];
+    uint8_t tag_missing[1];
+    uint8_t value_missing[1];
+    mpack_column_t columns[4];
+} test_schema_columns_t;
+
+static void test_schema_columns_init(test_schema_columns_t* c) {
+    memset(c, 0xff, sizeof(*c));
+    c->columns[0].type = mpack_field_i64;
+    c->columns[0].values = c->ts;
+    c->columns[0].missing = NULL;
+    c->columns[1].type = mpack_field_u16;
+    c->columns[1].values = c->id;
+    c->columns[1].missing = c->id_missing;
+    c->columns[2].type = mpack_field_str;
+    c->columns[2].values = c->tag;
+    c->columns[2].missing = c->tag_missing;
+    c->columns[3].type = mpack_field_i32;
+    c->columns[3].values = c->value;
+    c->columns[3].missing = c->value_missing;
+}
+
+// checks the columns of TEST_SCHEMA_COLUMNS_DATA, with the tags at the given offsets from strings
+static void test_schema_columns_check(const test_schema_columns_t* c, const char* strings) {
+    TEST_TRUE(c->ts[0] == 1 && c->ts[1] == 2 && c->ts[2] == 3);
+    TEST_TRUE(c->id[0] == 10 && c->id[1] == 11 && c->id[2] == 0);
+    TEST_TRUE(c->id_missing[0] == 0x4);
+    TEST_TRUE(c->tag[0].length == 1 && memcmp(strings + c->tag[0].offset, "a", 1) == 0);
+    TEST_TRUE(c->tag[1].length == 2 && memcmp(strings + c->tag[1].offset, "bc", 2) == 0);
+    TEST_TRUE(c->tag[2].length == 0 && c->tag[2].offset == 0);
+    TEST_TRUE(c->tag_missing[0] == 0x4);
+    TEST_TRUE(c->value[0] == 0 && c->value[1] == 0 && c->value[2] == -128);
+    TEST_TRUE(c->value_missing[0] == 0x3);
+}
+#endif
+
+#if MPACK_NODE
+static size_t test_schema_node_columns(const char* data, size_t size,
+        const mpack_enum_matcher_t* keys, test_schema_columns_t* c, size_t max_rows, mpack_error_t error)
+{
+    mpack_tree_t tree;
+    mpack_tree_init_data(&tree, data, size);
+    mpack_tree_parse(&tree);
+    size_t rows = mpack_node_columns(mpack_tree_root(&tree), keys, c->columns, max_rows);
+    if (error == mpack_ok && rows == 3)
+        test_schema_columns_check(c, mpack_tree_data(&tree));
+    TEST_TREE_DESTROY_ERROR(&tree, error);
+    return rows;
+}
+
+static void test_schema_node_columns_errors(const mpack_enum_matcher_t* keys) {
+    test_schema_columns_t c;
+    test_schema_columns_init(&c);
+
+    #define TEST_SCHEMA_NODE_COLUMNS(data, error) \
+        TEST_TRUE(0 == test_schema_node_columns(data, sizeof(data) - 1, keys, &c, 4, error))
+
+    TEST_SCHEMA_NODE_COLUMNS("\x91\x81\xa2" "id" "\x01", mpack_error_data);          // missing required key
+    TEST_SCHEMA_NODE_COLUMNS("\x91\x82\xa2" "ts" "\x01\xa2" "ts" "\x02", mpack_error_data); // duplicate key
+    TEST_SCHEMA_NODE_COLUMNS("\x91\x81\xa2" "ts" "\xc0", mpack_error_type);          // nil required value
+    TEST_SCHEMA_NODE_COLUMNS("\x91\x82\xa2" "ts" "\x01\xa2" "id" "\xff", mpack_error_type); // out of range
+    TEST_SCHEMA_NODE_COLUMNS("\x91\x82\xa2" "ts" "\x01\xa3" "tag" "\x01", mpack_error_type); // not a str
+    TEST_SCHEMA_NODE_COLUMNS("\x91\x90", mpack_error_type);                          // row is not a map
+    TEST_SCHEMA_NODE_COLUMNS("\x80", mpack_error_type);                              // not an array
+
+    #undef TEST_SCHEMA_NODE_COLUMNS
+
+    // too many rows
+    TEST_TRUE(0 == test_schema_node_columns(TEST_SCHEMA_COLUMNS_DATA, sizeof(TEST_SCHEMA_COLUMNS_DATA) - 1,
+                keys, &c, 2, mpack_error_too_big));
+
+    // unsupported column type
+    c.columns[2].type = mpack_field_cstr;
+    TEST_BREAK(0 == test_schema_node_columns(TEST_SCHEMA_COLUMNS_DATA, sizeof(TEST_SCHEMA_COLUMNS_DATA) - 1,
+                keys, &c, 4, mpack_error_bug));
+}
+#endif
+
+#if MPACK_EXPECT
+static size_t test_schema_decode_columns(const char* data, size_t size, const mpack_enum_matcher_t* keys,
+        test_schema_columns_t* c, size_t max_rows, size_t strings_size, mpack_error_t error)
+{
+    char strings[8];
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, data, size);
+    size_t rows = mpack_decode_columns(&reader, keys, c->columns, max_rows, strings, strings_size);
+    if (error == mpack_ok && rows == 3) {
+        test_schema_columns_check(c, strings);
+        TEST_TRUE(c->tag[0].offset == 0 && c->tag[1].offset == 1);
+    }
+    TEST_READER_DESTROY_ERROR(&reader, error);
+    return rows;
+}
+
+static void test_schema_decode_columns_errors(const mpack_enum_matcher_t* keys) {
+    test_schema_columns_t c;
+    test_schema_columns_init(&c);
+
+    #define TEST_SCHEMA_DECODE_COLUMNS(data, error) \
+        TEST_TRUE(0 == test_schema_decode_columns(data, sizeof(data) - 1, keys, &c, 4, 8, error))
+
+    TEST_SCHEMA_DECODE_COLUMNS("\x91\x81\xa2" "id" "\x01", mpack_error_data);
+    TEST_SCHEMA_DECODE_COLUMNS("\x91\x82\xa2" "ts" "\x01\xa2" "ts" "\x02", mpack_error_invalid);
+    TEST_SCHEMA_DECODE_COLUMNS("\x91\x81\xa2" "ts" "\xc0", mpack_error_type);
+    TEST_SCHEMA_DECODE_COLUMNS("\x91\x82\xa2" "ts" "\x01\xa2" "id" "\xff", mpack_error_type);
+    TEST_SCHEMA_DECODE_COLUMNS("\x91\x82\xa2" "ts" "\x01\xa3" "tag" "\x01", mpack_error_type);
+    TEST_SCHEMA_DECODE_COLUMNS("\x91\x90", mpack_error_type);
+    TEST_SCHEMA_DECODE_COLUMNS("\x80", mpack_error_type);
+
+    #undef TEST_SCHEMA_DECODE_COLUMNS
+
+    // too many rows, or too many string bytes
+    TEST_TRUE(0 == test_schema_decode_columns(TEST_SCHEMA_COLUMNS_DATA, sizeof(TEST_SCHEMA_COLUMNS_DATA) - 1,
+                keys, &c, 2, 8, mpack_error_too_big));
+    TEST_TRUE(0 == test_schema_decode_columns(TEST_SCHEMA_COLUMNS_DATA, sizeof(TEST_SCHEMA_COLUMNS_DATA) - 1,
+                keys, &c, 4, 2, mpack_error_too_big));
+
+    c.columns[2].type = mpack_field_cstr;
+    TEST_BREAK(0 == test_schema_decode_columns(TEST_SCHEMA_COLUMNS_DATA, sizeof(TEST_SCHEMA_COLUMNS_DATA) - 1,
+                keys, &c, 4, 8, mpack_error_bug));
+}
+#endif
+
+#if MPACK_NODE || MPACK_EXPECT
+static void test_schema_columns(void) {
+    mpack_enum_matcher_t keys;
+    TEST_TRUE(mpack_enum_matcher_init(&keys, test_schema_column_keys, 4) == mpack_ok);
+    test_schema_columns_t c;
+
+    #if MPACK_NODE
+    test_schema_columns_init(&c);
+    TEST_TRUE(3 == test_schema_node_columns(TEST_SCHEMA_COLUMNS_DATA, sizeof(TEST_SCHEMA_COLUMNS_DATA) - 1,
+                &keys, &c, 3, mpack_ok));
+    test_schema_columns_init(&c);
+    TEST_TRUE(0 == test_schema_node_columns("\x90", 1, &keys, &c, 0, mpack_ok));
+    test_schema_node_columns_errors(&keys);
+    #endif
+
+    #if MPACK_EXPECT
+    test_schema_columns_init(&c);
+    TEST_TRUE(3 == test_schema_decode_columns(TEST_SCHEMA_COLUMNS_DATA, sizeof(TEST_SCHEMA_COLUMNS_DATA) - 1,
+                &keys, &c, 3, 3, mpack_ok));
+    test_schema_decode_columns_errors(&keys);
+    #endif
+
+    mpack_enum_matcher_destroy(&keys);
+}
+#endif
+
+void test_schema(void) {
+    test_schema_init_errors();
+    test_system_fail_until_ok(&test_schema_init_memory);
+    test_system_fail_until_ok(&test_schema_init_allocator);
+    test_schema_perfect_hash();
+
+    mpack_schema_t schema;
+    TEST_TRUE(mpack_schema_init(&schema, test_schema_point_fields, TEST_SCHEMA_POINT_COUNT) == mpack_ok);
+    #if MPACK_WRITER
+    test_schema_encode(&schema);
+    #endif
+    #if MPACK_EXPECT
+    test_schema_decode(&schema);
+    #endif
+    mpack_schema_destroy(&schema);
+
+    #if MPACK_WRITER && MPACK_EXPECT && MPACK_FLOAT && MPACK_DOUBLE
+    test_schema_floats();
+    #endif
+
+    #if MPACK_NODE || MPACK_EXPECT
+    test_schema_columns();
+    #endif
+}
+
+#endif
+
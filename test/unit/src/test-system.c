@@ -165,6 +165,27 @@ void test_free(void* p) {
     free(p);
 }
 
+static void* test_allocator_alloc(void* context, size_t size) {
+    void* p = test_malloc(size);
+    if (p)
+        ++*(size_t*)context;
+    return p;
+}
+
+static void test_allocator_free(void* context, void* p) {
+    TEST_TRUE(*(size_t*)context > 0, "freeing more than was allocated");
+    --*(size_t*)context;
+    test_free(p);
+}
+
+void test_allocator_init(mpack_allocator_t* allocator, size_t* active) {
+    *active = 0;
+    allocator->allocate = test_allocator_alloc;
+    allocator->reallocate = NULL;
+    allocator->release = test_allocator_free;
+    allocator->context = active;
+}
+
 #endif
 
 
@@ -61,6 +61,12 @@ size_t test_malloc_active_count(void);
 
 // Returns the total number of mallocs or non-zero reallocs ever made.
 size_t test_malloc_total_count(void);
+
+// Initializes a custom allocator that counts its active allocations in
+// the given counter. It allocates with test_malloc() so failures can be
+// simulated, and has no realloc function.
+struct mpack_allocator_t;
+void test_allocator_init(struct mpack_allocator_t* allocator, size_t* active);
 #endif
 
 
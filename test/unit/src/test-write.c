@@ -359,6 +359,21 @@ static void test_write_simple_misc(void) {
     TEST_TRUE(mpack_load_u16(growable_buf + 1) == strlen(lipsum));
     TEST_TRUE(memcmp(growable_buf + MPACK_TAG_SIZE_STR16, lipsum, strlen(lipsum)) == 0);
     MPACK_FREE(growable_buf);
+
+    // test growing with a custom allocator
+    mpack_allocator_t allocator;
+    size_t active;
+    test_allocator_init(&allocator, &active);
+    mpack_writer_init_growable(&writer, &growable_buf, &size);
+    mpack_writer_set_allocator(&writer, &allocator);
+    TEST_TRUE(active == 1);
+    mpack_write_cstr(&writer, lipsum);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(active == 1);
+    TEST_TRUE(size == MPACK_TAG_SIZE_STR16 + strlen(lipsum));
+    TEST_TRUE(memcmp(growable_buf + MPACK_TAG_SIZE_STR16, lipsum, strlen(lipsum)) == 0);
+    allocator.release(allocator.context, growable_buf);
+    TEST_TRUE(active == 0);
     #endif
 }
 
@@ -823,6 +838,27 @@ static void test_write_tracking(void) {
     TEST_BREAK((mpack_finish_map(&writer), true));
     TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
 
+    // finishing type once everything nested past the initial capacity is
+    // finished
+    int i;
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    for (i = 0; i <= MPACK_TRACKING_INITIAL_CAPACITY; ++i)
+        mpack_start_array(&writer, 1);
+    mpack_write_nil(&writer);
+    for (i = 0; i <= MPACK_TRACKING_INITIAL_CAPACITY; ++i)
+        mpack_finish_array(&writer);
+    TEST_BREAK((mpack_finish_array(&writer), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+
+    // destroying with a type left open
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_start_array(&writer, 1);
+    mpack_start_array(&writer, 0);
+    mpack_finish_array(&writer);
+    TEST_BREAK((mpack_writer_destroy(&writer), true));
+
+    // depth-only tracking doesn't check types, element counts or bytes
+    #if !MPACK_TRACKING_DEPTH_ONLY
     // closing unfinished type
     mpack_writer_init(&writer, buf, sizeof(buf));
     mpack_start_array(&writer, 1);
@@ -864,6 +900,32 @@ static void test_write_tracking(void) {
     TEST_BREAK((mpack_write_bytes(&writer, "test", 4), true));
     TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
 
+    #endif
+
+    // tracking doesn't allocate unless elements are nested deeper than its
+    // initial capacity, and depth-only tracking never allocates
+    size_t allocations = test_malloc_total_count();
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    for (i = 0; i < MPACK_TRACKING_INITIAL_CAPACITY; ++i)
+        mpack_start_array(&writer, 1);
+    mpack_write_nil(&writer);
+    for (i = 0; i < MPACK_TRACKING_INITIAL_CAPACITY; ++i)
+        mpack_finish_array(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(test_malloc_total_count() == allocations);
+
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    for (i = 0; i <= MPACK_TRACKING_INITIAL_CAPACITY; ++i)
+        mpack_start_array(&writer, 1);
+    mpack_write_nil(&writer);
+    for (i = 0; i <= MPACK_TRACKING_INITIAL_CAPACITY; ++i)
+        mpack_finish_array(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    #if MPACK_TRACKING_DEPTH_ONLY
+    TEST_TRUE(test_malloc_total_count() == allocations);
+    #else
+    TEST_TRUE(test_malloc_total_count() == allocations + 1);
+    #endif
 }
 #endif
 
@@ -1156,6 +1218,607 @@ static void test_write_flush_message(void) {
     TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
 }
 
+static void test_write_frames(void) {
+    mpack_writer_t writer;
+    char buffer[64];
+
+    // a fixed writer back-patches the length of each frame
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_writer_begin_frame(&writer);
+    mpack_start_array(&writer, 2);
+    mpack_write_u8(&writer, 1);
+    mpack_write_u8(&writer, 2);
+    mpack_finish_array(&writer);
+    mpack_writer_end_frame(&writer);
+    mpack_writer_begin_frame(&writer);
+    mpack_write_nil(&writer);
+    mpack_writer_end_frame(&writer);
+    TEST_DESTROY_MATCH_IMPL(buffer, "\x00\x00\x00\x03\x92\x01\x02" "\x00\x00\x00\x01\xc0");
+
+    // a frame of builds
+    #if MPACK_BUILDER
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_writer_begin_frame(&writer);
+    mpack_build_array(&writer);
+    mpack_write_true(&writer);
+    mpack_complete_array(&writer);
+    mpack_writer_end_frame(&writer);
+    TEST_DESTROY_MATCH_IMPL(buffer, "\x00\x00\x00\x02\x91\xc3");
+    #endif
+
+    // a flushing writer flushes before the frame and writes it whole
+    test_write_flush_t flush = {buf, sizeof(buf), 0};
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_writer_set_context(&writer, &flush);
+    mpack_writer_set_flush(&writer, &test_write_flush_callback);
+    mpack_write_cstr(&writer, "hello");
+    mpack_writer_begin_frame(&writer);
+    TEST_TRUE(flush.count == 6);
+    mpack_write_bin(&writer, buf, 50);
+    mpack_writer_end_frame(&writer);
+    TEST_TRUE(flush.count == 6);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(flush.count == 6 + 4 + 52);
+    TEST_TRUE(memcmp(buf + 6, "\x00\x00\x00\x34\xc4\x32", 6) == 0);
+
+    // but not if it doesn't fit in the buffer
+    flush.count = 0;
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_writer_set_context(&writer, &flush);
+    mpack_writer_set_flush(&writer, &test_write_flush_callback);
+    mpack_writer_begin_frame(&writer);
+    mpack_write_cstr(&writer, quick_brown_fox);
+    mpack_write_cstr(&writer, quick_brown_fox);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_too_big);
+    TEST_TRUE(flush.count == 0);
+
+    #ifdef MPACK_MALLOC
+    // a growable writer can write a frame of any size
+    char* data;
+    size_t size;
+    mpack_writer_init_growable(&writer, &data, &size);
+    mpack_write_nil(&writer);
+    mpack_writer_begin_frame(&writer);
+    mpack_write_cstr(&writer, lipsum);
+    mpack_writer_end_frame(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    size_t length = MPACK_TAG_SIZE_STR16 + strlen(lipsum);
+    TEST_TRUE(size == 1 + MPACK_FRAME_HEADER_SIZE + length);
+    TEST_TRUE(mpack_load_u32(data + 1) == length);
+    TEST_TRUE(memcmp(data + 1 + MPACK_FRAME_HEADER_SIZE + MPACK_TAG_SIZE_STR16, lipsum, strlen(lipsum)) == 0);
+    MPACK_FREE(data);
+    #endif
+
+    // frames can't be nested or left open
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_writer_begin_frame(&writer);
+    TEST_BREAK((mpack_writer_begin_frame(&writer), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    TEST_BREAK((mpack_writer_end_frame(&writer), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_writer_begin_frame(&writer);
+    TEST_BREAK((mpack_writer_destroy(&writer), true));
+    TEST_TRUE(mpack_writer_error(&writer) == mpack_error_bug);
+
+    // a frame can't be flushed
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_writer_set_context(&writer, &flush);
+    mpack_writer_set_flush(&writer, &test_write_flush_callback);
+    mpack_writer_begin_frame(&writer);
+    TEST_BREAK((mpack_writer_flush_message(&writer), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+
+    #if MPACK_WRITE_TRACKING
+    // frames can't split elements
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_writer_begin_frame(&writer);
+    mpack_start_array(&writer, 1);
+    TEST_BREAK((mpack_writer_end_frame(&writer), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    mpack_start_array(&writer, 1);
+    TEST_BREAK((mpack_writer_begin_frame(&writer), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+    #endif
+}
+
+#if MPACK_DOUBLE
+#define TEST_COMPACT_WRITE(expect, value) \
+    TEST_SIMPLE_WRITE(expect, (mpack_writer_set_compact_floats(&writer, true), mpack_write_double(&writer, value)))
+
+static void test_write_compact_floats(void) {
+    mpack_writer_t writer;
+
+    // integers are written as ints when they are no larger than a float
+    TEST_COMPACT_WRITE("\x00", 0.0);
+    TEST_COMPACT_WRITE("\x7f", 127.0);
+    TEST_COMPACT_WRITE("\xff", -1.0);
+    TEST_COMPACT_WRITE("\xd0\xdf", -33.0);
+    TEST_COMPACT_WRITE("\xcd\x01\x00", 256.0);
+    TEST_COMPACT_WRITE("\xce\x80\x00\x00\x00", 2147483648.0);
+    TEST_COMPACT_WRITE("\xce\x01\x00\x00\x01", 16777217.0);
+    TEST_COMPACT_WRITE("\xd2\x80\x00\x00\x00", -2147483648.0);
+
+    #if MPACK_FLOAT
+    // otherwise as floats if they are exact
+    TEST_COMPACT_WRITE("\xca\x3f\x00\x00\x00", 0.5);
+    TEST_COMPACT_WRITE("\xca\xc0\x20\x00\x00", -2.5);
+    TEST_COMPACT_WRITE("\xca\x4f\x80\x00\x00", 4294967296.0);
+    TEST_COMPACT_WRITE("\xca\x5f\x00\x00\x00", 9223372036854775808.0);
+    TEST_COMPACT_WRITE("\xca\x5f\x80\x00\x00", 18446744073709551616.0);
+    TEST_COMPACT_WRITE("\xca\xdf\x00\x00\x00", -9223372036854775808.0);
+
+    // the largest floats are narrowed, but nothing beyond them
+    TEST_COMPACT_WRITE("\xca\x7f\x00\x00\x00", mpack_load_double("\x47\xe0\x00\x00\x00\x00\x00\x00"));
+    TEST_COMPACT_WRITE("\xca\x7f\x7f\xff\xff", mpack_load_double("\x47\xef\xff\xff\xe0\x00\x00\x00"));
+    TEST_COMPACT_WRITE("\xca\xff\x7f\xff\xff", mpack_load_double("\xc7\xef\xff\xff\xe0\x00\x00\x00"));
+    TEST_COMPACT_WRITE("\xcb\x47\xef\xff\xff\xf0\x00\x00\x00", mpack_load_double("\x47\xef\xff\xff\xf0\x00\x00\x00"));
+    TEST_COMPACT_WRITE("\xcb\x47\xf0\x00\x00\x00\x00\x00\x00", mpack_load_double("\x47\xf0\x00\x00\x00\x00\x00\x00"));
+
+    // negative zero and infinities keep their sign, and NaNs their bits
+    TEST_COMPACT_WRITE("\xca\x80\x00\x00\x00", -0.0);
+    TEST_COMPACT_WRITE("\xca\x7f\x80\x00\x00", mpack_load_double("\x7f\xf0\x00\x00\x00\x00\x00\x00"));
+    TEST_COMPACT_WRITE("\xca\xff\x80\x00\x00", mpack_load_double("\xff\xf0\x00\x00\x00\x00\x00\x00"));
+    TEST_COMPACT_WRITE("\xca\x7f\xc0\x00\x00", mpack_load_double("\x7f\xf8\x00\x00\x00\x00\x00\x00"));
+    #endif
+    TEST_COMPACT_WRITE("\xcb\x7f\xf8\x00\x00\x00\x00\x00\x01", mpack_load_double("\x7f\xf8\x00\x00\x00\x00\x00\x01"));
+
+    // everything else stays a double
+    TEST_COMPACT_WRITE("\xcb\x40\x09\x21\xfb\x53\xc8\xd4\xf1", 3.14159265);
+    TEST_COMPACT_WRITE("\xcb\x3f\xf0\x00\x00\x1a\xd7\xf2\x9b", 1.0000001);
+    TEST_COMPACT_WRITE("\xcb\x42\x70\x00\x00\x00\x00\x10\x00", 1099511627777.0);
+    TEST_COMPACT_WRITE("\xcb\x7e\x37\xe4\x3c\x88\x00\x75\x9c", 1e300);
+    TEST_COMPACT_WRITE("\xcb\x00\x00\x00\x00\x00\x00\x07\xe8", 1e-320);
+
+    // this also applies to tags and typed arrays
+    TEST_SIMPLE_WRITE("\x01", (mpack_writer_set_compact_floats(&writer, true),
+            mpack_write_tag(&writer, mpack_tag_make_double(1.0))));
+    static const double d[] = {2.0, -3.14159265, -70000.0};
+    TEST_SIMPLE_WRITE("\x93\x02\xcb\xc0\x09\x21\xfb\x53\xc8\xd4\xf1\xd2\xff\xfe\xee\x90",
+            (mpack_writer_set_compact_floats(&writer, true), mpack_write_double_array(&writer, d, 3)));
+
+    // it is off by default
+    TEST_SIMPLE_WRITE("\xcb\x3f\xf0\x00\x00\x00\x00\x00\x00", mpack_write_double(&writer, 1.0));
+}
+#endif
+
+static void test_write_typed_arrays(void) {
+    mpack_writer_t writer;
+
+    static const uint32_t u32[] = {1, 255, 256, 65536};
+    TEST_SIMPLE_WRITE("\x90", mpack_write_u32_array(&writer, NULL, 0));
+    TEST_SIMPLE_WRITE("\x94\x01\xcc\xff\xcd\x01\x00\xce\x00\x01\x00\x00",
+            mpack_write_u32_array(&writer, u32, 4));
+    TEST_SIMPLE_WRITE("\x92\xce\x00\x00\x00\x01\xce\x00\x00\x00\xff",
+            mpack_write_u32_array_fixed(&writer, u32, 2));
+
+    static const int64_t i64[] = {-1, -33, 200, MPACK_INT64_MIN};
+    TEST_SIMPLE_WRITE("\x94\xff\xd0\xdf\xcc\xc8\xd3\x80\x00\x00\x00\x00\x00\x00\x00",
+            mpack_write_i64_array(&writer, i64, 4));
+    TEST_SIMPLE_WRITE("\x91\xd3\xff\xff\xff\xff\xff\xff\xff\xff",
+            mpack_write_i64_array_fixed(&writer, i64, 1));
+
+    #if MPACK_FLOAT
+    static const float f[] = {0.0f, 2.718f};
+    TEST_SIMPLE_WRITE("\x92\xca\x00\x00\x00\x00\xca\x40\x2d\xf3\xb6",
+            mpack_write_float_array(&writer, f, 2));
+    #endif
+    #if MPACK_DOUBLE
+    static const double d[] = {-3.14159265};
+    TEST_SIMPLE_WRITE("\x91\xcb\xc0\x09\x21\xfb\x53\xc8\xd4\xf1",
+            mpack_write_double_array(&writer, d, 1));
+    #endif
+
+    // typed arrays can be nested in ordinary arrays
+    TEST_SIMPLE_WRITE("\x92\x91\x01\xc0", (
+            mpack_start_array(&writer, 2),
+            mpack_write_u32_array(&writer, u32, 1),
+            mpack_write_nil(&writer),
+            mpack_finish_array(&writer)));
+
+    // a large array through a minimum size buffer must match writing each
+    // element individually
+    int64_t values[300];
+    size_t i;
+    for (i = 0; i < sizeof(values) / sizeof(*values); ++i)
+        {
+        int64_t v = (int64_t)i;
+        values[i] = (i % 7 == 0) ? -(v * v * v * v * 1000) : v * v * v;
+    }
+
+    char reference[sizeof(values) / sizeof(*values) * MPACK_TAG_SIZE_I64 + MPACK_TAG_SIZE_ARRAY16];
+    mpack_writer_init(&writer, reference, sizeof(reference));
+    mpack_start_array(&writer, (uint32_t)(sizeof(values) / sizeof(*values)));
+    for (i = 0; i < sizeof(values) / sizeof(*values); ++i)
+        mpack_write_i64(&writer, values[i]);
+    mpack_finish_array(&writer);
+    size_t reference_size = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    char small[MPACK_WRITER_MINIMUM_BUFFER_SIZE];
+    test_write_flush_t flush = {buf, sizeof(buf), 0};
+    mpack_writer_init(&writer, small, sizeof(small));
+    mpack_writer_set_context(&writer, &flush);
+    mpack_writer_set_flush(&writer, &test_write_flush_callback);
+    mpack_write_i64_array(&writer, values, (uint32_t)(sizeof(values) / sizeof(*values)));
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(flush.count == reference_size && memcmp(buf, reference, reference_size) == 0);
+
+    // without a flush function the array must fit
+    mpack_writer_init(&writer, small, sizeof(small));
+    mpack_write_u32_array_fixed(&writer, u32, 4);
+    mpack_write_u32_array_fixed(&writer, u32, 4);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_too_big);
+
+    #if MPACK_BUILDER && defined(MPACK_MALLOC)
+    // typed arrays inside a build are not counted as build elements
+    char* data;
+    size_t size;
+    mpack_writer_init_growable(&writer, &data, &size);
+    mpack_build_array(&writer);
+    mpack_write_i64_array(&writer, values, (uint32_t)(sizeof(values) / sizeof(*values)));
+    mpack_write_nil(&writer);
+    mpack_complete_array(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(size == reference_size + 2 && data[0] == '\x92' && data[size - 1] == '\xc0' &&
+            memcmp(data + 1, reference, reference_size) == 0);
+    MPACK_FREE(data);
+    #endif
+}
+
+typedef struct test_write_flush_iov_t {
+    test_write_flush_t flush;
+    const char* payload; // a payload that must never be copied to the buffer
+    size_t references;   // the number of segments referencing the payload
+    size_t calls;
+} test_write_flush_iov_t;
+
+static void test_write_flush_iov_callback(mpack_writer_t* writer, const mpack_iovec_t* iov, size_t count) {
+    test_write_flush_iov_t* flush = (test_write_flush_iov_t*)writer->context;
+    ++flush->calls;
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        TEST_TRUE(iov[i].len > 0);
+        if (iov[i].base == flush->payload)
+            ++flush->references;
+        if (iov[i].len > flush->flush.capacity - flush->flush.count) {
+            mpack_writer_flag_error(writer, mpack_error_io);
+            return;
+        }
+        memcpy(flush->flush.out + flush->flush.count, iov[i].base, iov[i].len);
+        flush->flush.count += iov[i].len;
+    }
+}
+
+static void test_write_flush_iov_message(mpack_writer_t* writer, const char* payload) {
+    mpack_start_array(writer, 5);
+    mpack_write_bin(writer, payload, 2000);
+    mpack_write_cstr(writer, "hello");
+    mpack_write_str(writer, payload, 1500);
+    mpack_write_bin(writer, payload, 100);
+    mpack_write_bin(writer, payload, 3000);
+    mpack_finish_array(writer);
+}
+
+static void test_write_flush_iov(void) {
+    static char payload[3000];
+    size_t i;
+    for (i = 0; i < sizeof(payload); ++i)
+        payload[i] = (char)i;
+
+    // encode the encoded output normally
+    static char encoded[8192];
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, encoded, sizeof(encoded));
+    test_write_flush_iov_message(&writer, payload);
+    size_t encoded_size = mpack_writer_buffer_used(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    // with enough segments, large payloads are referenced and everything is
+    // flushed at once on destroy
+    static char out[8192];
+    char small[256];
+    mpack_iovec_t iov[8];
+    test_write_flush_iov_t flush = {{out, sizeof(out), 0}, payload, 0, 0};
+    mpack_writer_init(&writer, small, sizeof(small));
+    mpack_writer_set_context(&writer, &flush);
+    mpack_writer_set_flush_iov(&writer, &test_write_flush_iov_callback, iov, sizeof(iov) / sizeof(*iov));
+    test_write_flush_iov_message(&writer, payload);
+    TEST_TRUE(flush.calls == 0);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(flush.calls == 1);
+    TEST_TRUE(flush.references == 3);
+    TEST_TRUE(flush.flush.count == encoded_size);
+    TEST_TRUE(memcmp(out, encoded, encoded_size) == 0);
+
+    // with the minimum number of segments, the pending segments are flushed
+    // before each reference
+    test_write_flush_iov_t flush_min = {{out, sizeof(out), 0}, payload, 0, 0};
+    mpack_writer_init(&writer, small, sizeof(small));
+    mpack_writer_set_context(&writer, &flush_min);
+    mpack_writer_set_flush_iov(&writer, &test_write_flush_iov_callback, iov, 3);
+    test_write_flush_iov_message(&writer, payload);
+    mpack_writer_flush_message(&writer);
+    TEST_TRUE(flush_min.flush.count == encoded_size);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(flush_min.calls == 3);
+    TEST_TRUE(flush_min.references == 3);
+    TEST_TRUE(memcmp(out, encoded, encoded_size) == 0);
+
+    // too few segments
+    mpack_writer_init(&writer, small, sizeof(small));
+    TEST_BREAK((mpack_writer_set_flush_iov(&writer, &test_write_flush_iov_callback, iov, 2), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+}
+
+#ifdef MPACK_MALLOC
+static void test_write_growable_reset(void) {
+    char* data;
+    size_t size;
+    mpack_writer_t writer;
+    size_t i;
+
+    // with enough reserved space, writing many messages does not allocate
+    mpack_writer_init_growable_reserve(&writer, &data, &size, 4096);
+    size_t allocations = test_malloc_total_count();
+    for (i = 0; i < 10; ++i) {
+        mpack_start_array(&writer, 2);
+        mpack_write_u32(&writer, (uint32_t)i);
+        mpack_write_cstr(&writer, lipsum);
+        mpack_finish_array(&writer);
+        mpack_writer_reset_growable(&writer);
+        TEST_TRUE(size == 2 + MPACK_TAG_SIZE_STR16 + strlen(lipsum));
+        TEST_TRUE(data[0] == '\x92' && data[1] == (char)i);
+        TEST_TRUE(memcmp(data + 2 + MPACK_TAG_SIZE_STR16, lipsum, strlen(lipsum)) == 0);
+    }
+    TEST_TRUE(test_malloc_total_count() == allocations);
+
+    // the last message is still handed off on destroy
+    mpack_write_nil(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(size == 1 && data[0] == '\xc0');
+    MPACK_FREE(data);
+
+    // a buffer that grows keeps its capacity across resets
+    mpack_writer_init_growable_reserve(&writer, &data, &size, 0);
+    mpack_write_cstr(&writer, lipsum);
+    mpack_writer_reset_growable(&writer);
+    allocations = test_malloc_total_count();
+    mpack_write_cstr(&writer, lipsum);
+    mpack_writer_reset_growable(&writer);
+    TEST_TRUE(test_malloc_total_count() == allocations);
+    TEST_TRUE(size == MPACK_TAG_SIZE_STR16 + strlen(lipsum));
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    MPACK_FREE(data);
+
+    #if MPACK_WRITE_TRACKING
+    // cannot reset with open elements
+    mpack_writer_init_growable(&writer, &data, &size);
+    mpack_start_array(&writer, 1);
+    TEST_BREAK((mpack_writer_reset_growable(&writer), true));
+    TEST_TRUE(data == NULL && size == 0);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+    #endif
+
+    // cannot reset a writer that is not growable
+    char buffer[32];
+    mpack_writer_init(&writer, buffer, sizeof(buffer));
+    TEST_BREAK((mpack_writer_reset_growable(&writer), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+}
+#endif
+
+#ifdef MPACK_MALLOC
+static void test_write_fork_join(void) {
+    mpack_writer_t writer;
+    mpack_writer_t children[2];
+
+    // children can be written in any order, and are joined in order
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_start_array(&writer, 5);
+    mpack_write_nil(&writer);
+    mpack_writer_fork(&writer, &children[0], 2);
+    mpack_writer_fork(&writer, &children[1], 2);
+    mpack_write_u8(&children[1], 3);
+    mpack_write_u8(&children[1], 4);
+    mpack_write_u8(&children[0], 1);
+    mpack_write_u8(&children[0], 2);
+    mpack_writer_join(&writer, &children[0]);
+    mpack_writer_join(&writer, &children[1]);
+    mpack_finish_array(&writer);
+    TEST_DESTROY_MATCH_IMPL(buf, "\x95\xc0\x01\x02\x03\x04");
+
+    #if MPACK_DOUBLE
+    // children write doubles in the same form as their parent
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_set_compact_floats(&writer, true);
+    mpack_start_array(&writer, 2);
+    mpack_write_double(&writer, 1.0);
+    mpack_writer_fork(&writer, &children[0], 1);
+    mpack_write_double(&children[0], 1.0);
+    mpack_writer_join(&writer, &children[0]);
+    mpack_finish_array(&writer);
+    TEST_DESTROY_MATCH_IMPL(buf, "\x92\x01\x01");
+    #endif
+
+    // a child larger than the parent's buffer is flushed from its own buffer
+    char* single;
+    size_t single_size;
+    int i;
+    mpack_writer_init_growable(&writer, &single, &single_size);
+    mpack_start_array(&writer, 40);
+    for (i = 0; i < 40; ++i)
+        mpack_write_cstr(&writer, lipsum);
+    mpack_finish_array(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+
+    static char out[0x10000];
+    char small[64];
+    test_write_flush_t flush = {out, sizeof(out), 0};
+    mpack_writer_init(&writer, small, sizeof(small));
+    mpack_writer_set_context(&writer, &flush);
+    mpack_writer_set_flush(&writer, &test_write_flush_callback);
+    mpack_start_array(&writer, 40);
+    mpack_writer_fork(&writer, &children[0], 39);
+    for (i = 0; i < 39; ++i)
+        mpack_write_cstr(&children[0], lipsum);
+    mpack_write_cstr(&writer, lipsum);
+    mpack_writer_join(&writer, &children[0]);
+    mpack_finish_array(&writer);
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    TEST_TRUE(flush.count == single_size && memcmp(out, single, single_size) == 0);
+    MPACK_FREE(single);
+
+    #if MPACK_BUILDER
+    // the elements of a child count towards a build
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_build_map(&writer);
+    mpack_writer_fork(&writer, &children[0], 4);
+    mpack_write_cstr(&children[0], "a");
+    mpack_write_u8(&children[0], 1);
+    mpack_write_cstr(&children[0], "b");
+    mpack_write_u8(&children[0], 2);
+    mpack_writer_join(&writer, &children[0]);
+    mpack_complete_map(&writer);
+    TEST_DESTROY_MATCH_IMPL(buf, "\x82\xa1" "a" "\x01\xa1" "b" "\x02");
+    #endif
+
+    // the error of a child is flagged on the parent
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_start_array(&writer, 1);
+    mpack_writer_fork(&writer, &children[0], 1);
+    mpack_writer_flag_error(&children[0], mpack_error_io);
+    mpack_writer_join(&writer, &children[0]);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_io);
+
+    #if MPACK_WRITE_TRACKING && !MPACK_TRACKING_DEPTH_ONLY
+    // a child must write exactly the elements it was forked for
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_start_array(&writer, 2);
+    mpack_writer_fork(&writer, &children[0], 2);
+    mpack_write_nil(&children[0]);
+    TEST_BREAK((mpack_writer_join(&writer, &children[0]), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+
+    // and they must fit in the parent
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_start_array(&writer, 1);
+    mpack_writer_fork(&writer, &children[0], 2);
+    mpack_write_nil(&children[0]);
+    mpack_write_nil(&children[0]);
+    TEST_BREAK((mpack_writer_join(&writer, &children[0]), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+    #endif
+
+    // only forked writers can be joined
+    mpack_writer_init(&writer, buf, sizeof(buf));
+    mpack_writer_init(&children[0], buf + 64, 64);
+    TEST_BREAK((mpack_writer_join(&writer, &children[0]), true));
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_bug);
+}
+
+static bool test_write_fork_join_allocs(void) {
+    char* data;
+    size_t size;
+    mpack_writer_t writer;
+    mpack_writer_t child;
+    int i;
+
+    mpack_writer_init_growable(&writer, &data, &size);
+    mpack_start_array(&writer, 20);
+    mpack_writer_fork(&writer, &child, 20);
+    for (i = 0; i < 20; ++i)
+        mpack_write_cstr(&child, lipsum);
+    mpack_writer_join(&writer, &child);
+    mpack_finish_array(&writer);
+
+    mpack_error_t error = mpack_writer_destroy(&writer);
+    if (error == mpack_error_memory)
+        return false;
+    TEST_TRUE(error == mpack_ok);
+    TEST_TRUE(size == 3 + 20 * (MPACK_TAG_SIZE_STR16 + strlen(lipsum)));
+    MPACK_FREE(data);
+    return true;
+}
+#endif
+
+static void test_write_reset(void) {
+    mpack_writer_t writer;
+
+    // a partial message is discarded
+    mpack_writer_init(&writer, buf, 32);
+    mpack_start_array(&writer, 2);
+    mpack_write_true(&writer);
+    mpack_writer_reset(&writer);
+    TEST_TRUE(mpack_writer_buffer_used(&writer) == 0);
+    mpack_write_false(&writer);
+    TEST_DESTROY_MATCH_IMPL(buf, "\xc2");
+
+    // the error is cleared
+    mpack_writer_init(&writer, buf, 32);
+    mpack_write_bin(&writer, buf, 32);
+    TEST_TRUE(mpack_writer_error(&writer) == mpack_error_too_big);
+    mpack_writer_reset(&writer);
+    TEST_TRUE(mpack_writer_error(&writer) == mpack_ok);
+    mpack_write_nil(&writer);
+    TEST_DESTROY_MATCH_IMPL(buf, "\xc0");
+
+    #ifdef MPACK_MALLOC
+    // many messages don't touch the allocator
+    mpack_writer_init(&writer, buf, 32);
+    size_t allocations = test_malloc_total_count();
+    int i;
+    for (i = 0; i < 100; ++i) {
+        mpack_writer_reset(&writer);
+        mpack_start_map(&writer, 1);
+        mpack_write_cstr(&writer, "i");
+        mpack_write_int(&writer, i);
+        mpack_finish_map(&writer);
+    }
+    TEST_TRUE(test_malloc_total_count() == allocations);
+    TEST_DESTROY_MATCH_IMPL(buf, "\x81\xa1i\x63");
+    #endif
+
+    // a writer without a buffer stays in error
+    mpack_writer_init_error(&writer, mpack_error_io);
+    mpack_writer_reset(&writer);
+    TEST_WRITER_DESTROY_ERROR(&writer, mpack_error_io);
+}
+
+#if MPACK_STATS && defined(MPACK_MALLOC)
+static void test_write_stats(void) {
+    mpack_writer_t writer;
+    char* data;
+    size_t size;
+
+    // a growable writer grows through its flush function
+    mpack_writer_init_growable(&writer, &data, &size);
+    TEST_TRUE(mpack_writer_stats(&writer).grows == 0);
+    size_t i;
+    for (i = 0; i < 100; ++i)
+        mpack_write_cstr(&writer, quick_brown_fox);
+    mpack_writer_stats_t stats = mpack_writer_stats(&writer);
+    TEST_TRUE(stats.grows > 0);
+    TEST_TRUE(stats.flushes >= stats.grows);
+    TEST_TRUE(stats.builder_pages == 0);
+
+    #if MPACK_BUILDER
+    mpack_writer_reset_stats(&writer);
+    TEST_TRUE(mpack_writer_stats(&writer).grows == 0);
+    mpack_build_array(&writer);
+    for (i = 0; i < 100; ++i)
+        mpack_write_cstr(&writer, quick_brown_fox);
+    mpack_complete_array(&writer);
+    TEST_TRUE(mpack_writer_stats(&writer).builder_pages > 0);
+    #endif
+
+    TEST_WRITER_DESTROY_NOERROR(&writer);
+    MPACK_FREE(data);
+}
+#endif
+
 static void test_misc(void) {
 
     // writing too much data without a flush callback
@@ -1263,6 +1926,10 @@ void test_writes() {
     test_write_generic_kv();
     #endif
     test_write_simple_misc();
+    #if MPACK_DOUBLE
+    test_write_compact_floats();
+    #endif
+    test_write_typed_arrays();
     test_write_utf8();
     #if MPACK_EXTENSIONS
     test_write_timestamp();
@@ -1284,6 +1951,17 @@ void test_writes() {
     #endif
 
     test_write_flush_message();
+    test_write_flush_iov();
+    test_write_frames();
+    #ifdef MPACK_MALLOC
+    test_write_growable_reset();
+    test_write_fork_join();
+    test_system_fail_until_ok(&test_write_fork_join_allocs);
+    #endif
+    test_write_reset();
+    #if MPACK_STATS && defined(MPACK_MALLOC)
+    test_write_stats();
+    #endif
     test_misc();
 }
 
@@ -29,6 +29,10 @@
 #include "test-common.h"
 #include "test-node.h"
 #include "test-file.h"
+#include "test-sax.h"
+#include "test-schema.h"
+#include "test-json.h"
+#include "test-compress.h"
 
 mpack_tag_t (*fn_mpack_tag_nil)(void) = &mpack_tag_nil;
 
@@ -99,6 +103,18 @@ int main(void) {
     #if MPACK_NODE
     test_node();
     #endif
+    #if MPACK_SAX
+    test_sax();
+    #endif
+    #if MPACK_SCHEMA
+    test_schema();
+    #endif
+    #if MPACK_JSON
+    test_json();
+    #endif
+    #if MPACK_COMPRESS
+    test_compress();
+    #endif
     #if MPACK_STDIO
     test_file();
     #endif
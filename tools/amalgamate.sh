@@ -12,6 +12,10 @@ HEADERS="\
     mpack/mpack-reader.h \
     mpack/mpack-expect.h \
     mpack/mpack-node.h \
+    mpack/mpack-sax.h \
+    mpack/mpack-schema.h \
+    mpack/mpack-json.h \
+    mpack/mpack-compress.h \
     "
 
 SOURCES="\
@@ -21,10 +25,15 @@ SOURCES="\
     mpack/mpack-reader.c \
     mpack/mpack-expect.c \
     mpack/mpack-node.c \
+    mpack/mpack-sax.c \
+    mpack/mpack-schema.c \
+    mpack/mpack-json.c \
+    mpack/mpack-compress.c \
     "
 
 TOOLS="\
     tools/afl.sh \
+    tools/bench.sh \
     tools/clean.sh \
     tools/coverage.sh \
     tools/scan-build.sh \
@@ -0,0 +1,11 @@
+#!/bin/sh
+
+# Builds and runs the benchmarks.
+# Set CC before calling this to use a different compiler.
+# Arguments are passed to the benchmark runner (see test/bench/bench.c.)
+
+set -e
+cd "$(dirname $0)/.."
+test/unit/configure.py
+ninja -f .build/unit/build.ninja bench
+.build/unit/bench/runner "$@"